@@ -55,18 +55,30 @@ Ahci_device_port::Ahci_device_port(unsigned port, AHCI_uddk_device * device, voi
   _port_reg((ahci_port_t *)pctrlreg),
   _device(device),
   _irq(irq),
+  _ptr_irq_thread(NULL),
+  _command_slot_tracker(NULL),
+  _ncq_depth(0),
+  _ncq_outstanding(0),
   _initialized(false),
   _cmd_frame_allocator(device, 4096, 10),
   _misc_allocator(device, 4096, 8)
 {
   assert(device);
   assert(pctrlreg);
+  __builtin_memset(_ncq_slots,0,sizeof(_ncq_slots));
+  __builtin_memset(_command_tbl,0,sizeof(_command_tbl));
 }
 
 
 Ahci_device_port::~Ahci_device_port() {
   if(_ptr_irq_thread)
     delete _ptr_irq_thread;
+  if(_command_slot_tracker)
+    delete _command_slot_tracker;
+  for(unsigned i=0;i<NCQ_SLOTS;i++) {
+    if(_command_tbl[i])
+      _device->free_dma_pages((void*)_command_tbl[i]);
+  }
 }
 
 
@@ -180,8 +192,24 @@ void Ahci_device_port::init()
     /* run IDENTIFY DEVICE command */
     identify_device();
 
+    /* NCQ depth is the smaller of the HBA's command slots and the device queue depth */
+    {
+      unsigned hba_slots = ((_device->ctrl()->cap >> 8) & 0x1f) + 1;
+      unsigned dev_depth = (_device_identity.queue_depth & 0x1f) + 1;
+      _ncq_depth = hba_slots < dev_depth ? hba_slots : dev_depth;
+      assert(_ncq_depth <= NCQ_SLOTS);
+      _command_slot_tracker = new Exokernel::Bitmap_allocator_lockfree(_ncq_depth);
+      AHCI_INFO("NCQ depth: %u\n",_ncq_depth);
+    }
+
     _port_reg->pxis = ~0;
 
+    /* IDENTIFY left controller interrupts off; completions are now reaped
+       by the IRQ thread (and by any thread waiting on IO) */
+    _device->ctrl()->ghc |= AHCI_GHC_GHC_IE;
+    wmb();
+    _ptr_irq_thread->start();
+
     _initialized = true;
 
     AHCI_INFO("Port [%u] is active.\n",_port_num);
@@ -402,6 +430,22 @@ addr_t Ahci_device_port::get_command_slot_p(unsigned index) {
 }
 
 
+/** 
+ * Get the command table of a slot
+ * 
+ * @param slot Slot number
+ * @param phys [out] Physical address of the command table
+ * 
+ * @return Virtual address of the command table
+ */
+void * Ahci_device_port::get_command_table(unsigned slot, addr_t * phys) {
+  assert(slot < NCQ_SLOTS);
+  assert(_command_tbl[slot]);
+  *phys = _command_tbl_p[slot];
+  return (void *) _command_tbl[slot];
+}
+
+
 void Ahci_device_port::setup_memory()
 {
   addr_t phys = 0;
@@ -434,7 +478,17 @@ void Ahci_device_port::setup_memory()
   phys+=1024;
   virt+=1024; /* 32 entries of 32 bytes each */
   
-  /* note: command tables are set up on demand using a dynamic allocator */
+  /* one command table per slot so that all slots can be in flight; each
+     is sized for MAX_PRDT_ENTRIES and allocated separately to keep the
+     physically contiguous allocations small */
+  for(unsigned i=0;i<NCQ_SLOTS;i++) {
+    _command_tbl[i] = (volatile uint32_t *) 
+      _device->alloc_dma_pages(CMD_TABLE_SIZE / PAGE_SIZE, &_command_tbl_p[i]);
+    assert(_command_tbl[i]);
+    assert(_command_tbl_p[i]);
+    __builtin_memset((void*)_command_tbl[i],0,CMD_TABLE_SIZE);
+  }
+
   wmb();
   AHCI_INFO("memory setup complete OK.\n");
 }
@@ -481,7 +535,6 @@ uint32_t Ahci_device_port::get_device_is() const {
 /** 
  * Perform a synchronous first-party DMA read
  * 
- * @param slot Slot number
  * @param block Sector number
  * @param count Number of sector
  * @param prdt_p Destination memory PRDT
@@ -489,37 +542,39 @@ uint32_t Ahci_device_port::get_device_is() const {
  * @return 
  */
 
-status_t Ahci_device_port::sync_fpdma_read(unsigned slot, 
-                                           uint64_t block, 
+status_t Ahci_device_port::sync_fpdma_read(uint64_t block, 
                                            unsigned count, 
                                            addr_t prdt_p)
 {
-  return sync_fpdma(slot,block,count,prdt_p,false);
+  return sync_fpdma(block,count,prdt_p,false);
 }
 
 /** 
  * Perform a synchronous first-party DMA write
  * 
- * @param slot Slot number
  * @param block Sector number
  * @param count Number of sector
  * @param prdt_p Destination memory PRDT
  * 
  * @return 
  */
-status_t Ahci_device_port::sync_fpdma_write(unsigned slot, 
-                                            uint64_t block, 
+status_t Ahci_device_port::sync_fpdma_write(uint64_t block, 
                                             unsigned count, 
                                             addr_t prdt_p)
 {
-  return sync_fpdma(slot,block,count,prdt_p,true);
+  return sync_fpdma(block,count,prdt_p,true);
 }
 
 
+static void sync_fpdma_notify(unsigned slot, void * param)
+{
+  *((volatile bool *) param) = true;
+}
+
 /** 
- * Generalized function for first-party DMA
+ * Generalized function for first-party DMA.  The command goes through the
+ * NCQ pipeline and this call polls for its completion.
  * 
- * @param slot Command slot to use
  * @param blocknum Starting sector
  * @param count Number of sectors to r/w
  * @param prdt_p DMA area
@@ -527,189 +582,417 @@ status_t Ahci_device_port::sync_fpdma_write(unsigned slot,
  * 
  * @return S_OK on success
  */
-status_t Ahci_device_port::sync_fpdma(unsigned slot,
-                                      uint64_t blocknum, 
+status_t Ahci_device_port::sync_fpdma(uint64_t blocknum, 
                                       unsigned count, 
                                       addr_t prdt_p, 
                                       bool write)
 {
+  volatile bool done = false;
+  status_t status = Exokernel::E_FAIL;
 
-  if(!_initialized) 
-    panic("[AHCI]: call to sync_fpdma before initialization is complete.\n");
+  status_t rc = async_fpdma(blocknum, count, prdt_p, write,
+                            sync_fpdma_notify, (void *) &done, &status);
+  if(rc != Exokernel::S_OK)
+    return rc;
+
+  while(!done) {
+    reap_completions();
+    cpu_relax();
+  }
+
+  return status;
+}
 
 
-  /* get the command header for this slot */
+/** 
+ * Take a free command slot, reaping completions until one is available
+ * 
+ * @param pending Prepared but not yet issued slots; these are issued
+ * before waiting so that the wait can make progress
+ * 
+ * @return Slot number
+ */
+unsigned Ahci_device_port::alloc_ncq_slot(uint32_t& pending)
+{
+  signed slot;
+  while((slot = _command_slot_tracker->next_free()) < 0) {
+    if(pending) {
+      issue_ncq_slots(pending);
+      pending = 0;
+    }
+    reap_completions();
+    cpu_relax();
+  }
+  assert(slot < (signed) NCQ_SLOTS);
+  return (unsigned) slot;
+}
+
+
+/** 
+ * Build an FPDMA READ/WRITE command in a slot's command table
+ * 
+ */
+void Ahci_device_port::prepare_fpdma(unsigned slot,
+                                     uint64_t blocknum,
+                                     unsigned count,
+                                     const io_segment_t * segs,
+                                     unsigned num_segs,
+                                     bool write,
+                                     ahci_notify_callback_t callback,
+                                     void * callback_param,
+                                     status_t * status)
+{
   ahci_cmdhdr_t * cmdhdr = get_command_slot(slot);
   assert(cmdhdr);
 
 #ifdef AHCI_VERBOSE
-  if(write) 
-    AHCI_INFO("fpdma_write port(%u) block:[%lu] count:[%u blocks] using slot (%u)\n",
-              _port_num,blocknum,count,slot);
-  else
-    AHCI_INFO("fpdma_read port(%u) block:[%lu] count:[%u blocks] using slot (%u)\n",
-              _port_num,blocknum,count,slot);
+  AHCI_INFO("fpdma_%s port(%u) block:[%lu] count:[%u blocks] using slot (%u)\n",
+            write ? "write" : "read", _port_num,blocknum,count,slot);
 #endif 
-  
-  volatile sata_ncq_command_frame_t * cmd;
-  if(write) {
-    /* set up command */
-    cmd = setup_fpdma_write_cmd(slot,cmdhdr,blocknum,count,prdt_p);
-  }
-  else {
-    /* set up command */
-    cmd = setup_fpdma_read_cmd(slot,cmdhdr,blocknum,count,prdt_p);
-  }
 
-  WAIT_FOR_NOT_BUSY;
+  Ncq_slot& s = _ncq_slots[slot];
+  s.callback = callback;
+  s.callback_param = callback_param;
+  s.status = status;
+
+  setup_fpdma_cmd(slot,cmdhdr,blocknum,count,segs,num_segs,write);
+}
 
+
+/** 
+ * Issue prepared slots with a single PxSACT/PxCI write.  Both registers are
+ * write-1-to-set, so concurrent issuers need no lock; PxSACT is set before
+ * PxCI for each slot as the AHCI spec requires.
+ * 
+ * @param mask Slots to issue
+ */
+void Ahci_device_port::issue_ncq_slots(uint32_t mask)
+{
 	/*
 	 * The barrier is required to ensure that writes to cmd_block reach
 	 * the memory before the write to PORT_CMD_ACTIVATE.
 	 */
   wmb();
 
-  /* issue */
-  {
-    _port_reg->pxsact = (1<<slot);
-    _port_reg->pxci = (1<<slot);
-  }
+  _port_reg->pxsact = mask;
+  _port_reg->pxci = mask;
 
-  wmb();
+  /* only mark outstanding once PxSACT is set, so the reaper can't see the
+     slot as complete before the HBA knows about it */
+  __sync_fetch_and_or(&_ncq_outstanding, mask);
+}
 
-  WAIT_FOR_NOT_BUSY;
- 
-  poll_for_port_interrupt(3); // wait for Set Device Bits Interrupt (SDBS)
-  
-  // AHCI_INFO("PXIS=0x%x\n",get_pxis());
-  // AHCI_INFO("PXSACT=0x%x\n",get_pxsact());
 
-  set_pxis(0x8); // clear interrupt
+/** 
+ * Issue an asynchronous first-party DMA command
+ * 
+ * @param blocknum Starting sector
+ * @param count Number of sectors (at most 65536)
+ * @param prdt_p Physical address of the (contiguous) DMA buffer
+ * @param write 1=write 0=read
+ * @param callback Completion callback (optional)
+ * @param callback_param Parameter passed to the callback
+ * @param status [out] Completion status, written before the callback (optional)
+ * 
+ * @return S_OK on success, E_INVAL on bad parameters
+ */
+status_t Ahci_device_port::async_fpdma(uint64_t blocknum,
+                                       unsigned count,
+                                       addr_t prdt_p,
+                                       bool write,
+                                       ahci_notify_callback_t callback,
+                                       void * callback_param,
+                                       status_t * status)
+{
+  io_segment_t seg;
+  seg.virt = NULL;
+  seg.phys = prdt_p;
+  seg.len = ((size_t) count) * SATA_DEFAULT_BLOCK_SIZE;
+
+  return async_fpdma_sg(blocknum, count, &seg, 1, write, callback, callback_param, status);
+}
+
+
+/** 
+ * Issue an asynchronous first-party DMA command over a list of DMA
+ * segments (one PRDT entry per 4MB of each segment)
+ * 
+ * @param blocknum Starting sector
+ * @param count Number of sectors (at most 65536); must equal the segment total
+ * @param segs DMA segments (word aligned, even lengths)
+ * @param num_segs Number of segments
+ * @param write 1=write 0=read
+ * @param callback Completion callback (optional)
+ * @param callback_param Parameter passed to the callback
+ * @param status [out] Completion status, written before the callback (optional)
+ * 
+ * @return S_OK on success, E_INVAL on bad parameters
+ */
+status_t Ahci_device_port::async_fpdma_sg(uint64_t blocknum,
+                                          unsigned count,
+                                          const io_segment_t * segs,
+                                          unsigned num_segs,
+                                          bool write,
+                                          ahci_notify_callback_t callback,
+                                          void * callback_param,
+                                          status_t * status)
+{
+  if(!_initialized) 
+    panic("[AHCI]: call to async_fpdma before initialization is complete.\n");
+
+  if(count_prdt_entries(segs, num_segs, count) < 0)
+    return Exokernel::E_INVAL;
 
-  _cmd_frame_allocator.free((sata_std_command_frame_t *)cmd);  
+  uint32_t pending = 0;
+  unsigned slot = alloc_ncq_slot(pending);
+  prepare_fpdma(slot, blocknum, count, segs, num_segs, write, callback, callback_param, status);
+  issue_ncq_slots(1U << slot);
 
   return Exokernel::S_OK;
 }
 
 
-/** Read one sector from the SATA device using FPDMA.
- *
- * @param phys     Physical address of buffer for sector data.
- * @param blocknum Block number to read.
- *
+/** 
+ * Synchronously perform a BLOCK_READ or BLOCK_WRITE request
+ * 
+ * @param io_request IO request
+ * 
+ * @return S_OK on success, E_INVAL for unsupported actions
  */
+status_t Ahci_device_port::sync_io(io_request_t io_request)
+{
+  if(io_request.action != BLOCK_READ && io_request.action != BLOCK_WRITE)
+    return Exokernel::E_INVAL;
+
+  return sync_fpdma(io_request.offset, io_request.num_blocks, io_request.buffer_phys,
+                    io_request.action == BLOCK_WRITE);
+}
+
+
 /** 
- * Perform a first-party DMA read
+ * Asynchronously perform a BLOCK_READ or BLOCK_WRITE request; use
+ * wait_io_completion to wait for it
  * 
- * @param cmdhdr 
- * @param block Starting sector (each sector is 512 bytes)
- * @param count Number of sectors
- * @param prdt_phys Physical buffer address
+ * @param io_request IO request
  * 
- * @return Pointer to command frame (caller release)
+ * @return S_OK on success, E_INVAL for unsupported actions
  */
-volatile sata_ncq_command_frame_t * 
-Ahci_device_port::setup_fpdma_read_cmd(unsigned slot, 
-                                       ahci_cmdhdr_t * cmdhdr, 
-                                       uint64_t blocknum, 
-                                       unsigned count, 
-                                       addr_t prdt_phys)
+status_t Ahci_device_port::async_io(io_request_t io_request)
 {
+  return async_io_batch(&io_request, 1);
+}
 
-  /* allocate command frame */
-  volatile sata_ncq_command_frame_t *cmd = 0;
-  addr_t cmd_phys = 0;
 
-  cmd = (sata_ncq_command_frame_t *) _cmd_frame_allocator.alloc(&cmd_phys);
+/** 
+ * Asynchronously issue a batch of BLOCK_READ/BLOCK_WRITE requests.  Up to the
+ * NCQ depth of commands are issued with one PxSACT/PxCI write; larger batches
+ * are issued as slots free up.
+ * 
+ * @param io_requests Array of IO requests
+ * @param length Number of requests
+ * 
+ * @return S_OK on success, E_INVAL if a request is unsupported (no request
+ * is issued in that case)
+ */
+status_t Ahci_device_port::async_io_batch(io_request_t * io_requests, size_t length)
+{
+  if(!_initialized) 
+    panic("[AHCI]: call to async_io_batch before initialization is complete.\n");
 
-  assert(cmd);
-  assert(cmd_phys);
+  for(size_t i=0;i<length;i++) {
+    io_request_t& r = io_requests[i];
+    if((r.action != BLOCK_READ && r.action != BLOCK_WRITE) ||
+       r.num_blocks == 0 || r.num_blocks > MAX_FPDMA_BLOCKS || (r.buffer_phys & 0x1))
+      return Exokernel::E_INVAL;
+  }
 
-  //  assert(sizeof(sata_ncq_command_frame_t) <= sizeof(sata_std_command_frame_t));
-  __builtin_memset((void*)cmd,0,sizeof(sata_ncq_command_frame_t));
+  uint32_t pending = 0;
+  for(size_t i=0;i<length;i++) {
+    io_request_t& r = io_requests[i];
+    io_segment_t seg;
+    seg.virt = r.buffer_virt;
+    seg.phys = r.buffer_phys;
+    seg.len = r.num_blocks * SATA_DEFAULT_BLOCK_SIZE;
+
+    unsigned slot = alloc_ncq_slot(pending);
+    prepare_fpdma(slot, r.offset, r.num_blocks, &seg, 1,
+                  r.action == BLOCK_WRITE, NULL, NULL, NULL);
+    pending |= (1U << slot);
+  }
 
-  /* set up Read first-party DMA queued command */
-  cmd->fis_type = SATA_CMD_FIS_TYPE; // 0x27 Register Host-to-Device FIS
-  cmd->c = SATA_CMD_FIS_COMMAND_INDICATOR;
-  cmd->command = 0x60;
-  cmd->control = 0;
-        
-  cmd->reserved1 = 0;
-  cmd->icc = 0;
-  cmd->reserved3 = 0;
-  cmd->reserved4 = 0;
-  cmd->reserved5 = 0;
-  cmd->reserved6 = 0;
-        
-  //  cmd->tag = 1; // tag field (identifies amongst outstanding commands
-  assert(count != 0);
-  cmd->sector_count_low = count & 0xff;
-  cmd->sector_count_high = (count >> 8) & 0xff;
-        
-  cmd->lba0 = blocknum & 0xff;
-  cmd->lba1 = (blocknum >> 8) & 0xff;
-  cmd->lba2 = (blocknum >> 16) & 0xff;
-  cmd->lba3 = (blocknum >> 24) & 0xff;
-  cmd->lba4 = (blocknum >> 32) & 0xff;
-  cmd->lba5 = (blocknum >> 40) & 0xff;
+  if(pending)
+    issue_ncq_slots(pending);
 
-  cmd->tag = slot << 3;
+  return Exokernel::S_OK;
+}
 
-  /* set up PRDT */
-  volatile ahci_cmd_prdt_t *prdt = (volatile ahci_cmd_prdt_t *) &cmd->prdt;
 
-  prdt->data_address_low = LO(prdt_phys);
-  prdt->data_address_upper = HI(prdt_phys);
-  prdt->reserved1 = 0;
-  prdt->dbc = (SATA_DEFAULT_BLOCK_SIZE * count) - 1;
-  prdt->reserved2 = 0;
-  prdt->ioc = 0;
+/** 
+ * Asynchronously perform a multi-segment BLOCK_READ or BLOCK_WRITE request
+ * as a single NCQ command; use wait_io_completion to wait for it
+ * 
+ * @param io_request Multi-segment IO request
+ * 
+ * @return S_OK on success, E_INVAL if the action is unsupported or the
+ * segments cannot be described by one command table
+ */
+status_t Ahci_device_port::async_io_sg(io_request_sg_t io_request)
+{
+  if(io_request.action != BLOCK_READ && io_request.action != BLOCK_WRITE)
+    return Exokernel::E_INVAL;
 
+  return async_fpdma_sg(io_request.offset, io_request.num_blocks,
+                        io_request.segments, io_request.num_segments,
+                        io_request.action == BLOCK_WRITE);
+}
 
-  /* set up command header */
-  {    
-    cmdhdr->flags = 5; // command fis h2d is 5 dwords
-    cmdhdr->prdtl = 1;
-    cmdhdr->bytesprocessed = 0;
-    cmdhdr->flags |= AHCI_CMDHDR_FLAGS_CLEAR_BUSY_UPON_OK | AHCI_CMDHDR_FLAGS_5DWCMD;
-    cmdhdr->cmdtable = LO(cmd_phys);
-    cmdhdr->cmdtableu = HI(cmd_phys);
+
+/** 
+ * Wait for all outstanding NCQ commands on the port to complete
+ * 
+ * @return S_OK on success
+ */
+status_t Ahci_device_port::wait_io_completion()
+{
+  while(_ncq_outstanding) {
+    reap_completions();
+    cpu_relax();
   }
+  return Exokernel::S_OK;
+}
 
-  return cmd;
+
+/** 
+ * Reap completed NCQ commands: slots that are outstanding but no longer
+ * set in PxSACT have completed.  Called from the IRQ thread and by threads
+ * waiting on IO; only one thread reaps at a time.
+ * 
+ * @return Number of commands reaped
+ */
+unsigned Ahci_device_port::reap_completions()
+{
+  if(!_reap_lock.try_lock())
+    return 0;
+
+  uint32_t outstanding = _ncq_outstanding;
+  if(outstanding == 0) {
+    _reap_lock.unlock();
+    return 0;
+  }
+
+  /* acknowledge before sampling PxSACT, so that a completion after the
+     sample raises the interrupt again */
+  ahci_port_is_t pxis = get_pxis();
+  if(pxis & AHCI_PORT_IS_RESTART) {
+    PERR("[AHCI]: port %u error (PXIS=0x%x PXTFD=0x%x PXSERR=0x%x PXSACT=0x%x)",
+         _port_num, pxis, get_pxtfd(), get_pxserr(), get_pxsact());
+    panic("[AHCI]: NCQ error recovery not implemented.\n");
+  }
+  set_pxis(pxis);
+  _device->ctrl()->is = 1U << _port_num;
+
+  uint32_t done = outstanding & ~get_pxsact();
+  unsigned count = 0;
+
+  while(done) {
+    unsigned slot = __builtin_ctz(done);
+    done &= done - 1;
+
+    Ncq_slot& s = _ncq_slots[slot];
+    ahci_notify_callback_t callback = s.callback;
+    void * callback_param = s.callback_param;
+    if(s.status)
+      *s.status = Exokernel::S_OK;
+
+    /* clear outstanding before releasing the slot; a new issuer on the same
+       slot sets the bit again */
+    __sync_fetch_and_and(&_ncq_outstanding, ~(1U << slot));
+    _command_slot_tracker->mark_free(slot);
+
+    if(callback)
+      callback(slot, callback_param);
+    count++;
+  }
+
+  _reap_lock.unlock();
+  return count;
 }
 
 
-volatile sata_ncq_command_frame_t * Ahci_device_port::setup_fpdma_write_cmd(unsigned slot, 
-                                                                            ahci_cmdhdr_t * cmdhdr, 
-                                                                            uint64_t blocknum, 
-                                                                            unsigned count,
-                                                                            addr_t prdt_phys)
+/** 
+ * Count the PRDT entries needed for a segment list; segments longer than
+ * 4MB take several entries
+ * 
+ * @param segs Segments
+ * @param num_segs Number of segments
+ * @param count Number of sectors the segments must cover
+ * 
+ * @return Number of PRDT entries, or -1 if the segments are invalid
+ */
+signed Ahci_device_port::count_prdt_entries(const io_segment_t * segs,
+                                            unsigned num_segs,
+                                            unsigned count)
+{
+  if(!segs || num_segs == 0 || count == 0 || count > MAX_FPDMA_BLOCKS)
+    return -1;
+
+  size_t total = 0;
+  unsigned entries = 0;
+  for(unsigned i=0;i<num_segs;i++) {
+    /* PRD addresses must be word aligned and byte counts even */
+    if(segs[i].len == 0 || (segs[i].len & 0x1) || (segs[i].phys & 0x1))
+      return -1;
+    total += segs[i].len;
+    entries += (segs[i].len + MAX_PRD_BYTES - 1) / MAX_PRD_BYTES;
+  }
+
+  if(total != ((size_t) count) * SATA_DEFAULT_BLOCK_SIZE || entries > MAX_PRDT_ENTRIES)
+    return -1;
+
+  return entries;
+}
+
+
+/** 
+ * Set up a READ/WRITE FPDMA QUEUED command in a slot's command table
+ * 
+ * @param slot Command slot (also the NCQ tag)
+ * @param cmdhdr Command header of the slot
+ * @param blocknum Starting sector (each sector is 512 bytes)
+ * @param count Number of sectors
+ * @param segs DMA segments (validated with count_prdt_entries)
+ * @param num_segs Number of segments
+ * @param write 1=write 0=read
+ * 
+ * @return Pointer to command frame (in the slot's command table)
+ */
+volatile sata_ncq_command_frame_t * 
+Ahci_device_port::setup_fpdma_cmd(unsigned slot, 
+                                  ahci_cmdhdr_t * cmdhdr, 
+                                  uint64_t blocknum, 
+                                  unsigned count, 
+                                  const io_segment_t * segs,
+                                  unsigned num_segs,
+                                  bool write)
 {
-  /* allocate command frame */
   volatile sata_ncq_command_frame_t *cmd = 0;
   addr_t cmd_phys = 0;
 
-  cmd = (sata_ncq_command_frame_t *) _cmd_frame_allocator.alloc(&cmd_phys);
+  cmd = (sata_ncq_command_frame_t *) get_command_table(slot, &cmd_phys);
 
   assert(cmd);
   assert(cmd_phys);
 
-  assert(sizeof(sata_ncq_command_frame_t) <= sizeof(sata_std_command_frame_t));
   __builtin_memset((void*)cmd,0,sizeof(sata_ncq_command_frame_t));
 
-  cmd->fis_type = SATA_CMD_FIS_TYPE;
+  /* set up Read/Write first-party DMA queued command */
+  cmd->fis_type = SATA_CMD_FIS_TYPE; // 0x27 Register Host-to-Device FIS
   cmd->c = SATA_CMD_FIS_COMMAND_INDICATOR;
-  cmd->command = 0x61;
+  cmd->command = write ? 0x61 : 0x60;
   cmd->control = 0;
-  
-  cmd->reserved1 = 0;
-  cmd->icc = 0;
-  cmd->reserved3 = 0;
-  cmd->reserved4 = 0;
-  cmd->reserved5 = 0;
-  cmd->reserved6 = 0;
-        
+
+  /* count of 65536 is encoded as 0 */
+  assert(count != 0);
   cmd->sector_count_low = count & 0xff;
   cmd->sector_count_high = (count >> 8) & 0xff;
         
@@ -719,46 +1002,59 @@ volatile sata_ncq_command_frame_t * Ahci_device_port::setup_fpdma_write_cmd(unsi
   cmd->lba3 = (blocknum >> 24) & 0xff;
   cmd->lba4 = (blocknum >> 32) & 0xff;
   cmd->lba5 = (blocknum >> 40) & 0xff;
-        
+
   cmd->tag = slot << 3;
 
-  /* set up PRDT */
+  /* set up PRDT; each entry covers at most 4MB */
   volatile ahci_cmd_prdt_t *prdt = (volatile ahci_cmd_prdt_t *) &cmd->prdt;
-
-  prdt->data_address_low = LO(prdt_phys);
-  prdt->data_address_upper = HI(prdt_phys);
-  prdt->reserved1 = 0;
-  prdt->dbc = (SATA_DEFAULT_BLOCK_SIZE * count) - 1;
-  prdt->reserved2 = 0;
-  prdt->ioc = 0; /* interrupt on completion */
+  unsigned entries = 0;
+
+  for(unsigned i=0;i<num_segs;i++) {
+    addr_t phys = segs[i].phys;
+    size_t remaining = segs[i].len;
+
+    while(remaining > 0) {
+      size_t len = remaining > MAX_PRD_BYTES ? MAX_PRD_BYTES : remaining;
+      assert(entries < MAX_PRDT_ENTRIES);
+
+      prdt->data_address_low = LO(phys);
+      prdt->data_address_upper = HI(phys);
+      prdt->reserved1 = 0;
+      prdt->dbc = len - 1;
+      prdt->reserved2 = 0;
+      prdt->ioc = 0;
+
+      prdt++;
+      entries++;
+      phys += len;
+      remaining -= len;
+    }
+  }
 
   /* set up command header */
   {    
-    cmdhdr->flags = 5; // command fis h2d is 5 dwords
-    cmdhdr->prdtl = 1;
+    cmdhdr->flags = AHCI_CMDHDR_FLAGS_CLEAR_BUSY_UPON_OK | AHCI_CMDHDR_FLAGS_5DWCMD;
+    if(write)
+      cmdhdr->flags |= AHCI_CMDHDR_FLAGS_WRITE;
+    cmdhdr->prdtl = entries;
     cmdhdr->bytesprocessed = 0;
-
-    cmdhdr->flags =     
-      AHCI_CMDHDR_FLAGS_CLEAR_BUSY_UPON_OK |
-      AHCI_CMDHDR_FLAGS_WRITE |
-      AHCI_CMDHDR_FLAGS_5DWCMD;
-
     cmdhdr->cmdtable = LO(cmd_phys);
     cmdhdr->cmdtableu = HI(cmd_phys);
   }
-        
+
   return cmd;
 }
 
 
 void * IRQ_thread::entry(void *) {
   assert(_port);
-  unsigned count = 0;
   while(!thread_should_exit()) {
     _port->device()->wait_for_msi_irq(_irq);
 
     PDBG("IRQ thread fired.");
+    _port->reap_completions();
   }
+  return NULL;
 }
 
 
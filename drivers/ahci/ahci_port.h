@@ -51,17 +51,41 @@
 class IRQ_thread;
 class AHCI_uddk_device;
 
+/** 
+ * Completion callback for asynchronous FPDMA commands
+ * 
+ * @param slot Command slot the command completed on
+ * @param param Callback parameter given at issue
+ */
+typedef void (*ahci_notify_callback_t)(unsigned slot, void * param);
+
 class Ahci_device_port
 {  
 
 private:
+  enum {
+    NCQ_SLOTS         = 32,         /* command slots (and NCQ tags) per port */
+    MAX_FPDMA_BLOCKS  = 65536,      /* 32MB; limit of the FPDMA sector count */
+    MAX_PRD_BYTES     = 0x400000,   /* 4MB; limit of one PRDT entry */
+    MAX_PRDT_ENTRIES  = 8192,       /* 32MB in 4K pages */
+    CMD_TABLE_HDR     = 0x80,       /* command FIS, ATAPI command, reserved */
+    CMD_TABLE_SIZE    = (CMD_TABLE_HDR + (MAX_PRDT_ENTRIES * 16) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1),
+  };
+
+  /** State of an issued NCQ command */
+  struct Ncq_slot {
+    ahci_notify_callback_t callback;
+    void *                 callback_param;
+    status_t *             status;
+  };
+
   unsigned _port_num;
 
   volatile ahci_port_t *   _port_reg;
   ahci_cmdhdr_t *          _command_hdr;
   addr_t                   _command_hdr_p;
-  volatile uint32_t *      _command_tbl;
-  addr_t                   _command_tbl_p;
+  volatile uint32_t *      _command_tbl[NCQ_SLOTS];   /* one command table per slot */
+  addr_t                   _command_tbl_p[NCQ_SLOTS];
 
   AHCI_uddk_device *       _device;
   unsigned                 _irq;
@@ -73,7 +97,13 @@ private:
   volatile received_fis_t * _received_fis_v;
   addr_t                    _received_fis_p;
 
-  //   Bitmap_tracker_threadsafe<32> _command_slot_tracker;
+  /* NCQ pipeline: slots are taken from a lock-free bitmap and each slot has a
+     fixed command table, so many commands can be in flight at once */
+  Exokernel::Bitmap_allocator_lockfree * _command_slot_tracker;
+  Ncq_slot                 _ncq_slots[NCQ_SLOTS];
+  unsigned                 _ncq_depth;
+  volatile uint32_t        _ncq_outstanding; /* issued and not yet reaped */
+  Exokernel::Spin_lock     _reap_lock;
 
   sata_identify_data_t _device_identity;
   uint64_t _device_capacity; /* capacity of the device in bytes */
@@ -109,6 +139,7 @@ private:
   void get_model_name(char * src, char * dst, unsigned len);
   ahci_cmdhdr_t * get_command_slot(unsigned index);
   addr_t get_command_slot_p(unsigned index);
+  void * get_command_table(unsigned slot, addr_t * phys);
 
   void poll_for_port_interrupt(unsigned bit);
 
@@ -130,15 +161,41 @@ public:
   volatile ahci_port_t * const port_reg() { return _port_reg; }
 
 private:
-  status_t sync_fpdma(unsigned slot, uint64_t block, unsigned count, addr_t prdt_p, bool write);
-  volatile sata_ncq_command_frame_t * setup_fpdma_read_cmd(unsigned slot, ahci_cmdhdr_t * cmd_hdr, uint64_t blocknum, unsigned count, addr_t prdt_phys);
-  volatile sata_ncq_command_frame_t * setup_fpdma_write_cmd(unsigned slot, ahci_cmdhdr_t * cmd_hdr, uint64_t blocknum, unsigned count, addr_t prdt_phys);
+  status_t sync_fpdma(uint64_t block, unsigned count, addr_t prdt_p, bool write);
+  unsigned alloc_ncq_slot(uint32_t& pending);
+  void prepare_fpdma(unsigned slot, uint64_t block, unsigned count,
+                     const io_segment_t * segs, unsigned num_segs, bool write,
+                     ahci_notify_callback_t callback, void * callback_param, status_t * status);
+  signed count_prdt_entries(const io_segment_t * segs, unsigned num_segs, unsigned count);
+  void issue_ncq_slots(uint32_t mask);
+  volatile sata_ncq_command_frame_t * setup_fpdma_cmd(unsigned slot, ahci_cmdhdr_t * cmd_hdr, uint64_t blocknum, unsigned count,
+                                                      const io_segment_t * segs, unsigned num_segs, bool write);
 
 public:
-  status_t sync_fpdma_read(unsigned slot, uint64_t block, unsigned count, addr_t prdt_p);
-  status_t sync_fpdma_write(unsigned slot, uint64_t block, unsigned count, addr_t prdt_p);
+  status_t sync_fpdma_read(uint64_t block, unsigned count, addr_t prdt_p);
+  status_t sync_fpdma_write(uint64_t block, unsigned count, addr_t prdt_p);
 
   uint64_t capacity_in_blocks() const { return _device_capacity_blocks; }
+
+  /* asynchronous NCQ interface (IBlockData-style) */
+  status_t async_fpdma(uint64_t block, unsigned count, addr_t prdt_p, bool write,
+                       ahci_notify_callback_t callback = NULL,
+                       void * callback_param = NULL,
+                       status_t * status = NULL);
+  status_t async_fpdma_sg(uint64_t block, unsigned count,
+                          const io_segment_t * segs, unsigned num_segs, bool write,
+                          ahci_notify_callback_t callback = NULL,
+                          void * callback_param = NULL,
+                          status_t * status = NULL);
+  status_t sync_io(io_request_t io_request);
+  status_t async_io(io_request_t io_request);
+  status_t async_io_sg(io_request_sg_t io_request);
+  status_t async_io_batch(io_request_t * io_requests, size_t length);
+  status_t wait_io_completion();
+  unsigned reap_completions();
+
+  unsigned ncq_depth() const { return _ncq_depth; }
+  unsigned ncq_outstanding() const { return __builtin_popcount(_ncq_outstanding); }
 };
 
 
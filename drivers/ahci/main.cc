@@ -47,8 +47,7 @@
 
 void do_basic_write_test(AHCI_uddk_device * dev, unsigned port, void * vbuff, addr_t pbuff)
 {
-  status_t hr = dev->port(port)->sync_fpdma_write(0, // slot 
-                                                  0, // block
+  status_t hr = dev->port(port)->sync_fpdma_write(0, // block
                                                   1, // count
                                                   pbuff);
   
@@ -59,8 +58,7 @@ void do_basic_write_test(AHCI_uddk_device * dev, unsigned port, void * vbuff, ad
 
 void do_basic_read_test(AHCI_uddk_device * dev, unsigned port, void * vbuff, addr_t pbuff)
 {
-  status_t hr = dev->port(port)->sync_fpdma_read(0, // slot 
-                                                 0, // block
+  status_t hr = dev->port(port)->sync_fpdma_read(0, // block
                                                  1, // count
                                                  pbuff);
   
@@ -83,8 +81,7 @@ void do_random_read_test(AHCI_uddk_device * dev, unsigned port, void * vbuff, ad
   for(unsigned b=0;b<num_blocks;b++) {
     uint64_t block_to_read = (genrand64_int64() % capacity);
 
-    status_t hr = dev->port(port)->sync_fpdma_read(0, // slot 
-                                                   block_to_read, // block
+    status_t hr = dev->port(port)->sync_fpdma_read(block_to_read, // block
                                                    1, // count
                                                    pbuff);
     
@@ -97,6 +94,41 @@ void do_random_read_test(AHCI_uddk_device * dev, unsigned port, void * vbuff, ad
   PLOG("rate: %g blocks/second", 1000.0 / (msec/(double)num_blocks));
 }
 
+void do_async_random_read_test(AHCI_uddk_device * dev, unsigned port, void * vbuff, addr_t pbuff, unsigned num_blocks)
+{
+  using namespace Exokernel;
+
+  enum { BATCH = 32 };
+  Ahci_device_port * p = dev->port(port);
+  uint64_t capacity = p->capacity_in_blocks();
+
+  PLOG("NCQ depth: %u", p->ncq_depth());
+
+  init_genrand64(rdtsc());
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC_RAW,&start);
+
+  io_request_t reqs[BATCH];
+  for(unsigned b=0;b<num_blocks;b+=BATCH) {
+    for(unsigned i=0;i<BATCH;i++) {
+      reqs[i].action = BLOCK_READ;
+      reqs[i].buffer_virt = ((byte *)vbuff) + (i * 512);
+      reqs[i].buffer_phys = pbuff + (i * 512);
+      reqs[i].offset = genrand64_int64() % capacity;
+      reqs[i].num_blocks = 1;
+    }
+    status_t hr = p->async_io_batch(reqs, BATCH);
+    assert(hr == Exokernel::S_OK);
+  }
+  p->wait_io_completion();
+  clock_gettime(CLOCK_MONOTONIC_RAW,&end);
+  
+  PLOG("rate: %g blocks/second (async, batches of %u)",
+       ((double) num_blocks) / ((double) (end.tv_sec - start.tv_sec) +
+                                ((double) (end.tv_nsec - start.tv_nsec) / 1000000000.0)),
+       BATCH);
+}
+
 
 int main()
 {
@@ -127,6 +159,7 @@ int main()
 
 #if 0
     do_random_read_test(dev,USE_AHCI_PORT,virt,phys,1000);
+    do_async_random_read_test(dev,USE_AHCI_PORT,virt,phys,32000);
 #endif
     
     printf("Cleaning up AHCI device.\n");
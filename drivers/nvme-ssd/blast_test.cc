@@ -282,6 +282,10 @@ void read_blast(IBlockDevice * itf, off_t max_lba)
 #endif
     threads[i]->start();
   }
+
+  Stats_dump_thread stats_thread(itf, 1, NUM_QUEUES);
+  stats_thread.start();
+
   sleep(TIME_DURATION_SEC);
 
   /* signal threads to exit */
@@ -291,6 +295,7 @@ void read_blast(IBlockDevice * itf, off_t max_lba)
   for(unsigned i=0;i<NUM_QUEUES;i++) {
     threads[i]->join();
   }
+  stats_thread.join();
 
   PINF("Random Read Rate: %ld IOPS\n", total_ops / TIME_DURATION_SEC);
 }
@@ -314,12 +319,15 @@ void verify_blast(IBlockDevice * itf)
     threads[i]->start();
   }
 
+  Stats_dump_thread stats_thread(itf, 1, NUM_QUEUES);
+  stats_thread.start();
 
   /* join threads */
   for(unsigned i=0;i<NUM_QUEUES;i++) {
     threads[i]->join();
     delete threads[i];
   }
+  stats_thread.join();
 
   PINF("Verify complete. OK.");
 
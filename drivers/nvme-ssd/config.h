@@ -31,14 +31,23 @@
 #define __NVME_CONFIG_H__
 
 #include <tinyxml.h>
+#include "nvme_types.h"
 
 class Config_IO_Queues
 {
 private:
+  enum {
+    DEFAULT_CQ_SPIN_US = 20, /* adaptive mode spin budget */
+    CORE_FROM_SQ = ~0U,      /* inline queues run on the submission core */
+  };
+
   struct mapping {
     unsigned queue_id;
     core_id_t core;
-    mapping(unsigned q, core_id_t c) : queue_id(q), core(c) {}
+    NVME::cq_mode_t cq_mode;
+    unsigned cq_spin_us;
+    mapping(unsigned q, core_id_t c, NVME::cq_mode_t m, unsigned s) 
+      : queue_id(q), core(c), cq_mode(m), cq_spin_us(s) {}
   };
 
   unsigned _num_queues;
@@ -48,61 +57,243 @@ private:
   /*For submission queue. TODO: This class needs to be cleaned. */
   unsigned _num_sub_queues;
   std::map<unsigned, unsigned> _sq_qid_core_map;
+  std::map<unsigned, NVME::sq_priority_t> _sq_qid_prio_map;
 
 public:
   Config_IO_Queues() : _num_queues(0), _cores_len(64), _num_sub_queues(0) {
   }
   
-  void add_IO_queue(const char * id, const char * core) {
+  static NVME::cq_mode_t parse_cq_mode(const char * mode) {
+    if(!mode || strcmp(mode,"interrupt")==0)
+      return NVME::CQ_MODE_INTERRUPT;
+    else if(strcmp(mode,"poll")==0)
+      return NVME::CQ_MODE_POLL;
+    else if(strcmp(mode,"adaptive")==0)
+      return NVME::CQ_MODE_ADAPTIVE;
+    else if(strcmp(mode,"inline")==0)
+      return NVME::CQ_MODE_INLINE;
+
+    PERR("unrecognized completion queue mode (%s)",mode);
+    assert(false);
+    return NVME::CQ_MODE_INTERRUPT;
+  }
+
+  void add_IO_queue(const char * id, const char * core,
+                    const char * mode = NULL, const char * spin_us = NULL) {
     _num_queues++;
     int i = atoi(id);
-    int c = atoi(core);    
-    assert(c <= sysconf(_SC_NPROCESSORS_ONLN));
+    NVME::cq_mode_t cq_mode = parse_cq_mode(mode);
+    core_id_t c = CORE_FROM_SQ;
+
+    /* run-to-completion queues do not need a CQ core */
+    if(core) {
+      c = atoi(core);
+      assert(c <= sysconf(_SC_NPROCESSORS_ONLN));
+    }
+    else if(cq_mode != NVME::CQ_MODE_INLINE) {
+      PERR("completion queue (%d) needs a core unless mode is inline",i);
+      assert(false);
+    }
     
-    struct mapping m(i,c);
+    struct mapping m(i,c,
+                     cq_mode,
+                     spin_us ? atoi(spin_us) : DEFAULT_CQ_SPIN_US);
     _core_qid_mappings.push_back(m);
   }
 
-  void add_sub_queue(const char * id, const char * core) {
+  static NVME::sq_priority_t parse_sq_priority(const char * prio) {
+    if(!prio || strcmp(prio,"high")==0)
+      return NVME::SQ_PRIO_HIGH;
+    else if(strcmp(prio,"urgent")==0)
+      return NVME::SQ_PRIO_URGENT;
+    else if(strcmp(prio,"medium")==0)
+      return NVME::SQ_PRIO_MEDIUM;
+    else if(strcmp(prio,"low")==0)
+      return NVME::SQ_PRIO_LOW;
+
+    PERR("unrecognized submission queue priority (%s)",prio);
+    assert(false);
+    return NVME::SQ_PRIO_HIGH;
+  }
+
+  void add_sub_queue(const char * id, const char * core, const char * priority = NULL) {
     _num_sub_queues++;
     int i = atoi(id);
     int c = atoi(core);
     assert(c <= sysconf(_SC_NPROCESSORS_ONLN));
 
     _sq_qid_core_map[i] = c;
+    _sq_qid_prio_map[i] = parse_sq_priority(priority);
   }
 
   unsigned num_io_queues() const { return _num_queues; }
   unsigned io_queue_get_assigned_core(unsigned index, core_id_t * core) { 
     assert(index < _core_qid_mappings.size());
-    *core = _core_qid_mappings[index].core;
+    *core = get_core(index);
     return _core_qid_mappings[index].queue_id;
   }
   core_id_t get_core(unsigned index) {
     assert(index < _core_qid_mappings.size());
+    if(_core_qid_mappings[index].core == CORE_FROM_SQ)
+      return get_sub_core_from_qid(_core_qid_mappings[index].queue_id);
     return _core_qid_mappings[index].core;
   }
 
+  /** 
+   * Completion mode (interrupt, poll or adaptive) for an IO queue
+   * 
+   * @param index Index of the IO queue counting from 0
+   * 
+   * @return Completion mode
+   */
+  NVME::cq_mode_t get_cq_mode(unsigned index) {
+    assert(index < _core_qid_mappings.size());
+    return _core_qid_mappings[index].cq_mode;
+  }
+
+  /** 
+   * Spin budget used by the adaptive completion mode
+   * 
+   * @param index Index of the IO queue counting from 0
+   * 
+   * @return Budget in microseconds
+   */
+  unsigned get_cq_spin_us(unsigned index) {
+    assert(index < _core_qid_mappings.size());
+    return _core_qid_mappings[index].cq_spin_us;
+  }
+
   unsigned num_sub_queues() const { return _num_sub_queues; }
   unsigned get_sub_core_from_qid (unsigned qid) {
     assert(_sq_qid_core_map.find(qid) != _sq_qid_core_map.end() );
     return _sq_qid_core_map[qid];
   }
+
+  /** 
+   * Arbitration priority class of a submission queue
+   * 
+   * @param qid Queue identifier counting from 1
+   * 
+   * @return Priority class (high if not configured)
+   */
+  NVME::sq_priority_t get_sub_priority_from_qid(unsigned qid) {
+    std::map<unsigned, NVME::sq_priority_t>::iterator i = _sq_qid_prio_map.find(qid);
+    return i == _sq_qid_prio_map.end() ? NVME::SQ_PRIO_HIGH : i->second;
+  }
+};
+
+class Config_arbitration
+{
+private:
+  enum {
+    DEFAULT_ARB_BURST = 3,   /* fetch up to 8 commands from a queue per turn */
+    DEFAULT_HIGH_WEIGHT = 16,
+    DEFAULT_MEDIUM_WEIGHT = 4,
+    DEFAULT_LOW_WEIGHT = 1,
+  };
+
+  bool     _wrr;
+  unsigned _arb_burst;
+  unsigned _high_weight;
+  unsigned _medium_weight;
+  unsigned _low_weight;
+
+public:
+  Config_arbitration() : _wrr(false), 
+                         _arb_burst(DEFAULT_ARB_BURST),
+                         _high_weight(DEFAULT_HIGH_WEIGHT),
+                         _medium_weight(DEFAULT_MEDIUM_WEIGHT),
+                         _low_weight(DEFAULT_LOW_WEIGHT) {
+  }
+
+  void set_arbitration(const char * mechanism, 
+                       const char * burst, 
+                       const char * high, 
+                       const char * medium, 
+                       const char * low) {
+    if(mechanism) {
+      if(strcmp(mechanism,"wrr")==0)
+        _wrr = true;
+      else if(strcmp(mechanism,"rr")==0)
+        _wrr = false;
+      else {
+        PERR("unrecognized arbitration mechanism (%s)",mechanism);
+        assert(false);
+      }
+    }
+    if(burst) _arb_burst = atoi(burst);
+    if(high) _high_weight = atoi(high);
+    if(medium) _medium_weight = atoi(medium);
+    if(low) _low_weight = atoi(low);
+  }
+
+  /** 
+   * Weighted round robin with urgent priority class requested (otherwise
+   * plain round robin, and queue priorities are ignored)
+   * 
+   */
+  bool get_arb_wrr() const { return _wrr; }
+  unsigned get_arb_burst() const { return _arb_burst; }
+  unsigned get_high_weight() const { return _high_weight; }
+  unsigned get_medium_weight() const { return _medium_weight; }
+  unsigned get_low_weight() const { return _low_weight; }
 };
 
 class Config_queue_config
 {
 private:
+  enum {
+    DEFAULT_DB_BATCH = 32,    /* pending SQ entries that force a doorbell */
+    DEFAULT_DB_WINDOW_US = 0, /* do not hold the doorbell for later submitters */
+  };
+
   unsigned _io_queue_len;
+  unsigned _db_batch;
+  unsigned _db_window_us;
+  bool     _shadow_doorbells;
 public:
+  Config_queue_config() : _io_queue_len(0), _db_batch(DEFAULT_DB_BATCH), _db_window_us(DEFAULT_DB_WINDOW_US),
+                          _shadow_doorbells(true) {
+  }
+
   void set_io_queue_len(const char * lenstr) {
     _io_queue_len = atoi(lenstr);
   }
   unsigned get_io_queue_len() const { return _io_queue_len; }
+
+  void set_doorbell_coalescing(const char * batch, const char * window_us) {
+    if(batch) _db_batch = atoi(batch);
+    if(window_us) _db_window_us = atoi(window_us);
+  }
+
+  /** 
+   * Submission doorbell coalescing: ring once this many entries are pending
+   * 
+   */
+  unsigned get_db_batch() const { return _db_batch; }
+
+  /** 
+   * Submission doorbell coalescing: longest time (us) a committed entry
+   * may wait for other submitters before the doorbell is rung
+   * 
+   */
+  unsigned get_db_window_us() const { return _db_window_us; }
+
+  void set_shadow_doorbells(const char * enable) {
+    if(enable) _shadow_doorbells = (strcmp(enable,"off") != 0 && strcmp(enable,"false") != 0);
+  }
+
+  /** 
+   * Use Doorbell Buffer Config (shadow doorbells) when the controller
+   * supports it
+   * 
+   */
+  bool get_shadow_doorbells() const { return _shadow_doorbells; }
 };
 
 class Config : public Config_IO_Queues,
-               public Config_queue_config
+               public Config_queue_config,
+               public Config_arbitration
 {
 public:
   class Config_exception : public Exokernel::Exception {
@@ -125,11 +316,25 @@ private:
       try {
         TiXmlElement * e = _root.FirstChild("IO_queue_config").Element();
         set_io_queue_len(e->Attribute("length"));
+        set_doorbell_coalescing(e->Attribute("doorbell_batch"),      /* optional */
+                                e->Attribute("doorbell_window_us")); /* optional */
+        set_shadow_doorbells(e->Attribute("shadow_doorbells"));      /* optional: on|off */
       }
       catch(...) {
         throw Config_exception("cannot find IO_queue_config node");
       }
     }
+    /* Arbitration (optional) */
+    {
+      TiXmlElement * e = _root.FirstChild("Arbitration").Element();
+      if(e) {
+        set_arbitration(e->Attribute("mechanism"), /* rr|wrr */
+                        e->Attribute("burst"),
+                        e->Attribute("high"),
+                        e->Attribute("medium"),
+                        e->Attribute("low"));
+      }
+    }
     /* IO_queues */
     {
       TiXmlElement * e = _root.FirstChild("IO_queues").Element();
@@ -140,9 +345,14 @@ private:
       while(child) {
         /* Completion_queues */
         if(child->ValueStr()=="Completion_queue") {
-          add_IO_queue(child->Attribute("id"), child->Attribute("core"));
+          add_IO_queue(child->Attribute("id"), 
+                       child->Attribute("core"),
+                       child->Attribute("mode"),     /* optional: interrupt|poll|adaptive|inline */
+                       child->Attribute("spin_us")); /* optional: adaptive spin budget */
         } else if (child->ValueStr()=="Submission_queue") {
-          add_sub_queue(child->Attribute("id"), child->Attribute("core"));
+          add_sub_queue(child->Attribute("id"), 
+                        child->Attribute("core"),
+                        child->Attribute("priority")); /* optional: urgent|high|medium|low */
         } else {
           PERR("Not Recognized!!");
           assert(false);
@@ -29,6 +29,7 @@
 
 #include <signal.h>
 #include <libexo.h>
+#include <common/cycles.h>
 
 #include "cq_thread.h"
 #include "nvme_queue.h"
@@ -39,16 +40,24 @@
 
 std::vector<CQ_thread *> cq_objs;
 
-CQ_thread::CQ_thread(NVME_IO_queue * qbase, unsigned core, unsigned vector, unsigned qid) 
+CQ_thread::CQ_thread(NVME_IO_queue * qbase, 
+                     unsigned core, 
+                     unsigned vector, 
+                     unsigned qid,
+                     NVME::cq_mode_t mode,
+                     unsigned spin_us) 
   : Exokernel::Base_thread(NULL, core), /* order important */
     g_times_woken(0),
     g_entries_cleared(0),
+    g_irq_wakeups(0),
     _qid(qid),
-    _core(core)
+    _core(core),
+    _mode(mode)
 {
   _irq = vector;
   _queues = qbase;
-  PLOG("### CQ_thread: core=%u, qbase=%p",core,(void*)qbase);
+  _spin_cycles = (cpu_time_t) get_tsc_frequency_in_mhz() * spin_us;
+  PLOG("### CQ_thread: core=%u, qbase=%p mode=%s",core,(void*)qbase,mode_name(mode));
   cq_objs.push_back(this);
 }
 
@@ -56,14 +65,50 @@ void sig_handler(int sig) {
   /* dump stats */
   printf("\n");
   for(std::vector<CQ_thread*>::iterator i=cq_objs.begin(); i!=cq_objs.end(); i++) {
-    printf("CQ thread (irq=%d): times woken = %lu (woken)/%lu (cleared)\n",
-           (*i)->irq(),
-           (*i)->g_times_woken,
-           (*i)->g_entries_cleared);
+    CQ_thread * t = *i;
+    printf("CQ thread (irq=%d) (mode=%s): times woken = %lu (woken)/%lu (cleared)/%lu (irq) entries per wakeup = %.2f\n",
+           t->irq(),
+           CQ_thread::mode_name(t->mode()),
+           t->g_times_woken,
+           t->g_entries_cleared,
+           t->g_irq_wakeups,
+           t->g_times_woken ? ((double)t->g_entries_cleared) / t->g_times_woken : 0.0);
   }
   panic("ctrl-c handled.");
 }
 
+/** 
+ * Block until the MSI-X vector for this queue fires
+ * 
+ */
+void CQ_thread::wait_for_irq()
+{
+  if(_queues->device()->wait_for_msix_irq(_irq) != Exokernel::S_OK) {
+    panic("unexpected");
+  }
+  g_irq_wakeups++;
+}
+
+/** 
+ * Spin on the phase tag of the CQ head for at most the spin budget.
+ * Completions reaped this way still raise their MSI-X interrupt, so
+ * a later wait may return with nothing to reap; this is harmless.
+ * 
+ * 
+ * @return True if a completion arrived within the budget
+ */
+bool CQ_thread::spin_for_completion()
+{
+  cpu_time_t start = rdtsc();
+
+  while(!_queues->completion_pending()) {
+    if(rdtsc() - start > _spin_cycles)
+      return false;
+    cpu_relax();
+  }
+  return true;
+}
+
 void* CQ_thread::entry(void* qb) {
 
   assert(_queues);
@@ -91,75 +136,37 @@ void* CQ_thread::entry(void* qb) {
   str << "cq-thread-" << _irq;
   Exokernel::set_thread_name(str.str().c_str());
 
-  Completion_command_slot * ccs;
-  status_t s;
-
+  unsigned found_completion = false;
   
   /* hmm, should be some other condition instead of while(1) !! */
   while(1) {
 
-#if 1
-    /* wait for interrupt */
-    if(_queues->device()->wait_for_msix_irq(_irq) != Exokernel::S_OK) {
-      panic("unexpected");
+    switch(_mode) {
+    case NVME::CQ_MODE_POLL:
+      /* busy-poll the phase tag; the CQ was created without IRQs */
+      while(!_queues->completion_pending())
+        cpu_relax();
+      break;
+    case NVME::CQ_MODE_ADAPTIVE:
+      /* keep polling while completions are flowing, otherwise re-arm */
+      if(!(found_completion && spin_for_completion()))
+        wait_for_irq();
+      break;
+    default:
+      /* wait for interrupt */
+      wait_for_irq();
       break;
     }
-#else
-    cpu_relax();
-#endif
     
-    unsigned found_completion = false;
-
     g_times_woken++;
     PLOG("IRQ(%u) !!! WOKEN !!! (core=%u) (times=%lu)",_irq, _core, g_times_woken);
 
-  retry:
+    /* reap completions; this updates SQ head and batch manager */
+    unsigned cleared = _queues->poll_completions();
+    found_completion = (cleared > 0);
+    g_entries_cleared += cleared;
 
-    unsigned cq_batch_counter = 0;
-
-    /* iterate through the completed completion slots (looking at phase tag) */
-    while((ccs = _queues->get_next_completion())!=NULL) {
-
-      /* update SQ head*/
-      _queues->update_sq_head(ccs);
-
-      /* update batch info; this will free slot */
-      s = _queues->update_batch_manager(ccs->command_id);
-      assert(s == Exokernel::S_OK);
-
-      found_completion = true;
-
-      g_entries_cleared++;
-      PLOG("cleared = %lu (Q:%u)", g_entries_cleared, _qid);
-
-#if (CQ_MAX_BATCH_TO_RING > 1)
-      cq_batch_counter++;
-      if(_unlikely(cq_batch_counter >= CQ_MAX_BATCH_TO_RING)) {
-#endif
-        _queues->ring_completion_doorbell();
-#if (CQ_MAX_BATCH_TO_RING > 1)
-        cq_batch_counter = 0;
-      }
-#endif
-
-    }
-
-    /* we may not have woken readers yet */
-    // if(!woke_reader)
-    //   goto retry;
     PLOG("found completion --> %s",found_completion ? "yes" : "no");
-
-    /* ring completion doorbell for new _cq_head */
-
-    if(found_completion) {
-      PLOG("ringing completion doorbell");
-      _queues->ring_completion_doorbell();
-      cq_batch_counter = 0;
-    }
-    // else {
-    //    _queues->dump_queue_info();
-    // }
- 
   }
 
   assert(0=="CQ exited?");
@@ -51,149 +51,42 @@ private:
   unsigned _irq;
   unsigned _qid;
 
+  NVME::cq_mode_t _mode;
+  cpu_time_t      _spin_cycles; /* adaptive mode spin budget */
+
   NVME_IO_queue * _queues;
 
+  void wait_for_irq();
+  bool spin_for_completion();
+
 public:
   /* debugging */
   unsigned long g_times_woken;
   unsigned long g_entries_cleared;
+  unsigned long g_irq_wakeups;   /* wakeups that came through MSI-X */
 
 public:
-  CQ_thread(NVME_IO_queue * qbase, unsigned core, unsigned vector, unsigned queue_id);
+  CQ_thread(NVME_IO_queue * qbase, 
+            unsigned core, 
+            unsigned vector, 
+            unsigned queue_id,
+            NVME::cq_mode_t mode = NVME::CQ_MODE_INTERRUPT,
+            unsigned spin_us = 0);
 
   void* entry(void* qb);
 
   unsigned irq() const { return _irq; }
-};
-
-
-/** 
- * Callback manager is used to maintain a table of call back functions
- * and their corresponding void * parameter (usually a cast this pointer).
- * 
- * @param max Maximum number of outstanding call backs (default 128)
- */
-class Callback_manager
-{
-private:
-
-  notify_callback_t _callback;
-  void *           _callback_params;
-
-public:
-  Callback_manager() : _callback(NULL), _callback_params(NULL) {
-  }
-
-  /** 
-   * Register a callback function.
-   * 
-   * @param slot Slot for callback, usually queue id
-   * @param cf Call back function
-   * @param param Parameters for call back
-   */
-  void register_callback(notify_callback_t cf, void * param) {
-    _callback = cf;
-    _callback_params = param;
-  }
-
-
-  /** 
-   * Call callback function assigned to specific slot.
-   * 
-   * @param slot Slot corresponding to the callback function
-   * 
-   * @return E_FAIL if not function assigned to slot.
-   */
-  status_t call(unsigned command_id) {
-    if(!_callback) {
-      PWRN("callback not set");
-      return Exokernel::E_FAIL;
-    }
-    /* make call back */
-    _callback(command_id,_callback_params);
-    return Exokernel::S_OK;
-  }
-
-};
-
-
-class Callback_manager_multislot
-{
-private:
-
-  //  Exokernel::Spin_lock _lock;
-
-  size_t              _max_callbacks;
-  notify_callback_t * _callbacks;
-  void **             _callback_params;
-  unsigned canary;
-
-public:
-  Callback_manager_multislot(size_t max) : _max_callbacks(max+1) {
-    canary = 0xbeeffeed;
-
-    _callbacks = new notify_callback_t [_max_callbacks];
-    memset(_callbacks,0,sizeof(notify_callback_t)*_max_callbacks);
-
-    _callback_params = new void * [_max_callbacks];
-    memset(_callback_params,0,sizeof(void*)*_max_callbacks);
-  }
-
-  ~Callback_manager_multislot() {
-    delete _callbacks;
-    delete _callback_params;
-  }
-
-  /** 
-   * Register a callback function.
-   * 
-   * @param slot Slot for callback, usually queue id
-   * @param cf Call back function
-   * @param param Parameters for call back
-   */
-  void register_callback(unsigned slot, notify_callback_t cf, void * param) {
-    if(slot > _max_callbacks) {
-      panic("exceed max slot capacity in callback manager (slot=%u)",slot);
+  NVME::cq_mode_t mode() const { return _mode; }
+
+  static const char * mode_name(NVME::cq_mode_t mode) {
+    switch(mode) {
+    case NVME::CQ_MODE_POLL: return "poll";
+    case NVME::CQ_MODE_ADAPTIVE: return "adaptive";
+    case NVME::CQ_MODE_INLINE: return "inline";
+    default: return "interrupt";
     }
-    PLOG("registered for slot %u", slot);
-    _callbacks[slot] = cf;
-    _callback_params[slot] = param;
-  }
-
-
-  /** 
-   * Clear a previously registered call back
-   * 
-   * @param slot Slot to clear
-   */
-  void deregister_callback(unsigned slot) {    
-    //    Exokernel::Spin_lock_guard g(_lock);
-    assert(_callbacks[slot]);
-    _callbacks[slot] = NULL;
   }
-
-  /** 
-   * Call callback function assigned to specific slot.
-   * 
-   * @param slot Slot corresponding to the callback function
-   * 
-   * @return E_FAIL if not function assigned to slot.
-   */
-  status_t call(unsigned slot, unsigned command_id) {
-    assert(canary==0xbeeffeed);
-    PLOG("Calling callback slot=%u command_id=%u", slot, command_id);
-    //    Exokernel::Spin_lock_guard g(_lock);
-    if(!_callbacks[slot & 0xffff]) {
-      PWRN("call on callback (slot=%x) that is empty.",slot);
-      return Exokernel::E_FAIL;
-    }
-    /* make call back */
-    (_callbacks[slot])(command_id,_callback_params[slot]);
-    return Exokernel::S_OK;
-  }
-
 };
 
 
-
 #endif // __CQ_THREAD_H__
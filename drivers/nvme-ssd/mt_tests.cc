@@ -13,6 +13,7 @@
 #include "nvme_drv_component.h"
 #include "nvme_device.h"
 #include "nvme_types.h"
+#include "tests.h"
 
 #define BLOCK_4K
 
@@ -437,10 +438,14 @@ class mt_tests {
         for(unsigned i=1;i<=NUM_QUEUES;i++)
           thr[i-1]->start();
 
+        Stats_dump_thread stats_thread(itf, 1, NUM_QUEUES);
+        stats_thread.start();
+
         for(unsigned i=1;i<=NUM_QUEUES;i++) {
           PLOG("!!!!!!!!!!!!!! joined read thread %p",thr[i-1]);
           thr[i-1]->join();
         }
+        stats_thread.join();
 
         PLOG("All read threads joined.");
 
@@ -34,59 +34,47 @@
 #include <boost/atomic.hpp>
 
 /** 
- * WARNING: this class has issues with wrapping around the count
+ * Per-command notification.  Pass notify_callback and a pointer to the
+ * object as the completion callback/cookie when issuing a command; the
+ * command's tag routes exactly one completion here.
  * 
  */
 class Notify_object
 {
 private:
   Semaphore _sem;
-  boost::atomic<unsigned long> _next_when;
-  //  boost::atomic<unsigned> _count;
+  boost::atomic<bool> _done;
+  uint16_t _status;
 
-  //  Exokernel::Atomic _next_when;
-  //  Exokernel::Atomic _count;
-
-  void notify(unsigned long command_id) {
-
-    if(command_id >= _next_when) {
-      _sem.post();
-    }
-
-    // PLOG("notified of command id=%u", command_id);
-    // atomic_t p = _count.increment_and_fetch();
-    // if(_count. >= _next_when.read()) {
-    //   PLOG("!!!!!posting!!!!");
-    //   _sem.post();
-    // }
-    // else {
-    //   PLOG("p=%lu",p);
-    // }
+  void notify(unsigned command_id) {
+    PLOG("notified of command id=%u", command_id);
+    _done.store(true, boost::memory_order_release);
+    _sem.post();
   }
 
-
 public:
-  Notify_object() : _next_when(0) {
+  Notify_object() : _done(false), _status(0) {
   }
 
+  /** 
+   * Completion status of the command (valid once done); pass
+   * status_ptr() when issuing to have it filled in
+   * 
+   */
+  uint16_t status() const { return _status; }
+  uint16_t * status_ptr() { return &_status; }
 
-  void set_when(atomic_t when) {
-
-    //if(when > _next_when.load()) {
-      _next_when.store(when);
-    //}
-
-    // TRACE();
-    // if(_count.read() >= when) { /* could have got there already! */
-    //   PLOG("We are there already!!!!!!!!!!!!!!!!!!!!");
-    //   _sem.post();
-    //   return;
-    // }
-    // while(!_next_when.cas_bool(_next_when,when));
+  /** 
+   * Check for completion without blocking; used by inline
+   * (run-to-completion) queues that must reap while they wait.
+   * 
+   */
+  bool done() const { 
+    return _done.load(boost::memory_order_acquire);
   }
 
   /** 
-   * Wait for counting event to occur
+   * Wait for the command to complete
    * 
    */
   void wait() {
@@ -107,6 +95,8 @@ class Notify {
     virtual void action() = 0;
     virtual void wait() = 0;
     virtual bool free_notify_obj() = 0;
+    /* called before action() with the first error status of the batch */
+    virtual void error(uint16_t status) {}
     virtual ~Notify() {};
 };
 
@@ -116,17 +116,14 @@ size_t RingBuffer<Element, Size>::increment(size_t idx) const
 
 /* data structure to record batch info */
 typedef struct {
-  uint16_t  start_cmdid;
-  uint16_t  end_cmdid;
   uint16_t  total;
   uint16_t  counter;
+  uint16_t  status;   /* first error status in the batch, 0 if none */
   Notify*   notify;
   bool      ready;
   bool      complete;
 
   void dump() {
-    printf("start_cmd = %u", start_cmdid);
-    printf("end_cmd   = %u", end_cmdid);
     printf("total     = %u", total);
     printf("counter   = %u", counter);
     printf("ready     = %u", ready);
@@ -139,99 +136,52 @@ typedef struct {
 
 typedef RingBuffer<batch_info_t, BATCH_INFO_BUFFER_SIZE> batch_info_buffer_t;
 
-//each batch contains cmds with contiguous cmd ids
-//cmd id wrap-around is not allowed in a single batch
+//each batch is a group of commands whose tags (see nvme_tag_table.h)
+//refer back to the batch entry; completions update the entry in O(1)
 class NVME_batch_manager {
 
   private:
     batch_info_buffer_t _buffer;
     batch_info_t* _array;
-    //keep tracking the cmdid before the first batch's start cmdid
-    //only consumer (CQ) updates this value after initialization
-    //cmd id before this value (in terms of circle) is available.
-    boost::atomic<uint16_t> _last_available_cmdid;
 
   public:
-    NVME_batch_manager() : _last_available_cmdid(0x0) {
+    NVME_batch_manager() {
       _array = _buffer.get_array();
     }
 
     ~NVME_batch_manager() {}
 
-    bool push(const batch_info_t& item) {return _buffer.push(item);}
-
-    bool pop(batch_info_t& item) {return _buffer.pop(item);}
-
-    //done by consumer
-    status_t update(uint16_t cmdid) {
-      unsigned long long attempts = 0;
-      bool ret;
-      while((ret = _update_single_iteration(cmdid)) != true) {
-        attempts++;
-        if(attempts > 1000ULL) {
-          PERR("!!!! The command id is not within the range of any batch !!");
-          assert(false);
-        }
-      }
-      return Exokernel::S_OK;
-    }
-
-#if 0
-    //done by producer
-    void add_to_last_batch(uint16_t cmdid) {
-      //get_last_entry() checks if the queue is empty
-      size_t last_entry = _buffer.get_last_entry();
-
-      assert(_array[last_entry].ready == false);
-
-      _array[last_entry].end_cmdid = cmdid;
-      _array[last_entry].total++;
-
-      assert(
-          (_array[last_entry].end_cmdid - _array[last_entry].start_cmdid + 1 == _array[last_entry].total) || 
-          (_array[last_entry].end_cmdid + BATCH_INFO_BUFFER_SIZE - _array[last_entry].start_cmdid == _array[last_entry].total) // 0 is not used for cmd id
-          );
-    }
-
-    //done by producer
-    void finish_batch() {
-      //Under a memory model where stores can be reordered, a memory barrier/fence is needed here
-      size_t last_entry = _buffer.get_last_entry();
-      assert(_array[last_entry].ready == false);
-      _array[last_entry].ready = true;
-    }
-#endif
-
     /**
-     * check if the cmd id has been released by the head batch
-     * assuming this can only be called by producer, which alloc cmd ids by incrementing counters
+     * push a new batch; done by producer
+     * @param item Batch info
+     * @param idx [out] Index of the entry for use with update()
      */
-    bool is_available(uint16_t cmdid) {
-      uint16_t val = _last_available_cmdid.load(boost::memory_order_relaxed);
-      return (cmdid != val);
+    bool push(const batch_info_t& item, unsigned * idx) {
+      size_t tail = _buffer.get_tail();
+      if(!_buffer.push(item)) return false;
+      *idx = tail;
+      return true;
     }
 
-    /**
-     * check if the range of cmd id has been released by the head batch
-     * assuming this can only be called by producer, which alloc cmd ids by incrementing counters
-     **/
-    bool is_available(uint16_t cmdid_start, uint16_t cmdid_end) {
-      assert(cmdid_start <= cmdid_end);
-      uint16_t val = _last_available_cmdid.load(boost::memory_order_relaxed);
-      //PLOG("last_available = %u, start_cmdid = %u, end_cmdid = %u", val, cmdid_start, cmdid_end);
-      return (  (cmdid_start < val && cmdid_end < val)
-             || (cmdid_start > val && cmdid_end > val)
-             );
-    }
+    bool pop(batch_info_t& item) {return _buffer.pop(item);}
 
     /**
-     * check if we can safely reset the cmd id counter to 0
-     * the cmd id counter can be reset only when the values after(greater than) the current counter are not being used
-     * Only called by producer
+     * account one completed command to a batch; done by consumer
+     * @param idx Index of the batch entry returned by push()
+     * @param status Completion status of the command
      */
-    bool can_reset_cmdid(uint16_t cmdid_counter) {
-      uint16_t val = _last_available_cmdid.load(boost::memory_order_relaxed);
-      return (val <= cmdid_counter);
+    status_t update(unsigned idx, uint16_t status) {
+      assert(idx < BATCH_INFO_BUFFER_SIZE);
+      size_t head = _buffer.get_head();
+      size_t tail = _buffer.get_tail();
+
+      if(head > tail) tail += BATCH_INFO_BUFFER_SIZE;
+
+      if(status != 0 && _array[idx].status == 0)
+        _array[idx].status = status;
+
+      _process_update_batch_info(idx, head, tail);
+      return Exokernel::S_OK;
     }
 
     bool wasEmpty() const { return _buffer.wasEmpty(); }
@@ -246,31 +196,6 @@ class NVME_batch_manager {
       return (_array[idx].ready && _array[idx].counter == _array[idx].total);
     }
 
-    bool _update_single_iteration(uint16_t cmdid) {
-      size_t head = _buffer.get_head();
-      size_t tail = _buffer.get_tail(); //may get a stale value, this is fine
-
-      if(head > tail) tail += BATCH_INFO_BUFFER_SIZE;
-
-      //FIXME: not true for flush command, as flush command is not recorded in the batch manager
-      //assert(head != tail); //Should not be empty
-
-      //TODO: maybe need a better search algo, e.g., binary search
-      for(size_t idx = head; idx < tail; idx++){
-        size_t idx2 = idx % BATCH_INFO_BUFFER_SIZE;
-
-        assert(_array[idx2].start_cmdid <= _array[idx2].end_cmdid);
-        if(cmdid >= _array[idx2].start_cmdid && cmdid <= _array[idx2].end_cmdid){
-          _process_update_batch_info(idx2, head, tail);
-          return true; //updated sucessfully
-        }
-      }
-      //we may reach here?? because the tail we got can be a stale value
-      PLOG("Did NOT find the right range!!");
-      return true; //FIXME: flush command is not recorded in the batch manager
-    }
-
-
     void _process_update_batch_info(size_t idx, size_t head, size_t tail) {
 
       _array[idx].counter++;
@@ -278,7 +203,10 @@ class NVME_batch_manager {
 
       if(_is_complete(idx)) {
         assert(_array[idx].complete == false);
-        if(_array[idx].notify) _array[idx].notify->action();
+        if(_array[idx].notify) {
+          if(_array[idx].status) _array[idx].notify->error(_array[idx].status);
+          _array[idx].notify->action();
+        }
         _array[idx].complete = true;
 
         //if idx is the head, then pop all finished batch info
@@ -291,7 +219,6 @@ class NVME_batch_manager {
 
             if(_is_complete(idx2)) {
               _buffer.pop(bi);
-              _last_available_cmdid.store(bi.end_cmdid, boost::memory_order_relaxed);
               // release notify object
               if(bi.notify && bi.notify->free_notify_obj()) {
                 PLOG("Free the notify object at entry %lu", idx2);
@@ -311,5 +238,3 @@ class NVME_batch_manager {
 
 
 #endif
-
-
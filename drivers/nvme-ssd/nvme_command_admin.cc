@@ -107,26 +107,35 @@ status_t Command_admin_identify::check_ns_result(NVME_device * dev, unsigned nsi
   _queues->check_command_completion(_cid);
 
   nvme_id_ns * id = (nvme_id_ns *) _prp1;
-  NVME_INFO("[NID(%u):NSIZE] max %lu sectors (%lu GB)\n",nsid,id->nsze,REDUCE_GB(id->nsze*4096)); // TODO: fix hard wiring
-  NVME_INFO("[NID(%u):NCAP] max %lu sectors\n",nsid,id->ncap);
-  NVME_INFO("[NID(%u):NUSE] used %lu sectors (%lu GB)\n",nsid,id->nuse,REDUCE_GB(id->nuse*4096));
 
   /* store NS information */  
   NVME_device::ns_info * info = new NVME_device::ns_info();
+  info->_nsid = nsid;
   info->_nsze = id->nsze;
   info->_ncap = id->ncap;
 
-  uint8_t nlbaf = id->nlbaf;
+  /* formatted LBA size and metadata size from the selected LBA format */
+  unsigned lbaf = id->flbas & 0xf;
+  assert(lbaf <= id->nlbaf);
+  info->_lba_shift = id->lbaf[lbaf].ds ? id->lbaf[lbaf].ds : 9;
+  info->_flbasize = 1U << info->_lba_shift;
+  info->_ms = id->lbaf[lbaf].ms;
+
+  NVME_INFO("[NID(%u):NSIZE] max %lu sectors (%lu GB)\n",nsid,id->nsze,REDUCE_GB(id->nsze << info->_lba_shift));
+  NVME_INFO("[NID(%u):NCAP] max %lu sectors\n",nsid,id->ncap);
+  NVME_INFO("[NID(%u):NUSE] used %lu sectors (%lu GB)\n",nsid,id->nuse,REDUCE_GB(id->nuse << info->_lba_shift));
   NVME_INFO("nlbaf = %u\n",id->nlbaf);
-  NVME_INFO("flbas = %u\n",id->flbas);
+  NVME_INFO("flbas = %u (LBA size %u, metadata %u)\n",id->flbas,info->_flbasize,info->_ms);
 
-  for(unsigned i=0;i<id->nlbaf;i++) {
+  for(unsigned i=0;i<=id->nlbaf;i++) {
     NVME_INFO("LBAF ms=%u ds=%u rp=%u\n",
          id->lbaf[i].ms,         
          id->lbaf[i].ds,
          id->lbaf[i].rp);
   }
 
+  /* namespaces are identified in order, so the vector is indexed by nsid - 1 */
+  assert(dev->_ns_ident.size() == nsid - 1);
   dev->_ns_ident.push_back(info);
   
   return Exokernel::S_OK;
@@ -167,6 +176,12 @@ status_t Command_admin_identify::check_controller_result(NVME_device * dev)
     NVME_INFO("Supports security send/recv :       %s\n", (oacs & 0x1) ? "yes":"no"); 
   }
   NVME_INFO("Supports fused operations :         %s\n", (id->fuses & 0x1) ? "yes":"no"); 
+  NVME_INFO("Supports compare :                  %s\n", (id->oncs & NVME_CTRL_ONCS_COMPARE) ? "yes":"no"); 
+  NVME_INFO("Supports dataset management :       %s\n", (id->oncs & NVME_CTRL_ONCS_DSM) ? "yes":"no"); 
+  NVME_INFO("Supports write zeroes :             %s\n", (id->oncs & NVME_CTRL_ONCS_WRITE_ZEROES) ? "yes":"no"); 
+  NVME_INFO("Supports SGLs :                     %s\n", 
+            (id->sgls & 0x3) == NVME_CTRL_SGLS_NONE ? "no" :
+            (id->sgls & 0x3) == NVME_CTRL_SGLS_DWORD_ALIGNED ? "yes (dword aligned)" : "yes"); 
 
   /* store device information */
   dev->_ident._vid = id->vid;
@@ -174,6 +189,9 @@ status_t Command_admin_identify::check_controller_result(NVME_device * dev)
   memcpy(dev->_ident._firmware_rev, id->fr,8);
   dev->_ident._oacs = id->oacs;
   dev->_ident._nn = id->nn;
+  dev->_ident._mdts = id->mdts;
+  dev->_ident._sgls = id->sgls;
+  dev->_ident._oncs = id->oncs;
   
   return Exokernel::S_OK;
 }
@@ -277,6 +295,24 @@ status_t Command_admin_set_features::configure_interrupt_coalescing_time(unsigne
 }
 
 
+status_t Command_admin_set_features::configure_arbitration(unsigned burst, 
+                                                           unsigned high_weight, 
+                                                           unsigned medium_weight, 
+                                                           unsigned low_weight)
+{
+  assert(_sc);
+  struct nvme_features * f = (struct nvme_features *) _sc->raw();
+  f->fid = NVME_FEAT_ARBITRATION;
+  /* weights are 0's based */
+  f->dword11 = (((uint32_t)burst) & 0x7) |
+    (((uint32_t)(low_weight - 1) & 0xff) << 8) |
+    (((uint32_t)(medium_weight - 1) & 0xff) << 16) |
+    (((uint32_t)(high_weight - 1) & 0xff) << 24);
+
+  return Exokernel::S_OK;
+}
+
+
 /** 
  * CREATE IO QUEUE -------------------------------------------------------------
  * 
@@ -287,7 +323,7 @@ Command_admin_create_io_sq::Command_admin_create_io_sq(NVME_admin_queue * q,
                                                        size_t queue_size,
                                                        addr_t prp1,
                                                        unsigned cq_id,
-                                                       queue_priority_t priority)
+                                                       NVME::sq_priority_t priority)
   : Command_admin_base(q)
 {
   signed slot_id;
@@ -317,7 +353,8 @@ Command_admin_create_io_cq::Command_admin_create_io_cq(NVME_admin_queue * q,
                                                        vector_t vector,
                                                        unsigned queue_id,
                                                        size_t queue_items,
-                                                       addr_t prp1)
+                                                       addr_t prp1,
+                                                       bool irq_enabled)
   : Command_admin_base(q)
 {
   signed slot_id;
@@ -335,7 +372,7 @@ Command_admin_create_io_cq::Command_admin_create_io_cq(NVME_admin_queue * q,
   c->qsize = queue_items - 1;
   c->cqid = queue_id;
   c->irq_vector = vector; /* vector is logical */
-  c->cq_flags = 0x3;      /* IEN and PC are set */
+  c->cq_flags = irq_enabled ? 0x3 : 0x1; /* PC always set; IEN only when interrupt driven */
 
   PLOG("CREATE CQ size=%u qid=%u logical vector=%u",c->qsize, c->cqid, c->irq_vector);
   
@@ -390,3 +427,32 @@ Command_admin_format::Command_admin_format(NVME_admin_queue * q,
   /* assign unique command identifier */
   sc->command_id = _cid = slot_id;
 }
+
+
+/** 
+ * DOORBELL BUFFER CONFIG  ---------------------------------------------
+ * 
+ */
+Command_admin_doorbell_buffer_config::Command_admin_doorbell_buffer_config(NVME_admin_queue * q, 
+                                                                           addr_t dbbuf_phys,
+                                                                           addr_t eventidx_phys)
+  : Command_admin_base(q)
+{
+  assert((dbbuf_phys & 0xfffUL) == 0UL);
+  assert((eventidx_phys & 0xfffUL) == 0UL);
+
+  signed slot_id;
+  Submission_command_slot * sc = _queues->next_sub_slot(&slot_id);
+  assert(sc);
+  sc->clear();
+
+  struct nvme_sub_command_common * c = (struct nvme_sub_command_common *) sc->raw();  
+  assert(c);
+
+  c->opcode = nvme_admin_dbbuf;
+  c->prp1 = dbbuf_phys;
+  c->prp2 = eventidx_phys;
+
+  /* assign unique command identifier */
+  sc->command_id = _cid = slot_id;
+}
@@ -168,6 +168,23 @@ public:
   status_t configure_num_queues(uint32_t num_queues);
   status_t configure_interrupt_coalescing(bool turn_on, vector_t vector);
   status_t configure_interrupt_coalescing_time(unsigned aggregation_time, unsigned threshold);
+
+  /** 
+   * Arbitration feature: burst and weighted round robin weights. The
+   * values are not checked here; NVME_admin_queue::set_arbitration
+   * validates them before a command slot is taken.
+   * 
+   * @param burst log2 of commands fetched from a queue per arbitration (7 = no limit)
+   * @param high_weight Commands per round for high priority queues (1-256)
+   * @param medium_weight Commands per round for medium priority queues (1-256)
+   * @param low_weight Commands per round for low priority queues (1-256)
+   * 
+   * @return S_OK on success
+   */
+  status_t configure_arbitration(unsigned burst, 
+                                 unsigned high_weight, 
+                                 unsigned medium_weight, 
+                                 unsigned low_weight);
 };
 
 
@@ -186,22 +203,13 @@ public:
  */
 class Command_admin_create_io_sq : public Command_admin_base
 {
-public:
-  /* weighted RR priorities */
-  typedef enum { 
-    PRIO_URGENT=0x0,
-    PRIO_HIGH=0x1,
-    PRIO_MED=0x2,
-    PRIO_LOW=0x3,
-  } queue_priority_t;
-
 public:
   Command_admin_create_io_sq(NVME_admin_queue * q, 
                              unsigned queue_id,
                              size_t queue_size,
                              addr_t prp1,
                              unsigned cq_id,
-                             queue_priority_t priority=PRIO_HIGH);
+                             NVME::sq_priority_t priority=NVME::SQ_PRIO_HIGH);
 
 };
 
@@ -214,6 +222,7 @@ public:
  * @param queue_id Queue identifier to use for new queue
  * @param queue_size Size of queue in items
  * @param prp1 Physical memory for queue
+ * @param irq_enabled Enable interrupts (IEN) for the queue
  * 
  */
 class Command_admin_create_io_cq : public Command_admin_base
@@ -223,7 +232,8 @@ public:
                              vector_t vector,
                              unsigned queue_id,
                              size_t queue_size,
-                             addr_t prp1);
+                             addr_t prp1,
+                             bool irq_enabled=true);
 
 };
 
@@ -259,4 +269,20 @@ public:
                        unsigned lbaf,
                        unsigned nsid);
 };
+
+/** 
+ * DOORBELL BUFFER CONFIG command
+ * 
+ * @param q Pointer to admin queues
+ * @param dbbuf_phys Page for shadow doorbells
+ * @param eventidx_phys Page for EventIdx values
+ * 
+ */
+class Command_admin_doorbell_buffer_config : public Command_admin_base
+{
+public:
+  Command_admin_doorbell_buffer_config(NVME_admin_queue * q,
+                                       addr_t dbbuf_phys,
+                                       addr_t eventidx_phys);
+};
 #endif // __NVME_COMMAND_ADMIN_H__
@@ -67,6 +67,11 @@ public:
 };
 
 
+/** 
+ * Read, write or compare command
+ * 
+ * @param opcode nvme_cmd_read, nvme_cmd_write or nvme_cmd_compare
+ */
 class Command_io_rw
 {
 protected:
@@ -77,15 +82,15 @@ public:
   Command_io_rw(Submission_command_slot * sc,
                 unsigned command_id,
                 unsigned nsid,
-                addr_t prp1, 
+                const NVME::data_ptr_t& dptr,
                 off_t offset, 
                 size_t num_blocks,
                 bool sequential, 
                 unsigned access_freq, 
                 unsigned access_lat,
-                bool iswrite) {
+                uint8_t opcode) {
 
-    assert(nsid==1); // 1 namespace for moment
+    assert(nsid > 0);
 
     unsigned slot_id;
     // assert(sc);
@@ -99,19 +104,23 @@ public:
 
     struct nvme_rw_command * c = (struct nvme_rw_command *) sc->raw();
     
-    c->opcode = iswrite ? nvme_cmd_write : nvme_cmd_read;
+    assert(opcode == nvme_cmd_read || opcode == nvme_cmd_write || opcode == nvme_cmd_compare);
+    c->opcode = opcode;
     c->nsid = nsid;
     c->command_id = _cid = command_id; //ioq->next_command_id();
-    c->prp1 = prp1;
+    c->flags = dptr.psdt;
+    c->prp1 = dptr.dptr1;
+    c->prp2 = dptr.dptr2;
     c->slba = offset;
 
     c->length = num_blocks - 1;
 
     __builtin_memcpy(&c->dsmgmt,&dsm,1);
 
-    PLOG("!!! issuing (%s) command prp1=0x%lx nsid=%d slba=%ld nblocks=%u cmdid=%u control=0x%x dsmgmt=0x%x!!!",
-           iswrite ? "write" : "read",
+    PLOG("!!! issuing (%s) command prp1=0x%lx prp2=0x%lx nsid=%d slba=%ld nblocks=%u cmdid=%u control=0x%x dsmgmt=0x%x!!!",
+           opcode == nvme_cmd_write ? "write" : opcode == nvme_cmd_read ? "read" : "compare",
            c->prp1,
+           c->prp2,
            c->nsid,
            c->slba,
            c->length,
@@ -124,4 +133,77 @@ public:
 };
 
 
+/** 
+ * Write Zeroes command
+ * 
+ * @param deallocate Ask the controller to deallocate the blocks as well
+ */
+class Command_io_write_zeroes
+{
+protected:
+  unsigned _cid;
+
+public:
+  Command_io_write_zeroes(Submission_command_slot * sc,
+                          unsigned command_id,
+                          unsigned nsid,
+                          off_t offset,
+                          size_t num_blocks,
+                          bool deallocate) {
+    assert(sc);
+    assert(nsid > 0);
+    assert(num_blocks > 0 && num_blocks <= 0x10000);
+
+    struct nvme_rw_command * c = (struct nvme_rw_command *) sc->raw();
+
+    c->opcode = nvme_cmd_write_zeroes;
+    c->nsid = nsid;
+    c->command_id = _cid = command_id;
+    c->slba = offset;
+    c->length = num_blocks - 1;
+    c->control = deallocate ? NVME_WZ_DEAC : 0;
+
+    PLOG("!!! issuing write zeroes command nsid=%d slba=%ld nblocks=%u cmdid=%u dealloc=%d",
+         c->nsid, c->slba, c->length, c->command_id, deallocate);
+  }
+};
+
+
+/** 
+ * Dataset Management command deallocating (trimming) a list of ranges
+ * 
+ * @param ranges_phys Physical address of the nvme_dsm_range list (one page)
+ * @param num_ranges Number of ranges (1-256)
+ */
+class Command_io_dsm
+{
+protected:
+  unsigned _cid;
+
+public:
+  Command_io_dsm(Submission_command_slot * sc,
+                 unsigned command_id,
+                 unsigned nsid,
+                 addr_t ranges_phys,
+                 unsigned num_ranges) {
+    assert(sc);
+    assert(nsid > 0);
+    assert(ranges_phys);
+    assert(num_ranges > 0 && num_ranges <= 256);
+
+    struct nvme_dsm_cmd * c = (struct nvme_dsm_cmd *) sc->raw();
+
+    c->opcode = nvme_cmd_dsm;
+    c->nsid = nsid;
+    c->command_id = _cid = command_id;
+    c->prp1 = ranges_phys; /* page aligned, so the list never needs PRP2 */
+    c->nr = num_ranges - 1;
+    c->attributes = NVME_DSMGMT_AD;
+
+    PLOG("!!! issuing DSM deallocate command nsid=%d ranges=%u cmdid=%u",
+         c->nsid, num_ranges, c->command_id);
+  }
+};
+
+
 #endif // __NVME_COMMAND_IO_H__
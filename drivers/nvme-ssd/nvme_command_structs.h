@@ -109,15 +109,25 @@ struct nvme_id_ctrl {
 	uint8_t		vwc;
 	uint16_t	awun;
 	uint16_t	awupf;
-	uint8_t		rsvd530[1518];
+	uint8_t		nvscc;
+	uint8_t		rsvd531;
+	uint16_t	acwu;
+	uint8_t		rsvd534[2];
+	uint32_t	sgls;
+	uint8_t		rsvd540[1508];
 	struct nvme_id_power_state	psd[32];
 	uint8_t		vs[1024];
 };
 
+enum {
+	NVME_CTRL_OACS_DBBUF_SUPP		= 1 << 8,
+};
+
 enum {
 	NVME_CTRL_ONCS_COMPARE			= 1 << 0,
 	NVME_CTRL_ONCS_WRITE_UNCORRECTABLE	= 1 << 1,
 	NVME_CTRL_ONCS_DSM			= 1 << 2,
+	NVME_CTRL_ONCS_WRITE_ZEROES		= 1 << 3,
 };
 
 
@@ -207,9 +217,15 @@ enum nvme_opcode {
 	nvme_cmd_read		= 0x02,
 	nvme_cmd_write_uncor	= 0x04,
 	nvme_cmd_compare	= 0x05,
+	nvme_cmd_write_zeroes	= 0x08,
 	nvme_cmd_dsm		= 0x09,
 };
 
+/* Write Zeroes: deallocate (DEAC) bit of the control field */
+enum {
+	NVME_WZ_DEAC		= 1 << 9,
+};
+
 
 struct nvme_rw_command {
 	uint8_t			opcode;
@@ -229,6 +245,32 @@ struct nvme_rw_command {
 	uint16_t			appmask;
 };
 
+/* PSDT field of the command flags: data pointer is an SGL */
+enum {
+	NVME_CMD_PSDT_PRP = 0x0,
+	NVME_CMD_PSDT_SGL = 0x1 << 6,
+};
+
+/* SGL support reported in nvme_id_ctrl::sgls bits 1:0 */
+enum {
+	NVME_CTRL_SGLS_NONE = 0x0,
+	NVME_CTRL_SGLS_BYTE_ALIGNED = 0x1,
+	NVME_CTRL_SGLS_DWORD_ALIGNED = 0x2,
+};
+
+enum {
+	NVME_SGL_TYPE_DATA_BLOCK = 0x0,
+	NVME_SGL_TYPE_SEGMENT = 0x2,
+	NVME_SGL_TYPE_LAST_SEGMENT = 0x3,
+};
+
+struct nvme_sgl_desc {
+	uint64_t			addr;
+	uint32_t			length;
+	uint8_t			rsvd[3];
+	uint8_t			type; /* type in bits 7:4, sub type in 3:0 */
+} __attribute__((packed));
+
 struct nvme_io_dsm {
   unsigned access_freq    : 4;
   unsigned access_lat     : 2;
@@ -296,6 +338,7 @@ enum nvme_admin_opcode {
 	nvme_admin_async_event		= 0x0c,
 	nvme_admin_activate_fw		= 0x10,
 	nvme_admin_download_fw		= 0x11,
+	nvme_admin_dbbuf		= 0x7c,
 	nvme_admin_format_nvm		= 0x80,
 	nvme_admin_security_send	= 0x81,
 	nvme_admin_security_recv	= 0x82,
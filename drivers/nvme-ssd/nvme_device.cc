@@ -50,6 +50,70 @@ NVME_device::~NVME_device() {
   /* get rid of admin queues last */
   if(_admin_queues)
     delete _admin_queues;
+
+  /* IO queues are gone, so the controller no longer uses these */
+  if(_dbbuf)
+    free_dma_pages(_dbbuf);
+  if(_dbbuf_eventidx)
+    free_dma_pages(_dbbuf_eventidx);
+}
+
+
+status_t NVME_device::get_stats(unsigned queue_id, io_stats_t * stats)
+{
+  static const unsigned long tsc_mhz = get_tsc_frequency_in_mhz();
+
+  if(stats == NULL)
+    return Exokernel::E_INVAL;
+
+  if(queue_id != IO_STATS_ALL_PORTS) {
+    if((queue_id > _num_io_queues)||(queue_id == 0))
+      return Exokernel::E_INVAL;
+    assert(_io_queues[queue_id - 1]);
+    _io_queues[queue_id - 1]->stats().summarize(stats, tsc_mhz);
+    return Exokernel::S_OK;
+  }
+
+  /* percentiles do not add up, so merge the histograms first */
+  NVME_queue_stats * total = new NVME_queue_stats();
+  for(unsigned q=0; q<_num_io_queues; q++) {
+    assert(_io_queues[q]);
+    total->merge(_io_queues[q]->stats());
+  }
+  total->summarize(stats, tsc_mhz);
+  delete total;
+
+  return Exokernel::S_OK;
+}
+
+
+void NVME_device::setup_doorbell_buffer()
+{
+  if(!_config.get_shadow_doorbells())
+    return;
+
+  if(!(_ident._oacs & NVME_CTRL_OACS_DBBUF_SUPP)) {
+    NVME_INFO("Doorbell buffer config not supported by controller\n");
+    return;
+  }
+
+  _dbbuf = alloc_dma_pages(1, &_dbbuf_phys);
+  _dbbuf_eventidx = alloc_dma_pages(1, &_dbbuf_eventidx_phys);
+  assert(_dbbuf);
+  assert(_dbbuf_eventidx);
+  memset(_dbbuf, 0, PAGE_SIZE);
+  memset(_dbbuf_eventidx, 0, PAGE_SIZE);
+
+  if(_admin_queues->issue_doorbell_buffer_config(_dbbuf_phys, _dbbuf_eventidx_phys) != Exokernel::S_OK) {
+    free_dma_pages(_dbbuf);
+    free_dma_pages(_dbbuf_eventidx);
+    _dbbuf = NULL;
+    _dbbuf_eventidx = NULL;
+    return;
+  }
+
+  NVME_INFO("Shadow doorbells enabled (dbbuf=0x%lx eventidx=0x%lx)\n",
+            _dbbuf_phys, _dbbuf_eventidx_phys);
 }
 
 
@@ -83,8 +147,21 @@ void NVME_device::hw_reset() {
   _admin_queues->setup_doorbells();
   NVME_INFO("doorbells setup.\n");
 
-  /* configure CC */
-  _regs->cc(0x460001);
+  /* configure CC (IOCQES=16 bytes, IOSQES=64 bytes) and arbitration */
+  uint32_t cc = 0x460001;
+
+  _wrr = false;
+  if(_config.get_arb_wrr()) {
+    if(NVME_CAP_AMS(_regs->cap()) & NVME_CAP_AMS_WRR) {
+      cc |= (NVME_CC_AMS_WRR << NVME_CC_AMS_SHIFT);
+      _wrr = true;
+      NVME_INFO("arbitration: weighted round robin with urgent priority class\n");
+    }
+    else {
+      NVME_INFO("arbitration: weighted round robin not supported, using round robin\n");
+    }
+  }
+  _regs->cc(cc);
   
   /* re-enabled device */
   _regs->cc_enable();
@@ -175,6 +252,21 @@ void NVME_device::nvme_init_device() {
   /* collect device information */
   _admin_queues->issue_identify_device();
 
+  /* shadow doorbells must be configured before IO queues are created */
+  setup_doorbell_buffer();
+
+  /* weights for the high/medium/low classes */
+  if(_wrr) {
+    status_t s = _admin_queues->set_arbitration(_config.get_arb_burst(),
+                                                _config.get_high_weight(),
+                                                _config.get_medium_weight(),
+                                                _config.get_low_weight());
+    if(s == Exokernel::S_OK)
+      NVME_INFO("arbitration: burst=%u weights high=%u medium=%u low=%u\n",
+                1U << _config.get_arb_burst(), _config.get_high_weight(),
+                _config.get_medium_weight(), _config.get_low_weight());
+  }
+
 #ifdef CONFIG_FORMAT_ON_INIT
   /* format disk */
   _admin_queues->issue_format(2);
@@ -212,7 +304,8 @@ void NVME_device::nvme_init_device() {
     core_id_t core;
     unsigned qid = _config.io_queue_get_assigned_core(i,&core);
 
-    NVME_INFO("Assigning completion queue id (%u) to core (%u)\n",qid,core);
+    NVME_INFO("Assigning completion queue id (%u) to core (%u) (mode=%s)\n",qid,core,
+              CQ_thread::mode_name(_config.get_cq_mode(i)));
 
     NVME_IO_queue * ioq = 
       new NVME_IO_queue(this,
@@ -220,9 +313,13 @@ void NVME_device::nvme_init_device() {
                         _msi_vectors[0],   /* base vector as logical is needed */
                         _msi_vectors[i+1], /* vector for this queue */
                         core,              /* affinity for cq thread */
-                        io_queue_len);     /* length of queue in items */
+                        io_queue_len,      /* length of queue in items */
+                        _config.get_cq_mode(i),
+                        _config.get_cq_spin_us(i),
+                        _config.get_sub_priority_from_qid(qid));
 
     ioq->setup_doorbells();
+    ioq->set_doorbell_coalescing(_config.get_db_batch(), _config.get_db_window_us());
     ioq->start_cq_thread();
 
     assert(ioq);
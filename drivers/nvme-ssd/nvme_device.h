@@ -63,6 +63,20 @@ private:
   unsigned                   _num_io_queues;
 
   Config                     _config;
+
+  void *                     _dbbuf;          /* shadow doorbells (NULL if not in use) */
+  addr_t                     _dbbuf_phys;
+  void *                     _dbbuf_eventidx; /* EventIdx values */
+  addr_t                     _dbbuf_eventidx_phys;
+
+  bool                       _wrr;            /* weighted round robin arbitration selected */
+
+  /** 
+   * Set up shadow doorbells if the controller supports Doorbell
+   * Buffer Config and the configuration allows it
+   * 
+   */
+  void setup_doorbell_buffer();
   
 public:
   struct {
@@ -71,15 +85,21 @@ public:
     byte     _firmware_rev[8]; // firmware revision
     uint16_t _oacs;            // optional admin command support
     uint32_t _nn;              // number of namespaces
+    uint8_t  _mdts;            // max data transfer size (2^n min pages, 0=unlimited)
+    uint32_t _sgls;            // SGL support
+    uint16_t _oncs;            // optional NVM command support
   } _ident;
 
   struct ns_info {
+    unsigned _nsid;     // namespace identifier
     uint64_t _nsze;     // total size of the namespace in logical blocks
     uint64_t _ncap;     // maximum number of blocks that can be allocated at one time
     uint32_t _flbasize; // formatted LBA size
+    unsigned _lba_shift;// log2 of formatted LBA size
+    uint16_t _ms;       // metadata bytes per LBA
   };
 
-  std::vector<ns_info *> _ns_ident;
+  std::vector<ns_info *> _ns_ident; // indexed by nsid - 1
   
 public:
 
@@ -92,7 +112,12 @@ public:
       _mmio(NULL), 
       _regs(NULL),
       _admin_queues(NULL),
-      _config(config_filename)
+      _config(config_filename),
+      _dbbuf(NULL),
+      _dbbuf_phys(0),
+      _dbbuf_eventidx(NULL),
+      _dbbuf_eventidx_phys(0),
+      _wrr(false)
   { 
     nvme_init_device();
   }
@@ -133,20 +158,41 @@ public:
 
   NVME_admin_queue * admin_queues() const { return _admin_queues; }
 
-#if 0  
-  unsigned register_callback(unsigned queue_id,
-                             notify_callback_t callback,
-                             void * callback_param) {
+  /** 
+   * Shadow doorbell and EventIdx pages, or NULL if shadow doorbells
+   * are not in use
+   * 
+   */
+  INLINE void * dbbuf_shadow() const { return _dbbuf; }
+  INLINE void * dbbuf_eventidx() const { return _dbbuf_eventidx; }
 
-    if((queue_id > _num_io_queues)||(queue_id == 0)) {
-      assert(0);
-      return Exokernel::E_INVAL;
-    }
-    assert(_io_queues[queue_id - 1]);
-    return _io_queues[queue_id - 1]->register_callback(callback,
-                                                       callback_param);
+  /** 
+   * True if the controller arbitrates with weighted round robin (SQ
+   * priorities apply)
+   * 
+   */
+  INLINE bool wrr_arbitration() const { return _wrr; }
+
+  /** 
+   * Look up identify namespace data
+   * 
+   * @param nsid Namespace identifier counting from 1
+   * 
+   * @return Namespace information, or NULL if the namespace is not active
+   */
+  INLINE const ns_info * ns(unsigned nsid) const {
+    if(nsid == 0 || nsid > _ns_ident.size())
+      return NULL;
+    const ns_info * info = _ns_ident[nsid - 1];
+    return (info->_nsze > 0) ? info : NULL;
   }
-#endif
+
+  /** 
+   * Number of namespaces reported by the controller (active or not)
+   * 
+   */
+  INLINE unsigned num_namespaces() const { return _ns_ident.size(); }
+
 
   /** 
    * Main entry to perform asynchronous read
@@ -159,8 +205,10 @@ public:
    * @param access_freq Hint - this is a high freqency data item
    * @param access_lat Hint - latency requirements
    * @param nsid - Namespace identifier
+   * @param callback - Per-command completion callback
+   * @param callback_param - Cookie for callback
    * 
-   * @return S_OK on success
+   * @return Command identifier
    */
   status_t block_async_read(unsigned queue_id,
                             addr_t prp1,
@@ -169,7 +217,9 @@ public:
                             bool sequential=false, 
                             unsigned access_freq=0, 
                             unsigned access_lat=0,
-                            unsigned nsid=1) 
+                            unsigned nsid=1,
+                            notify_callback_t callback=NULL,
+                            void * callback_param=NULL) 
   {
     if((queue_id > _num_io_queues)||(queue_id == 0)) {
       assert(0);
@@ -182,7 +232,9 @@ public:
                                                       sequential,
                                                       access_freq,
                                                       access_lat,
-                                                      nsid);
+                                                      nsid,
+                                                      callback,
+                                                      callback_param);
   }
 
 
@@ -199,8 +251,10 @@ public:
    * @param access_freq Hint - this is a high freqency data item
    * @param access_lat Hint - latency requirements
    * @param nsid - Namespace identifier
+   * @param callback - Per-command completion callback
+   * @param callback_param - Cookie for callback
    * 
-   * @return 
+   * @return Command identifier
    */
   status_t block_async_write(unsigned queue_id,
                              addr_t prp1,
@@ -209,7 +263,9 @@ public:
                              bool sequential=false, 
                              unsigned access_freq=0, 
                              unsigned access_lat=0,
-                             unsigned nsid=1) 
+                             unsigned nsid=1,
+                             notify_callback_t callback=NULL,
+                             void * callback_param=NULL) 
   {
     if((queue_id > _num_io_queues)||(queue_id == 0)) {
       assert(0);
@@ -222,12 +278,26 @@ public:
                                                        sequential,
                                                        access_freq,
                                                        access_lat,
-                                                       nsid);
+                                                       nsid,
+                                                       callback,
+                                                       callback_param);
   }
 
+  /** 
+   * Issue a batch of IO requests; completion is observed with
+   * wait_io_completion
+   * 
+   * @param queue_id Queue identifier counting from 1
+   * @param io_desc Array of IO requests
+   * @param length Number of requests
+   * @param nsid Namespace identifier
+   * 
+   * @return S_OK on success, E_INVAL if a request is invalid (nothing is issued)
+   */
   status_t async_io_batch(unsigned queue_id,
                           io_request_t* io_desc,
-                          uint64_t length
+                          uint64_t length,
+                          unsigned nsid=1
                           )
   {
     if((queue_id > _num_io_queues)||(queue_id == 0)) {
@@ -236,7 +306,127 @@ public:
       return Exokernel::E_INVAL;
     }
     assert(_io_queues[queue_id - 1]);
-    return _io_queues[queue_id - 1]->issue_async_io_batch(io_desc, length);
+    if(_io_queues[queue_id - 1]->issue_async_io_batch(io_desc, length, nsid) == 0)
+      return Exokernel::E_INVAL;
+
+    return Exokernel::S_OK;
+  }
+
+  /** 
+   * Issue a batch of multi-segment (scatter-gather) requests
+   * 
+   * @param queue_id Queue identifier counting from 1
+   * @param io_desc Array of multi-segment IO requests
+   * @param length Number of requests
+   * @param nsid Namespace identifier
+   * 
+   * @return S_OK on success, E_INVAL if a request cannot be described
+   */
+  status_t async_io_sg_batch(unsigned queue_id,
+                             const io_request_sg_t* io_desc,
+                             uint64_t length,
+                             unsigned nsid=1)
+  {
+    if((queue_id > _num_io_queues)||(queue_id == 0)) {
+      PERR("queue id (%u) > num IO queues! (%u)", queue_id, _num_io_queues);
+      assert(0);
+      return Exokernel::E_INVAL;
+    }
+    assert(_io_queues[queue_id - 1]);
+    if(_io_queues[queue_id - 1]->issue_async_io_sg_batch(io_desc, length, nsid) == 0)
+      return Exokernel::E_INVAL;
+
+    return Exokernel::S_OK;
+  }
+
+  /** 
+   * Issue a single IO request with its own completion callback
+   * 
+   * @param queue_id Queue identifier counting from 1
+   * @param io_request IO request
+   * @param callback Per-command completion callback
+   * @param callback_param Cookie for callback
+   * @param nsid Namespace identifier
+   * @param status Where to write the completion status (may be NULL)
+   * 
+   * @return Command identifier, or 0 if the request is invalid
+   */
+  uint16_t async_io(unsigned queue_id,
+                    const io_request_t& io_request,
+                    notify_callback_t callback,
+                    void * callback_param,
+                    unsigned nsid=1,
+                    uint16_t * status=NULL)
+  {
+    if((queue_id > _num_io_queues)||(queue_id == 0)) {
+      PERR("queue id (%u) > num IO queues! (%u)", queue_id, _num_io_queues);
+      assert(0);
+      return 0;
+    }
+    assert(_io_queues[queue_id - 1]);
+    return _io_queues[queue_id - 1]->issue_async_io(io_request, nsid, callback, callback_param, status);
+  }
+
+  /** 
+   * Zero blocks without transferring data (Write Zeroes)
+   * 
+   * @param queue_id Queue identifier counting from 1
+   * @param offset LBA offset
+   * @param num_blocks Number of LBAs (up to 65536)
+   * @param deallocate Also deallocate the blocks
+   * @param nsid Namespace identifier
+   * @param callback Per-command completion callback (may be NULL)
+   * @param callback_param Cookie for callback
+   * 
+   * @return Command identifier, or 0 if the request is invalid or unsupported
+   */
+  uint16_t async_write_zeroes(unsigned queue_id,
+                              off_t offset,
+                              size_t num_blocks,
+                              bool deallocate=false,
+                              unsigned nsid=1,
+                              notify_callback_t callback=NULL,
+                              void * callback_param=NULL)
+  {
+    if((queue_id > _num_io_queues)||(queue_id == 0)) {
+      PERR("queue id (%u) > num IO queues! (%u)", queue_id, _num_io_queues);
+      assert(0);
+      return 0;
+    }
+    assert(_io_queues[queue_id - 1]);
+    return _io_queues[queue_id - 1]->issue_async_write_zeroes(offset, num_blocks, deallocate, nsid,
+                                                              callback, callback_param);
+  }
+
+  /** 
+   * Deallocate (trim) ranges, up to 256 ranges per Dataset Management
+   * command
+   * 
+   * @param queue_id Queue identifier counting from 1
+   * @param ranges Ranges (offset and num_blocks are used)
+   * @param num_ranges Number of ranges
+   * @param nsid Namespace identifier
+   * @param callback Completion callback, once per command (may be NULL)
+   * @param callback_param Cookie for callback
+   * 
+   * @return Command identifier of the last command, or 0 if the request
+   * is invalid or unsupported
+   */
+  uint16_t async_deallocate(unsigned queue_id,
+                            const io_request_t * ranges,
+                            unsigned num_ranges,
+                            unsigned nsid=1,
+                            notify_callback_t callback=NULL,
+                            void * callback_param=NULL)
+  {
+    if((queue_id > _num_io_queues)||(queue_id == 0)) {
+      PERR("queue id (%u) > num IO queues! (%u)", queue_id, _num_io_queues);
+      assert(0);
+      return 0;
+    }
+    assert(_io_queues[queue_id - 1]);
+    return _io_queues[queue_id - 1]->issue_async_deallocate(ranges, num_ranges, nsid,
+                                                            callback, callback_param);
   }
 
   status_t flush(unsigned nsid, unsigned queue_id)
@@ -246,7 +436,7 @@ public:
       return Exokernel::E_INVAL;
     }
     assert(_io_queues[queue_id - 1]);
-    return _io_queues[queue_id - 1]->issue_flush(); //TODO: add nsid
+    return _io_queues[queue_id - 1]->issue_flush(nsid);
   }
 
 
@@ -261,17 +451,41 @@ public:
   }
 
 
-  uint16_t next_cmdid(unsigned queue_id) {
+  /** 
+   * Get IO queue telemetry
+   * 
+   * @param queue_id Queue identifier counting from 1, or
+   * IO_STATS_ALL_PORTS for all IO queues combined
+   * @param stats [out] Statistics summary
+   * 
+   * @return S_OK on success, E_INVAL on bad queue identifier
+   */
+  status_t get_stats(unsigned queue_id, io_stats_t * stats);
+
+
+  /** 
+   * Reap completions on a queue from the calling thread.  Intended for
+   * inline (run-to-completion) queues that have no CQ thread.
+   * 
+   * @param queue_id Queue identifier counting from 1
+   * @param max Maximum number of completions to reap
+   * 
+   * @return Number of completions reaped
+   */
+  unsigned poll_completions(unsigned queue_id, unsigned max = ~0U)
+  {
     if((queue_id > _num_io_queues)||(queue_id == 0)) {
       assert(0);
-      return Exokernel::E_INVAL;
+      return 0;
     }
-
-    return _io_queues[queue_id - 1]->next_cmdid();
+    assert(_io_queues[queue_id - 1]);
+    assert(_io_queues[queue_id - 1]->inline_completion());
+    return _io_queues[queue_id - 1]->poll_completions(max);
   }
 
 
 
+
 };
 
 
@@ -4,6 +4,8 @@
 #include <common/logging.h>
 #include <component/base.h>
 #include <boost/tokenizer.hpp>
+#include <pthread.h>
+#include <map>
 
 #include "nvme_drv_component.h"
 
@@ -28,26 +30,32 @@ static void split_config_string(std::string op, std::map<std::string, std::strin
 }
 
 
-//////////////////////////////////////////////////////////////////////
-// IDeviceControl interface
-//
-status_t NVME_driver_component::init_device(unsigned instance, const char * config) {
+/* device instances shared by the per-namespace components */
+struct shared_device_t {
+  NVME_device * dev;
+  unsigned      refs;
+};
 
-  PLOG("init_device(instance=%u)",instance);
+static std::map<unsigned, shared_device_t> g_devices;
+static pthread_mutex_t g_devices_lock = PTHREAD_MUTEX_INITIALIZER;
 
-  std::string filename = "config.xml";
-  if(config) {
-    std::map<std::string, std::string> params;
-    split_config_string(std::string(config), params);
-    if(!params["file"].empty()) {
-      filename = params["file"];
-      PLOG("Opening config file (%s)", filename.c_str());
-    }
+static NVME_device * attach_device(unsigned instance, const char * filename)
+{
+  NVME_device * dev = NULL;
+
+  pthread_mutex_lock(&g_devices_lock);
+
+  std::map<unsigned, shared_device_t>::iterator i = g_devices.find(instance);
+  if(i != g_devices.end()) {
+    i->second.refs++;
+    dev = i->second.dev;
+    pthread_mutex_unlock(&g_devices_lock);
+    return dev;
   }
-  
+
   try {
     PLOG("instantiating new NVME_device instance");
-    _dev = new NVME_device(filename.c_str(), instance); //compatibility
+    dev = new NVME_device(filename, instance); //compatibility
   }
   catch(Exokernel::Exception e) {
     NVME_INFO("EXCEPTION: error in NVME device initialization (%s) \n",e.cause());
@@ -61,7 +69,69 @@ status_t NVME_driver_component::init_device(unsigned instance, const char * conf
     NVME_INFO("EXCEPTION: error in NVME device initialization (unknown exception) \n");
     asm("int3");
   }
+
+  if(dev) {
+    shared_device_t sd = { dev, 1 };
+    g_devices[instance] = sd;
+  }
+
+  pthread_mutex_unlock(&g_devices_lock);
+  return dev;
+}
+
+static void detach_device(unsigned instance)
+{
+  pthread_mutex_lock(&g_devices_lock);
+
+  std::map<unsigned, shared_device_t>::iterator i = g_devices.find(instance);
+  assert(i != g_devices.end());
+
+  if(--i->second.refs == 0) {
+    i->second.dev->destroy();
+    delete i->second.dev;
+    g_devices.erase(i);
+  }
+
+  pthread_mutex_unlock(&g_devices_lock);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// IDeviceControl interface
+//
+status_t NVME_driver_component::init_device(unsigned instance, const char * config) {
+
+  PLOG("init_device(instance=%u)",instance);
+
+  std::string filename = "config.xml";
+  if(config) {
+    std::map<std::string, std::string> params;
+    split_config_string(std::string(config), params);
+    if(!params["file"].empty()) {
+      filename = params["file"];
+      PLOG("Opening config file (%s)", filename.c_str());
+    }
+    if(!params["ns"].empty()) {
+      _nsid = atoi(params["ns"].c_str());
+    }
+  }
   
+  _instance = instance;
+  _dev = attach_device(instance, filename.c_str());
+  if(!_dev)
+    return E_FAIL;
+
+  const NVME_device::ns_info * ns = _dev->ns(_nsid);
+  if(!ns) {
+    PERR("namespace (%u) is not active on device instance (%u)", _nsid, instance);
+    detach_device(instance);
+    _dev = NULL;
+    return E_INVAL;
+  }
+  _lba_shift = ns->_lba_shift;
+
+  NVME_INFO("component bound to namespace %u (%lu blocks of %u bytes)\n",
+            _nsid, ns->_nsze, ns->_flbasize);
 
 #ifdef TESTING_ONLY
   /* IRQ will be masked and will need unmasking */
@@ -81,8 +151,7 @@ Exokernel::Device * NVME_driver_component::get_device() {
 status_t NVME_driver_component::shutdown_device() {
 
   if(_dev) {
-    _dev->destroy();
-    delete _dev;
+    detach_device(_instance);
     _dev = NULL;
   }
 
@@ -92,57 +161,29 @@ status_t NVME_driver_component::shutdown_device() {
 
 status_t 
 NVME_driver_component::
-sync_read_block(void * buffer_virt, /* must be 512 byte aligned */
+sync_read_block(void * buffer_virt,
                 addr_t buffer_phys, 
-                off_t lba,          /* store offset */
-                size_t num_blocks,  /* each block is 512 bytes */
+                off_t lba,          /* namespace LBA */
+                size_t num_blocks,  /* in namespace LBAs */
                 unsigned port       /* device port */
                 )
 {
-  assert(0);
-  // const unsigned qid = port; /* do we want to change IBlockDevice? */
-
-  // /* set up call back */
-  // _dev->io_queue(qid)->callback_manager()->register_callback(&Notify_object::notify_callback,
-  //                                                            (void*)&nobj);
-
-  // uint16_t cid = _dev->block_async_read(qid,
-  //                                       buffer_phys,
-  //                                       lba,
-  //                                       num_blocks); /* num blocks */
-  // nobj.set_when(cid);
-  // nobj.wait();
-
-  return E_NOT_IMPL;
+  io_request_t io_request = { BLOCK_READ, buffer_virt, buffer_phys, lba, num_blocks };
+  return sync_io(io_request, port);
 }
 
 
 status_t 
 NVME_driver_component::
-sync_write_block(void * buffer_virt, /* must be 512 byte aligned */
+sync_write_block(void * buffer_virt,
                  addr_t buffer_phys, 
-                 off_t lba,          /* logical block offset */
-                 size_t num_blocks,  /* each block is 512 bytes */
+                 off_t lba,          /* namespace LBA */
+                 size_t num_blocks,  /* in namespace LBAs */
                  unsigned port       /* device port */
                  )
 {
-  assert(0);
-  // const unsigned qid = port; /* do we want to change IBlockDevice? */
-
-  // Notify_object nobj;
-
-  // /* set up call back */
-  // _dev->io_queue(qid)->callback_manager()->register_callback(&Notify_object::notify_callback,
-  //                                                            (void*)&nobj);
-
-  // uint16_t cid = _dev->block_async_write(qid,
-  //                                        buffer_phys,
-  //                                        lba,
-  //                                        num_blocks); /* num blocks */
-  // nobj.set_when(cid);
-  // nobj.wait();
-
-  return E_NOT_IMPL;
+  io_request_t io_request = { BLOCK_WRITE, buffer_virt, buffer_phys, lba, num_blocks };
+  return sync_io(io_request, port);
 }
 
 
@@ -152,10 +193,29 @@ NVME_driver_component::
 sync_io(io_request_t io_request,
         unsigned port)
 {
-  Notify_Sync nobj;
-  async_io(io_request, port);
+  Notify_object nobj;
+  if(_dev->async_io(port /* same as queue */,
+                    io_request,
+                    &Notify_object::notify_callback,
+                    (void*)&nobj,
+                    _nsid,
+                    nobj.status_ptr()) == 0)
+    return E_INVAL;
+
+  NVME_IO_queue * ioq = _dev->io_queue(port);
+  if(ioq->inline_completion()) {
+    while(!nobj.done()) ioq->poll_completions();
+  }
+  else {
+    nobj.wait();
+  }
 
-  nobj.wait();
+  if(nobj.status() != NVME_SC_SUCCESS) {
+    /* mask off DNR/More; controllers typically set DNR on a miscompare */
+    if((nobj.status() & 0x7ff) != NVME_SC_COMPARE_FAILED)
+      PERR("IO failed (action=%d status=0x%x)", io_request.action, nobj.status());
+    return E_FAIL;
+  }
 
   return S_OK;
 }
@@ -167,13 +227,30 @@ NVME_driver_component::
 async_io(io_request_t io_request,
          unsigned port)
 {
-  _dev->async_io_batch(port /* same as queue */,
-                       &io_request,
-                       1);
+  /* single commands take the multi-submitter path, not the batch
+     manager, so concurrent callers on a queue do not serialize */
+  if(_dev->async_io(port /* same as queue */,
+                    io_request,
+                    NULL,
+                    NULL,
+                    _nsid) == 0)
+    return E_INVAL;
 
   return S_OK;
 }
 
+/* async multi-segment I/O */
+status_t
+NVME_driver_component::
+async_io_sg(io_request_sg_t io_request,
+            unsigned port)
+{
+  return _dev->async_io_sg_batch(port /* same as queue */,
+                                 &io_request,
+                                 1,
+                                 _nsid);
+}
+
 /* async I/O batch */
 status_t
 NVME_driver_component::
@@ -181,11 +258,10 @@ async_io_batch(io_request_t* io_requests,
                size_t length,
                unsigned port)
 {
-  _dev->async_io_batch(port /* same as queue */,
-                       io_requests, 
-                       length);
-
-  return S_OK;
+  return _dev->async_io_batch(port /* same as queue */,
+                              io_requests, 
+                              length,
+                              _nsid);
 }
 
 
@@ -193,8 +269,7 @@ status_t
 NVME_driver_component::
 wait_io_completion(unsigned port)
 {
-  _dev->wait_io_completion(port /* same as queue */);
-  return S_OK;
+  return _dev->wait_io_completion(port /* same as queue */);
 }
 
 
@@ -203,12 +278,21 @@ status_t
 NVME_driver_component::
 flush(unsigned nsid, unsigned port)
 {
-  _dev->flush(nsid, port /* queue */);
+  _dev->flush(nsid ? nsid : _nsid, port /* queue */);
   return S_OK;
 }
 
 
 
+status_t
+NVME_driver_component::
+get_stats(io_stats_t * stats, unsigned port)
+{
+  return _dev->get_stats(port /* same as queue */, stats);
+}
+
+
+
 extern "C" void * factory_createInstance(Component::uuid_t& component_id)
 {
   if(component_id == NVME_driver_component::component_id()) {
@@ -4,15 +4,24 @@
 #include <component/block_device_itf.h>
 #include "nvme_device.h"
 
+/** 
+ * Block device component for one namespace of an NVMe device.  Several
+ * component instances bound to different namespaces of the same device
+ * instance share one NVME_device (and its IO queues).
+ * 
+ */
 class NVME_driver_component : public IBlockDevice
 {
 private:
   NVME_device * _dev;
+  unsigned      _instance;
+  unsigned      _nsid;
+  unsigned      _lba_shift;  /* log2 of namespace LBA size */
 
 public:  
   DECLARE_COMPONENT_UUID(0x32211000,0xe72d,0x4ddd,0x34d9,0x3e,0x44,0x20,0x15,0x20,0x15);
 
-  NVME_driver_component() : _dev(NULL) {
+  NVME_driver_component() : _dev(NULL), _instance(0), _nsid(1), _lba_shift(0) {
   }
 
   virtual ~NVME_driver_component() {
@@ -40,7 +49,9 @@ public:
    * Initialize device
    * 
    * @param instance Device instance counting from 0 (determined by PCI order)
-   * @param config Configuration string (e.g., file=config.xml&param2=foobar)
+   * @param config Configuration string (e.g., file=config.xml&ns=2). The
+   * namespace defaults to 1; the file is only used by the first component
+   * to attach to the device instance.
    * 
    * @return S_OK on success
    */
@@ -58,10 +69,10 @@ public:
   /** 
    * Synchronously (block until completion) read N blocks
    * 
-   * @param buffer_virt Pointer to DMA buffer (must be device block size (e.g., 4K) aligned)
-   * @param buffer_phys Physical address of DMA buffer (must be device block size (e.g., 4K) aligned)
-   * @param offset Offset in blocks 
-   * @param num_blocks Number of blocks to read
+   * @param buffer_virt Pointer to DMA buffer (must be dword aligned)
+   * @param buffer_phys Physical address of DMA buffer (must be dword aligned)
+   * @param offset Offset in namespace LBAs
+   * @param num_blocks Number of namespace LBAs
    * @param port Port/queue to use
    * 
    * @return S_OK on success
@@ -76,10 +87,10 @@ public:
   /** 
    * Synchronously (block until completion) write N blocks
    * 
-   * @param buffer_virt Pointer to DMA buffer (must be device block size (e.g., 4K) aligned)
-   * @param buffer_phys Physical address of DMA buffer (must be device block size (e.g., 4K) aligned)
-   * @param offset Offset in blocks 
-   * @param num_blocks Number of blocks to read
+   * @param buffer_virt Pointer to DMA buffer (must be dword aligned)
+   * @param buffer_phys Physical address of DMA buffer (must be dword aligned)
+   * @param offset Offset in namespace LBAs
+   * @param num_blocks Number of namespace LBAs
    * @param port Port/queue to use
    * 
    * @return S_OK on success
@@ -104,18 +115,90 @@ public:
                    unsigned port);
 
 
+  /** 
+   * Asynchronous IO; completion is observed with wait_io_completion.
+   * Safe for concurrent submitters on the same port.
+   * 
+   * @param io_request IO request
+   * @param port Queue/port
+   * 
+   * @return S_OK on success, E_INVAL for invalid requests
+   */
   status_t async_io(io_request_t io_request,
                     unsigned port);
 
+  /** 
+   * Multi-segment asynchronous IO; segments are mapped with a PRP list
+   * or an SGL
+   * 
+   * @param io_request Multi-segment IO request
+   * @param port Queue/port
+   * 
+   * @return S_OK on success, E_INVAL if segments cannot be described
+   */
+  status_t async_io_sg(io_request_sg_t io_request,
+                       unsigned port);
+
+  /** 
+   * Asynchronous batch of IO requests
+   * 
+   * @param io_requests Array of IO requests
+   * @param length Number of requests
+   * @param port Queue/port
+   * 
+   * @return S_OK on success, E_INVAL if a request is invalid (nothing is issued)
+   */
   status_t async_io_batch(io_request_t* io_requests,
                           size_t length,
                           unsigned port);
 
+  /** 
+   * Wait for all IO on a port to complete
+   * 
+   * @param port Port/queue
+   * 
+   * @return S_OK, or E_FAIL if an asynchronous command failed since the
+   * previous wait
+   */
   status_t wait_io_completion(unsigned port);
 
+  /** 
+   * Flush IO device
+   * 
+   * @param nsid Namespace identifier (0 for this component's namespace)
+   * @param port Queue/port
+   * 
+   * @return S_OK on success
+   */
   status_t flush(unsigned nsid,
                  unsigned port);
 
+  // IBlockDevice
+  //
+
+  /** 
+   * Get IO telemetry for a queue, or for the whole device
+   * 
+   * @param stats [out] Statistics
+   * @param port Queue/port, or IO_STATS_ALL_PORTS
+   * 
+   * @return S_OK on success, E_INVAL on bad port
+   */
+  status_t get_stats(io_stats_t * stats,
+                     unsigned port);
+
+  /** 
+   * Namespace this component is bound to
+   * 
+   */
+  unsigned nsid() const { return _nsid; }
+
+  /** 
+   * LBA size of the namespace in bytes
+   * 
+   */
+  unsigned block_size() const { return 1U << _lba_shift; }
+
 
 };
 
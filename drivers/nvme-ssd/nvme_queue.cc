@@ -39,6 +39,16 @@
 
 using namespace Exokernel;
 
+/* wait on a queue resource; inline-completion queues have no CQ thread,
+   so the waiting submitter must reap its own CQ to free the resource */
+#define IO_QUEUE_LOOP( condition )                    \
+  do {                                                \
+    if(_inline_completion) {                          \
+      while( condition ) poll_completions();          \
+    }                                                 \
+    else NVME_LOOP( condition, false )                \
+  } while(0)
+
 /**---------------------------------------------------------------------------------------- 
  * BASE QUEUES
  * ---------------------------------------------------------------------------------------- 
@@ -55,6 +65,8 @@ NVME_queues_base::NVME_queues_base(NVME_device * dev, unsigned queue_id, unsigne
   _dev(dev),  _queue_id(queue_id),
   _sq_dma_mem(NULL), _sq_dma_mem_phys(0), 
   _cq_dma_mem(NULL), _cq_dma_mem_phys(0), 
+  _sq_shadow_db(NULL), _sq_event_idx(NULL),
+  _cq_shadow_db(NULL), _cq_event_idx(NULL),
   _sq_head(0),
   _sq_tail(0),
   _cq_head(0),
@@ -89,6 +101,26 @@ void NVME_queues_base::setup_doorbells()
 
   /* set pointer to CQ doorbell */
   _cq_db = r->offset<uint32_t>(NVME_OFFSET_COMPLETION_DB(r->cap(),_queue_id,stride));
+
+  /* shadow doorbells follow the register layout, in dwords (IO queues only) */
+  uint32_t * dbbuf = (uint32_t *) _dev->dbbuf_shadow();
+  uint32_t * eventidx = (uint32_t *) _dev->dbbuf_eventidx();
+
+  if(_queue_id > 0 && dbbuf && eventidx) {
+    const unsigned sq_idx = (2 * _queue_id) << stride;
+    const unsigned cq_idx = ((2 * _queue_id) + 1) << stride;
+    assert((cq_idx + 1) * sizeof(uint32_t) <= PAGE_SIZE);
+
+    _sq_shadow_db = &dbbuf[sq_idx];
+    _sq_event_idx = &eventidx[sq_idx];
+    _cq_shadow_db = &dbbuf[cq_idx];
+    _cq_event_idx = &eventidx[cq_idx];
+
+    /* queue was just created; its doorbells start at zero */
+    *_sq_shadow_db = 0;
+    *_cq_shadow_db = 0;
+    mb();
+  }
 }
 
 
@@ -172,7 +204,9 @@ Completion_command_slot * NVME_queues_base::get_next_completion()
        _comp_cmd[curr_head].status,
        _queue_id);
 
-  /* check status code */
+  /* check status code; the slot is always consumed and the reaper
+     passes errors back to the issuer (status pointer, batch entry or
+     wait_io_completion) */
   unsigned status =  _comp_cmd[curr_head].status;
 
   if(status > 0) {
@@ -181,37 +215,17 @@ Completion_command_slot * NVME_queues_base::get_next_completion()
     unsigned SCT  = 0x7  & (status >>  8);
     unsigned SC   = 0xff & status;
 
-    PLOG("DNR = 0x%x, More = 0x%x, SCT = 0x%x, SC = 0x%x",
+    PERR("completion error: cid = %u, DNR = 0x%x, More = 0x%x, SCT = 0x%x (%s), SC = 0x%x (Q:%u)",
+         _comp_cmd[curr_head].command_id,
          DNR,
          More,
          SCT,
-         SC
-         );
-
-    if(SCT == 0x0) {
-      //PDBG("Generic Command Status");
-      if(_unlikely(SC != 0x0)) {  /* not Successful Completion */
-        PERR("DNR = 0x%x, More = 0x%x, SCT = 0x%x, SC = 0x%x",
-             DNR,
-             More,
-             SCT,
-             SC
-             );
-        assert(false);
-      }
-    } else if (SCT == 0x1) {
-      PDBG("Command Specific Status");
-      assert(false);
-    } else if (SCT == 0x2) {
-      PDBG("Media Error");
-      assert(false);
-    } else if (SCT == 0x7) {
-      PDBG("Vendor Specific");
-      assert(false);
-    } else {
-      PDBG("Reserved");
-      assert(false);
-    }
+         SCT == 0x0 ? "generic" : 
+         SCT == 0x1 ? "command specific" : 
+         SCT == 0x2 ? "media error" : 
+         SCT == 0x7 ? "vendor specific" : "reserved",
+         SC,
+         _queue_id);
   }
 
   /* indicate that completion has been dealt with */
@@ -257,11 +271,15 @@ void NVME_queues_base::dump_queue_info() {
 
 Submission_command_slot * NVME_queues_base::next_sub_slot(signed * cmdid) {
 
-  queue_ptr_t curr_ptr;
-  
   *cmdid = alloc_cmdid();
   assert(*cmdid > 0);
 
+  return next_free_sub_slot();
+}
+
+Submission_command_slot * NVME_queues_base::next_free_sub_slot() {
+
+  queue_ptr_t curr_ptr;
   status_t st;
 
   NVME_LOOP( ((st = increment_submission_tail(&curr_ptr)) != Exokernel::S_OK), false);
@@ -427,7 +445,7 @@ void NVME_admin_queue::feature_info()
     ring_submission_doorbell();
     _dev->wait_for_msix_irq(irq());
 
-    cmd.extract_info(_dev->_ns_ident[n]);
+    cmd.extract_info(_dev->_ns_ident[n - 1]);
 
     /* ring completion doorbell and increment completion head*/
     ring_doorbell_single_completion();
@@ -493,12 +511,13 @@ uint32_t NVME_admin_queue::ring_wait_complete(Command_admin_base& cmd)
 status_t NVME_admin_queue::create_io_completion_queue(vector_t vector,
                                                       unsigned queue_id,
                                                       size_t queue_max_items,
-                                                      addr_t prp1)
+                                                      addr_t prp1,
+                                                      bool irq_enabled)
 {
   assert(prp1);
 
   /* construct command */
-  Command_admin_create_io_cq cmd(this,vector,queue_id,queue_max_items,prp1);
+  Command_admin_create_io_cq cmd(this,vector,queue_id,queue_max_items,prp1,irq_enabled);
 
   if(ring_wait_complete(cmd)!=0) 
     assert(0);
@@ -516,12 +535,13 @@ status_t NVME_admin_queue::create_io_completion_queue(vector_t vector,
 status_t NVME_admin_queue::create_io_submission_queue(unsigned queue_id,
                                                        size_t queue_size,
                                                        addr_t prp1,
-                                                       unsigned cq_id)
+                                                       unsigned cq_id,
+                                                       NVME::sq_priority_t priority)
 {
   assert(prp1);
 
   /* construct command */
-  Command_admin_create_io_sq cmd(this,queue_id,queue_size,prp1,cq_id);
+  Command_admin_create_io_sq cmd(this,queue_id,queue_size,prp1,cq_id,priority);
 
   if(ring_wait_complete(cmd)!=0)
     assert(0);
@@ -563,6 +583,35 @@ status_t NVME_admin_queue::set_queue_num(unsigned num_queues)
 }
 
 
+status_t NVME_admin_queue::set_arbitration(unsigned burst, 
+                                           unsigned high_weight, 
+                                           unsigned medium_weight, 
+                                           unsigned low_weight)
+{
+  /* check before the command takes a submission slot */
+  if(burst > 7 || 
+     high_weight < 1 || high_weight > 256 ||
+     medium_weight < 1 || medium_weight > 256 ||
+     low_weight < 1 || low_weight > 256) {
+    PERR("invalid arbitration parameters (burst=%u weights=%u/%u/%u)",
+         burst, high_weight, medium_weight, low_weight);
+    return Exokernel::E_INVAL;
+  }
+
+  Command_admin_set_features cmd(this);
+  cmd.configure_arbitration(burst, high_weight, medium_weight, low_weight);
+
+  ring_wait_complete(cmd);
+
+  if(cmd.get_status() != 0) {
+    PERR("set features (arbitration) failed (status=0x%x)", cmd.get_status());
+    return Exokernel::E_FAIL;
+  }
+
+  return Exokernel::S_OK;
+}
+
+
 status_t NVME_admin_queue::set_irq_coal(bool state, vector_t vector)
 {
   /* construct command */
@@ -585,6 +634,22 @@ status_t NVME_admin_queue::set_irq_coal_options(unsigned agg, unsigned threshold
 
 
 
+status_t NVME_admin_queue::issue_doorbell_buffer_config(addr_t dbbuf_phys, addr_t eventidx_phys)
+{
+  /* construct command */
+  Command_admin_doorbell_buffer_config cmd(this, dbbuf_phys, eventidx_phys);
+
+  if(ring_wait_complete(cmd)!=0)
+    assert(0);
+
+  if(cmd.get_status() != 0) {
+    PERR("doorbell buffer config rejected (status=0x%x)",cmd.get_status());
+    return Exokernel::E_FAIL;
+  }
+
+  return Exokernel::S_OK;
+}
+
 status_t NVME_admin_queue::issue_format(unsigned lbaf, unsigned nsid)
 {
   assert(nsid==1); 
@@ -613,15 +678,29 @@ status_t NVME_admin_queue::issue_format(unsigned lbaf, unsigned nsid)
  * @param dev 
  * @param vector 
  * @param core 
+ * @param cq_mode Completion mode for the CQ thread
+ * @param cq_spin_us Spin budget for adaptive completion mode
  */
 NVME_IO_queue::NVME_IO_queue(NVME_device * dev, 
                              unsigned queue_id,
                              vector_t base_vector,
                              vector_t vector, 
                              unsigned core,
-                             size_t queue_length) : 
+                             size_t queue_length,
+                             NVME::cq_mode_t cq_mode,
+                             unsigned cq_spin_us,
+                             NVME::sq_priority_t sq_priority) : 
   NVME_queues_base(dev, queue_id, vector, queue_length),
-  _cq_thread(NULL)
+  _cq_thread(NULL),
+  _tag_table(NULL),
+  _inline_completion(cq_mode == NVME::CQ_MODE_INLINE),
+  _sq_priority(sq_priority),
+  _sq_reserved(0),
+  _sq_committed(0),
+  _sq_rung(0),
+  _db_pending_since(0),
+  _db_batch(1),
+  _db_window(0)
 {
   assert(dev);
   assert(vector);
@@ -637,12 +716,16 @@ NVME_IO_queue::NVME_IO_queue(NVME_device * dev,
 
   _queue_id = queue_id; 
   assert(_queue_id > 0); /* admin Q is id 0 */
+  _unreported_errors = 0;
 
-  /* init batch counters */
-  _sq_batch_counter = 0;
-  prev_tsc = 0;
-  cur_tsc = 0;
-  drain_tsc = (unsigned long long)get_tsc_frequency_in_mhz() * US_PER_RING;
+  /* commands outstanding can exceed the SQ length because the SQ head
+     advances on fetch, not on completion */
+  _tag_table = new NVME_tag_table(MIN(_queue_max_items * 2, 0xfffe));
+
+  /* transfer limits from identify controller */
+  _max_transfer = dev->_ident._mdts ? ((size_t) PAGE_SIZE << dev->_ident._mdts) : 0;
+  _sgl_support = dev->_ident._sgls & 0x3;
+  _oncs = dev->_ident._oncs;
 
   /* allocate memory for the completion queue */
   num_pages = (round_up_page(CQ_entry_size_bytes * _queue_max_items)/PAGE_SIZE)*2;
@@ -662,7 +745,9 @@ NVME_IO_queue::NVME_IO_queue(NVME_device * dev,
   rc = admin->create_io_completion_queue(_queue_id, /* logical vector */
                                          _queue_id,
                                          _queue_max_items,
-                                         _cq_dma_mem_phys);
+                                         _cq_dma_mem_phys,
+                                         cq_mode == NVME::CQ_MODE_INTERRUPT ||
+                                         cq_mode == NVME::CQ_MODE_ADAPTIVE); /* no IRQs when polling */
   assert(rc==Exokernel::S_OK);
 
   /* allocate memory for the submission queue */
@@ -683,7 +768,8 @@ NVME_IO_queue::NVME_IO_queue(NVME_device * dev,
   rc = admin->create_io_submission_queue(_queue_id,
                                          _queue_max_items,
                                          _sq_dma_mem_phys,
-                                         _queue_id);
+                                         _queue_id,
+                                         _sq_priority);
   assert(rc==Exokernel::S_OK);
 
   /* set up pointers into queues (queues are contiguous)  */
@@ -693,14 +779,18 @@ NVME_IO_queue::NVME_IO_queue(NVME_device * dev,
   assert(sizeof(Completion_command_slot) == 16);
   _comp_cmd = (Completion_command_slot *) _cq_dma_mem;
 
-  /* finally create CQ thread */
-  _cq_thread = new CQ_thread(this, core, vector, _queue_id);
+  /* finally create CQ thread, unless the submitter reaps inline */
+  if(!_inline_completion)
+    _cq_thread = new CQ_thread(this, core, vector, _queue_id, cq_mode, cq_spin_us);
 
   NVME_INFO("NVME_IO_queues ctor'ed\n");
 }
 
 void NVME_IO_queue::start_cq_thread()
 {
+  if(_inline_completion)
+    return;
+
   assert(_cq_thread);
   _cq_thread->start();
 }
@@ -716,9 +806,18 @@ NVME_IO_queue::~NVME_IO_queue() {
   assert(admin);
 
   /* cancel waiting threads */
-  assert(_cq_thread);
-  _cq_thread->cancel();
-  delete _cq_thread;
+  if(_cq_thread) {
+    _cq_thread->cancel();
+    delete _cq_thread;
+  }
+
+  /* free PRP list / SGL pages */
+  for(unsigned cmdid=1; cmdid<=_tag_table->size(); cmdid++) {
+    NVME_tag_table::slot * t = _tag_table->lookup(cmdid);
+    if(t->sg_list)
+      _dev->free_dma_pages(t->sg_list);
+  }
+  delete _tag_table;
   
   /* delete IO queues */
   rc = admin->delete_io_queue(NVME::QTYPE_SUB, _queue_id);
@@ -734,59 +833,246 @@ void NVME_IO_queue::dump_info() {
   NVME_INFO("IO QUEUE [%u]\n",_queue_id);
 }
 
+void NVME_IO_queue::set_doorbell_coalescing(unsigned batch, unsigned window_us)
+{
+  _db_batch = batch > 0 ? batch : 1;
+  _db_window = (cpu_time_t) get_tsc_frequency_in_mhz() * window_us;
+  NVME_INFO("IO QUEUE [%u] doorbell batch=%u window=%uus\n", _queue_id, _db_batch, window_us);
+}
+
+Submission_command_slot * NVME_IO_queue::reserve_sub_slot(unsigned * idx)
+{
+  unsigned curr = _sq_reserved.load(boost::memory_order_relaxed);
+
+  for(;;) {
+    const unsigned next = sq_next(curr);
+
+    if(_unlikely(next == sq_head())) {
+      /* full: make sure the controller can see what is queued, then
+         wait for it to fetch (run-to-completion queues reap inline) */
+      ring_coalesced();
+      if(_inline_completion) 
+        poll_completions();
+      else 
+        cpu_relax();
+      curr = _sq_reserved.load(boost::memory_order_relaxed);
+      continue;
+    }
+
+    if(_sq_reserved.compare_exchange_weak(curr, next, 
+                                          boost::memory_order_acquire,
+                                          boost::memory_order_relaxed))
+      break;
+  }
+
+  _sub_cmd[curr].clear();
+  *idx = curr;
+
+  PLOG("sub_slot = %u (Q:%u)", curr, _queue_id);
+  return &_sub_cmd[curr];
+}
+
+__thread NVME_IO_queue * NVME_IO_queue::_db_deferred = NULL;
+
+void NVME_IO_queue::commit_sub_slot(unsigned idx)
+{
+  /* publish in SQ order so that a doorbell never covers an unwritten entry */
+  while(_sq_committed.load(boost::memory_order_acquire) != idx)
+    cpu_relax();
+
+  if(idx == _sq_rung.load(boost::memory_order_relaxed))
+    _db_pending_since.store(rdtsc(), boost::memory_order_relaxed);
+
+  _sq_committed.store(sq_next(idx), boost::memory_order_release);
+
+  /* pairs with the fence in ring_coalesced: either we see the doorbell
+     lock free, or the ringer sees our commit after unlocking */
+  boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+  /* issuing a batch: rung once after its last command */
+  if(_db_deferred == this)
+    return;
+
+  /* another submitter is between reserve and commit - it rings for us */
+  if(_sq_reserved.load(boost::memory_order_acquire) != _sq_committed.load(boost::memory_order_acquire) &&
+     sq_pending() < _db_batch)
+    return;
+
+  /* last one in: hold the doorbell open for others until the window closes */
+  if(_db_window > 0) {
+    const cpu_time_t deadline = _db_pending_since.load(boost::memory_order_relaxed) + _db_window;
+
+    while(sq_pending() < _db_batch && rdtsc() < deadline) {
+      if(_sq_reserved.load(boost::memory_order_acquire) != _sq_committed.load(boost::memory_order_acquire))
+        return;
+      cpu_relax();
+    }
+  }
+
+  ring_coalesced();
+}
+
+void NVME_IO_queue::ring_coalesced()
+{
+  while(_db_lock.try_lock()) {
+    const unsigned tail = _sq_committed.load(boost::memory_order_acquire);
+
+    if(tail != _sq_rung.load(boost::memory_order_relaxed)) {
+      _stats.doorbell(ring_submission_doorbell(tail));
+      _sq_rung.store(tail, boost::memory_order_release);
+    }
+
+    _db_lock.unlock();
+
+    /* store-load ordering between the unlock and the re-check; see
+       commit_sub_slot */
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+    /* entries committed while the lock was held were left to us */
+    if(_sq_committed.load(boost::memory_order_acquire) == tail)
+      break;
+  }
+}
+
 static unsigned issued = 0;
 
-uint16_t NVME_IO_queue::issue_async_read(addr_t prp1, 
-                                          off_t offset, 
-                                          size_t num_blocks,
-                                          bool sequential, 
-                                          unsigned access_freq, 
-                                          unsigned access_lat,
-                                          unsigned nsid) 
+unsigned NVME_IO_queue::poll_completions(unsigned max)
 {
+  Completion_command_slot * ccs;
+  status_t s;
+  unsigned reaped = 0;
+#if (CQ_MAX_BATCH_TO_RING > 1)
+  unsigned cq_batch_counter = 0;
+#endif
 
-  signed slot_id;
-  Submission_command_slot * sc;
+  /* several run-to-completion submitters may share the queue */
+  if(_inline_completion && !_reap_lock.try_lock())
+    return 0;
+
+  /* iterate through the completed completion slots (looking at phase tag) */
+  while(reaped < max && (ccs = get_next_completion())!=NULL) {
+
+    /* update SQ head*/
+    update_sq_head(ccs);
+
+    /* route completion through the tag table, then recycle the tag */
+    uint16_t cmdid = ccs->command_id;
+    NVME_tag_table::slot * t = _tag_table->lookup(cmdid);
+    _stats.completed(t, rdtsc(), _tag_table->outstanding());
+    notify_callback_t callback = t->callback;
+    void * callback_param = t->cookie;
+    unsigned batch = t->batch;
+    uint16_t status = ccs->status;
+    if(_unlikely(status != 0)) {
+      _stats.failed();
+      /* no status pointer: report it from wait_io_completion */
+      if(t->status == NULL)
+        __sync_fetch_and_add(&_unreported_errors, 1);
+    }
+    if(t->status)
+      *t->status = status;
+    _tag_table->release(cmdid);
+
+    /* update batch info */
+    if(batch != NVME_tag_table::NO_BATCH) {
+      s = update_batch_manager(batch, status);
+      assert(s == Exokernel::S_OK);
+    }
 
-#if COLLECT_STATS
-  cpu_time_t start = rdtsc();
+    if(callback)
+      callback(cmdid, callback_param);
+
+    reaped++;
+    PLOG("cleared = %u (Q:%u)", reaped, _queue_id);
+
+#if (CQ_MAX_BATCH_TO_RING > 1)
+    cq_batch_counter++;
+    if(_unlikely(cq_batch_counter >= CQ_MAX_BATCH_TO_RING)) {
+#endif
+      ring_completion_doorbell();
+#if (CQ_MAX_BATCH_TO_RING > 1)
+      cq_batch_counter = 0;
+    }
 #endif
+  }
+
+  /* ring completion doorbell for new _cq_head */
+  if(reaped > 0) {
+    PLOG("ringing completion doorbell");
+    ring_completion_doorbell();
+  }
 
+  _stats.reaped(reaped);
 
-  Completion_command_slot * ccs;
-  if(!(sc = next_sub_slot(&slot_id))) {
-    panic("no sub slots! issued=%u -- this should not happen!!",issued);
-  }  
+  if(_inline_completion)
+    _reap_lock.unlock();
+
+  return reaped;
+}
 
-  //  NVME_INFO("Submitting on queue %u\n", _queue_id);
+/** 
+ * Allocate a command identifier from the tag table, waiting for
+ * outstanding commands to complete if all tags are in use.
+ * 
+ * @param callback Per-command completion callback
+ * @param callback_param Cookie for callback
+ * @param batch Batch manager entry or NO_BATCH
+ * @param status Where to write the completion status (may be NULL)
+ * 
+ * @return Command identifier
+ */
+uint16_t NVME_IO_queue::alloc_tag(notify_callback_t callback, 
+                                  void * callback_param, 
+                                  unsigned batch,
+                                  uint16_t * status)
+{
+  uint16_t cmdid = _tag_table->alloc(callback, callback_param, batch, status);
+  if(_unlikely(cmdid == 0)) {
+    /* tags come back on completion; a batch being issued may still be
+       holding its commands back from the doorbell */
+    ring_coalesced();
+    IO_QUEUE_LOOP( ((cmdid = _tag_table->alloc(callback, callback_param, batch, status)) == 0) );
+  }
+  return cmdid;
+}
 
-  assert(slot_id >= 0);
-  assert(slot_id > 0);
+uint16_t NVME_IO_queue::issue_rw(uint16_t cmdid,
+                                 const NVME::data_ptr_t& dptr, 
+                                 off_t offset, 
+                                 size_t num_blocks,
+                                 bool sequential, 
+                                 unsigned access_freq, 
+                                 unsigned access_lat,
+                                 unsigned nsid,
+                                 uint8_t opcode) 
+{
+  Submission_command_slot * sc;
+  unsigned idx;
+
+#if COLLECT_STATS
+  cpu_time_t start = rdtsc();
+#endif
+
+  sc = reserve_sub_slot(&idx);
+  assert(sc);
+  assert(cmdid > 0);
 
   Command_io_rw cmd(sc,
-                    slot_id, /* command_id */
+                    cmdid, /* command_id */
                     nsid, /* device namespace */
-                    prp1, 
+                    dptr, 
                     offset, 
                     num_blocks, 
                     sequential, 
                     access_freq, 
                     access_lat,
-                    false);  
+                    opcode);  
 
-#if (SQ_MAX_BATCH_TO_RING > 1)
-  cur_tsc = rdtsc();
-  _sq_batch_counter++;
-  if(_unlikely(_sq_batch_counter >= SQ_MAX_BATCH_TO_RING || cur_tsc - prev_tsc >= drain_tsc)) {
-#endif
-
-    ring_submission_doorbell();
-
-#if (SQ_MAX_BATCH_TO_RING > 1)
-    prev_tsc = cur_tsc;
-    _sq_batch_counter = 0;
-  }
-#endif
+  NVME_queue_stats::submitted(_tag_table->lookup(cmdid),
+                              opcode == nvme_cmd_write ? IO_STATS_OP_WRITE : 
+                              opcode == nvme_cmd_read ? IO_STATS_OP_READ : IO_STATS_OP_OTHER,
+                              num_blocks << _dev->ns(nsid)->_lba_shift);
+  commit_sub_slot(idx);
 
 #if COLLECT_STATS
   /* collect statistics */
@@ -805,11 +1091,236 @@ uint16_t NVME_IO_queue::issue_async_read(addr_t prp1,
   issued++;
 #endif 
 
-  return slot_id & 0xffff;
+  return cmdid;
+}
+
+/** 
+ * Second quadword of an SGL descriptor carried in the command DPTR
+ * 
+ */
+static INLINE addr_t sgl_dptr2(uint32_t length, uint8_t type)
+{
+  return ((addr_t) length) | (((addr_t) (type << 4)) << 56);
 }
 
+void * NVME_IO_queue::sg_list(uint16_t cmdid, addr_t * phys)
+{
+  NVME_tag_table::slot * t = _tag_table->lookup(cmdid);
+
+  /* allocated once per tag, then reused by every command on the tag */
+  if(_unlikely(t->sg_list == NULL)) {
+    t->sg_list = _dev->alloc_dma_pages(1, &t->sg_list_phys, Exokernel::Device_sysfs::DMA_TO_DEVICE);
+    assert(t->sg_list);
+    assert(t->sg_list_phys);
+  }
+
+  *phys = t->sg_list_phys;
+  return t->sg_list;
+}
+
+status_t NVME_IO_queue::resolve_ns(unsigned nsid,
+                                   off_t offset,
+                                   size_t num_blocks,
+                                   unsigned * lba_shift,
+                                   uint64_t max_blocks)
+{
+  const NVME_device::ns_info * ns = _dev->ns(nsid);
+
+  if(_unlikely(ns == NULL)) {
+    PERR("namespace (%u) is not active", nsid);
+    return Exokernel::E_INVAL;
+  }
+
+  /* NLB is a 0's based 16-bit field for IO commands, 32-bit in DSM ranges */
+  if(_unlikely(num_blocks == 0 || num_blocks > max_blocks || offset < 0 ||
+               ((uint64_t) offset + num_blocks) > ns->_nsze)) {
+    PERR("IO (lba=%ld, blocks=%lu) outside namespace (%u) of %lu blocks", 
+         offset, num_blocks, nsid, ns->_nsze);
+    return Exokernel::E_INVAL;
+  }
+
+  *lba_shift = ns->_lba_shift;
+  return Exokernel::S_OK;
+}
+
+status_t NVME_IO_queue::check_segments(const io_segment_t * segs,
+                                       unsigned nsegs,
+                                       size_t total,
+                                       uint8_t * psdt)
+{
+  assert(psdt);
+
+  if(segs == NULL || nsegs == 0 || total == 0)
+    return Exokernel::E_INVAL;
+
+  if(_max_transfer > 0 && total > _max_transfer) {
+    PERR("transfer of %lu bytes exceeds device limit (%lu bytes)", total, _max_transfer);
+    return Exokernel::E_INVAL;
+  }
+
+  size_t len = 0;
+  size_t num_pages = 0;
+  bool prp_ok = ((segs[0].phys & 0x3UL) == 0);
+  bool dword_ok = true;
+
+  for(unsigned i=0; i<nsegs; i++) {
+    const io_segment_t& seg = segs[i];
+
+    if(seg.len == 0 || seg.phys == 0)
+      return Exokernel::E_INVAL;
 
+    /* PRPs cannot describe a hole: inner boundaries must fall on pages */
+    if(i > 0 && (seg.phys & (PAGE_SIZE - 1)))
+      prp_ok = false;
+    if(i < nsegs - 1 && ((seg.phys + seg.len) & (PAGE_SIZE - 1)))
+      prp_ok = false;
 
+    if((seg.phys | seg.len) & 0x3UL)
+      dword_ok = false;
+
+    len += seg.len;
+    num_pages += ((seg.phys & (PAGE_SIZE - 1)) + seg.len + PAGE_SIZE - 1) / PAGE_SIZE;
+  }
+
+  if(len != total) {
+    PERR("segment lengths (%lu bytes) do not match transfer (%lu bytes)", len, total);
+    return Exokernel::E_INVAL;
+  }
+
+  /* PRP1 holds the first page, the remainder must fit in one list page */
+  if(prp_ok && (num_pages - 1) <= PRP_LIST_ENTRIES) {
+    *psdt = NVME_CMD_PSDT_PRP;
+    return Exokernel::S_OK;
+  }
+
+  if(_sgl_support == NVME_CTRL_SGLS_NONE ||
+     (_sgl_support == NVME_CTRL_SGLS_DWORD_ALIGNED && !dword_ok) ||
+     nsegs > SGL_LIST_ENTRIES) {
+    PERR("segments cannot be described by PRPs and controller SGL support (0x%x) is insufficient", 
+         _sgl_support);
+    return Exokernel::E_INVAL;
+  }
+
+  *psdt = NVME_CMD_PSDT_SGL;
+  return Exokernel::S_OK;
+}
+
+void NVME_IO_queue::map_segments(uint16_t cmdid,
+                                 const io_segment_t * segs,
+                                 unsigned nsegs,
+                                 uint8_t psdt,
+                                 NVME::data_ptr_t& dptr)
+{
+  addr_t list_phys = 0;
+
+  dptr.psdt = psdt;
+  dptr.dptr1 = segs[0].phys;
+  dptr.dptr2 = 0;
+
+  if(psdt == NVME_CMD_PSDT_SGL) {
+
+    if(nsegs == 1) {
+      /* single data block descriptor held in the command */
+      dptr.dptr2 = sgl_dptr2(segs[0].len, NVME_SGL_TYPE_DATA_BLOCK);
+      return;
+    }
+
+    /* last segment descriptor pointing at a list of data block descriptors */
+    struct nvme_sgl_desc * list = (struct nvme_sgl_desc *) sg_list(cmdid, &list_phys);
+    for(unsigned i=0; i<nsegs; i++) {
+      list[i].addr = segs[i].phys;
+      list[i].length = segs[i].len;
+      list[i].rsvd[0] = list[i].rsvd[1] = list[i].rsvd[2] = 0;
+      list[i].type = NVME_SGL_TYPE_DATA_BLOCK << 4;
+    }
+
+    dptr.dptr1 = list_phys;
+    dptr.dptr2 = sgl_dptr2(nsegs * sizeof(struct nvme_sgl_desc), NVME_SGL_TYPE_LAST_SEGMENT);
+    return;
+  }
+
+  /* PRP1 is the first (possibly offset) page; PRP2 is either the second
+     page or a pointer to a list of all pages after the first */
+  uint64_t * list = NULL;
+  addr_t second = 0;
+  unsigned n = 0;
+
+  for(unsigned i=0; i<nsegs; i++) {
+    addr_t page = (i == 0) ? ((segs[0].phys & ~((addr_t) PAGE_SIZE - 1)) + PAGE_SIZE) : segs[i].phys;
+    const addr_t end = segs[i].phys + segs[i].len;
+
+    for(; page < end; page += PAGE_SIZE) {
+      if(n == 0) {
+        second = page;
+      }
+      else {
+        if(n == 1) {
+          list = (uint64_t *) sg_list(cmdid, &list_phys);
+          list[0] = second;
+        }
+        assert(n < PRP_LIST_ENTRIES);
+        list[n] = page;
+      }
+      n++;
+    }
+  }
+
+  if(n == 1)
+    dptr.dptr2 = second;
+  else if(n > 1)
+    dptr.dptr2 = list_phys;
+}
+
+uint16_t NVME_IO_queue::issue_segments(const io_segment_t * segs,
+                                       unsigned nsegs,
+                                       uint8_t psdt,
+                                       off_t offset, 
+                                       size_t num_blocks,
+                                       unsigned nsid,
+                                       uint8_t opcode,
+                                       notify_callback_t callback,
+                                       void * callback_param,
+                                       unsigned batch,
+                                       uint16_t * status)
+{
+  NVME::data_ptr_t dptr;
+  uint16_t cmdid = alloc_tag(callback, callback_param, batch, status);
+
+  map_segments(cmdid, segs, nsegs, psdt, dptr);
+
+  return issue_rw(cmdid, dptr, offset, num_blocks, 
+                  false, 0, 0, nsid, 
+                  opcode);
+}
+
+uint16_t NVME_IO_queue::issue_async_read(addr_t prp1, 
+                                          off_t offset, 
+                                          size_t num_blocks,
+                                          bool sequential, 
+                                          unsigned access_freq, 
+                                          unsigned access_lat,
+                                          unsigned nsid,
+                                          notify_callback_t callback,
+                                          void * callback_param) 
+{
+  NVME::data_ptr_t dptr;
+  unsigned lba_shift;
+  uint8_t psdt;
+
+  if(resolve_ns(nsid, offset, num_blocks, &lba_shift) != Exokernel::S_OK)
+    return 0;
+
+  io_segment_t seg = { NULL, prp1, num_blocks << lba_shift };
+  if(check_segments(&seg, 1, seg.len, &psdt) != Exokernel::S_OK)
+    return 0;
+
+  uint16_t cmdid = alloc_tag(callback, callback_param, NVME_tag_table::NO_BATCH);
+  map_segments(cmdid, &seg, 1, psdt, dptr);
+
+  return issue_rw(cmdid, dptr, offset, num_blocks, 
+                  sequential, access_freq, access_lat, nsid, 
+                  nvme_cmd_read);
+}
 
 uint16_t NVME_IO_queue::issue_async_write(addr_t prp1, 
                                            off_t offset, 
@@ -817,132 +1328,426 @@ uint16_t NVME_IO_queue::issue_async_write(addr_t prp1,
                                            bool sequential, 
                                            unsigned access_freq, 
                                            unsigned access_lat,
-                                           unsigned nsid) 
+                                           unsigned nsid,
+                                           notify_callback_t callback,
+                                           void * callback_param) 
+{
+  NVME::data_ptr_t dptr;
+  unsigned lba_shift;
+  uint8_t psdt;
+
+  if(resolve_ns(nsid, offset, num_blocks, &lba_shift) != Exokernel::S_OK)
+    return 0;
+
+  io_segment_t seg = { NULL, prp1, num_blocks << lba_shift };
+  if(check_segments(&seg, 1, seg.len, &psdt) != Exokernel::S_OK)
+    return 0;
+
+  uint16_t cmdid = alloc_tag(callback, callback_param, NVME_tag_table::NO_BATCH);
+  map_segments(cmdid, &seg, 1, psdt, dptr);
+
+  return issue_rw(cmdid, dptr, offset, num_blocks, 
+                  sequential, access_freq, access_lat, nsid, 
+                  nvme_cmd_write);
+}
+
+status_t NVME_IO_queue::check_request(const io_request_t& io_desc, unsigned nsid)
 {
-  signed slot_id;
-  Submission_command_slot * sc = next_sub_slot(&slot_id);
+  unsigned lba_shift;
+  uint8_t psdt;
+
+  switch(io_desc.action) {
+  case BLOCK_READ:
+  case BLOCK_WRITE:
+  case BLOCK_COMPARE:
+    if(io_desc.action == BLOCK_COMPARE && !(_oncs & NVME_CTRL_ONCS_COMPARE)) {
+      PERR("compare not supported by controller");
+      return Exokernel::E_NOT_SUPPORTED;
+    }
+    if(resolve_ns(nsid, io_desc.offset, io_desc.num_blocks, &lba_shift) != Exokernel::S_OK)
+      return Exokernel::E_INVAL;
+    {
+      io_segment_t seg = { io_desc.buffer_virt, io_desc.buffer_phys, 
+                           io_desc.num_blocks << lba_shift };
+      if(check_segments(&seg, 1, seg.len, &psdt) != Exokernel::S_OK)
+        return Exokernel::E_INVAL;
+      if(psdt != NVME_CMD_PSDT_PRP) { /* single-buffer requests only build PRPs */
+        PERR("%s buffer does not fit a PRP data pointer",
+             io_desc.action == BLOCK_READ ? "read" :
+             io_desc.action == BLOCK_WRITE ? "write" : "compare");
+        return Exokernel::E_INVAL;
+      }
+    }
+    return Exokernel::S_OK;
+
+  case BLOCK_TRIM:
+    if(!(_oncs & NVME_CTRL_ONCS_DSM)) {
+      PERR("dataset management not supported by controller");
+      return Exokernel::E_NOT_SUPPORTED;
+    }
+    return resolve_ns(nsid, io_desc.offset, io_desc.num_blocks, &lba_shift, 0xffffffffULL);
+
+  case BLOCK_WRITE_ZEROES:
+    if(!(_oncs & NVME_CTRL_ONCS_WRITE_ZEROES)) {
+      PERR("write zeroes not supported by controller");
+      return Exokernel::E_NOT_SUPPORTED;
+    }
+    return resolve_ns(nsid, io_desc.offset, io_desc.num_blocks, &lba_shift);
+
+  default:
+    PERR("Unrecoganized Operaton !!");
+    return Exokernel::E_INVAL;
+  }
+}
+
+uint16_t NVME_IO_queue::issue_dsm(const io_request_t * ranges,
+                                  unsigned num_ranges,
+                                  unsigned nsid,
+                                  notify_callback_t callback,
+                                  void * callback_param,
+                                  unsigned batch)
+{
+  assert(num_ranges > 0 && num_ranges <= DSM_MAX_RANGES);
+  assert(sizeof(struct nvme_dsm_range) * DSM_MAX_RANGES <= PAGE_SIZE);
+
+  uint16_t cmdid = alloc_tag(callback, callback_param, batch);
+
+  /* the range list lives in the tag's list page, like a PRP list */
+  addr_t list_phys;
+  struct nvme_dsm_range * list = (struct nvme_dsm_range *) sg_list(cmdid, &list_phys);
+  for(unsigned r=0; r<num_ranges; r++) {
+    list[r].cattr = 0;
+    list[r].nlb = ranges[r].num_blocks;
+    list[r].slba = ranges[r].offset;
+  }
+
+  unsigned idx;
+  Submission_command_slot * sc = reserve_sub_slot(&idx);
   assert(sc);
 
-  Command_io_rw cmd(sc,
-                    slot_id, /* command id */
-                    nsid, /* device namespace */
-                    prp1, 
-                    offset, 
-                    num_blocks, 
-                    sequential, 
-                    access_freq, 
-                    access_lat,
-                    true);
-#if (SQ_MAX_BATCH_TO_RING > 1)
-  cur_tsc = rdtsc();
-  _sq_batch_counter++;
-  if(_unlikely(_sq_batch_counter >= SQ_MAX_BATCH_TO_RING || 
-               cur_tsc - prev_tsc >= drain_tsc)) {
-#endif
+  Command_io_dsm cmd(sc, cmdid, nsid, list_phys, num_ranges);
+  NVME_queue_stats::submitted(_tag_table->lookup(cmdid), IO_STATS_OP_OTHER, 0);
 
-    ring_submission_doorbell();
+  commit_sub_slot(idx);
+  return cmdid;
+}
 
-#if (SQ_MAX_BATCH_TO_RING > 1)
-    prev_tsc = cur_tsc;
-    _sq_batch_counter = 0;
+uint16_t NVME_IO_queue::issue_write_zeroes(off_t offset,
+                                           size_t num_blocks,
+                                           bool deallocate,
+                                           unsigned nsid,
+                                           notify_callback_t callback,
+                                           void * callback_param,
+                                           unsigned batch)
+{
+  uint16_t cmdid = alloc_tag(callback, callback_param, batch);
+
+  unsigned idx;
+  Submission_command_slot * sc = reserve_sub_slot(&idx);
+  assert(sc);
+
+  Command_io_write_zeroes cmd(sc, cmdid, nsid, offset, num_blocks, deallocate);
+  NVME_queue_stats::submitted(_tag_table->lookup(cmdid), IO_STATS_OP_OTHER, 0);
+
+  commit_sub_slot(idx);
+  return cmdid;
+}
+
+uint16_t NVME_IO_queue::issue_async_io(const io_request_t& io_desc,
+                                       unsigned nsid,
+                                       notify_callback_t callback,
+                                       void * callback_param,
+                                       uint16_t * status)
+{
+  if(check_request(io_desc, nsid) != Exokernel::S_OK)
+    return 0;
+
+  switch(io_desc.action) {
+  case BLOCK_TRIM:
+    return issue_dsm(&io_desc, 1, nsid, callback, callback_param, NVME_tag_table::NO_BATCH);
+  case BLOCK_WRITE_ZEROES:
+    return issue_write_zeroes(io_desc.offset, io_desc.num_blocks, false, nsid,
+                              callback, callback_param, NVME_tag_table::NO_BATCH);
+  default:
+    break;
   }
-#endif
 
-  return slot_id; // return command id
+  io_segment_t seg = { io_desc.buffer_virt, io_desc.buffer_phys, 
+                       io_desc.num_blocks << _dev->ns(nsid)->_lba_shift };
+
+  return issue_segments(&seg, 1, NVME_CMD_PSDT_PRP,
+                        io_desc.offset,
+                        io_desc.num_blocks,
+                        nsid,
+                        io_desc.action == BLOCK_WRITE ? nvme_cmd_write :
+                        io_desc.action == BLOCK_READ ? nvme_cmd_read : nvme_cmd_compare,
+                        callback, callback_param, NVME_tag_table::NO_BATCH, status);
+}
+
+uint16_t NVME_IO_queue::issue_async_compare(addr_t prp1,
+                                            off_t offset,
+                                            size_t num_blocks,
+                                            unsigned nsid,
+                                            notify_callback_t callback,
+                                            void * callback_param,
+                                            uint16_t * status)
+{
+  io_request_t io = { BLOCK_COMPARE, NULL, prp1, offset, num_blocks };
+  return issue_async_io(io, nsid, callback, callback_param, status);
+}
+
+uint16_t NVME_IO_queue::issue_async_write_zeroes(off_t offset,
+                                                 size_t num_blocks,
+                                                 bool deallocate,
+                                                 unsigned nsid,
+                                                 notify_callback_t callback,
+                                                 void * callback_param)
+{
+  io_request_t io = { BLOCK_WRITE_ZEROES, NULL, 0, offset, num_blocks };
+  if(check_request(io, nsid) != Exokernel::S_OK)
+    return 0;
+
+  return issue_write_zeroes(offset, num_blocks, deallocate, nsid,
+                            callback, callback_param, NVME_tag_table::NO_BATCH);
+}
+
+uint16_t NVME_IO_queue::issue_async_deallocate(const io_request_t * ranges,
+                                               unsigned num_ranges,
+                                               unsigned nsid,
+                                               notify_callback_t callback,
+                                               void * callback_param)
+{
+  assert(ranges);
+
+  /* reject the whole request before anything is queued */
+  for(unsigned r=0; r<num_ranges; r++) {
+    io_request_t io = ranges[r];
+    io.action = BLOCK_TRIM;
+    if(check_request(io, nsid) != Exokernel::S_OK)
+      return 0;
+  }
+
+  uint16_t cmdid = 0;
+  for(unsigned r=0; r<num_ranges; r+=DSM_MAX_RANGES) {
+    cmdid = issue_dsm(&ranges[r], MIN(num_ranges - r, (unsigned) DSM_MAX_RANGES), nsid,
+                      callback, callback_param, NVME_tag_table::NO_BATCH);
+  }
+
+  return cmdid;
 }
 
 uint16_t NVME_IO_queue::issue_async_io_batch(io_request_t* io_desc,
-                                             uint64_t length)
+                                             uint64_t length,
+                                             unsigned nsid)
 {
   batch_info_t bi;
   memset(&bi, 0, sizeof(batch_info_t));
   assert(length > 0);
-  assert(length < 0xffff); //otherwise, we run out of cmd ids. Keep it simple.
-  // init the batch info block, and add it to the buffer
-  // only one-time batch is considered now
-  uint16_t start_cmdid = next_cmdid();
-  uint16_t end_cmdid = next_cmdid(length);
-  //PLOG("start_cmdid = %u, end_cmdid = %u", start_cmdid, end_cmdid);
-
-  if(end_cmdid < start_cmdid) { //handling wrap-around
-    PLOG("start_cmdid = %u, end_cmdid = %u", start_cmdid, end_cmdid);
-
-    reset_cmdid();
-    start_cmdid = next_cmdid();
-    end_cmdid = next_cmdid(length);
-  
-    PLOG("Reset: start_cmdid = %u, end_cmdid = %u", start_cmdid, end_cmdid);
+  assert(length < 0xffff);
+  assert(io_desc);
+
+  /* reject the whole batch before anything is queued, and count the
+     commands (adjacent trims share one) */
+  unsigned num_cmds = 0;
+  for(uint64_t idx = 0; idx < length; ) {
+    if(check_request(io_desc[idx], nsid) != Exokernel::S_OK)
+      return 0;
+
+    if(io_desc[idx].action == BLOCK_TRIM) {
+      unsigned n = trim_run(io_desc, length, idx);
+      for(unsigned r = 1; r < n; r++)
+        if(check_request(io_desc[idx + r], nsid) != Exokernel::S_OK)
+          return 0;
+      idx += n;
+    }
+    else {
+      idx++;
+    }
+    num_cmds++;
   }
-  assert(end_cmdid >= start_cmdid);
-  
-  //check availability
-  NVME_LOOP( (!_batch_manager->is_available(start_cmdid, end_cmdid)), false);
 
-  bi.start_cmdid = start_cmdid;
-  bi.end_cmdid = end_cmdid;
-  bi.total = length;
+  bi.total = num_cmds;
   bi.counter = 0;
   //  bi.notify = NULL;
   bi.ready = true;
   bi.complete = false;
 
   //push to the buffer
-  NVME_LOOP( (!(_batch_manager->push(bi))), false);
+  unsigned batch;
+  IO_QUEUE_LOOP( (!(_batch_manager->push(bi, &batch))) );
+  _stats.batch_submitted(length);
 
-  //issue all IOs
+  //issue all IOs; each tag refers back to the batch entry
+  const unsigned lba_shift = _dev->ns(nsid)->_lba_shift;
   uint16_t cmdid = 0;
-  assert(io_desc);
 
-  for(int idx = 0; idx < length; idx++) {
+  _db_deferred = this;
+
+  for(uint64_t idx = 0; idx < length; ) {
     io_request_t* io_desc_ptr = io_desc + idx;
-    if(io_desc_ptr->action == BLOCK_READ) {
-      cmdid = issue_async_read(io_desc_ptr->buffer_phys, 
-                               io_desc_ptr->offset,
-                               io_desc_ptr->num_blocks);
 
-      PLOG("READ: issued cmdid = %u, offset = %lu(0x%lx), page_offset = %lu(0x%lx)\n", 
-           cmdid, io_desc_ptr->offset, io_desc_ptr->offset, io_desc_ptr->offset/8, io_desc_ptr->offset/8);
+    switch(io_desc_ptr->action) {
+    case BLOCK_TRIM: {
+      unsigned n = trim_run(io_desc, length, idx);
+      cmdid = issue_dsm(io_desc_ptr, n, nsid, NULL, NULL, batch);
+      idx += n;
+      continue;
+    }
+    case BLOCK_WRITE_ZEROES:
+      cmdid = issue_write_zeroes(io_desc_ptr->offset, io_desc_ptr->num_blocks, false, nsid,
+                                 NULL, NULL, batch);
+      break;
+    default: {
+      io_segment_t seg = { io_desc_ptr->buffer_virt, io_desc_ptr->buffer_phys, 
+                           io_desc_ptr->num_blocks << lba_shift };
+
+      cmdid = issue_segments(&seg, 1, NVME_CMD_PSDT_PRP,
+                             io_desc_ptr->offset,
+                             io_desc_ptr->num_blocks,
+                             nsid,
+                             io_desc_ptr->action == BLOCK_WRITE ? nvme_cmd_write :
+                             io_desc_ptr->action == BLOCK_READ ? nvme_cmd_read : nvme_cmd_compare,
+                             NULL, NULL, batch);
+      break;
+    }
+    }
 
-    } 
-    else if (io_desc_ptr->action == BLOCK_WRITE) {
+    PLOG("%s: issued cmdid = %u, offset = %lu(0x%lx), page_offset = %lu(0x%lx)\n", 
+         io_desc_ptr->action == BLOCK_WRITE ? "WRITE" : "READ",
+         cmdid, io_desc_ptr->offset, io_desc_ptr->offset, io_desc_ptr->offset/8, io_desc_ptr->offset/8);
+    idx++;
+  }
 
-      cmdid = issue_async_write(io_desc_ptr->buffer_phys, 
-                                io_desc_ptr->offset,
-                                io_desc_ptr->num_blocks);
+  _db_deferred = NULL;
+  ring_coalesced();
 
-      PLOG("WRITE: issued cmdid = %u, offset = %lu(0x%lx), page_offset = %lu(0x%lx)\n", 
-           cmdid, io_desc_ptr->offset, io_desc_ptr->offset, io_desc_ptr->offset/8, io_desc_ptr->offset/8);
+  return cmdid;
+}
 
-    } 
-    else {
+uint16_t NVME_IO_queue::issue_async_io_sg(const io_request_sg_t& io_desc,
+                                          unsigned nsid,
+                                          notify_callback_t callback,
+                                          void * callback_param)
+{
+  uint8_t psdt;
+
+  if(io_desc.action != BLOCK_READ && io_desc.action != BLOCK_WRITE) {
+    PERR("Unrecoganized Operaton !!");
+    return 0;
+  }
+
+  unsigned lba_shift;
+  if(resolve_ns(nsid, io_desc.offset, io_desc.num_blocks, &lba_shift) != Exokernel::S_OK)
+    return 0;
+
+  if(check_segments(io_desc.segments, io_desc.num_segments, 
+                    io_desc.num_blocks << lba_shift, &psdt) != Exokernel::S_OK)
+    return 0;
+
+  return issue_segments(io_desc.segments, io_desc.num_segments, psdt,
+                        io_desc.offset,
+                        io_desc.num_blocks,
+                        nsid,
+                        io_desc.action == BLOCK_WRITE ? nvme_cmd_write : nvme_cmd_read,
+                        callback, callback_param, NVME_tag_table::NO_BATCH);
+}
+
+uint16_t NVME_IO_queue::issue_async_io_sg_batch(const io_request_sg_t* io_desc,
+                                                uint64_t length,
+                                                unsigned nsid)
+{
+  batch_info_t bi;
+  memset(&bi, 0, sizeof(batch_info_t));
+  assert(length > 0);
+  assert(length < 0xffff);
+  assert(io_desc);
+
+  /* reject the whole batch before anything is queued */
+  for(unsigned idx = 0; idx < length; idx++) {
+    unsigned lba_shift;
+    uint8_t psdt;
+
+    if(io_desc[idx].action != BLOCK_READ && io_desc[idx].action != BLOCK_WRITE) {
       PERR("Unrecoganized Operaton !!");
-      assert(false);
+      return 0;
     }
-    //printf("issue cmdid = %u, offset = %lu(%lx, %lx)\n", cmdid, io_desc_ptr->offset, io_desc_ptr->offset, io_desc_ptr->offset/8);
+
+    if(resolve_ns(nsid, io_desc[idx].offset, io_desc[idx].num_blocks, &lba_shift) != Exokernel::S_OK)
+      return 0;
+
+    if(check_segments(io_desc[idx].segments, io_desc[idx].num_segments, 
+                      io_desc[idx].num_blocks << lba_shift, &psdt) != Exokernel::S_OK)
+      return 0;
   }
 
-  assert(cmdid == bi.end_cmdid);
-  return bi.end_cmdid;
+  bi.total = length;
+  bi.counter = 0;
+  bi.ready = true;
+  bi.complete = false;
+
+  unsigned batch;
+  IO_QUEUE_LOOP( (!(_batch_manager->push(bi, &batch))) );
+  _stats.batch_submitted(length);
+
+  const unsigned lba_shift = _dev->ns(nsid)->_lba_shift;
+  uint16_t cmdid = 0;
+
+  _db_deferred = this;
+
+  for(unsigned idx = 0; idx < length; idx++) {
+    const io_request_sg_t& io = io_desc[idx];
+    uint8_t psdt;
+
+    check_segments(io.segments, io.num_segments, io.num_blocks << lba_shift, &psdt);
+
+    cmdid = issue_segments(io.segments, io.num_segments, psdt,
+                           io.offset,
+                           io.num_blocks,
+                           nsid,
+                           io.action == BLOCK_WRITE ? nvme_cmd_write : nvme_cmd_read,
+                           NULL, NULL, batch);
+  }
+
+  _db_deferred = NULL;
+  ring_coalesced();
+
+  return cmdid;
 }
 
 status_t NVME_IO_queue::wait_io_completion()
 {
-  ring_submission_doorbell(); /* make sure the doorbell is rang */
+  ring_coalesced(); /* make sure the doorbell is rang */
 
-  NVME_LOOP( ( !(_batch_manager->wasEmpty()) ), false);
+  /* batched requests, then single requests issued outside the batch manager */
+  IO_QUEUE_LOOP( ( !(_batch_manager->wasEmpty()) || _tag_table->outstanding() > 0 ) );
 
+  unsigned failed = __sync_lock_test_and_set(&_unreported_errors, 0);
+  if(failed > 0) {
+    PERR("%u command(s) completed with an error (Q:%u)", failed, _queue_id);
+    return Exokernel::E_FAIL;
+  }
   return Exokernel::S_OK;
 }
 
-uint16_t NVME_IO_queue::issue_flush() 
+uint16_t NVME_IO_queue::issue_flush(unsigned nsid, notify_callback_t callback, void * callback_param) 
 {
-  signed slot_id;
-  Submission_command_slot * sc = next_sub_slot(&slot_id);
+  if(_dev->ns(nsid) == NULL) {
+    PERR("namespace (%u) is not active", nsid);
+    return 0;
+  }
+
+  uint16_t cmdid = alloc_tag(callback, callback_param, NVME_tag_table::NO_BATCH);
+
+  unsigned idx;
+  Submission_command_slot * sc = reserve_sub_slot(&idx);
   assert(sc);
 
-  Command_io_flush cmd(sc, slot_id, 1 /* nsid */);
+  Command_io_flush cmd(sc, cmdid, nsid);
+  NVME_queue_stats::submitted(_tag_table->lookup(cmdid), IO_STATS_OP_OTHER, 0);
 
-  ring_submission_doorbell();
+  /* flush is not worth holding back */
+  commit_sub_slot(idx);
+  ring_coalesced();
 
-  return slot_id;
+  return cmdid;
 }
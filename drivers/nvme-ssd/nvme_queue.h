@@ -44,6 +44,8 @@
 #include "nvme_types.h"
 #include "cq_thread.h"
 #include "nvme_batch_manager.h"
+#include "nvme_tag_table.h"
+#include "nvme_stats.h"
 
 /*
   The maximum size for either an I/O Submission Queue or an I/O
@@ -86,6 +88,13 @@ protected:
   addr_t               _cq_dma_mem_phys;
   volatile uint32_t *  _cq_db;         /* pointer to CQ doorbell */
 
+  /* shadow doorbells and EventIdx in host memory (IO queues, when the
+     controller accepted Doorbell Buffer Config); NULL otherwise */
+  volatile uint32_t *  _sq_shadow_db;
+  volatile uint32_t *  _sq_event_idx;
+  volatile uint32_t *  _cq_shadow_db;
+  volatile uint32_t *  _cq_event_idx;
+
   const unsigned       _queue_max_items;   /* maximum number of items for each queue */
 
   Submission_command_slot * _sub_cmd;  /* array of submission commands */
@@ -139,7 +148,7 @@ public:
   void setup_doorbells();
 
   /**
-   * alloc a command id
+   * alloc a command id (admin queue; IO queues allocate from their tag table)
    */
   uint16_t alloc_cmdid() {
     _cmdid_counter++;
@@ -147,29 +156,6 @@ public:
     return _cmdid_counter;
   }
 
-  /**
-   * check next available cmdid, but not really alloc the id
-   */
-  uint16_t next_cmdid() {
-    uint16_t next_id = _cmdid_counter + 1;
-    if( _unlikely(next_id == 0) ) next_id = 1;
-    return next_id;
-  }
-
-  uint16_t next_cmdid(uint16_t length) {
-    assert(length < 0xffff);
-    uint16_t next_id = _cmdid_counter + length;
-    if( _unlikely(next_id == 0 || next_id < _cmdid_counter) ) next_id++;
-    return next_id;
-  }
-
-  void reset_cmdid() {
-#ifndef DISABLE_BATCH_MANAGER_FOR_TESTIN
-    NVME_LOOP( (!(_batch_manager->can_reset_cmdid(_cmdid_counter)) ), false);
-#endif
-    _cmdid_counter = 0;
-  }
-
   /**
    * update the head of IO sub queue
    */
@@ -189,14 +175,27 @@ public:
   /**
    * called by completion thread to update batch info
    */
-  status_t update_batch_manager(uint16_t cmdid) {
-    return _batch_manager->update(cmdid);
+  status_t update_batch_manager(unsigned batch, uint16_t status) {
+    return _batch_manager->update(batch, status);
   }
 
   unsigned queue_length() const {
     return _queue_max_items;
   }
 
+  /** 
+   * Check if the submission queue is full (tail would catch head)
+   * 
+   * 
+   * @return True if no submission slot is free
+   */
+  INLINE bool sq_full() const {
+    unsigned new_tail = _sq_tail + 1;
+    if(new_tail >= _queue_max_items)
+      new_tail -= _queue_max_items;
+    return new_tail == _sq_head;
+  }
+
 
   /** 
    * Get hold of next available submission command slot.  Only
@@ -208,6 +207,15 @@ public:
    */
   Submission_command_slot * next_sub_slot(signed * slot_id);
 
+  /** 
+   * Get hold of next available submission command slot without
+   * allocating a command identifier (the caller supplies one).
+   * 
+   * 
+   * @return Pointer to cleared slot
+   */
+  Submission_command_slot * next_free_sub_slot();
+
   /** 
    * Get hold of current completion slot
    * 
@@ -221,12 +229,64 @@ public:
    * Doorbell functions
    * 
    */
+
+  /** 
+   * True if the controller asked (through EventIdx) to be told about the
+   * move from old to new_idx
+   * 
+   */
+  static INLINE bool dbbuf_need_event(uint16_t event_idx, uint16_t new_idx, uint16_t old) {
+    return (uint16_t)(new_idx - event_idx - 1) < (uint16_t)(new_idx - old);
+  }
+
+  /** 
+   * Update a doorbell, going through the shadow doorbell if there is one
+   * and only writing the MMIO register when the controller needs it
+   * 
+   */
+  INLINE bool write_doorbell(volatile uint32_t * db,
+                             volatile uint32_t * shadow_db,
+                             volatile uint32_t * event_idx,
+                             uint16_t value) {
+    if(shadow_db) {
+      wmb(); /* queue entries visible before the shadow value */
+      uint16_t old = *shadow_db;
+      *shadow_db = value;
+      mb();  /* shadow value visible before reading EventIdx */
+      if(!dbbuf_need_event(*event_idx, value, old))
+        return false;
+    }
+    *db = value;
+    return true;
+  }
+
   INLINE void ring_submission_doorbell() {
-    *(volatile uint32_t *) (_sq_db) = _sq_tail;
+    write_doorbell(_sq_db, _sq_shadow_db, _sq_event_idx, _sq_tail);
+  }
+
+  /** 
+   * Ring the SQ doorbell with a tail maintained outside the base class
+   * (multi-submitter IO queues)
+   * 
+   * @param tail New submission tail
+   * 
+   * @return True if the doorbell register was written
+   */
+  INLINE bool ring_submission_doorbell(uint16_t tail) {
+    _sq_tail = tail;
+    return write_doorbell(_sq_db, _sq_shadow_db, _sq_event_idx, tail);
+  }
+
+  /** 
+   * Most recent SQ head reported by the controller
+   * 
+   */
+  INLINE uint16_t sq_head() const { 
+    return *(volatile const uint16_t *) &_sq_head; 
   }
 
   INLINE void ring_completion_doorbell() {
-    *(volatile uint32_t *) (_cq_db) = _cq_head;
+    write_doorbell(_cq_db, _cq_shadow_db, _cq_event_idx, _cq_head);
   }
 
   /** 
@@ -314,6 +374,17 @@ public:
    */
   Completion_command_slot * get_next_completion();
 
+  /** 
+   * Check the phase tag at the completion head without consuming
+   * the entry; used for polling.
+   * 
+   * 
+   * @return True if a new completion entry is available
+   */
+  INLINE bool completion_pending() const {
+    return _comp_cmd[_cq_head].phase_tag == _cq_phase;
+  }
+
   /** 
    * Helper to get hold of device reference
    * 
@@ -381,13 +452,15 @@ public:
    * @param queue_id Identifier to use for the queue
    * @param queue_size Size of the queue in items
    * @param prp1 Physical memory area for the queue
+   * @param irq_enabled Set to false for purely polled queues
    * 
    * @return S_OK on success
    */
   status_t create_io_completion_queue(vector_t vector,
                                       unsigned queue_id,
                                       size_t queue_size,
-                                      addr_t prp1);
+                                      addr_t prp1,
+                                      bool irq_enabled=true);
 
   /** 
    * Create an IO submission queue through admin command issue
@@ -396,13 +469,15 @@ public:
    * @param queue_size Size of the queue in items
    * @param prp1 Physical memory area for the queue
    * @param cq_id Identifier of the corresponding completion queue
+   * @param priority Priority class under weighted round robin arbitration
    * 
    * @return S_OK on success
    */
   status_t create_io_submission_queue(unsigned queue_id,
                                       size_t queue_size,
                                       addr_t prp1,
-                                      unsigned cq_id);
+                                      unsigned cq_id,
+                                      NVME::sq_priority_t priority=NVME::SQ_PRIO_HIGH);
 
   /** 
    * Delete an IO submission queue through admin command issue
@@ -424,6 +499,24 @@ public:
   status_t set_queue_num(unsigned num_queues);
 
 
+  /** 
+   * Set the weighted round robin arbitration weights (Set Features,
+   * Arbitration).  Only meaningful once CC.AMS selects weighted round
+   * robin with urgent priority class.
+   * 
+   * @param burst log2 of the arbitration burst (7 = no limit)
+   * @param high_weight Weight of high priority queues (1-256)
+   * @param medium_weight Weight of medium priority queues (1-256)
+   * @param low_weight Weight of low priority queues (1-256)
+   * 
+   * @return S_OK on success, E_INVAL on bad parameters, E_FAIL if rejected
+   */
+  status_t set_arbitration(unsigned burst, 
+                           unsigned high_weight, 
+                           unsigned medium_weight, 
+                           unsigned low_weight);
+
+
   /** 
    * Format the disk
    * 
@@ -434,6 +527,19 @@ public:
   status_t issue_format(unsigned lbaf, unsigned nsid=1);
 
 
+  /** 
+   * Hand the controller host memory for shadow doorbells and EventIdx
+   * values (Doorbell Buffer Config).  Must be issued before IO queues
+   * are created.
+   * 
+   * @param dbbuf_phys Physical address of shadow doorbell page
+   * @param eventidx_phys Physical address of EventIdx page
+   * 
+   * @return S_OK on success, E_FAIL if the controller rejects the command
+   */
+  status_t issue_doorbell_buffer_config(addr_t dbbuf_phys, addr_t eventidx_phys);
+
+
   /** 
    * Configure the interrupt coalescing for a specific vector
    * 
@@ -468,13 +574,210 @@ class NVME_IO_queue;
 class NVME_IO_queue : public NVME_queues_base                       
 {
 private:
+  enum {
+    PRP_LIST_ENTRIES = PAGE_SIZE / sizeof(uint64_t),              /* one list page, no chaining */
+    SGL_LIST_ENTRIES = PAGE_SIZE / sizeof(struct nvme_sgl_desc),
+    DSM_MAX_RANGES   = 256,                                       /* per command; fills one list page */
+  };
+
 
   CQ_thread *      _cq_thread;
-  Callback_manager _callback_manager;
+  NVME_tag_table * _tag_table;         /* outstanding commands by command id */
+  bool             _inline_completion; /* submitter reaps its own CQ */
+  Exokernel::Spin_lock _reap_lock;     /* inline queues: one reaper at a time */
+  NVME::sq_priority_t _sq_priority;    /* arbitration class of the SQ */
+
+  /* Submission coalescing.  Any number of threads may submit: each
+     reserves an SQ entry with a CAS on _sq_reserved, writes its command,
+     and publishes it by advancing _sq_committed in SQ order.  The
+     doorbell is rung by the last submitter in flight, once _db_batch
+     entries are pending, or after the oldest pending entry has waited
+     _db_window cycles - so concurrent submitters share one MMIO write. */
+  boost::atomic<unsigned>   _sq_reserved;   /* next SQ index to hand out */
+  boost::atomic<unsigned>   _sq_committed;  /* entries before this index are written */
+  boost::atomic<unsigned>   _sq_rung;       /* tail last written to the doorbell */
+  boost::atomic<cpu_time_t> _db_pending_since;
+  Exokernel::Spin_lock      _db_lock;       /* serializes doorbell writes (try-lock only) */
+  unsigned                  _db_batch;
+  cpu_time_t                _db_window;
+
+  /* queue whose doorbell the calling thread holds back while it issues
+     a batch; the batch rings once after its last command */
+  static __thread NVME_IO_queue * _db_deferred;
+
+  INLINE unsigned sq_next(unsigned idx) const {
+    return (idx + 1 == _queue_max_items) ? 0 : idx + 1;
+  }
+
+  INLINE unsigned sq_pending() const {
+    unsigned committed = _sq_committed.load(boost::memory_order_relaxed);
+    unsigned rung = _sq_rung.load(boost::memory_order_relaxed);
+    return (committed >= rung) ? (committed - rung) : (committed + _queue_max_items - rung);
+  }
+
+  /** 
+   * Reserve the next SQ entry, waiting (or reaping, for inline queues)
+   * while the SQ is full.  Safe for concurrent submitters.
+   * 
+   * @param idx [out] SQ index of the entry
+   * 
+   * @return Pointer to cleared slot
+   */
+  Submission_command_slot * reserve_sub_slot(unsigned * idx);
+
+  /** 
+   * Publish a written SQ entry and ring the doorbell if this submitter
+   * is responsible for it, unless the calling thread is issuing a batch
+   * on this queue.
+   * 
+   * @param idx SQ index returned by reserve_sub_slot
+   */
+  void commit_sub_slot(unsigned idx);
+
+  /** 
+   * Write all committed entries to the SQ doorbell
+   * 
+   */
+  void ring_coalesced();
+
+  NVME_queue_stats _stats;             /* always-on telemetry */
+  volatile unsigned _unreported_errors; /* failed commands issued without a status pointer */
+
+  size_t           _max_transfer;      /* bytes per command (MDTS), 0 = unlimited */
+  unsigned         _sgl_support;       /* NVME_CTRL_SGLS_xxx */
+  unsigned         _oncs;              /* optional NVM commands (NVME_CTRL_ONCS_xxx) */
 
-  unsigned         _sq_batch_counter;
-  cpu_time_t prev_tsc, cur_tsc, diff_tsc;
-  cpu_time_t drain_tsc;
+  uint16_t alloc_tag(notify_callback_t callback, void * callback_param, unsigned batch,
+                     uint16_t * status = NULL);
+
+  /** 
+   * Get the PRP list / SGL page belonging to a tag
+   * 
+   * @param cmdid Command identifier
+   * @param phys [out] Physical address of page
+   * 
+   * @return Virtual address of page
+   */
+  void * sg_list(uint16_t cmdid, addr_t * phys);
+
+  /** 
+   * Check that a segment list can be described to the controller and
+   * choose PRPs or an SGL for it.  PRPs are used whenever the segments
+   * are page-aligned at their inner boundaries; otherwise an SGL is
+   * used if the controller supports them.
+   * 
+   * @param segs Segment array
+   * @param nsegs Number of segments
+   * @param total Transfer length in bytes
+   * @param psdt [out] NVME_CMD_PSDT_PRP or NVME_CMD_PSDT_SGL
+   * 
+   * @return S_OK, or E_INVAL if the segments cannot be described
+   */
+  status_t check_segments(const io_segment_t * segs,
+                          unsigned nsegs,
+                          size_t total,
+                          uint8_t * psdt);
+
+  /** 
+   * Validate a request against its namespace and get the LBA size
+   * 
+   * @param nsid Namespace identifier
+   * @param offset Starting LBA
+   * @param num_blocks Number of LBAs
+   * @param lba_shift [out] log2 of the namespace LBA size
+   * @param max_blocks Largest number of LBAs the command can carry
+   * 
+   * @return S_OK, or E_INVAL if the namespace is inactive or the range is outside it
+   */
+  status_t resolve_ns(unsigned nsid,
+                      off_t offset,
+                      size_t num_blocks,
+                      unsigned * lba_shift,
+                      uint64_t max_blocks = 0x10000);
+
+  /** 
+   * Check a single-buffer request of any action before anything is
+   * queued
+   * 
+   * @param io_desc IO request
+   * @param nsid Namespace identifier
+   * 
+   * @return S_OK, E_INVAL if the request is invalid, or E_NOT_SUPPORTED
+   * if the controller lacks the optional command
+   */
+  status_t check_request(const io_request_t& io_desc, unsigned nsid);
+
+  /** 
+   * Build the data pointer for a command, writing a PRP list or SGL
+   * segment into the page owned by the command's tag if needed.
+   * Segments must have been accepted by check_segments.
+   * 
+   * @param cmdid Command identifier owning the list page
+   * @param segs Segment array
+   * @param nsegs Number of segments
+   * @param psdt Data pointer type chosen by check_segments
+   * @param dptr [out] Data pointer
+   */
+  void map_segments(uint16_t cmdid,
+                    const io_segment_t * segs,
+                    unsigned nsegs,
+                    uint8_t psdt,
+                    NVME::data_ptr_t& dptr);
+
+  uint16_t issue_segments(const io_segment_t * segs,
+                          unsigned nsegs,
+                          uint8_t psdt,
+                          off_t offset, 
+                          size_t num_blocks,
+                          unsigned nsid,
+                          uint8_t opcode,
+                          notify_callback_t callback,
+                          void * callback_param,
+                          unsigned batch,
+                          uint16_t * status = NULL);
+
+  uint16_t issue_rw(uint16_t cmdid,
+                    const NVME::data_ptr_t& dptr, 
+                    off_t offset,
+                    size_t num_blocks,
+                    bool sequential, 
+                    unsigned access_freq, 
+                    unsigned access_lat,
+                    unsigned nsid,
+                    uint8_t opcode);
+
+  /** 
+   * Deallocate up to DSM_MAX_RANGES ranges with one Dataset Management
+   * command; the range list is written into the tag's list page.
+   * Ranges must have been checked.
+   * 
+   */
+  uint16_t issue_dsm(const io_request_t * ranges,
+                     unsigned num_ranges,
+                     unsigned nsid,
+                     notify_callback_t callback,
+                     void * callback_param,
+                     unsigned batch);
+
+  uint16_t issue_write_zeroes(off_t offset,
+                              size_t num_blocks,
+                              bool deallocate,
+                              unsigned nsid,
+                              notify_callback_t callback,
+                              void * callback_param,
+                              unsigned batch);
+
+  /** 
+   * Number of adjacent BLOCK_TRIM requests from index idx that go
+   * into one Dataset Management command
+   * 
+   */
+  static INLINE unsigned trim_run(const io_request_t * io_desc, uint64_t length, uint64_t idx) {
+    unsigned n = 0;
+    while(idx + n < length && n < DSM_MAX_RANGES && io_desc[idx + n].action == BLOCK_TRIM)
+      n++;
+    return n;
+  }
 
 public:
   NVME_IO_queue(NVME_device * dev, 
@@ -482,14 +785,65 @@ public:
                  vector_t base_vector, 
                  vector_t vector, 
                  unsigned core,
-                 size_t queue_len);
+                 size_t queue_len,
+                 NVME::cq_mode_t cq_mode=NVME::CQ_MODE_INTERRUPT,
+                 unsigned cq_spin_us=0,
+                 NVME::sq_priority_t sq_priority=NVME::SQ_PRIO_HIGH);
 
   ~NVME_IO_queue();
 
   void dump_info();
   void start_cq_thread();
 
-  INLINE Callback_manager * callback_manager() { return  &_callback_manager; }
+  /** 
+   * Configure submission doorbell coalescing
+   * 
+   * @param batch Ring once this many entries are pending (1 rings on every submit)
+   * @param window_us Maximum time the last submitter holds the doorbell
+   * waiting for others to join the batch (0 to ring immediately)
+   */
+  void set_doorbell_coalescing(unsigned batch, unsigned window_us);
+
+  /** 
+   * Check if the submission queue is full (multi-submitter reservation)
+   * 
+   */
+  INLINE bool sq_full() const {
+    return sq_next(_sq_reserved.load(boost::memory_order_relaxed)) == sq_head();
+  }
+
+  /** 
+   * Reap completed entries from the CQ, updating the SQ head and the
+   * batch manager, and ring the CQ doorbell.  Called by the CQ thread,
+   * or by the submitting thread itself for inline (run-to-completion)
+   * queues.  Must not be called concurrently on the same queue.
+   * 
+   * @param max Maximum number of entries to reap
+   * 
+   * @return Number of entries reaped
+   */
+  unsigned poll_completions(unsigned max = ~0U);
+
+  /** 
+   * Whether the submitting thread reaps completions for this queue
+   * 
+   */
+  INLINE bool inline_completion() const { return _inline_completion; }
+
+  /** 
+   * Arbitration priority class the SQ was created with
+   * 
+   */
+  INLINE NVME::sq_priority_t priority() const { return _sq_priority; }
+
+  INLINE NVME_tag_table * tag_table() { return _tag_table; }
+
+  /** 
+   * Queue telemetry (latency histograms, occupancy, doorbell and batch
+   * counts).  May be read while IO is in flight.
+   * 
+   */
+  INLINE const NVME_queue_stats& stats() const { return _stats; }
 
   //  Exokernel::Event _pending_reader;
   // Exokernel::Event _wake_cq_thread;
@@ -499,14 +853,15 @@ public:
    * 
    * @param prp1 Physical destination address
    * @param offset LBA offset to read from
-   * @param num_blocks Size of read in 512b blocks
-   * @param callback Callback function
-   * @param callback_param Cookie for callback
+   * @param num_blocks Size of transfer in namespace LBAs
    * @param sequential Hint to whether this is part of a sequential read or not
    * @param access_freq Hint to access frequency for this data
    * @param access_lat Hint to access latency for this data
+   * @param nsid Namespace identifier
+   * @param callback Per-command completion callback (may be NULL)
+   * @param callback_param Cookie for callback
    * 
-   * @return S_OK on success otherwise E_FAIL
+   * @return Command identifier
    */
   uint16_t issue_async_read(addr_t prp1, 
                             off_t offset,
@@ -514,7 +869,9 @@ public:
                             bool sequential=false, 
                             unsigned access_freq=0, 
                             unsigned access_lat=0,
-                            unsigned nsid=1);
+                            unsigned nsid=1,
+                            notify_callback_t callback=NULL,
+                            void * callback_param=NULL);
 
 
   /** 
@@ -522,12 +879,15 @@ public:
    * 
    * @param prp1 Physical destination address
    * @param offset LBA offset to read from
-   * @param num_blocks Size of read in 512b blocks
+   * @param num_blocks Size of transfer in namespace LBAs
    * @param sequential Hint to whether this is part of a sequential read or not
    * @param access_freq Hint to access frequency for this data
    * @param access_lat Hint to access latency for this data
+   * @param nsid Namespace identifier
+   * @param callback Per-command completion callback (may be NULL)
+   * @param callback_param Cookie for callback
    * 
-   * @return S_OK on success otherwise E_FAIL
+   * @return Command identifier
    */
   uint16_t issue_async_write(addr_t prp1, 
                              off_t offset,
@@ -535,22 +895,161 @@ public:
                              bool sequential=false, 
                              unsigned access_freq=0, 
                              unsigned access_lat=0,
-                             unsigned nsid=1);
+                             unsigned nsid=1,
+                             notify_callback_t callback=NULL,
+                             void * callback_param=NULL);
+
+
+  /** 
+   * Issue a single request of any io_action_t
+   * 
+   * @param io_desc IO request
+   * @param nsid Namespace identifier
+   * @param callback Per-command completion callback (may be NULL)
+   * @param callback_param Cookie for callback
+   * @param status Where to write the completion status (may be NULL);
+   * NVME_SC_COMPARE_FAILED reports a BLOCK_COMPARE mismatch
+   * 
+   * @return Command identifier, or 0 on invalid or unsupported request
+   */
+  uint16_t issue_async_io(const io_request_t& io_desc,
+                          unsigned nsid=1,
+                          notify_callback_t callback=NULL,
+                          void * callback_param=NULL,
+                          uint16_t * status=NULL);
+
+  /** 
+   * Issue a compare command: the controller compares the LBAs with the
+   * buffer and completes with NVME_SC_COMPARE_FAILED on mismatch.
+   * 
+   * @param prp1 Physical address of data to compare with
+   * @param offset LBA offset
+   * @param num_blocks Size in namespace LBAs
+   * @param nsid Namespace identifier
+   * @param callback Per-command completion callback (may be NULL)
+   * @param callback_param Cookie for callback
+   * @param status Where to write the completion status (may be NULL)
+   * 
+   * @return Command identifier, or 0 on invalid or unsupported request
+   */
+  uint16_t issue_async_compare(addr_t prp1,
+                               off_t offset,
+                               size_t num_blocks,
+                               unsigned nsid=1,
+                               notify_callback_t callback=NULL,
+                               void * callback_param=NULL,
+                               uint16_t * status=NULL);
 
+  /** 
+   * Issue a write zeroes command (no data transfer)
+   * 
+   * @param offset LBA offset
+   * @param num_blocks Size in namespace LBAs (up to 65536)
+   * @param deallocate Also deallocate the blocks if the controller can
+   * @param nsid Namespace identifier
+   * @param callback Per-command completion callback (may be NULL)
+   * @param callback_param Cookie for callback
+   * 
+   * @return Command identifier, or 0 on invalid or unsupported request
+   */
+  uint16_t issue_async_write_zeroes(off_t offset,
+                                    size_t num_blocks,
+                                    bool deallocate=false,
+                                    unsigned nsid=1,
+                                    notify_callback_t callback=NULL,
+                                    void * callback_param=NULL);
+
+  /** 
+   * Deallocate (trim) ranges with Dataset Management commands, up to
+   * 256 ranges per command.  Only offset and num_blocks of each request
+   * are used.
+   * 
+   * @param ranges Ranges to deallocate
+   * @param num_ranges Number of ranges (any number)
+   * @param nsid Namespace identifier
+   * @param callback Completion callback, invoked once per DSM command (may be NULL)
+   * @param callback_param Cookie for callback
+   * 
+   * @return Command identifier of the last command, or 0 on invalid or
+   * unsupported request (nothing is issued)
+   */
+  uint16_t issue_async_deallocate(const io_request_t * ranges,
+                                  unsigned num_ranges,
+                                  unsigned nsid=1,
+                                  notify_callback_t callback=NULL,
+                                  void * callback_param=NULL);
 
+  /** 
+   * Issue a batch of IO requests tracked by the batch manager.  The
+   * batch manager is single-producer, so only one thread per queue may
+   * use the batch interfaces; single IO issue is multi-submitter safe.
+   * Requests may be of any io_action_t; adjacent BLOCK_TRIM requests are
+   * merged into Dataset Management commands of up to 256 ranges.  The
+   * submission doorbell is rung once, after the last command.
+   * 
+   * @param io_desc Array of IO requests
+   * @param length Number of requests
+   * @param nsid Namespace identifier
+   * 
+   * @return Command identifier of last request, or 0 on invalid request
+   */
   uint16_t issue_async_io_batch(io_request_t* io_desc,
-                                uint64_t length);
+                                uint64_t length,
+                                unsigned nsid=1);
 
+  /** 
+   * Issue a multi-segment read or write.  The segments are described
+   * to the controller with a PRP list or, where the controller supports
+   * it and the segments are not page-aligned, an SGL.
+   * 
+   * @param io_desc Multi-segment IO request
+   * @param nsid Namespace identifier
+   * @param callback Per-command completion callback (may be NULL)
+   * @param callback_param Cookie for callback
+   * 
+   * @return Command identifier, or 0 if the segments cannot be described
+   */
+  uint16_t issue_async_io_sg(const io_request_sg_t& io_desc,
+                             unsigned nsid=1,
+                             notify_callback_t callback=NULL,
+                             void * callback_param=NULL);
 
+  /** 
+   * Issue a batch of multi-segment requests, tracked by the batch
+   * manager like issue_async_io_batch, with one doorbell write.
+   * 
+   * @param io_desc Array of multi-segment IO requests
+   * @param length Number of requests
+   * @param nsid Namespace identifier
+   * 
+   * @return Command identifier of last request, or 0 if any request
+   * cannot be described (nothing is issued)
+   */
+  uint16_t issue_async_io_sg_batch(const io_request_sg_t* io_desc,
+                                   uint64_t length,
+                                   unsigned nsid=1);
+
+
+  /** 
+   * Wait until all outstanding commands on the queue, batched or not,
+   * have completed
+   * 
+   * @return S_OK, or E_FAIL if a command issued without a status
+   * pointer (batches, async_io) completed with an error since the
+   * previous wait
+   */
   status_t wait_io_completion();
 
   /** 
    * Issue flush command
    * 
+   * @param nsid Namespace identifier
+   * @param callback Per-command completion callback (may be NULL)
+   * @param callback_param Cookie for callback
    * 
-   * @return 
+   * @return Command identifier
    */
-  uint16_t issue_flush();
+  uint16_t issue_flush(unsigned nsid=1, notify_callback_t callback=NULL, void * callback_param=NULL);
 
 };
 
@@ -65,7 +65,13 @@ struct NVME_register_map {
 #define NVME_CAP_MPSMIN(cap)	(((cap) >> 48) & 0xf)
 #define NVME_CAP_MPSMAX(cap)	(((cap) >> 51) & 0xf)
 #define NVME_CAP_NSSRS(cap)	    (((cap) >> 36) & 0x1)
-#define NVME_CAP_AMS(cap)	    (unsigned)(((cap) >> 16) & 0x3)
+#define NVME_CAP_AMS(cap)	    (unsigned)(((cap) >> 17) & 0x3)
+#define NVME_CAP_AMS_WRR      0x1 /* weighted round robin with urgent priority class */
+#define NVME_CAP_AMS_VS       0x2 /* vendor specific */
+
+#define NVME_CC_AMS_SHIFT     11
+#define NVME_CC_AMS_RR        0x0
+#define NVME_CC_AMS_WRR       0x1
 
 #define NVME_CSTS_RDY(csts)  (csts & 0x1)
 #define NVME_CSTS_CFS(csts)  ((csts >> 1) & 0x1)
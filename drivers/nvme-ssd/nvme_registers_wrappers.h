@@ -285,7 +285,9 @@ public:
     NVME_INFO("CAP: MPSMIN min memory page size = %lu\n", (1UL << (NVME_CAP_MPSMIN(_registers->cap)+12)));
     assert((1UL << (NVME_CAP_MPSMIN(_registers->cap)+12))==4096UL);
     NVME_INFO("CAP: MPSMAX max memory page size = %lu\n", (1UL << (NVME_CAP_MPSMAX(_registers->cap)+12)));
-    NVME_INFO("CAP: AMS is %s\n",NVME_CAP_AMS(_registers->cap) == 0x2 ? "weighted RR" : "vendor specific");
+    NVME_INFO("CAP: AMS weighted RR with urgent = %s, vendor specific = %s\n",
+              (NVME_CAP_AMS(_registers->cap) & NVME_CAP_AMS_WRR) ? "yes" : "no",
+              (NVME_CAP_AMS(_registers->cap) & NVME_CAP_AMS_VS) ? "yes" : "no");
     NVME_INFO("CAP: NSSRS supports sub-system reset is '%s'\n",NVME_CAP_NSSRS(_registers->cap) ? "yes" : "no");
     NVME_INFO("CAP: TO timeout %lu ms\n", NVME_CAP_TIMEOUT(_registers->cap) * 500);
 
@@ -0,0 +1,196 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+#ifndef __NVME_STATS_H__
+#define __NVME_STATS_H__
+
+#include <common/types.h>
+#include <common/cycles.h>
+#include <common/histogram.h>
+#include "nvme_tag_table.h"
+
+/** 
+ * Always-on telemetry for one IO queue.  Latencies are recorded in TSC
+ * cycles from submission to completion, keyed by operation and transfer
+ * size, and converted to nanoseconds when summarized.
+ * 
+ * Completion-side statistics are recorded by the queue's reaper alone
+ * and doorbell counts under the doorbell lock.  Batch sizes may come
+ * from several submitters and are recorded atomically.
+ */
+class NVME_queue_stats
+{
+private:
+  Log_linear_histogram _latency[IO_STATS_OPS][IO_STATS_SIZES];
+  Log_linear_histogram _queue_depth;
+  Log_linear_histogram _submit_batch;
+  Log_linear_histogram _reap_batch;
+  uint64_t             _doorbell_rings;
+  uint64_t             _doorbell_mmio;
+  uint64_t             _errors;
+
+public:
+  NVME_queue_stats() : _doorbell_rings(0), _doorbell_mmio(0), _errors(0) {
+  }
+
+  static INLINE unsigned size_class(size_t bytes) {
+    if(bytes <= 4096)   return IO_STATS_SIZE_4K;
+    if(bytes <= 32768)  return IO_STATS_SIZE_32K;
+    if(bytes <= 262144) return IO_STATS_SIZE_256K;
+    return IO_STATS_SIZE_LARGE;
+  }
+
+  /** 
+   * Stamp a command's tag as it is submitted
+   * 
+   * @param t Tag table slot of the command
+   * @param op IO_STATS_OP_xxx
+   * @param bytes Transfer size
+   */
+  static INLINE void submitted(NVME_tag_table::slot * t, unsigned op, size_t bytes) {
+    t->op = op;
+    t->size_class = size_class(bytes);
+    t->submit_tsc = rdtsc();
+  }
+
+  /** 
+   * Record a completed command (reaper only)
+   * 
+   * @param t Tag table slot of the command
+   * @param now Completion time
+   * @param outstanding Commands outstanding, including this one
+   */
+  INLINE void completed(const NVME_tag_table::slot * t, cpu_time_t now, unsigned outstanding) {
+    _latency[t->op][t->size_class].record(now - t->submit_tsc);
+    _queue_depth.record(outstanding);
+  }
+
+  /** 
+   * Count a command that completed with an error status (reaper only)
+   * 
+   */
+  INLINE void failed() {
+    _errors++;
+  }
+
+  INLINE void reaped(unsigned n) { 
+    if(n) _reap_batch.record(n); 
+  }
+
+  /** 
+   * Record a batch submission; batches may be submitted by several
+   * threads at once
+   * 
+   */
+  INLINE void batch_submitted(unsigned n) { 
+    _submit_batch.record_atomic(n); 
+  }
+
+  INLINE void doorbell(bool mmio) {
+    _doorbell_rings++;
+    if(mmio) _doorbell_mmio++;
+  }
+
+  /** 
+   * Add another queue's statistics (for whole-device totals)
+   * 
+   */
+  void merge(const NVME_queue_stats& other) {
+    for(unsigned op=0; op<IO_STATS_OPS; op++)
+      for(unsigned sz=0; sz<IO_STATS_SIZES; sz++)
+        _latency[op][sz].merge(other._latency[op][sz]);
+    _queue_depth.merge(other._queue_depth);
+    _submit_batch.merge(other._submit_batch);
+    _reap_batch.merge(other._reap_batch);
+    _doorbell_rings += other._doorbell_rings;
+    _doorbell_mmio += other._doorbell_mmio;
+    _errors += other._errors;
+  }
+
+  /** 
+   * Summarize
+   * 
+   * @param stats [out] Summary
+   * @param tsc_mhz TSC frequency used to convert cycles to nanoseconds
+   */
+  void summarize(io_stats_t * stats, unsigned long tsc_mhz) const {
+    assert(stats);
+    assert(tsc_mhz > 0);
+
+    stats->commands = 0;
+    for(unsigned op=0; op<IO_STATS_OPS; op++) {
+      for(unsigned sz=0; sz<IO_STATS_SIZES; sz++) {
+        _latency[op][sz].summarize(&stats->latency_ns[op][sz], 1000, tsc_mhz);
+        stats->commands += _latency[op][sz].count();
+      }
+    }
+    _queue_depth.summarize(&stats->queue_depth);
+    _submit_batch.summarize(&stats->submit_batch);
+    _reap_batch.summarize(&stats->reap_batch);
+    stats->doorbell_rings = _doorbell_rings;
+    stats->doorbell_mmio = _doorbell_mmio;
+    stats->errors = _errors;
+  }
+};
+
+/** 
+ * Print a statistics summary (one line per populated class)
+ * 
+ * @param stats Statistics from IBlockDevice::get_stats
+ * @param port Port the statistics belong to
+ */
+static inline void dump_io_stats(const io_stats_t& stats, unsigned port)
+{
+  static const char * op_name[IO_STATS_OPS] = { "read", "write", "other" };
+  static const char * size_name[IO_STATS_SIZES] = { "<=4K", "<=32K", "<=256K", ">256K" };
+
+  if(port == IO_STATS_ALL_PORTS)
+    printf("[stats] all queues: cmds=%lu errors=%lu", stats.commands, stats.errors);
+  else
+    printf("[stats] queue %u: cmds=%lu errors=%lu", port, stats.commands, stats.errors);
+
+  printf(" qd(mean=%lu p99=%lu max=%lu) db/cmd=%.3f mmio/db=%.3f batch(mean=%lu max=%lu) reap(mean=%lu max=%lu)\n",
+         stats.queue_depth.mean, stats.queue_depth.p99, stats.queue_depth.max,
+         stats.commands ? ((double) stats.doorbell_rings) / stats.commands : 0.0,
+         stats.doorbell_rings ? ((double) stats.doorbell_mmio) / stats.doorbell_rings : 0.0,
+         stats.submit_batch.mean, stats.submit_batch.max,
+         stats.reap_batch.mean, stats.reap_batch.max);
+
+  for(unsigned op=0; op<IO_STATS_OPS; op++) {
+    for(unsigned sz=0; sz<IO_STATS_SIZES; sz++) {
+      const io_dist_t& d = stats.latency_ns[op][sz];
+      if(d.count == 0) continue;
+      printf("[stats]   %-5s %-6s n=%-10lu lat(ns) min=%lu mean=%lu p50=%lu p90=%lu p99=%lu p999=%lu max=%lu\n",
+             op_name[op], size_name[sz], d.count,
+             d.min, d.mean, d.p50, d.p90, d.p99, d.p999, d.max);
+    }
+  }
+}
+
+#endif // __NVME_STATS_H__
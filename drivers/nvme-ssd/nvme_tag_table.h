@@ -0,0 +1,174 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+#ifndef __NVME_TAG_TABLE_H__
+#define __NVME_TAG_TABLE_H__
+
+#include <boost/atomic.hpp>
+#include <common/utils.h>
+#include <common/logging.h>
+#include "nvme_types.h"
+
+/** 
+ * Per-queue table of outstanding IO commands indexed by NVMe command
+ * identifier (tag).  Each slot holds the completion callback and cookie
+ * for exactly one command, so completions are routed in O(1) and tags
+ * are recycled individually - there is no command id counter to wrap.
+ * 
+ * Tags are allocated by any number of submitting threads and released by
+ * the (single) thread that reaps the completion queue.  The free list is a
+ * ring indexed by monotonic counters; submitters claim entries with a CAS
+ * on the head, so neither side takes a lock.
+ * 
+ * @param num_tags Number of tags (maximum outstanding commands)
+ */
+class NVME_tag_table
+{
+public:
+  enum { 
+    NO_BATCH = ~0U,
+  };
+
+  struct slot {
+    notify_callback_t callback; /* per-command completion callback */
+    void *            cookie;   /* user parameter for callback */
+    uint16_t *        status;   /* completion status written here (may be NULL) */
+    unsigned          batch;    /* batch manager entry or NO_BATCH */
+    void *            sg_list;  /* PRP list / SGL page, allocated on first use and kept */
+    addr_t            sg_list_phys;
+    cpu_time_t        submit_tsc; /* telemetry: submission time */
+    uint8_t           op;         /* telemetry: IO_STATS_OP_xxx */
+    uint8_t           size_class; /* telemetry: IO_STATS_SIZE_xxx */
+  };
+
+private:
+  const unsigned          _num_tags;
+  unsigned                _ring_mask;  /* ring size is a power of 2 >= num_tags */
+  slot *                  _slots;
+  uint16_t *              _free;       /* ring of free tags */
+  boost::atomic<uint64_t> _free_head;  /* consumed by submitters */
+  boost::atomic<uint64_t> _free_tail;  /* produced by completion reaper */
+
+public:
+  NVME_tag_table(unsigned num_tags) : _num_tags(num_tags), _free_head(0), _free_tail(0) {
+    assert(num_tags > 0);
+    assert(num_tags < 0xffff);
+
+    _slots = new slot[_num_tags];
+    memset(_slots, 0, sizeof(slot) * _num_tags);
+
+    /* at most num_tags entries are ever in the ring, so it cannot overrun */
+    unsigned ring_size = 1;
+    while(ring_size < _num_tags) ring_size <<= 1;
+    _ring_mask = ring_size - 1;
+
+    /* command identifier 0 is not used */
+    _free = new uint16_t[ring_size];
+    for(unsigned t=0; t<_num_tags; t++)
+      _free[t] = t + 1;
+    _free_tail.store(_num_tags);
+  }
+
+  ~NVME_tag_table() {
+    delete [] _slots;
+    delete [] _free;
+  }
+
+  /** 
+   * Allocate a tag and bind its completion routing.  Safe for
+   * concurrent submitters.
+   * 
+   * @param callback Callback to invoke on completion (may be NULL)
+   * @param cookie Parameter passed to callback
+   * @param batch Batch manager entry to update on completion
+   * @param status Where to write the completion status (may be NULL)
+   * 
+   * @return Command identifier, or 0 if all tags are outstanding
+   */
+  uint16_t alloc(notify_callback_t callback, void * cookie, unsigned batch = NO_BATCH,
+                 uint16_t * status = NULL) {
+    uint64_t head = _free_head.load(boost::memory_order_relaxed);
+    uint16_t cmdid;
+
+    do {
+      if(head == _free_tail.load(boost::memory_order_acquire))
+        return 0;
+      cmdid = _free[head & _ring_mask];
+    } while(!_free_head.compare_exchange_weak(head, head + 1, 
+                                              boost::memory_order_acquire,
+                                              boost::memory_order_relaxed));
+
+    /* the tag is ours; its completion cannot arrive before we submit */
+    slot * s = &_slots[cmdid - 1];
+    s->callback = callback;
+    s->cookie = cookie;
+    s->batch = batch;
+    s->status = status;
+
+    return cmdid;
+  }
+
+  /** 
+   * Look up the routing for a completed command
+   * 
+   * @param cmdid Command identifier from the completion entry
+   * 
+   * @return Pointer to slot
+   */
+  INLINE slot * lookup(uint16_t cmdid) {
+    assert(cmdid > 0 && cmdid <= _num_tags);
+    return &_slots[cmdid - 1];
+  }
+
+  /** 
+   * Return a tag to the free list.  Completion reaper only.
+   * 
+   * @param cmdid Command identifier to recycle
+   */
+  void release(uint16_t cmdid) {
+    assert(cmdid > 0 && cmdid <= _num_tags);
+    const uint64_t tail = _free_tail.load(boost::memory_order_relaxed);
+    _free[tail & _ring_mask] = cmdid;
+    _free_tail.store(tail + 1, boost::memory_order_release);
+  }
+
+  /** 
+   * Number of tags currently outstanding (snapshot)
+   * 
+   */
+  unsigned outstanding() const {
+    uint64_t head = _free_head.load();
+    uint64_t tail = _free_tail.load();
+    return _num_tags - (unsigned)(tail - head);
+  }
+
+  unsigned size() const { return _num_tags; }
+};
+
+#endif // __NVME_TAG_TABLE_H__
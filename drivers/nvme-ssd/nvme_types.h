@@ -42,9 +42,33 @@ namespace NVME
     QTYPE_COMP=0x1,
   } queue_type_t;
 
+  /* how the CQ thread discovers new completion entries */
+  typedef enum {
+    CQ_MODE_INTERRUPT=0x0, /* block on MSI-X for every wakeup */
+    CQ_MODE_POLL=0x1,      /* busy-poll the phase tag at the CQ head */
+    CQ_MODE_ADAPTIVE=0x2,  /* poll for a spin budget after completions, then re-arm MSI-X wait */
+    CQ_MODE_INLINE=0x3,    /* no CQ thread; the submitting thread reaps (run-to-completion) */
+  } cq_mode_t;
+
+  /* submission queue priority class (Weighted Round Robin with Urgent
+     arbitration; ignored by the controller under plain round robin) */
+  typedef enum { 
+    SQ_PRIO_URGENT=0x0, /* strict priority over the weighted classes */
+    SQ_PRIO_HIGH=0x1,
+    SQ_PRIO_MEDIUM=0x2,
+    SQ_PRIO_LOW=0x3,
+  } sq_priority_t;
+
   enum {
     BLOCK_SIZE=4096,//512,
   };
+
+  /* data pointer (DPTR) of an IO command: PRP1/PRP2, or an SGL descriptor */
+  typedef struct {
+    addr_t   dptr1;
+    addr_t   dptr2;
+    uint8_t  psdt;  /* command flags: NVME_CMD_PSDT_PRP or NVME_CMD_PSDT_SGL */
+  } data_ptr_t;
 }
 
 typedef void (*notify_callback_t)(unsigned, void *);
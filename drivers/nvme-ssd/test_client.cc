@@ -95,6 +95,11 @@ int main()
 
   itf->init_device(DEVICE_INSTANCE, "file=./config_qemu.xml");
 
+  /* device-level checks before the blast */
+  NVME_device * dev = (NVME_device *) itf->get_device();
+  sg_block_read(dev, 0);
+  stats_test(dev, 0);
+
   //  basic_test(itf);
 #ifdef QEMU
   read_blast(itf,10000);
@@ -18,10 +18,6 @@ void basic_block_read(NVME_device * dev, off_t lba) {
 
   Notify_object nobj;
 
-  /* set up call back */
-  dev->io_queue(qid)->callback_manager()->register_callback(&Notify_object::notify_callback,
-                                                            (void*)&nobj);
-
   addr_t phys = 0;
   void * p = dev->alloc_dma_pages(1,&phys);
 
@@ -33,8 +29,12 @@ void basic_block_read(NVME_device * dev, off_t lba) {
   cid = dev->block_async_read(qid,
                               phys,
                               lba, /* LBA */
-                              1); /* num blocks */
-  nobj.set_when(cid);
+                              1, /* num blocks */
+                              false, 0, 0, 1,
+                              &Notify_object::notify_callback,
+                              (void*)&nobj);
+  if(cid == 0)
+    panic("basic_block_read: submission failed");
   nobj.wait();
 
   PLOG("expected block read complete.");
@@ -51,13 +51,12 @@ void flush_test(NVME_device * dev) {
   const unsigned qid = 1;
   Notify_object nobj;
 
-  /* set up call back */
-  dev->io_queue(qid)->callback_manager()->register_callback(&Notify_object::notify_callback,
-                                                            (void*)&nobj);
-
   PLOG("Issuing flush command (qid=%u)..", qid);
-  cid = dev->io_queue(qid)->issue_flush();
-  nobj.set_when(cid);
+  cid = dev->io_queue(qid)->issue_flush(1, /* nsid */
+                                        &Notify_object::notify_callback,
+                                        (void*)&nobj);
+  if(cid == 0)
+    panic("flush_test: submission failed");
   nobj.wait();
   PLOG("Flushed OK.");
 }
@@ -69,10 +68,6 @@ void basic_block_write(NVME_device * dev, off_t lba) {
   const unsigned qid = 1;
   Notify_object nobj;
 
-  /* set up call back */
-  dev->io_queue(qid)->callback_manager()->register_callback(&Notify_object::notify_callback,
-                                                            (void*)&nobj);
-
   unsigned num_data_pages = 4;
   unsigned num_data_blocks = (PAGE_SIZE * num_data_pages) / 512;
 
@@ -94,11 +89,93 @@ void basic_block_write(NVME_device * dev, off_t lba) {
   cid = dev->block_async_write(qid,
                                phys,
                                lba, /* LBA */
-                               1);/* num blocks */
-    
-  nobj.set_when(cid);
+                               1, /* num blocks */
+                               false, 0, 0, 1,
+                               &Notify_object::notify_callback,
+                               (void*)&nobj);
+  if(cid == 0)
+    panic("basic_block_write: submission failed");
   nobj.wait();
   PLOG("******** Blocks written!!!");
 
   dev->free_dma_pages(p);
 }
+
+void sg_block_read(NVME_device * dev, off_t lba) {
+
+  PLOG("running sg_block_read..");
+
+  const unsigned qid = 1;
+  const unsigned num_segments = 4;
+  Notify_object nobj;
+
+  /* each block lands in a separately allocated page */
+  io_segment_t segs[num_segments];
+  for(unsigned i=0;i<num_segments;i++) {
+    segs[i].virt = dev->alloc_dma_pages(1,&segs[i].phys);
+    segs[i].len = NVME::BLOCK_SIZE;
+    assert(segs[i].virt);
+    assert(segs[i].phys);
+  }
+
+  io_request_sg_t io;
+  io.action = BLOCK_READ;
+  io.segments = segs;
+  io.num_segments = num_segments;
+  io.offset = lba;
+  io.num_blocks = num_segments;
+
+  uint16_t cid = dev->io_queue(qid)->issue_async_io_sg(io, 1,
+                                                       &Notify_object::notify_callback,
+                                                       (void*)&nobj);
+  if(cid == 0)
+    panic("sg_block_read: submission failed");
+  nobj.wait();
+
+  PLOG("scatter-gather read complete.");
+
+  for(unsigned i=0;i<num_segments;i++) {
+    hexdump(segs[i].virt,32);
+    dev->free_dma_pages(segs[i].virt);
+  }
+}
+
+void stats_test(NVME_device * dev, off_t lba) {
+
+  PLOG("running stats_test..");
+
+  const unsigned qid = 1;
+  const unsigned num_reads = 64;
+
+  addr_t phys = 0;
+  void * p = dev->alloc_dma_pages(1,&phys);
+  assert(p);
+  assert(phys);
+
+  for(unsigned i=0;i<num_reads;i++) {
+    Notify_object nobj;
+    uint16_t cid = dev->block_async_read(qid,
+                                         phys,
+                                         lba + i, /* LBA */
+                                         1, /* num blocks */
+                                         false, 0, 0, 1,
+                                         &Notify_object::notify_callback,
+                                         (void*)&nobj);
+    if(cid == 0)
+      panic("stats_test: read submission failed");
+    nobj.wait();
+  }
+
+  io_stats_t stats;
+  if(dev->get_stats(qid, &stats) != S_OK)
+    panic("stats_test: get_stats failed");
+  dump_io_stats(stats, qid);
+
+  /* every read falls into the same class */
+  if(stats.latency_ns[IO_STATS_OP_READ][IO_STATS_SIZE_4K].count < num_reads)
+    panic("stats_test: expected at least %u reads recorded", num_reads);
+
+  PLOG("stats_test OK.");
+
+  dev->free_dma_pages(p);
+}
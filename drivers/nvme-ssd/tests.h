@@ -1,9 +1,74 @@
 #ifndef __TESTS_H__
 #define __TESTS_H__
 
+#include <unistd.h>
 #include <common/dump_utils.h>
+#include <component/block_device_itf.h>
+#include <exo/thread.h>
 #include "nvme_device.h"
+#include "nvme_stats.h"
 
 #define QEMU 
 
+/* device-level tests (tests.cc), built into the driver library */
+void basic_block_read(NVME_device * dev, off_t lba);
+void basic_block_write(NVME_device * dev, off_t lba);
+void flush_test(NVME_device * dev);
+void sg_block_read(NVME_device * dev, off_t lba);
+void stats_test(NVME_device * dev, off_t lba);
+
+/** 
+ * Thread that periodically prints IO telemetry (latency percentiles,
+ * queue depth, doorbell and batch counts) for a range of ports while a
+ * test runs.  Stopped by join().
+ * 
+ */
+class Stats_dump_thread : public Exokernel::Base_thread
+{
+private:
+  IBlockDevice * _itf;
+  unsigned       _first_port;
+  unsigned       _last_port;
+  unsigned       _interval_ms;
+
+public:
+  Stats_dump_thread(IBlockDevice * itf, 
+                    unsigned first_port, 
+                    unsigned last_port, 
+                    unsigned interval_ms = 1000) :
+    Exokernel::Base_thread(NULL),
+    _itf(itf),
+    _first_port(first_port),
+    _last_port(last_port),
+    _interval_ms(interval_ms) {
+    assert(itf);
+  }
+
+  void dump() {
+    io_stats_t stats;
+
+    for(unsigned p=_first_port; p<=_last_port; p++) {
+      if(_itf->get_stats(&stats, p) == S_OK)
+        dump_io_stats(stats, p);
+    }
+    if(_last_port > _first_port && _itf->get_stats(&stats, IO_STATS_ALL_PORTS) == S_OK)
+      dump_io_stats(stats, IO_STATS_ALL_PORTS);
+  }
+
+  void* entry(void* param) {
+    unsigned elapsed_ms = 0;
+
+    while(!thread_should_exit()) {
+      usleep(100 * 1000);
+      elapsed_ms += 100;
+      if(elapsed_ms >= _interval_ms) {
+        dump();
+        elapsed_ms = 0;
+      }
+    }
+    dump(); /* final numbers */
+    return NULL;
+  }
+};
+
 #endif
@@ -101,26 +101,31 @@ private:
     alloc_config[0].num_blocks = 2;  // one block for RX DESC and the other for TX DESC
     alloc_config[0].alignment = 64;
     alloc_config[0].allocator_id = DESC_ALLOCATOR;
+    alloc_config[0].magazine_size = 0;
   
     alloc_config[1].block_size = PKT_MAX_SIZE;
     alloc_config[1].num_blocks = _frame_num_per_core * _rx_threads_per_nic;
     alloc_config[1].alignment = 64;
     alloc_config[1].allocator_id = PACKET_ALLOCATOR;
+    alloc_config[1].magazine_size = 32;  // per-packet hot path
   
     alloc_config[2].block_size = sizeof(struct exo_mbuf);
     alloc_config[2].num_blocks = _mbuf_num_per_core * _rx_threads_per_nic;
     alloc_config[2].alignment = 64;
     alloc_config[2].allocator_id = MBUF_ALLOCATOR;
+    alloc_config[2].magazine_size = 32;  // per-packet hot path
   
     alloc_config[3].block_size = sizeof(void *) * IXGBE_TX_MAX_BURST;
     alloc_config[3].num_blocks = _meta_data_num_per_core * _rx_threads_per_nic;
     alloc_config[3].alignment = 64;
     alloc_config[3].allocator_id = META_DATA_ALLOCATOR;
+    alloc_config[3].magazine_size = 0;
 
     alloc_config[4].block_size = 64;
     alloc_config[4].num_blocks = _net_header_num_per_core * _rx_threads_per_nic;
     alloc_config[4].alignment = 64;
     alloc_config[4].allocator_id = NET_HEADER_ALLOCATOR;
+    alloc_config[4].magazine_size = 0;
 
     alloc_config_t ** config_list = mem_arg.config_list;
     for (unsigned i = 0; i < mem_arg.num_allocators; i++) {
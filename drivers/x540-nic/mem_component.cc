@@ -180,6 +180,10 @@ Component::MemComponent::init(arg_t arg) {
                                               id,                          //debug id
                                               slab_alloc_2_str(id));       //debug desc
 
+      if (config_list[i]->magazine_size > 0) {
+        _allocator[j][i]->enable_magazines(config_list[i]->magazine_size);
+      }
+
       //populate shared memory table
       stt.type_id = SMT_MEMORY_AREA;
       stt.sub_type_id = (Exokernel::smt_sub_type_t)id;
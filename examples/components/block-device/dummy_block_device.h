@@ -25,6 +25,10 @@ public:
                     unsigned port
                     ) { return S_OK; }
 
+  status_t async_io_sg(io_request_sg_t io_request,
+                       unsigned port
+                       ) { return S_OK; }
+
   /* async batch I/O operation*/
   status_t async_io_batch(io_request_t* io_requests,
                           size_t length,
@@ -38,6 +42,12 @@ public:
                  unsigned port
                  ) { return S_OK; }
 
+  // IBlockDevice
+  //
+  status_t get_stats(io_stats_t * stats,
+                     unsigned port
+                     ) { return E_NOT_IMPL; }
+
 
 };
 
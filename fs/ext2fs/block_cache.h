@@ -44,6 +44,9 @@
 
 #include <env.h>
 #include <cycles.h>
+#include <basicstring.h>
+#include <thread.h>
+#include <semaphore.h>
 
 namespace Ext2fs
 {  
@@ -54,238 +57,683 @@ namespace Ext2fs
   };
 
   /** 
-   * This is a very simple allocator to help reduce the number
-   * of calls to env()->alloc_pages();
+   * This is the filesystem level block cache.  It caches file system
+   * block sized pages, indexed by hash and split into shards, each with
+   * its own lock, hash table, page frames and CLOCK eviction hand, so
+   * that concurrent readers of different blocks rarely contend.
+   *
+   * Misses are filled with a single device read that includes
+   * readahead: the window starts at one page and doubles while misses
+   * are sequential, up to a silo (4MB).  Sequentiality is tracked per
+   * stream (a Readahead object owned by the reader, e.g. a File), so
+   * interleaved readers do not reset each other's windows.  Each shard
+   * has its own staging buffer for misses on its pages, so misses on
+   * different shards are filled in parallel.  New pages, including readahead,
+   * start with the reference bit set so that CLOCK evicts in insertion
+   * order pages that have not been touched since; inserting readahead
+   * unreferenced would let a scan evict it before it is read.
+   *
+   * Clients that know their access pattern (e.g. file readahead) can
+   * also queue prefetches, which a worker thread fills in the
+   * background while the client consumes earlier data.  Prefetches
+   * use their own staging buffer and are issued in small pieces so
+   * that demand misses do not queue behind them.
+   *
+   * For zero-copy access a client can pin a page and read it in place
+   * through a Span; pinned frames are never reused until unpinned.  If
+   * the cache is given a shared memory name its frames are allocated
+   * from one shared region, so that other address spaces (file system
+   * clients) can map it and read spans by region offset.
    * 
    */
-  template <unsigned NUM_CHUNKS, size_t PAGES_PER_CHUNK>
-  class Simple_allocator
+  class Block_cache : public block_device_session_t
   {
-    struct Chunk {
-      Spin_lock _chunk_lock;
-      unsigned  _taken;
-      void *    _p;
+  private:
+    enum {
+      NUM_SHARDS        = 16,
+      SILO_SIZE_BYTES   = BLOCK_SIZE * BLOCKS_PER_SILO, /* readahead limit */
+      CHUNK_PAGES       = BLOCKS_PER_SILO / 8,          /* 4K pages per memory chunk (4MB) */
+      CHUNK_SIZE_BYTES  = CHUNK_PAGES * 4096,
+      PREFETCH_QUEUE    = 32,         /* pending prefetch requests (power of 2) */
+      PREFETCH_CHUNK_BYTES = 256 * 1024, /* largest single prefetch device read */
     };
 
-    Chunk _chunks[NUM_CHUNKS]; /* array of chunk entries */
+  public:
+    enum { DEFAULT_BUDGET_BYTES = SILO_SIZE_BYTES * MAX_SILOS };
+
+  private:
+    /** 
+     * Cached page frame
+     */
+    struct Page {
+      uint64_t  _key;        /* page index + 1; 0 when free */
+      byte *    _data;
+      Page *    _hash_next;
+      unsigned  _pins;       /* outstanding Spans; frame is not reused while > 0 */
+      bool      _referenced; /* CLOCK reference bit */
+    };
+
+    struct Shard;
 
   public:
-    Simple_allocator() {
-      __builtin_memset(_chunks,0,sizeof(_chunks));
-    }
+    /** 
+     * Sequential readahead state of one stream of demand misses.  Used by
+     * one reader at a time.
+     */
+    struct Readahead {
+      uint64_t  _next_page;  /* page a sequential miss would start at */
+      unsigned  _window;     /* pages read by the last miss */
+
+      Readahead() : _next_page(~0ULL), _window(1) {}
+    };
+
+    /** 
+     * Pinned, read-only reference to cached data; release with unpin().
+     * The contents stay valid (as of the time of pinning) even if the
+     * range is written or invalidated meanwhile.
+     */
+    struct Span {
+      const byte * ptr;
+      unsigned     len;
+      Page *       _page;
+      Shard *      _shard;
+    };
 
-    void * alloc()
+  private:
+
+    /** 
+     * Queued background prefetch
+     */
+    struct Prefetch_request {
+      aoff64_t  _offset;
+      unsigned  _byte_count;
+    };
+
+    /** 
+     * Worker thread that services the prefetch queue
+     */
+    class Prefetcher : public OmniOS::Thread
     {
-      for(unsigned i=0;i<NUM_CHUNKS;i++) {
-        _chunks[i]._chunk_lock.lock();
-        if(_chunks[i]._taken == 0) {
-          _chunks[i]._taken++;
-          if(_chunks[i]._p == NULL) {
-            _chunks[i]._p = env()->alloc_pages(PAGES_PER_CHUNK);
-          }
-          _chunks[i]._chunk_lock.unlock();
-          return _chunks[i]._p;
-        }
-        _chunks[i]._chunk_lock.unlock();
+    public:
+      Prefetcher(Block_cache * cache) {
+        start((void *) cache);
+      }
+
+      void entry_point(void * param) {
+        assert(param);
+        ((Block_cache *) param)->prefetch_loop();
+      }
+    };
+
+    /** 
+     * Shard of the cache; all fields but the fill state are protected by
+     * _lock.  _fill_lock serializes misses on the shard's pages and
+     * protects _staging; it is taken before any shard _lock.
+     */
+    struct Shard {
+      Spin_lock _lock;
+      Page *    _frames;
+      unsigned  _num_frames;
+      unsigned  _hand;
+      Page **   _buckets;
+      unsigned  _bucket_mask;
+      Spin_lock _fill_lock;
+      byte *    _staging;     /* allocated on the shard's first miss */
+    };
+
+    block_device_session_t * _physical_device_session;
+    size_t                   _page_size;
+    Shard                    _shards[NUM_SHARDS];
+
+    /* shared frame region; NULL when frames are private */
+    byte *                   _region;
+    size_t                   _region_size;
+    char                     _region_name[32];
+
+    /* bumped by each write before its invalidation; see insert() */
+    volatile uint64_t        _write_gen;
+
+    /* readahead stream of reads through the block device interface */
+    Spin_lock                _device_ra_lock;
+    Readahead                _device_ra;
+
+    /* background prefetch queue; protected by _prefetch_lock */
+    Spin_lock                _prefetch_lock;
+    Prefetch_request         _prefetch_queue[PREFETCH_QUEUE];
+    unsigned                 _prefetch_head;
+    unsigned                 _prefetch_tail;
+    sem_t                    _prefetch_sem;      /* one post per request, plus shutdown */
+    sem_t                    _prefetch_exit_sem; /* posted when the worker has stopped */
+    volatile bool            _prefetch_shutdown;
+    byte *                   _prefetch_staging;  /* worker only */
+    Prefetcher *             _prefetcher;
+
+    static inline uint64_t hash(uint64_t key) {
+      return key * 0x9E3779B97F4A7C15ULL;
+    }
+
+    inline Shard * shard_for(uint64_t key) {
+      return &_shards[(hash(key) >> 60) % NUM_SHARDS];
+    }
+
+    inline Page ** bucket_for(Shard * shard, uint64_t key) {
+      return &shard->_buckets[(hash(key) >> 20) & shard->_bucket_mask];
+    }
+
+    /** 
+     * Find a page in a shard (shard locked)
+     */
+    Page * lookup(Shard * shard, uint64_t key) {
+      for(Page * p = *bucket_for(shard,key); p; p = p->_hash_next) {
+        if(p->_key == key) return p;
       }
-      panic("not more chunks.");
       return NULL;
     }
 
-    void free(void * p) {
-      for(unsigned i=0;i<NUM_CHUNKS;i++) {
-        _chunks[i]._chunk_lock.lock();
-        if(_chunks[i]._p == p) {
-          _chunks[i]._taken--;
-          assert(_chunks[i]._taken == 0);
-        _chunks[i]._chunk_lock.unlock();
-          return;
+    /** 
+     * Remove a page from its hash chain (shard locked)
+     */
+    void unlink(Shard * shard, Page * page) {
+      Page ** pp = bucket_for(shard,page->_key);
+      while(*pp != page) {
+        assert(*pp);
+        pp = &(*pp)->_hash_next;
+      }
+      *pp = page->_hash_next;
+      page->_hash_next = NULL;
+      page->_key = 0;
+    }
+
+    /** 
+     * Pick a frame to (re)use with the CLOCK algorithm (shard locked)
+     * 
+     * @return Free frame, or NULL if every frame in the shard is pinned
+     */
+    Page * evict(Shard * shard) {
+      /* two sweeps: the first may only clear reference bits */
+      for(unsigned scanned=0;scanned < 2 * shard->_num_frames;scanned++) {
+        Page * p = &shard->_frames[shard->_hand];
+        shard->_hand = (shard->_hand + 1) % shard->_num_frames;
+        if(p->_pins) 
+          continue;
+        if(p->_key == 0) 
+          return p;
+        if(p->_referenced) {
+          p->_referenced = false; /* second chance */
+          continue;
         }
-        _chunks[i]._chunk_lock.unlock();
+        unlink(shard,p);
+        return p;
       }
+      return NULL;
     }
-  };
 
+    /** 
+     * Insert a page unless it is already cached
+     * 
+     * @param page_index Page index on the device
+     * @param data Page contents
+     * @param write_gen Value of _write_gen sampled before the device read
+     * that produced 'data'; the page is dropped if a write has completed
+     * since, as it may hold data older than that write
+     */
+    void insert(uint64_t page_index, const byte * data, uint64_t write_gen) {
+      uint64_t key = page_index + 1;
+      Shard * shard = shard_for(key);
+      Lock_guard guard(shard->_lock);
+
+      if(_write_gen != write_gen) 
+        return;
+
+      if(lookup(shard,key)) 
+        return;
+
+      Page * p = evict(shard);
+      if(!p) 
+        return; /* shard fully pinned; leave uncached */
+      __builtin_memcpy(p->_data,data,_page_size);
+      p->_key = key;
+      p->_referenced = true;
+      Page ** b = bucket_for(shard,key);
+      p->_hash_next = *b;
+      *b = p;
+    }
 
-  /** 
-   * This is the filesystem level block cache.  Reading multiple 
-   * sectors from the disk is more efficient than reading one
-   * sector at once.  For the moment this is a very simple
-   * cache aimed at contiguous reads - more like a prefetcher
-   * 
-   */
-  class Block_cache : public block_device_session_t
-                      
-  {
-  private:
+    /** 
+     * Copy from a cached page
+     * 
+     * @return true on hit
+     */
+    bool copy_from_cache(uint64_t page_index, unsigned in_page, unsigned count, byte * out) {
+      uint64_t key = page_index + 1;
+      Shard * shard = shard_for(key);
+      Lock_guard guard(shard->_lock);
+
+      Page * p = lookup(shard,key);
+      if(!p) 
+        return false;
+      p->_referenced = true;
+      __builtin_memcpy(out,p->_data + in_page,count);
+      return true;
+    }
 
     /** 
-     * Total number of silos in the block cache
+     * Sequential readahead policy (silo-style): the number of pages a
+     * miss at 'page' reads, given 'needed' pages of demand
      */
-    Simple_allocator<MAX_SILOS, BLOCKS_PER_SILO/8> _mem_allocator;
-    
+    unsigned readahead_pages(Readahead& ra, uint64_t page, unsigned needed) {
+      unsigned max_pages = SILO_SIZE_BYTES / _page_size;
+
+      if(page == ra._next_page) {
+        ra._window *= 2;
+        if(ra._window > max_pages) ra._window = max_pages;
+      }
+      else {
+        ra._window = 1;
+      }
+
+      unsigned num_pages = needed > ra._window ? needed : ra._window;
+      assert(num_pages <= max_pages);
+      ra._next_page = page + num_pages;
+      return num_pages;
+    }
+
     /** 
-     * A silo holds a group of contiguous blocks (4MB worth) 
+     * Fill the cache on a miss, with readahead, and copy the rest of the
+     * request out of the staging buffer
+     * 
+     * @param offset Device byte offset of the missing data
+     * @param byte_count Bytes still to read (fits in the staging buffer)
+     * @param out Destination; NULL to only fill the cache
+     * @param [out] copied Bytes copied to 'out'; less than byte_count if
+     * the page was filled (e.g. by a prefetch) while waiting for the lock
+     * @param ra Readahead stream; NULL for the block device interface stream
      * 
+     * @return S_OK on success
      */
-    class Silo {
-
-    private:
-      void *            _pages;
-      size_t            _len;
+    status_t fill(aoff64_t offset, unsigned byte_count, byte * out, unsigned& copied,
+                  Readahead * ra) {
+      uint64_t page = offset / _page_size;
+      unsigned in_page = offset % _page_size;
+      unsigned needed = (in_page + byte_count + _page_size - 1) / _page_size;
+
+      Shard * shard = shard_for(page + 1);
+      Lock_guard guard(shard->_fill_lock);
+
+      copied = _page_size - in_page;
+      if(copied > byte_count) copied = byte_count;
+      if(out ? copy_from_cache(page,in_page,copied,out) : is_cached(page))
+        return S_OK;
 
-    public:
-      enum { SILO_SIZE_BYTES = BLOCK_SIZE * BLOCKS_PER_SILO };
-      aoff64_t    _start_offset;
-      aoff64_t    _end_offset;      
-      Block_cache * _block_cache;
+      unsigned num_pages;
+      if(ra) {
+        num_pages = readahead_pages(*ra,page,needed);
+      }
+      else {
+        Lock_guard ra_guard(_device_ra_lock);
+        num_pages = readahead_pages(_device_ra,page,needed);
+      }
 
-    public:
-      Silo(Block_cache * block_cache,
-           aoff64_t offset, 
-           block_device_session_t * physical_device_session) : _block_cache(block_cache) {
-
-        _start_offset = offset & ~(0x1FFULL);   /* truncate to nearest block */        
-        _len = BLOCKS_PER_SILO * 512;
-        _end_offset = _start_offset + _len; 
-
-        //        _pages = env()->alloc_pages(_len / L4_PAGESIZE); /* hmm, we might optimize this? */
-        /* allocate memory from head allocator */
-        _pages = _block_cache->_mem_allocator.alloc();
-        assert(_pages);
-
-        /* populate pages */
-        //        OmniOS::info("Allocating silo (_start_offset=%llu,_end_offset=%llu); "
-        //                      "performing read.\n", _start_offset,_end_offset);
-      //        OmniOS::info("Silo memory @ %p\n",_pages);
-        check_ok(physical_device_session->read(_start_offset,_len,_pages));
+      if(!shard->_staging) {
+        shard->_staging = (byte *) env()->alloc_pages(CHUNK_PAGES);
+        assert(shard->_staging);
       }
+      byte * staging = shard->_staging;
+
+      uint64_t write_gen = _write_gen;
+      __sync_synchronize();
+      status_t s = _physical_device_session->read(page * _page_size,
+                                                  num_pages * _page_size,
+                                                  staging);
+      if(s != S_OK) 
+        return s;
+
+      for(unsigned i=0;i<num_pages;i++) 
+        insert(page + i, staging + (i * _page_size), write_gen);
+
+      if(out) 
+        __builtin_memcpy(out,staging + in_page,byte_count);
+      copied = byte_count;
+      return S_OK;
+    }
 
-      ~Silo() {
-        //        OmniOS::info("Silo memory @ %p..about to free.\n",_pages);
-        //        OmniOS::info("Freeing silo memory (_start_offset=%llu,_end_offset=%llu)\n",
-        //                       _start_offset,_end_offset);
+    /** 
+     * Check whether a page is cached, without touching its reference bit
+     */
+    bool is_cached(uint64_t page_index) {
+      uint64_t key = page_index + 1;
+      Shard * shard = shard_for(key);
+      Lock_guard guard(shard->_lock);
+      return lookup(shard,key) != NULL;
+    }
 
-        //        env()->free(_pages);
-        _block_cache->_mem_allocator.free(_pages);
+    /** 
+     * Bring a device range into the cache; called on the prefetcher
+     * thread.  Cached pages at either end of each piece are skipped; the
+     * sequential readahead state of demand misses is not affected.
+     * 
+     * @param offset Device byte offset
+     * @param byte_count Number of bytes (clipped to a silo)
+     * 
+     * @return S_OK on success
+     */
+    status_t prefetch(aoff64_t offset, unsigned byte_count) {
+      if(byte_count == 0) 
+        return S_OK;
+
+      const unsigned chunk_pages = PREFETCH_CHUNK_BYTES / _page_size;
+      uint64_t first = offset / _page_size;
+      uint64_t end = (offset + byte_count - 1) / _page_size + 1;
+      if(end - first > SILO_SIZE_BYTES / _page_size)
+        end = first + (SILO_SIZE_BYTES / _page_size);
+
+      for(;first < end && !_prefetch_shutdown;first += chunk_pages) {
+        uint64_t lo = first;
+        uint64_t hi = (end - first > chunk_pages) ? first + chunk_pages - 1 : end - 1;
+
+        while(lo <= hi && is_cached(lo)) lo++;
+        while(hi > lo && is_cached(hi)) hi--;
+        if(lo > hi) 
+          continue;
+
+        unsigned num_pages = hi - lo + 1;
+        uint64_t write_gen = _write_gen;
+        __sync_synchronize();
+        status_t s = _physical_device_session->read(lo * _page_size,
+                                                    num_pages * _page_size,
+                                                    _prefetch_staging);
+        if(s != S_OK) 
+          return s;
+
+        for(unsigned i=0;i<num_pages;i++) 
+          insert(lo + i, _prefetch_staging + (i * _page_size), write_gen);
       }
+      return S_OK;
+    }
 
-      /** 
-       * Read from the silo
-       * 
-       * @param offset File system offset
-       * @param byte_count Number of bytes
-       * @param buffer 
-       * 
-       * @return S_OK on success, E_FAIL if offset is not in this silo
-       */
-      status_t read(aoff64_t offset, unsigned byte_count, void * buffer) 
-      {
-        if(!((offset >= _start_offset) &&
-             ((offset + byte_count) <= _end_offset))) {
-          return E_FAIL;
+    /** 
+     * Service the prefetch queue until shutdown; called on the
+     * prefetcher thread
+     */
+    void prefetch_loop() {
+      for(;;) {
+        while(sem_wait(&_prefetch_sem) != 0) {} /* EINTR */
+        if(_prefetch_shutdown) 
+          break;
+
+        Prefetch_request req;
+        {
+          Lock_guard guard(_prefetch_lock);
+          assert(_prefetch_head != _prefetch_tail);
+          req = _prefetch_queue[_prefetch_tail % PREFETCH_QUEUE];
+          _prefetch_tail++;
         }
+        prefetch(req._offset,req._byte_count);
+      }
+      sem_post(&_prefetch_exit_sem);
+    }
 
-        byte * p = ((byte *)_pages) + (offset - _start_offset);
-        __builtin_memcpy(buffer,p,byte_count);
-        return S_OK;
+    /** 
+     * Drop cached pages in a byte range
+     */
+    void invalidate(aoff64_t offset, unsigned byte_count) {
+      uint64_t first = offset / _page_size;
+      uint64_t last = (offset + byte_count - 1) / _page_size;
+      for(uint64_t page=first;page<=last;page++) {
+        uint64_t key = page + 1;
+        Shard * shard = shard_for(key);
+        Lock_guard guard(shard->_lock);
+        Page * p = lookup(shard,key);
+        if(p) unlink(shard,p);
       }
-    };
+    }
 
-    struct Silo_entry
+  public:
+    /** 
+     * Constructor
+     * 
+     * @param physical_device_session Underlying device
+     * @param page_size Cache page size; the file system block size
+     * @param budget_bytes Memory used for cached pages (rounded down to 4MB chunks)
+     * @param shmem_name If not NULL, allocate the frames from a shared
+     * memory region of this name (see region_offset)
+     */
+    Block_cache(block_device_session_t * physical_device_session,
+                size_t page_size,
+                size_t budget_bytes = DEFAULT_BUDGET_BYTES,
+                const char * shmem_name = NULL) :
+      _physical_device_session(physical_device_session),
+      _page_size(page_size),
+      _region(NULL),
+      _region_size(0),
+      _write_gen(0),
+      _prefetch_head(0),
+      _prefetch_tail(0),
+      _prefetch_shutdown(false)
     {
-      Spin_lock _lock;
-      Silo *    _silo;
-      uint64_t  _age;
-    };
+      assert(page_size >= BLOCK_SIZE && page_size <= 4096);
+      assert((page_size & (page_size - 1)) == 0);
+
+      unsigned num_chunks = budget_bytes / CHUNK_SIZE_BYTES;
+      if(num_chunks < 1) num_chunks = 1;
+      unsigned frames_per_chunk = CHUNK_SIZE_BYTES / page_size;
+      unsigned frames_per_shard = (num_chunks * frames_per_chunk) / NUM_SHARDS;
+      assert(frames_per_shard > 0);
+
+      _prefetch_staging = (byte *) env()->alloc_pages(PREFETCH_CHUNK_BYTES / 4096);
+      assert(_prefetch_staging);
+
+      _region_name[0] = '\0';
+      if(shmem_name) {
+        assert(strlen(shmem_name) < sizeof(_region_name));
+        strcpy(_region_name,shmem_name);
+        _region_size = num_chunks * CHUNK_SIZE_BYTES;
+        status_t s = env()->shmem_alloc(_region_size,(void **) &_region,_region_name);
+        assert(s==S_OK);
+        assert(_region);
+      }
 
-    Silo_entry _silo_entries[MAX_SILOS];
-      
+      /* carve 4MB chunks into frames and deal them out to the shards */
+      byte * chunk = NULL;
+      unsigned chunk_used = frames_per_chunk;
+      unsigned next_chunk = 0;
+
+      for(unsigned s=0;s<NUM_SHARDS;s++) {
+        Shard& shard = _shards[s];
+        shard._num_frames = frames_per_shard;
+        shard._hand = 0;
+        shard._frames = new Page[frames_per_shard];
+        assert(shard._frames);
+        shard._staging = NULL;
+
+        for(unsigned f=0;f<frames_per_shard;f++) {
+          if(chunk_used == frames_per_chunk) {
+            if(_region)
+              chunk = _region + (next_chunk++ * CHUNK_SIZE_BYTES);
+            else
+              chunk = (byte *) env()->alloc_pages(CHUNK_PAGES);
+            assert(chunk);
+            chunk_used = 0;
+          }
+          Page& p = shard._frames[f];
+          p._key = 0;
+          p._data = chunk + (chunk_used++ * page_size);
+          p._hash_next = NULL;
+          p._pins = 0;
+          p._referenced = false;
+        }
 
-  private:
-    block_device_session_t * _physical_device_session;
+        unsigned num_buckets = 1;
+        while(num_buckets < frames_per_shard) num_buckets <<= 1;
+        shard._buckets = new Page*[num_buckets];
+        assert(shard._buckets);
+        __builtin_memset(shard._buckets,0,sizeof(Page*) * num_buckets);
+        shard._bucket_mask = num_buckets - 1;
+      }
+
+      sem_init(&_prefetch_sem,0,0);
+      sem_init(&_prefetch_exit_sem,0,0);
+      _prefetcher = new Prefetcher(this);
+      assert(_prefetcher);
+    }
 
     /** 
-     * Find a free silo and take the oldest and use that
-     * 
-     * 
-     * @return Best silo to use (in locked state)
+     * Destructor; stops the prefetcher (queued prefetches are dropped).
+     * No spans may be pinned.  Page memory from env()->alloc_pages is
+     * not returned, as elsewhere in the file system.
      */
-    Silo_entry * find_best_silo() {
-      Silo_entry * oldest_silo = _silo_entries;
-
-      for(unsigned i=0;i<MAX_SILOS;i++) {
-        _silo_entries[i]._lock.lock();
-        if(_silo_entries[i]._age > oldest_silo->_age) 
-          oldest_silo = &_silo_entries[i];
-        /* found free entry - short circuit */
-        if(_silo_entries[i]._age == 0) {
-          return &_silo_entries[i];
-        }
-        _silo_entries[i]._lock.unlock();
+    ~Block_cache() {
+      _prefetch_shutdown = true;
+      __sync_synchronize();
+      sem_post(&_prefetch_sem);
+      while(sem_wait(&_prefetch_exit_sem) != 0) {}
+      delete _prefetcher;
+
+      sem_destroy(&_prefetch_sem);
+      sem_destroy(&_prefetch_exit_sem);
+
+      for(unsigned s=0;s<NUM_SHARDS;s++) {
+        delete [] _shards[s]._frames;
+        delete [] _shards[s]._buckets;
       }
-      /* remove and release silo */
-      oldest_silo->_lock.lock();
-      delete oldest_silo->_silo;
-      oldest_silo->_age = 0;
-      oldest_silo->_silo = NULL;
-
-      return oldest_silo;
     }
 
     /** 
-     * Allocate a silo, either a new one (preferred) or an eviction
+     * Queue a prefetch for the background worker
      * 
-     * @param offset File system offset
+     * @param offset Device byte offset
+     * @param byte_count Number of bytes (clipped to a silo)
      * 
-     * @return Allocated silo (locked state)
+     * @return S_OK if queued, E_FAIL if the queue is full
      */
-    Silo_entry * allocate_silo(aoff64_t offset) {
-      Silo_entry * s = find_best_silo();
-      assert(s);
-      assert(s->_age == 0);
-      s->_silo = new Silo(this,offset, _physical_device_session);
-      s->_age = read_cycles();
-      /* silo is still locked */
-      return s;
+    status_t prefetch_async(aoff64_t offset, unsigned byte_count) {
+      {
+        Lock_guard guard(_prefetch_lock);
+        if(_prefetch_head - _prefetch_tail == PREFETCH_QUEUE)
+          return E_FAIL;
+        Prefetch_request& req = _prefetch_queue[_prefetch_head % PREFETCH_QUEUE];
+        req._offset = offset;
+        req._byte_count = byte_count;
+        _prefetch_head++;
+      }
+      sem_post(&_prefetch_sem);
+      return S_OK;
     }
 
     /** 
-     * Top-level function to do a read from the silos
+     * Pin the cached page holding a device offset, filling it on a miss
      * 
-     * @param offset File position byte offset
-     * @param byte_count Number of bytes 
-     * @param data Data
+     * @param offset Device byte offset
+     * @param byte_count Bytes wanted; the span stops at the page end
+     * @param [out] span Pinned span (ptr/len) to read in place
+     * @param ra Readahead stream of the caller; NULL to share the block
+     * device interface stream
      * 
-     * @return 
+     * @return S_OK on success, E_FAIL if the page could not be cached
      */
-    status_t do_silo_read(aoff64_t offset, unsigned byte_count, void * data)
-    {
-      /* first try to read from the silos */
-      for(unsigned i=0;i<MAX_SILOS;i++) {
-        if(_silo_entries[i]._silo) {
-          _silo_entries[i]._lock.lock();
-          if(_silo_entries[i]._silo->read(offset,byte_count,data)==S_OK) {
-            _silo_entries[i]._lock.unlock();
+    status_t pin(aoff64_t offset, unsigned byte_count, Span& span, Readahead * ra = NULL) {
+      uint64_t page = offset / _page_size;
+      unsigned in_page = offset % _page_size;
+      unsigned n = _page_size - in_page;
+      if(n > byte_count) n = byte_count;
+
+      uint64_t key = page + 1;
+      Shard * shard = shard_for(key);
+
+      /* the page can be evicted between the fill and the lookup; retry */
+      for(unsigned attempt=0;attempt<3;attempt++) {
+        {
+          Lock_guard guard(shard->_lock);
+          Page * p = lookup(shard,key);
+          if(p) {
+            p->_pins++;
+            p->_referenced = true;
+            span.ptr = p->_data + in_page;
+            span.len = n;
+            span._page = p;
+            span._shard = shard;
             return S_OK;
           }
-          _silo_entries[i]._lock.unlock();
         }
+        unsigned copied;
+        status_t s = fill(offset,n,NULL,copied,ra);
+        if(s != S_OK) return s;
       }
-      /* otherwise create a new silo */
-      Silo_entry * new_silo = allocate_silo(offset);
-      status_t err = new_silo->_silo->read(offset,byte_count,data);
-      assert(err == S_OK);
-      new_silo->_lock.unlock();
-      return err;
+      return E_FAIL;
     }
 
-  public:
-    // ctor
-    Block_cache(block_device_session_t * physical_device_session) :
-      _physical_device_session(physical_device_session)
+    /** 
+     * Name of the shared frame region, or NULL if frames are private
+     */
+    const char * region_name() const { 
+      return _region ? _region_name : NULL; 
+    }
+
+    /** 
+     * Size in bytes of the shared frame region
+     */
+    size_t region_size() const { 
+      return _region_size; 
+    }
+
+    /** 
+     * Offset of a pinned span's data within the shared frame region
+     */
+    size_t region_offset(const Span& span) const {
+      assert(_region);
+      assert(span.ptr >= _region && span.ptr < _region + _region_size);
+      return span.ptr - _region;
+    }
+
+    /** 
+     * Release a span obtained from pin()
+     */
+    void unpin(Span& span) {
+      assert(span._page);
+      Lock_guard guard(span._shard->_lock);
+      assert(span._page->_pins > 0);
+      span._page->_pins--;
+      span._page = NULL;
+      span.ptr = NULL;
+      span.len = 0;
+    }
+
+    /** 
+     * Read through the cache, tracking sequential misses in the caller's
+     * readahead stream
+     * 
+     * @param offset Device byte offset
+     * @param byte_count Number of bytes
+     * @param buffer Destination
+     * @param ra Readahead stream; NULL to share the block device
+     * interface stream
+     * 
+     * @return S_OK on success
+     */
+    status_t read(aoff64_t offset, unsigned byte_count, void * buffer, Readahead * ra)
     {
-      __builtin_memset(_silo_entries,0,sizeof(_silo_entries));
+      if(byte_count > SILO_SIZE_BYTES - _page_size) {
+        info("[EXT2FS]: WARNING read too big for block cache.\n");
+        return _physical_device_session->read(offset,byte_count,buffer);
+      }
+
+      byte * out = (byte *) buffer;
+      while(byte_count > 0) {
+        uint64_t page = offset / _page_size;
+        unsigned in_page = offset % _page_size;
+        unsigned n = _page_size - in_page;
+        if(n > byte_count) n = byte_count;
+
+        if(!copy_from_cache(page,in_page,n,out)) {
+          /* miss: the fill normally copies everything that is left */
+          status_t s = fill(offset,byte_count,out,n,ra);
+          if(s != S_OK) return s;
+        }
+        offset += n;
+        out += n;
+        byte_count -= n;
+      }
+      return S_OK;
     }
 
   public: 
@@ -293,12 +741,7 @@ namespace Ext2fs
     //
     status_t read(aoff64_t offset, unsigned byte_count, void * buffer) 
     {
-      if(byte_count > Silo::SILO_SIZE_BYTES) {
-        info("[EXT2FS]: WARNING read too big for block cache.\n");
-        return _physical_device_session->read(offset,byte_count,buffer);
-      }
-      else
-        return do_silo_read(offset,byte_count,buffer);
+      return read(offset,byte_count,buffer,NULL);
     }
 
     status_t dummy_read(aoff64_t offset, unsigned byte_count, void * buffer) 
@@ -308,7 +751,13 @@ namespace Ext2fs
 
     status_t write(aoff64_t offset , unsigned byte_count, void * buffer) 
     {
-      return _physical_device_session->write(offset,byte_count,buffer);
+      status_t s = _physical_device_session->write(offset,byte_count,buffer);
+      if(byte_count > 0) {
+        /* reads that raced with the device write must not cache old data */
+        __sync_fetch_and_add(&_write_gen,1);
+        invalidate(offset,byte_count);
+      }
+      return s;
     }
     
   };
@@ -303,7 +303,7 @@ namespace Ext2fs
     status_t lookup_block_and_offset(filepos_t pos, block_address_t& block, unsigned& offset ) 
     {
       Range_node<filepos_t,Logical_range_tree_node> * r = search_region(REG_CONTAINMENT,pos,1);
-      if(!r) return NULL;
+      if(!r) return E_FAIL;
 
       assert(pos >= r->lower() && pos <= r->upper());
       
@@ -159,6 +159,39 @@ public:
  Ipc::Iostream _ipc(l4_utcb());
 _ipc << ModuleId << InterfaceId << OP_seek; _ipc << file << offset;
 l4_msgtag_t res = _ipc.call(_server_cap); assert(!l4_ipc_error(res,l4_utcb())); 
+/* egress parameters */
+  status_t   result;
+_ipc >> result;
+ return result; } 
+public:
+  status_t  get_cache_region ( Shmem_handle & region , size_t &
+region_size ) { 
+/* ingress parameters */
+ Ipc::Iostream _ipc(l4_utcb());
+_ipc << ModuleId << InterfaceId << OP_get_cache_region;
+l4_msgtag_t res = _ipc.call(_server_cap); assert(!l4_ipc_error(res,l4_utcb())); 
+/* egress parameters */
+ _ipc >> region; _ipc >> region_size; status_t   result;
+_ipc >> result;
+ return result; } 
+public:
+  status_t  map_file ( file_handle_t file , unsigned long byte_count ,
+offset_t offset , size_t & num_spans ) { 
+/* ingress parameters */
+ Ipc::Iostream _ipc(l4_utcb());
+_ipc << ModuleId << InterfaceId << OP_map_file;
+_ipc << file << byte_count << offset;
+l4_msgtag_t res = _ipc.call(_server_cap); assert(!l4_ipc_error(res,l4_utcb())); 
+/* egress parameters */
+ _ipc >> num_spans; status_t   result;
+_ipc >> result;
+ return result; } 
+public:
+  status_t  unmap_file ( file_handle_t file ) { 
+/* ingress parameters */
+ Ipc::Iostream _ipc(l4_utcb());
+_ipc << ModuleId << InterfaceId << OP_unmap_file; _ipc << file;
+l4_msgtag_t res = _ipc.call(_server_cap); assert(!l4_ipc_error(res,l4_utcb())); 
 /* egress parameters */
   status_t   result;
 _ipc >> result;
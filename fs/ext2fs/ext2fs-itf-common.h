@@ -37,13 +37,15 @@
  #include <idl-ipc-common.h>
  using namespace IDL;
  #include "file/types.h"
+ #include "ext2fs_span.h"
  namespace Module { namespace Ext2fs { enum  { ModuleId = 0x4A2 } ; class Object
 : public  IPC::Object_base { 
 public:
  Object (  ) : Object_base ( ModuleId ) {  } enum  { OP_open_session = 2
 , OP_close_session = 3 , OP_open_file = 4 , OP_close_file = 5 ,
 OP_read_file_from_offset = 6 , OP_read_file = 7 , OP_read_file_info = 8 ,
-OP_read_directory_entries = 9 , OP_seek = 10 } ; }; class Filesystem_interface :
+OP_read_directory_entries = 9 , OP_seek = 10 , OP_get_cache_region = 11 ,
+OP_map_file = 12 , OP_unmap_file = 13 } ; }; class Filesystem_interface :
 public  Module::Ext2fs::Object { 
 public:
  enum  { InterfaceId = 0x9F2 } ;
@@ -75,6 +77,14 @@ public:
  virtual status_t  read_directory_entries ( String pathname ,
 directory_query_flags_t flags , size_t & entries ) = 0 ; 
 public:
- virtual status_t  seek ( file_handle_t file , offset_t offset ) = 0 ;
+ virtual status_t  seek ( file_handle_t file , offset_t offset ) = 0 ; 
+public:
+ virtual status_t  get_cache_region ( Shmem_handle & region , size_t &
+region_size ) = 0 ; 
+public:
+ virtual status_t  map_file ( file_handle_t file , unsigned long byte_count ,
+offset_t offset , size_t & num_spans ) = 0 ; 
+public:
+ virtual status_t  unmap_file ( file_handle_t file ) = 0 ;
 }; } } 
 #endif
@@ -127,6 +127,23 @@ status_t  result ; _ipc >> file; _ipc >> offset; _ipc.reset();
 /* actual function call */
  result = T::seek(file,offset); 
 /* no egress params */ _ipc << result; 
+return true; } case T::OP_get_cache_region : { Shmem_handle region ; size_t
+region_size ; status_t  result ; _ipc.reset(); 
+/* actual function call */
+ result = T::get_cache_region(region,region_size);
+_ipc << region; _ipc << region_size; _ipc << result; 
+return true; } case T::OP_map_file : { file_handle_t file ; unsigned long
+byte_count ; offset_t offset ; size_t num_spans ; status_t  result ;
+_ipc >> file; _ipc >> byte_count; _ipc >> offset; _ipc.reset(); 
+/* actual function call */
+
+result = T::map_file(file,byte_count,offset,num_spans); _ipc << num_spans;
+_ipc << result; 
+return true; } case T::OP_unmap_file : { file_handle_t file ; status_t  result ;
+_ipc >> file; _ipc.reset(); 
+/* actual function call */
+ result = T::unmap_file(file); 
+/* no egress params */ _ipc << result; 
 return true; } default : { debug_stop("unknown opt. %d",op); } } } return false;
 } 
 public:
@@ -142,5 +159,9 @@ offset ) = 0 ; virtual status_t  read_file ( file_handle_t file , unsigned long
 byte_count ) = 0 ; virtual status_t  read_file_info ( file_handle_t file ,
 file_info_t & finfo ) = 0 ; virtual status_t  read_directory_entries ( String
 pathname , directory_query_flags_t flags , size_t & entries ) = 0 ; virtual
-status_t  seek ( file_handle_t file , offset_t offset ) = 0 ; }; } } 
+status_t  seek ( file_handle_t file , offset_t offset ) = 0 ; virtual status_t 
+get_cache_region ( Shmem_handle & region , size_t & region_size ) = 0 ; virtual
+status_t  map_file ( file_handle_t file , unsigned long byte_count , offset_t
+offset , size_t & num_spans ) = 0 ; virtual status_t  unmap_file ( file_handle_t
+file ) = 0 ; }; } } 
 #endif
@@ -43,6 +43,7 @@
 #define __EXT2FS_H__
 
 #define MAX_PATH_SIZE 255
+#define EXT2FS_CACHE_SHMEM_NAME "ext2fs_cache_"
 //#define VERBOSE
 
 #ifdef VERBOSE
@@ -80,7 +81,7 @@ namespace Ext2fs
 
   private:
     block_device_session_t * _physical_device_session;
-    block_device_session_t * _block_cache_session;
+    Block_cache *            _block_cache_session;
     Ext2fs::Superblock *     _super_block;
     Mbr                      _mbr;
     uint64_t                 _partition_begin_lba;
@@ -105,8 +106,16 @@ namespace Ext2fs
       _fs_block_size = _super_block->get_block_size();
       _inode_size = _super_block->get_inode_size();
 
-      /* set up block cache */
-      _block_cache_session = (block_device_session_t *) new Block_cache(_physical_device_session);
+      /* set up block cache; frames are shared so clients can map spans */
+      {
+        char region_name[32];
+        strcpy(region_name,EXT2FS_CACHE_SHMEM_NAME);
+        strcat(region_name,itoa(instance));
+        _block_cache_session = new Block_cache(_physical_device_session,
+                                               _fs_block_size,
+                                               Block_cache::DEFAULT_BUDGET_BYTES,
+                                               region_name);
+      }
       assert(_block_cache_session);
     }
 
@@ -150,6 +159,13 @@ namespace Ext2fs
      */
     unsigned fs_block_size() const { return _fs_block_size; }
 
+    /** 
+     * Return the file system block cache
+     * 
+     * @return Block cache
+     */
+    Block_cache * block_cache() { return _block_cache_session; }
+
     Ext2fs::File * open(const char * pathname);
     status_t close(Ext2fs::File * handle);
   };
@@ -63,51 +63,164 @@ status_t Ext2fs::File::read(size_t len, void * buffer) {
   return read(_pos,len,buffer);
 }
 
+status_t Ext2fs::File::next_extent(filepos_t pos, 
+                                   size_t max_bytes, 
+                                   aoff64_t& absoff, 
+                                   unsigned& byte_count) {
+  unsigned fsbs = _core->fs_block_size();
+  block_address_t block=0;
+  unsigned offset=0;
+
+  assert(max_bytes > 0);
+  status_t rc = _range_tree->lookup_block_and_offset(pos, block, offset);
+  if(rc != S_OK) return rc;
+  assert(offset < fsbs);
+
+  absoff = _core->block_to_abs_offset(block) + offset;
+  byte_count = MIN(fsbs - offset, max_bytes);
+
+  /* extend while the next logical block is the next physical block */
+  while(byte_count < max_bytes) {
+    block_address_t next_block=0;
+    rc = _range_tree->lookup_block_and_offset(pos + byte_count, next_block, offset);
+    if(rc != S_OK || next_block != block + 1) break;
+    block = next_block;
+    byte_count += MIN(fsbs, max_bytes - byte_count);
+  }
+  return S_OK;
+}
+
+void Ext2fs::File::readahead_update(filepos_t pos, size_t len) {
+  if(pos == _ra_next_pos) {
+    /* sequential: grow the window, at least to the size of the read */
+    size_t window = _ra_window ? _ra_window * 2 : RA_MIN_BYTES;
+    if(window < len) window = len;
+    _ra_window = MIN(window, (size_t) RA_MAX_BYTES);
+  }
+  else {
+    /* random: stop reading ahead until the stream becomes sequential again */
+    _ra_window = 0;
+    _ra_issued_end = 0;
+  }
+  _ra_next_pos = pos + len;
+}
+
+void Ext2fs::File::readahead_issue(filepos_t pos) {
+  if(_ra_window == 0) return;
+
+  filepos_t file_size = size_in_bytes();
+  filepos_t start = (_ra_issued_end > pos) ? _ra_issued_end : pos;
+  filepos_t limit = MIN(pos + _ra_window, file_size);
+
+  while(start < limit) {
+    aoff64_t absoff;
+    unsigned byte_count;
+    if(next_extent(start, MIN(limit - start, (filepos_t) MAX_EXTENT_BYTES), absoff, byte_count) != S_OK)
+      break;
+    if(_core->_block_cache_session->prefetch_async(absoff, byte_count) != S_OK)
+      break; /* queue is full; pick up from here on the next read */
+    start += byte_count;
+  }
+  _ra_issued_end = start;
+}
+
 status_t Ext2fs::File::read(filepos_t read_pos, size_t len, void * buffer) {
       
   status_t rc;
   //  info("read: (pos=%llu,size=%u)\n",read_pos,len);
   /* now read from the file system */
 
+  readahead_update(read_pos, len);
+
   {
     assert(buffer);
       
-    unsigned fsbs = _core->fs_block_size(); // file system block size
     filepos_t curr_pos = read_pos;
-    unsigned bytes_copied = 0;
-    block_address_t block=0;
-    unsigned offset=0;
-    unsigned bytes_to_copy;
-    unsigned bytes_remaining = len;
+    size_t bytes_remaining = len;
     char * tbuffer = (char *) buffer;
 
     // TURN ON PROFILING
     //    _core->block_device()->turn_on_profiling();
 
-    do {
+    while(bytes_remaining > 0) {
 
-      rc = _range_tree->lookup_block_and_offset(curr_pos, block, offset);
-
-      assert(rc==S_OK);
-      assert(offset < fsbs);
-      bytes_to_copy = MIN(fsbs - offset, bytes_remaining);
-
-      /* perform read */
-      aoff64_t absoff = _core->block_to_abs_offset(block) + offset;
+      /* one cache request per run of physically contiguous blocks */
+      aoff64_t absoff;
+      unsigned bytes_to_copy;
+      rc = next_extent(curr_pos, 
+                       MIN(bytes_remaining, (size_t) MAX_EXTENT_BYTES), 
+                       absoff, 
+                       bytes_to_copy);
+      if(rc != S_OK) return rc;
                  
       /* change this to dummy_read to do a null call to server */
-      _core->_block_cache_session->read(absoff,
-                                        bytes_to_copy,
-                                        &tbuffer[bytes_copied]);
-      
+      rc = _core->_block_cache_session->read(absoff,
+                                             bytes_to_copy,
+                                             tbuffer,
+                                             &_cache_ra);
+      if(rc != S_OK) return rc;
 
-      bytes_copied += bytes_to_copy;
+      tbuffer += bytes_to_copy;
       bytes_remaining -= bytes_to_copy;
       curr_pos += bytes_to_copy;
     }
-    while(bytes_copied < len);
   }
   _pos = read_pos + len;
+
+  /* prefetch what follows while the caller consumes this data */
+  readahead_issue(_pos);
       
   return S_OK;
 }
+
+status_t Ext2fs::File::map(filepos_t read_pos, 
+                           size_t len, 
+                           Block_cache::Span * spans, 
+                           unsigned max_spans, 
+                           unsigned& num_spans) {
+  assert(spans);
+  num_spans = 0;
+
+  filepos_t file_size = size_in_bytes();
+  if(read_pos >= file_size) return E_LENGTH_EXCEEDED;
+  if(read_pos + len > file_size) len = file_size - read_pos;
+
+  readahead_update(read_pos, len);
+
+  unsigned fsbs = _core->fs_block_size();
+  filepos_t curr_pos = read_pos;
+  size_t bytes_remaining = len;
+
+  while(bytes_remaining > 0 && num_spans < max_spans) {
+    block_address_t block=0;
+    unsigned offset=0;
+    status_t rc = _range_tree->lookup_block_and_offset(curr_pos, block, offset);
+    if(rc == S_OK) {
+      assert(offset < fsbs);
+      aoff64_t absoff = _core->block_to_abs_offset(block) + offset;
+      rc = _core->_block_cache_session->pin(absoff, 
+                                            MIN(fsbs - offset, bytes_remaining), 
+                                            spans[num_spans],
+                                            &_cache_ra);
+    }
+    if(rc != S_OK) {
+      unmap(spans, num_spans);
+      num_spans = 0;
+      return rc;
+    }
+
+    bytes_remaining -= spans[num_spans].len;
+    curr_pos += spans[num_spans].len;
+    num_spans++;
+  }
+  _pos = _ra_next_pos = curr_pos; /* may stop short when 'spans' is full */
+
+  readahead_issue(_pos);
+
+  return S_OK;
+}
+
+void Ext2fs::File::unmap(Block_cache::Span * spans, unsigned num_spans) {
+  for(unsigned i=0;i<num_spans;i++)
+    _core->_block_cache_session->unpin(spans[i]);
+}
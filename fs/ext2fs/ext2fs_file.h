@@ -51,6 +51,12 @@ namespace Ext2fs
     friend class Ext2fs_core;
 
   private:
+    enum {
+      RA_MIN_BYTES     = 128 * 1024,       /* initial readahead window */
+      RA_MAX_BYTES     = 16 * 1024 * 1024, /* largest readahead window */
+      MAX_EXTENT_BYTES = 1024 * 1024,      /* largest single device request */
+    };
+
     Ext2fs_core *               _core;  /* core ext2fs services */
     Inode *                     _inode; /* file system inode */
     Block_address_collective *  _block_collective; /* block collective for quick access to block list */
@@ -61,9 +67,17 @@ namespace Ext2fs
     block_address_t *           _last_block_pointer;
     block_address_t *           _last_block_pointer_index;
     md5_byte_t                  _digest[16];    
+
+    /* readahead state */
+    filepos_t                   _ra_next_pos;   /* where a sequential read would start */
+    filepos_t                   _ra_issued_end; /* end of the range already queued for prefetch */
+    size_t                      _ra_window;     /* bytes kept in flight ahead of the reader */
+    Block_cache::Readahead      _cache_ra;      /* demand-miss readahead in the block cache */
+
   public:
     // ctor
-    File(Ext2fs_core * c) : _inode(NULL), _block_collective(NULL), _pos(0) {      
+    File(Ext2fs_core * c) : _inode(NULL), _block_collective(NULL), _pos(0),
+                            _ra_next_pos(0), _ra_issued_end(0), _ra_window(0) {      
       assert(c);
       _core = c;
       _last_block_address_list = NULL;
@@ -83,6 +97,37 @@ namespace Ext2fs
     //
     status_t open_file(const char * pathname);
     status_t unlink() { panic("unlink: not implemented."); return E_FAIL; }
+
+  private:
+
+    /** 
+     * Map a file range onto the longest run of physically contiguous
+     * file system blocks starting at 'pos'.
+     * 
+     * @param pos File position (bytes)
+     * @param max_bytes Upper bound on the extent length (must not pass EOF)
+     * @param [out] absoff Absolute device offset of 'pos'
+     * @param [out] byte_count Length of the extent in bytes
+     * 
+     * @return S_OK on success
+     */
+    status_t next_extent(filepos_t pos, size_t max_bytes, aoff64_t& absoff, unsigned& byte_count);
+
+    /** 
+     * Update the sequential access detector for a read and size the
+     * readahead window accordingly.
+     * 
+     * @param pos File position of the read
+     * @param len Length of the read
+     */
+    void readahead_update(filepos_t pos, size_t len);
+
+    /** 
+     * Queue asynchronous prefetches for the readahead window following 'pos'.
+     * 
+     * @param pos File position just after the data the caller has read
+     */
+    void readahead_issue(filepos_t pos);
     
   public:
 
@@ -93,7 +138,8 @@ namespace Ext2fs
      * @param len Number of bytes to read
      * @param buffer Destination buffer
      * 
-     * @return S_OK on success
+     * @return S_OK on success, otherwise the block lookup or device read
+     * error; the file position is then left unchanged
      */
     status_t read(filepos_t read_pos, size_t len, void * buffer);
 
@@ -109,6 +155,36 @@ namespace Ext2fs
     status_t read(size_t len, void * buffer);
 
 
+    /** 
+     * Zero-copy read: pin the cache pages holding a file range and
+     * return them as (ptr,len) spans, one per file system block.  The
+     * spans must be released with unmap().  Moves the file position
+     * past the mapped data.
+     * 
+     * @param read_pos File position (bytes)
+     * @param len Number of bytes wanted (clipped to the end of file)
+     * @param spans Array to receive the spans
+     * @param max_spans Size of 'spans'; mapping stops when it is full
+     * @param [out] num_spans Number of spans returned
+     * 
+     * @return S_OK on success; nothing is left pinned on failure
+     */
+    status_t map(filepos_t read_pos, 
+                 size_t len, 
+                 Block_cache::Span * spans, 
+                 unsigned max_spans, 
+                 unsigned& num_spans);
+
+
+    /** 
+     * Release spans returned by map()
+     * 
+     * @param spans Span array
+     * @param num_spans Number of spans
+     */
+    void unmap(Block_cache::Span * spans, unsigned num_spans);
+
+
     /** 
      * Return the size in bytes of a this file
      * 
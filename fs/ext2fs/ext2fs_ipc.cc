@@ -49,11 +49,15 @@ status_t Ext2fs::Filesystem_session_impl::open_file(String pathname,
   
   EXT2FS_INFO("Ext2fs::Filesystem_session_impl::open_file [%s]\n",pathname.c_str());
 
+  Lock_guard guard(_lock);
+
   if(_curr_handle_index > MAX_ACTIVE_HANDLES) { assert(0); return E_INSUFFICIENT_RESOURCES; }
 
   File_handle * newfh = new File_handle;
   assert(newfh);
   file = newfh->_handle = _curr_handle_index++;
+  newfh->_spans = NULL;
+  newfh->_num_spans = 0;
 
   assert(_core);
   newfh->_file_obj = _core->open(pathname.c_str());
@@ -69,12 +73,16 @@ status_t Ext2fs::Filesystem_session_impl::open_file(String pathname,
 
 status_t Ext2fs::Filesystem_session_impl::close_file(file_handle_t file) {
 
+  Lock_guard guard(_lock);
+
   /* locate file in list */
   List_element<File_handle> * e = _active_handles.head();
   assert(e);
   while(e) {
     if(((File_handle*)e)->_handle == file) {
       Ext2fs::File * fobj =  ((File_handle*)e)->_file_obj;
+      release_spans((File_handle*)e);
+      delete [] ((File_handle*)e)->_spans;
       _active_handles.remove(e); /* remove from list */
       delete e;
       return _core->close(fobj);
@@ -249,3 +257,116 @@ status_t Ext2fs::Filesystem_session_impl::seek(file_handle_t fh, offset_t offset
 }
 
 
+Ext2fs::Filesystem_session_impl::File_handle * 
+Ext2fs::Filesystem_session_impl::find_handle(file_handle_t file)
+{
+  List_element<File_handle> * e = _active_handles.head();
+  while(e) {
+    if(((File_handle*)e)->_handle == file) 
+      return (File_handle*)e;
+    e = e->next();
+  }
+  return NULL;
+}
+
+
+void Ext2fs::Filesystem_session_impl::release_spans(File_handle * fh)
+{
+  assert(fh);
+  if(fh->_num_spans == 0) return;
+  fh->_file_obj->unmap(fh->_spans, fh->_num_spans);
+  assert(_num_pinned >= fh->_num_spans);
+  _num_pinned -= fh->_num_spans;
+  fh->_num_spans = 0;
+}
+
+
+void Ext2fs::Filesystem_session_impl::close_all_files()
+{
+  Lock_guard guard(_lock);
+
+  List_element<File_handle> * e;
+  while((e = _active_handles.head()) != NULL) {
+    File_handle * fh = (File_handle*)e;
+    release_spans(fh);
+    delete [] fh->_spans;
+    _active_handles.remove(e);
+    _core->close(fh->_file_obj);
+    delete fh;
+  }
+  assert(_num_pinned == 0);
+}
+
+
+status_t Ext2fs::Filesystem_session_impl::get_cache_region(Shmem_handle& region, size_t& region_size)
+{
+  assert(_core);
+  const char * name = _core->block_cache()->region_name();
+  if(!name) return E_FAIL;
+
+  region = Shmem_handle(name);
+  region_size = _core->block_cache()->region_size();
+  return S_OK;
+}
+
+
+status_t Ext2fs::Filesystem_session_impl::map_file(file_handle_t file, 
+                                                   unsigned long byte_count, 
+                                                   offset_t offset, 
+                                                   size_t& num_spans)
+{
+  num_spans = 0;
+
+  Lock_guard guard(_lock);
+
+  File_handle * fh = find_handle(file);
+  if(!fh) return E_BAD_PARAM;
+
+  Block_cache * cache = _core->block_cache();
+  if(!cache->region_name()) return E_FAIL;
+
+  if((offset + byte_count) > fh->_file_obj->size_in_bytes()) 
+    return E_LENGTH_EXCEEDED;
+
+  /* a new mapping replaces the previous one */
+  release_spans(fh);
+  if(!fh->_spans) {
+    fh->_spans = new Block_cache::Span[MAX_MAPPED_SPANS];
+    assert(fh->_spans);
+  }
+
+  unsigned max_spans = _client_shmem_size / sizeof(mapped_span_t);
+  if(max_spans > MAX_MAPPED_SPANS) max_spans = MAX_MAPPED_SPANS;
+
+  /* pinned pages cannot be evicted; bound what one session holds */
+  unsigned quota = MAX_SESSION_PINS - _num_pinned;
+  if(quota == 0) return E_INSUFFICIENT_RESOURCES;
+  if(max_spans > quota) max_spans = quota;
+
+  unsigned n = 0;
+  status_t rc = fh->_file_obj->map(offset, byte_count, fh->_spans, max_spans, n);
+  if(rc != S_OK) return rc;
+  fh->_num_spans = n;
+  _num_pinned += n;
+
+  /* descriptors go to the client; the data itself is not copied */
+  mapped_span_t * desc = (mapped_span_t *) _client_shmem;
+  for(unsigned i=0;i<n;i++) {
+    desc[i].offset = cache->region_offset(fh->_spans[i]);
+    desc[i].len = fh->_spans[i].len;
+    desc[i].reserved = 0;
+  }
+  num_spans = n;
+  return S_OK;
+}
+
+
+status_t Ext2fs::Filesystem_session_impl::unmap_file(file_handle_t file)
+{
+  Lock_guard guard(_lock);
+
+  File_handle * fh = find_handle(file);
+  if(!fh) return E_BAD_PARAM;
+  release_spans(fh);
+  return S_OK;
+}
@@ -74,20 +74,33 @@ namespace Ext2fs {
     void *                        _client_shmem;
     size_t                        _client_shmem_size;
     file_handle_t _curr_handle_index;
+    unsigned _num_pinned;             /* spans pinned across all handles */
+    Spin_lock _lock;                  /* handle list and pins; see close_all_files */
 
     struct File_handle : public List_element<File_handle> {
       Ext2fs::File * _file_obj;
       file_handle_t _handle;
+      Block_cache::Span * _spans;     /* pinned by map_file; NULL until first map */
+      unsigned _num_spans;
     };
 
     List<File_handle> _active_handles;
 
     enum {
-      MAX_ACTIVE_HANDLES = 255
+      MAX_ACTIVE_HANDLES = 255,
+      MAX_MAPPED_SPANS = 1024,  /* per file handle */
+      MAX_SESSION_PINS = 4096,  /* per session, across all file handles */
     };
 
+    File_handle * find_handle(file_handle_t file);
+    void release_spans(File_handle * fh);
+
   public:
-    Filesystem_session_impl() : _curr_handle_index(1) {
+    Filesystem_session_impl() : _core(NULL), _curr_handle_index(1), _num_pinned(0) {
+    }
+
+    ~Filesystem_session_impl() {
+      close_all_files();
     }
 
     void hook_core(Ext2fs_core * c) { assert(c); _core = c; }
@@ -107,6 +120,13 @@ namespace Ext2fs {
       _client_shmem_size = client_shmem_size;      
     }
 
+    /** 
+     * Close every open file of the session, releasing its pinned spans.
+     * Called on session teardown; the client must not have calls in
+     * flight on the session.
+     */
+    void close_all_files();
+
   public: // interface methods
     status_t open_file(String pathname, unsigned long flags, file_handle_t & file );
     status_t close_file(file_handle_t file);
@@ -115,6 +135,9 @@ namespace Ext2fs {
     status_t read_file_info(file_handle_t, file_info_t&);
     status_t read_directory_entries (String pathname, directory_query_flags_t flags, size_t & entries);
     status_t seek(file_handle_t file, offset_t offset);
+    status_t get_cache_region(Shmem_handle& region, size_t& region_size);
+    status_t map_file(file_handle_t file, unsigned long byte_count, offset_t offset, size_t& num_spans);
+    status_t unmap_file(file_handle_t file);
   };
 
   /** 
@@ -133,8 +156,11 @@ namespace Ext2fs {
       Thread_params(Ext2fs_core * c, void * s, size_t ss) : _core(c),_shmem(s),_shmem_size(ss) {}
     };
 
+    Filesystem_session_impl * volatile _session; /* set once the service loop is up */
+
   public:
-    Filesystem_session_ipc_service(Ext2fs_core * core, unsigned session_id, void * shmem, size_t shmem_size) {
+    Filesystem_session_ipc_service(Ext2fs_core * core, unsigned session_id, void * shmem, size_t shmem_size) :
+      _session(NULL) {
 
       /* build IPC endpoint label */
       {
@@ -158,6 +184,7 @@ namespace Ext2fs {
       assert(p->_core);
       _impl.get_impl_class()->configure(p->_core,p->_shmem,p->_shmem_size);
       delete p;
+      _session = _impl.get_impl_class();
                                         
       /* call IPC servicing loop */
       ipc_service_loop.run();
@@ -165,6 +192,14 @@ namespace Ext2fs {
 
     const char * label() { return _label.c_str(); }
 
+    /** 
+     * Tear down the session state: close its files and release their
+     * pinned cache spans
+     */
+    void close() {
+      if(_session) _session->close_all_files();
+    }
+
   };
 
 
@@ -222,9 +257,23 @@ namespace Ext2fs {
     }
 
 
-    status_t close_session(IPC_handle /*ipc_endpoint*/) {
-      panic("close_session not yet implemented");
-      return S_OK;
+    /** 
+     * Close a session: close its files and release the cache pages it
+     * still has pinned.  The IPC endpoint itself stays up.
+     * 
+     * @param ipc_endpoint Endpoint handle returned by open_session
+     * 
+     * @return S_OK on success, E_NOT_FOUND if there is no such session
+     */
+    status_t close_session(IPC_handle ipc_endpoint) {
+      for(unsigned i=0;i<_num_sessions;i++) {
+        if(_sessions[i] && strcmp(_sessions[i]->label(),ipc_endpoint.c_str())==0) {
+          EXT2FS_INFO("close_session: %s\n", _sessions[i]->label());
+          _sessions[i]->close();
+          return S_OK;
+        }
+      }
+      return E_NOT_FOUND;
     }
   };
 
@@ -0,0 +1,56 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+
+
+
+
+
+
+#ifndef __EXT2FS_SPAN_H__
+#define __EXT2FS_SPAN_H__
+
+#include <types.h>
+
+namespace Ext2fs
+{
+  /** 
+   * Descriptor of a zero-copy file span, as written by map_file into the
+   * session shared memory.  The data lives at 'offset' in the block cache
+   * region (see get_cache_region) and stays valid until unmap_file.
+   * 
+   */
+  struct mapped_span_t {
+    uint64_t offset;   /* byte offset in the cache region */
+    uint32_t len;      /* bytes */
+    uint32_t reserved;
+  };
+}
+
+#endif // __EXT2FS_SPAN_H__
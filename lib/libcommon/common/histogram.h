@@ -0,0 +1,194 @@
+/*
+  eXokernel Development Kit (XDK)
+
+  Based on code by Samsung Research America Copyright (C) 2013
+ 
+  The GNU C Library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  The GNU C Library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with the GNU C Library; if not, see
+  <http://www.gnu.org/licenses/>.
+
+  As a special exception, if you link the code in this file with
+  files compiled with a GNU compiler to produce an executable,
+  that does not cause the resulting executable to be covered by
+  the GNU Lesser General Public License.  This exception does not
+  however invalidate any other reasons why the executable file
+  might be covered by the GNU Lesser General Public License.
+  This exception applies to code released by its copyright holders
+  in files containing the exception.  
+*/
+
+#ifndef __COMMON_HISTOGRAM_H__
+#define __COMMON_HISTOGRAM_H__
+
+#include <string.h>
+#include <assert.h>
+#include "types.h"
+
+/** 
+ * Log-linear (HDR-style) histogram of unsigned 64-bit values.  Each
+ * power of two is split into 2^SUB_BITS equal sub-buckets, so any
+ * recorded value is reported within 1/2^SUB_BITS (6.25%) of its true
+ * value.  Values up to 2^MAX_BITS-1 are kept; larger ones saturate.
+ * 
+ * Recording is a couple of shifts and an increment and takes no lock,
+ * so each histogram should have a single writer (or use record_atomic).
+ * A concurrent reader sees a snapshot that may be slightly inconsistent,
+ * which is fine for telemetry.
+ */
+class Log_linear_histogram
+{
+public:
+  enum {
+    SUB_BITS = 4,
+    SUB_BUCKETS = 1 << SUB_BITS,
+    MAX_BITS = 48,
+    NUM_BINS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS,
+  };
+
+private:
+  uint64_t _bins[NUM_BINS];
+  uint64_t _count;
+  uint64_t _sum;
+  uint64_t _min;
+  uint64_t _max;
+
+public:
+  Log_linear_histogram() {
+    reset();
+  }
+
+  void reset() {
+    memset(_bins, 0, sizeof(_bins));
+    _count = 0;
+    _sum = 0;
+    _min = ~0ULL;
+    _max = 0;
+  }
+
+  /** 
+   * Bin holding a value
+   * 
+   */
+  static inline unsigned bin_index(uint64_t value) {
+    if(value >= (1ULL << MAX_BITS))
+      value = (1ULL << MAX_BITS) - 1;
+
+    if(value < SUB_BUCKETS)
+      return (unsigned) value;
+
+    const unsigned msb = 63 - __builtin_clzll(value);
+    return ((msb - SUB_BITS + 1) << SUB_BITS) + 
+      (unsigned)((value >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+  }
+
+  /** 
+   * Largest value that falls into a bin
+   * 
+   */
+  static inline uint64_t bin_upper(unsigned idx) {
+    assert(idx < NUM_BINS);
+    if(idx < SUB_BUCKETS)
+      return idx;
+
+    const unsigned octave = idx >> SUB_BITS;
+    const uint64_t lower = ((uint64_t) (SUB_BUCKETS + (idx & (SUB_BUCKETS - 1)))) << (octave - 1);
+    return lower + (1ULL << (octave - 1)) - 1;
+  }
+
+  inline void record(uint64_t value) {
+    _bins[bin_index(value)]++;
+    _count++;
+    _sum += value;
+    if(value < _min) _min = value;
+    if(value > _max) _max = value;
+  }
+
+  /** 
+   * Record a value when there may be several concurrent writers
+   * 
+   */
+  inline void record_atomic(uint64_t value) {
+    __sync_fetch_and_add(&_bins[bin_index(value)], 1);
+    __sync_fetch_and_add(&_count, 1);
+    __sync_fetch_and_add(&_sum, value);
+
+    uint64_t m;
+    while(value < (m = _min) && !__sync_bool_compare_and_swap(&_min, m, value)) { }
+    while(value > (m = _max) && !__sync_bool_compare_and_swap(&_max, m, value)) { }
+  }
+
+  /** 
+   * Add another histogram's samples into this one
+   * 
+   */
+  void merge(const Log_linear_histogram& other) {
+    for(unsigned i=0; i<NUM_BINS; i++)
+      _bins[i] += other._bins[i];
+    _count += other._count;
+    _sum += other._sum;
+    if(other._min < _min) _min = other._min;
+    if(other._max > _max) _max = other._max;
+  }
+
+  uint64_t count() const { return _count; }
+  uint64_t min() const { return _count ? _min : 0; }
+  uint64_t max() const { return _max; }
+  uint64_t mean() const { return _count ? _sum / _count : 0; }
+
+  /** 
+   * Value at a percentile: the smallest bin upper bound that covers
+   * that fraction of samples (clamped to the recorded maximum)
+   * 
+   * @param pct Percentile (0-100)
+   * 
+   * @return Value, or 0 if nothing has been recorded
+   */
+  uint64_t percentile(double pct) const {
+    if(_count == 0)
+      return 0;
+
+    uint64_t target = (uint64_t) ((pct / 100.0) * _count + 0.5);
+    if(target < 1) target = 1;
+    if(target > _count) target = _count;
+
+    uint64_t seen = 0;
+    for(unsigned i=0; i<NUM_BINS; i++) {
+      seen += _bins[i];
+      if(seen >= target) {
+        uint64_t v = bin_upper(i);
+        return v < _max ? v : _max;
+      }
+    }
+    return _max;
+  }
+
+  /** 
+   * Summarize into an io_dist_t, scaling values by mul/div (e.g. to
+   * convert cycles to nanoseconds)
+   * 
+   */
+  void summarize(io_dist_t * d, uint64_t mul = 1, uint64_t div = 1) const {
+    assert(d);
+    assert(div > 0);
+    d->count = _count;
+    d->min   = min() * mul / div;
+    d->mean  = mean() * mul / div;
+    d->p50   = percentile(50.0) * mul / div;
+    d->p90   = percentile(90.0) * mul / div;
+    d->p99   = percentile(99.0) * mul / div;
+    d->p999  = percentile(99.9) * mul / div;
+    d->max   = max() * mul / div;
+  }
+};
+
+#endif // __COMMON_HISTOGRAM_H__
@@ -75,7 +75,10 @@ namespace Component
 /* IO descriptor */
 enum io_action_t {
   BLOCK_READ = 0,
-  BLOCK_WRITE
+  BLOCK_WRITE,
+  BLOCK_TRIM,         /* deallocate blocks; no buffer */
+  BLOCK_WRITE_ZEROES, /* zero blocks without a data transfer; no buffer */
+  BLOCK_COMPARE,      /* compare blocks with the buffer */
 };
 
 typedef struct {
@@ -86,6 +89,63 @@ typedef struct {
   size_t      num_blocks;
 } io_request_t;
 
+/* scatter-gather segment of a multi-segment IO */
+typedef struct {
+  void*       virt;
+  addr_t      phys;
+  size_t      len;  /* bytes */
+} io_segment_t;
+
+/* multi-segment IO descriptor; segment lengths sum to num_blocks */
+typedef struct {
+  io_action_t   action;
+  io_segment_t* segments;
+  unsigned      num_segments;
+  off_t         offset;
+  size_t        num_blocks;
+} io_request_sg_t;
+
+/* IO statistics classes (see IBlockDevice::get_stats) */
+enum {
+  IO_STATS_OP_READ = 0,
+  IO_STATS_OP_WRITE,
+  IO_STATS_OP_OTHER,   /* flush, trim, write zeroes and compare */
+  IO_STATS_OPS,
+};
+
+enum {
+  IO_STATS_SIZE_4K = 0, /* up to 4KiB */
+  IO_STATS_SIZE_32K,    /* up to 32KiB */
+  IO_STATS_SIZE_256K,   /* up to 256KiB */
+  IO_STATS_SIZE_LARGE,  /* over 256KiB */
+  IO_STATS_SIZES,
+};
+
+#define IO_STATS_ALL_PORTS (~0U)
+
+/* summary of a recorded distribution */
+typedef struct {
+  uint64_t count;
+  uint64_t min;
+  uint64_t mean;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+} io_dist_t;
+
+/* per-port IO telemetry, cumulative since the device was initialized */
+typedef struct {
+  io_dist_t latency_ns[IO_STATS_OPS][IO_STATS_SIZES]; /* submission to completion */
+  io_dist_t queue_depth;    /* commands outstanding, sampled at each completion */
+  io_dist_t submit_batch;   /* requests per batch submission */
+  io_dist_t reap_batch;     /* completions reaped per pass over the completion queue */
+  uint64_t  commands;       /* commands completed */
+  uint64_t  doorbell_rings; /* submission doorbell updates */
+  uint64_t  doorbell_mmio;  /* updates that wrote the doorbell register */
+  uint64_t  errors;         /* commands completed with an error status */
+} io_stats_t;
 
 //typedef void * notify_t;
 
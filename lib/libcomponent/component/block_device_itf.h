@@ -47,6 +47,19 @@ class IBlockDevice : public Component::IBase,
 public:
   DECLARE_INTERFACE_UUID(0x66d636bb,0x1cd1,0x427c,0xb0b6,0x7e,0x75,0xd9,0x10,0x9b,0x39);
 
+  /** 
+   * Get IO telemetry (latency percentiles by operation and size,
+   * queue-depth occupancy, doorbell and batch counts)
+   * 
+   * @param stats [out] Statistics, cumulative since device initialization
+   * @param port Port/queue, or IO_STATS_ALL_PORTS for the whole device
+   * 
+   * @return S_OK on success, E_INVAL on bad port.
+   */
+  virtual status_t get_stats(io_stats_t * stats,
+                             unsigned port
+                             ) = 0;
+
 };
 
 
@@ -7,13 +7,16 @@ class IBlockData {
 public:
 
   /** 
-   * Synchronously read/write a block of data
+   * Synchronously perform an IO operation.  Besides BLOCK_READ and
+   * BLOCK_WRITE, devices may support BLOCK_TRIM, BLOCK_WRITE_ZEROES and
+   * BLOCK_COMPARE (see io_action_t).
    * 
    * @param io_request Opaque pointer to an IO operation
    * @param port Device port to write to
    * @param device Device instance
    * 
-   * @return S_OK on success.
+   * @return S_OK on success, E_FAIL if the device reports an error
+   * (including a BLOCK_COMPARE mismatch).
    */
   virtual status_t sync_io(io_request_t io_request,
                            unsigned port
@@ -33,7 +36,21 @@ public:
                             ) = 0;
 
   /** 
-   * Asynchronously issue a batch (group) of IO operations.
+   * Asynchronously read/write a multi-segment (scatter-gather) request
+   * 
+   * @param io_request Multi-segment IO request
+   * @param port Port/queue to issue request to
+   * 
+   * @return S_OK on success, E_INVAL if the device cannot describe the segments.
+   */
+  virtual status_t async_io_sg(io_request_sg_t io_request,
+                               unsigned port
+                               ) = 0;
+
+  /** 
+   * Asynchronously issue a batch (group) of IO operations.  Requests may
+   * mix actions; devices may merge adjacent BLOCK_TRIM requests into a
+   * single command.
    * 
    * @param io_requests Array of opaque IO request pointers
    * @param length Number of requests
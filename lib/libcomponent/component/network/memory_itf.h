@@ -121,6 +121,7 @@ namespace Component
       unsigned num_blocks;       /**< The total number of blocks. */
       unsigned alignment;        /**< The block alignment. */
       allocator_t allocator_id;  /**< The allocator ID. */
+      unsigned magazine_size;    /**< Per-thread magazine size in blocks (0 = none). */
   } alloc_config_t;
   
   /**
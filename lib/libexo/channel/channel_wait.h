@@ -0,0 +1,131 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+#ifndef __EXO_CHANNEL_WAIT_H__
+#define __EXO_CHANNEL_WAIT_H__
+
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "common/utils.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/** Default number of empty polls before a waiting consumer sleeps. */
+#define CHANNEL_SPIN_BUDGET (4096)
+
+namespace Exokernel {
+
+  /**
+   * Wait queue for one channel buffer. It resides in the shared memory area
+   * next to the buffer, so the futex is process-shared.
+   *
+   * A consumer registers as a sleeper, re-checks the buffer and only then
+   * blocks on the sequence word. A producer bumps the sequence and issues a
+   * wake only when a sleeper is registered; both sides order their update
+   * against the other's check with a full barrier, so no wake-up is lost.
+   */
+  class Channel_waitq {
+
+  private:
+
+    volatile uint32_t _seq __attribute__((aligned(CACHE_LINE_SIZE)));  /**< futex word */
+    volatile uint32_t _sleepers;                                       /**< registered sleepers */
+
+  public:
+
+    /** Constructor. */
+    Channel_waitq() : _seq(0), _sleepers(0) {
+    }
+
+    /** 
+     * Registers the caller as a sleeper. The caller must re-check the buffer
+     * afterwards and then call either cancel() or wait().
+     *
+     * @return sequence value to pass to wait().
+     */
+    inline uint32_t prepare() {
+      uint32_t seq = _seq;
+      __sync_fetch_and_add(&_sleepers, 1);   // full barrier before the re-check
+      return seq;
+    }
+
+    /** Withdraws a registration made with prepare(). */
+    inline void cancel() {
+      __sync_fetch_and_sub(&_sleepers, 1);
+    }
+
+    /** 
+     * Sleeps until woken, unless a wake-up happened since prepare().
+     * Deregisters the caller before returning.
+     *
+     * @param seq value returned by prepare().
+     * @param timeout_ms sleep timeout in milliseconds (0 = no timeout).
+     * @return false if the sleep timed out, true otherwise.
+     */
+    bool wait(uint32_t seq, unsigned timeout_ms) {
+      struct timespec ts;
+      if (timeout_ms > 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+      }
+
+      long rc = syscall(SYS_futex, &_seq, FUTEX_WAIT, seq, 
+                        timeout_ms > 0 ? &ts : NULL, NULL, 0);
+      bool timed_out = (rc == -1 && errno == ETIMEDOUT);
+
+      __sync_fetch_and_sub(&_sleepers, 1);
+      return !timed_out;
+    }
+
+    /** 
+     * Wakes up to 'n' sleepers. Called by the producer after publishing
+     * items; costs only a barrier and a load when nobody sleeps.
+     *
+     * @param n number of sleepers to wake.
+     */
+    inline void wake(unsigned n) {
+      __sync_synchronize();   // order the publish before the sleeper check
+      if (_sleepers == 0) {
+        return;
+      }
+      __sync_fetch_and_add(&_seq, 1);
+      syscall(SYS_futex, &_seq, FUTEX_WAKE, n, NULL, NULL, 0);
+    }
+
+  };
+
+}
+
+#endif // __EXO_CHANNEL_WAIT_H__
@@ -0,0 +1,226 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+#ifndef __EXO_MPMC_CIRCULAR_BUFFER_H__
+#define __EXO_MPMC_CIRCULAR_BUFFER_H__
+
+/* the status codes are shared with the SPMC buffer of whichever channel
+   flavour (channel/ or numa_channel/) is in use */
+#ifndef __EXO_SPMC_CIRCULAR_BUFFER_H__
+#error "include shm_channel.h (or spmc_circbuffer.h) before mpmc_circbuffer.h"
+#endif
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+namespace Exokernel {  
+
+  /** 
+   * Bounded circular buffer for a multiple-producer, multiple-consumer
+   * model, usable as the BUFFER of Shm_channel. Each slot carries a
+   * sequence number telling which lap it is ready for, so producers and
+   * consumers only contend on their own position counter (one CAS per
+   * operation, or per run of slots for the bulk variants).
+   * The circular buffer stores pointers to instances of type T; that is, T*.  
+   * SIZE has to be power of 2. 
+   */
+  template <class T, unsigned SIZE>
+  class MPMC_circular_buffer {
+
+  private:
+
+    struct slot_t {
+      volatile uint64_t seq;
+      T* volatile item;
+    };
+
+    /** Next position to write (shared by producers). */
+    volatile uint64_t _enqueue_pos __attribute__((aligned(CACHE_LINE_SIZE))); 
+
+    /** Next position to read (shared by consumers). */
+    volatile uint64_t _dequeue_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    slot_t _slots[SIZE] __attribute__((aligned(CACHE_LINE_SIZE))); 
+
+    inline slot_t* slot(uint64_t pos) {
+      return &_slots[pos & (SIZE - 1)];
+    }
+
+  public:
+
+    /** Constructor. */
+    MPMC_circular_buffer() {
+      assert((SIZE != 0) && ((SIZE & (SIZE - 1)) == 0));
+
+      _enqueue_pos = 0;
+      _dequeue_pos = 0;
+
+      for (uint64_t i = 0; i < SIZE; i++) {
+        _slots[i].seq = i;
+        _slots[i].item = NULL;
+      }
+    }
+
+
+    /** 
+     * Removes the next available item from the buffer.
+     *
+     * @param[in,out] item pointer to the returned item.
+     * @return E_SPMC_CIRBUFF_OK on success. 
+     * @return E_SPMC_CIRBUFF_EMPTY if the buffer is empty. 
+     */
+    status_t consume(T** item) {
+      return consume_bulk(item, 1) ? E_SPMC_CIRBUFF_OK : E_SPMC_CIRBUFF_EMPTY;
+    }
+
+
+    /** 
+     * Inserts an item into the buffer.
+     * @param item pointer to a data item 
+     * 
+     * @return E_SPMC_CIRBUFF_OK on success. 
+     * @return E_SPMC_CIRBUFF_FULL if the buffer is full. 
+     */
+    status_t produce(T* item) {
+      if (item == NULL) {
+        return E_SPMC_CIRBUFF_INV_PARAM;
+      }
+      return produce_bulk(&item, 1) ? E_SPMC_CIRBUFF_OK : E_SPMC_CIRBUFF_FULL;
+    }
+
+
+    /** 
+     * Removes up to 'max' items from the buffer. The run of ready slots at
+     * the read position is claimed with a single CAS; a lost race is
+     * retried.
+     *
+     * @param[out] items array receiving the pointers to the removed items.
+     * @param max maximum number of items to remove.
+     * @return number of items removed; 0 if the buffer is empty.
+     */
+    size_t consume_bulk(T** items, size_t max) {
+      if (items == NULL || max == 0) {
+        return 0;
+      }
+
+      while (1) {
+        uint64_t pos = _dequeue_pos;
+        size_t n = 0;
+
+        while (n < max) {
+          int64_t diff = (int64_t)(__atomic_load_n(&slot(pos + n)->seq, __ATOMIC_ACQUIRE) - (pos + n + 1));
+          if (diff != 0) {
+            if (n == 0 && diff < 0) {
+              return 0;   /* not yet produced */
+            }
+            break;        /* end of the ready run, or 'pos' is stale */
+          }
+          n++;
+        }
+
+        if (n == 0) {
+          continue;
+        }
+
+        if (__sync_bool_compare_and_swap(&_dequeue_pos, pos, pos + n)) {
+          for (size_t i = 0; i < n; i++) {
+            slot_t* s = slot(pos + i);
+            items[i] = s->item;
+            __atomic_store_n(&s->seq, pos + i + SIZE, __ATOMIC_RELEASE);
+          }
+          return n;
+        }
+        cpu_relax();
+      }
+    }
+
+
+    /** 
+     * Inserts up to 'n' items into the buffer. The run of free slots at the
+     * write position is claimed with a single CAS; a lost race is retried.
+     *
+     * @param items array of pointers to data items (none may be NULL).
+     * @param n number of items in 'items'.
+     * @return number of items inserted (a prefix of 'items'); 0 if the
+     *         buffer is full.
+     */
+    size_t produce_bulk(T** items, size_t n) {
+      if (items == NULL || n == 0) {
+        return 0;
+      }
+
+      while (1) {
+        uint64_t pos = _enqueue_pos;
+        size_t count = 0;
+
+        while (count < n) {
+          int64_t diff = (int64_t)(__atomic_load_n(&slot(pos + count)->seq, __ATOMIC_ACQUIRE) - (pos + count));
+          if (diff != 0) {
+            if (count == 0 && diff < 0) {
+              return 0;   /* not yet consumed */
+            }
+            break;
+          }
+          count++;
+        }
+
+        if (count == 0) {
+          continue;
+        }
+
+        if (__sync_bool_compare_and_swap(&_enqueue_pos, pos, pos + count)) {
+          for (size_t i = 0; i < count; i++) {
+            slot_t* s = slot(pos + i);
+            assert(items[i] != NULL);
+            s->item = items[i];
+            __atomic_store_n(&s->seq, pos + i + 1, __ATOMIC_RELEASE);
+          }
+          return count;
+        }
+        cpu_relax();
+      }
+    }
+
+
+    /** Prints on screen information about the buffer. */
+    void dump() {
+      std::cout << "===========================" << std::endl
+                << "MPMC buffer :" << std::endl
+                << "enqueue_pos = " << _enqueue_pos << std::endl
+                << "dequeue_pos = " << _dequeue_pos << std::endl
+                << "size        = " << SIZE << std::endl
+                << "===========================" << std::endl;
+    }
+
+  };
+
+}
+
+#endif // __EXO_MPMC_CIRCULAR_BUFFER_H__
@@ -79,9 +79,11 @@ namespace Exokernel {
      *             object.
      *	@param size the size of the created shared memory area.
      *	@param need_alloc whether the shared memory is newly created
+     *	@param fixed whether to attach at the key-derived fixed address; areas
+     *	             holding only position-independent data can pass false
      *	return the virtual address of the shared memory
      */
-    void*	init(unsigned int key, size_t size, bool need_alloc) {
+    void*	init(unsigned int key, size_t size, bool need_alloc, bool fixed = true) {
 
       // TODO: Improve error management!
 
@@ -102,14 +104,12 @@ namespace Exokernel {
       }
 
       // Map shared memory object.
-      void* addr = (void*)(SHM_BIND_ADDRESS_64BITS + key * SHM_INTERVAL);
+      void* addr = fixed ? (void*)(SHM_BIND_ADDRESS_64BITS + key * SHM_INTERVAL) : NULL;
 
-      //(MAP_FIXED)?
       _ptr = mmap(addr, size, 
                   PROT_READ | PROT_WRITE, 
-                  MAP_SHARED | MAP_FIXED, 
+                  MAP_SHARED | (fixed ? MAP_FIXED : 0), 
                   fd, 0);
-      //_ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
       if (_ptr == MAP_FAILED) {
         std::cerr << "Error: mmap!" << std::endl;
         exit(3);
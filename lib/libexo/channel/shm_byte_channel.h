@@ -0,0 +1,199 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+#ifndef __EXO_BYTE_CHANNEL_H__
+#define __EXO_BYTE_CHANNEL_H__
+
+#include "shm_area.h"
+#include "channel_wait.h"
+#include "shm_byte_ring.h"
+
+/* shared memory keys of byte channels start here, clear of Shm_channel keys */
+#define BYTE_CHANNEL_KEY_BASE (2000)
+
+namespace Exokernel {
+
+  /**
+   * Shared-memory channel carrying variable-length messages inline. 
+   * Like Shm_channel it has two ends, each with a ring to send on and a ring
+   * to receive from, but the messages are copied into the ring rather than
+   * passed as pointers. The shared memory is therefore not mapped at a fixed
+   * address, and no separate allocation is needed for each message.
+   *
+   * Sending is reserve() + write in place + commit(); receiving is peek()
+   * (or peek_wait()) + read in place + release(). With MULTI_PRODUCER set,
+   * several threads of one end may send concurrently; receiving is always
+   * single-threaded.
+   */
+  template <bool MULTI_PRODUCER = false>
+  class Shm_byte_channel {
+
+  private:
+
+    typedef Shm_byte_ring<MULTI_PRODUCER> Ring;
+
+    Shm_area* _shm_areas[2];    /**< Two shared memory areas. */
+    Ring* _rings[2];            /**< Two rings, each in one shared memory area. */
+    Channel_waitq* _waitqs[2];  /**< Wait queues, at the start of each area. */
+
+    /** Offset of the ring within a shared memory area. */
+    static size_t ring_offset() {
+      return (sizeof(Channel_waitq) + CACHE_LINE_SIZE - 1) & ~((size_t) CACHE_LINE_SIZE - 1);
+    }
+
+  public:
+
+    /**
+     * Constructor. The creating end passes 'need_alloc = TRUE'; the other end
+     * connects with 'need_alloc = FALSE' and the same 'idx' and 'capacity'.
+     *
+     * @param idx the index of the channel.
+     * @param need_alloc tells whether or not the channel will allocate
+     *                   the shared memory area.
+     * @param capacity size in bytes of each ring (power of 2).
+     */
+    Shm_byte_channel(size_t idx, bool need_alloc, size_t capacity) {
+
+      for(size_t i = 0; i < 2; i++) {
+        _shm_areas[i] = new Shm_area();
+
+        byte* ptr = (byte*) _shm_areas[i]->init(BYTE_CHANNEL_KEY_BASE + 2*idx + i, 
+                                                ring_offset() + Ring::footprint(capacity),
+                                                need_alloc,
+                                                false);
+        if (need_alloc) {
+          _waitqs[i] = new(ptr) Channel_waitq();
+          _rings[i] = new(ptr + ring_offset()) Ring(capacity);
+        }
+        else {
+          // Switch the two existing rings created by its counterpart.
+          _waitqs[(i+1)%2] = (Channel_waitq *) ptr;
+          _rings[(i+1)%2] = (Ring *)(ptr + ring_offset());
+          assert(_rings[(i+1)%2]->capacity() == capacity);
+        }
+      }
+    }
+
+    /** Destructor. */ 
+    ~Shm_byte_channel() {
+      for(size_t i = 0; i < 2; i++) { 
+        _shm_areas[i]->~Shm_area();
+      }
+    }
+
+    /**
+     * Reserves space for an outgoing message.
+     * @param len the message length in bytes.
+     * @return pointer to write the message to, or NULL if the ring is full
+     *         or 'len' exceeds max_message().
+     */
+    inline void* reserve(size_t len) { 
+      return _rings[0]->reserve(len); 
+    }
+
+    /** Returns the largest message that can be sent. */
+    inline size_t max_message() const { 
+      return _rings[0]->max_message(); 
+    }
+
+    /**
+     * Sends a message previously reserved.
+     * @param msg the pointer returned by reserve().
+     */
+    inline void commit(void* msg) { 
+      _rings[0]->commit(msg); 
+      _waitqs[0]->wake(1);
+    }
+
+    /**
+     * Returns the next incoming message in place.
+     * @param[out] msg the pointer to the message.
+     * @param[out] len the message length in bytes.
+     * @return E_SPMC_CIRBUFF_OK, or E_SPMC_CIRBUFF_EMPTY if there is none.
+     */
+    inline status_t peek(void** msg, size_t* len) {
+      return _rings[1]->peek(msg, len); 
+    }
+
+    /**
+     * Returns the next incoming message in place, blocking while there is
+     * none (see Shm_channel::consume_wait).
+     *
+     * @param[out] msg the pointer to the message.
+     * @param[out] len the message length in bytes.
+     * @param spin_budget number of empty polls before sleeping.
+     * @param timeout_ms give up after sleeping this long (0 = wait forever).
+     * @return E_SPMC_CIRBUFF_OK on success, E_SPMC_CIRBUFF_EMPTY on timeout.
+     */
+    status_t peek_wait(void** msg, size_t* len,
+                       unsigned spin_budget = CHANNEL_SPIN_BUDGET,
+                       unsigned timeout_ms = 0) {
+      Ring* ring = _rings[1];
+      Channel_waitq* wq = _waitqs[1];
+
+      while (1) {
+        for (unsigned spin = 0; spin <= spin_budget; spin++) {
+          if (ring->peek(msg, len) == E_SPMC_CIRBUFF_OK) {
+            return E_SPMC_CIRBUFF_OK;
+          }
+          cpu_relax();
+        }
+
+        uint32_t seq = wq->prepare();
+        if (ring->peek(msg, len) == E_SPMC_CIRBUFF_OK) {
+          wq->cancel();
+          return E_SPMC_CIRBUFF_OK;
+        }
+
+        if (!wq->wait(seq, timeout_ms)) {
+          return ring->peek(msg, len);
+        }
+      }
+    }
+
+    /** Releases the message returned by the last peek. */
+    inline void release() {
+      _rings[1]->release();
+    }
+
+    /** Prints on screen information about the channel. */
+    void dump() {
+      std::cout << std::endl << "**** Shm_byte_channel information :" << std::endl;
+      std::cout << "** Send end: " << std::endl; 
+      _rings[0]->dump();
+      std::cout << "** Receive end: " << std::endl; 
+      _rings[1]->dump();
+      std::cout << std::endl;
+    }
+
+  };
+
+}
+
+#endif // __EXO_BYTE_CHANNEL_H__
@@ -0,0 +1,257 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+#ifndef __EXO_SHM_BYTE_RING_H__
+#define __EXO_SHM_BYTE_RING_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cassert>
+#include <iostream>
+
+#include "common/types.h"
+#include "common/utils.h"
+#include "spmc_circbuffer.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+namespace Exokernel {
+
+  /**
+   * Byte ring carrying variable-length messages inline, for a single
+   * consumer and either a single producer or (MULTI_PRODUCER = true) many.
+   * The ring is constructed in place in shared memory with a trailing data
+   * area of 'capacity' bytes; it holds only offsets, so each process may map
+   * it at a different address.
+   *
+   * Every message is preceded by an 8-byte record header and padded to 8
+   * bytes. A producer reserve()s space, writes the payload in place and
+   * commit()s it. The consumer peek()s at the oldest message in place and
+   * release()s it when done. A message that would straddle the end of the
+   * data area is preceded by a padding record and placed at its start.
+   * Records (header plus padded payload) are limited to half the capacity,
+   * so a message plus any padding in front of it always fits in an empty
+   * ring.
+   *
+   * With multiple producers, reservation is serialized by a short spinlock
+   * (only the header write and head update), while payload writes and
+   * commits proceed in parallel. The consumer stops at the first reserved but
+   * uncommitted message, so messages are delivered in reservation order.
+   */
+  template <bool MULTI_PRODUCER = false>
+  class Shm_byte_ring {
+
+  private:
+
+    /** Record header preceding each message. */
+    struct record_t {
+      volatile uint32_t len;    /**< payload length (or padding length) */
+      volatile uint32_t flags;  /**< REC_BUSY until committed; REC_PAD */
+    };
+
+    enum {
+      REC_BUSY = 0x1,
+      REC_PAD = 0x2,
+    };
+
+    const uint64_t _capacity;
+    const uint64_t _mask;
+
+    /** Next byte to reserve (written by producers only). */
+    volatile uint64_t _head __attribute__((aligned(CACHE_LINE_SIZE)));
+    volatile uint32_t _lock;
+
+    /** Oldest unreleased byte (written by the consumer only). */
+    volatile uint64_t _tail __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    /* the data area follows the (cache-line padded) ring object */
+
+    static inline uint64_t record_size(uint64_t len) {
+      return sizeof(record_t) + ((len + 7) & ~7ULL);
+    }
+
+    inline record_t* record_at(uint64_t pos) {
+      return (record_t*) (((byte*) this) + sizeof(Shm_byte_ring) + (pos & _mask));
+    }
+
+    inline void lock() {
+      if (MULTI_PRODUCER) {
+        while (!__sync_bool_compare_and_swap(&_lock, 0, 1)) {
+          while (_lock) cpu_relax();
+        }
+      }
+    }
+
+    inline void unlock() {
+      if (MULTI_PRODUCER) {
+        __sync_lock_release(&_lock);
+      }
+    }
+
+  public:
+
+    /** 
+     * Constructor. Must be placement-constructed on a region of at least
+     * footprint(capacity) bytes.
+     *
+     * @param capacity size of the data area in bytes (power of 2, >= 64).
+     */
+    Shm_byte_ring(size_t capacity) : _capacity(capacity), _mask(capacity - 1) {
+      assert(capacity >= CACHE_LINE_SIZE && (capacity & (capacity - 1)) == 0);
+      _head = 0;
+      _tail = 0;
+      _lock = 0;
+    }
+
+    /** Returns the number of bytes needed to hold a ring of 'capacity' bytes. */
+    static size_t footprint(size_t capacity) {
+      return sizeof(Shm_byte_ring) + capacity;
+    }
+
+    /** Returns the size of the data area. */
+    size_t capacity() const { return _capacity; }
+
+    /** 
+     * Returns the largest payload reserve() accepts. A larger record could
+     * need more than the whole ring once padded to the wrap point.
+     */
+    size_t max_message() const { return _capacity / 2 - sizeof(record_t); }
+
+    /** 
+     * Reserves space for a message of 'len' bytes.
+     *
+     * @param len payload length in bytes (at most max_message()).
+     * @return pointer to the payload area to write, or NULL if the ring is
+     *         full or the message is larger than max_message().
+     */
+    void* reserve(size_t len) {
+      if (len > max_message() || len > UINT32_MAX) {
+        return NULL;
+      }
+      uint64_t rec = record_size(len);
+
+      lock();
+
+      uint64_t head = _head;
+      uint64_t tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+      uint64_t room = _capacity - (head & _mask);
+      uint64_t pad = (room < rec) ? room : 0;
+
+      if (head + pad + rec - tail > _capacity) {
+        unlock();
+        return NULL;
+      }
+
+      if (pad > 0) {
+        record_t* p = record_at(head);
+        p->len = pad;
+        p->flags = REC_PAD;
+        head += pad;
+      }
+
+      record_t* r = record_at(head);
+      r->len = len;
+      r->flags = REC_BUSY;
+
+      __atomic_store_n(&_head, head + rec, __ATOMIC_RELEASE);
+      unlock();
+
+      return r + 1;
+    }
+
+    /** 
+     * Publishes a message previously returned by reserve().
+     *
+     * @param msg payload pointer returned by reserve().
+     */
+    void commit(void* msg) {
+      record_t* r = ((record_t*) msg) - 1;
+      assert(r->flags == REC_BUSY);
+      __atomic_store_n(&r->flags, 0, __ATOMIC_RELEASE);
+    }
+
+    /** 
+     * Returns the oldest committed message in place, without removing it.
+     *
+     * @param[out] msg pointer to the payload.
+     * @param[out] len payload length in bytes.
+     * @return E_SPMC_CIRBUFF_OK on success. 
+     * @return E_SPMC_CIRBUFF_EMPTY if there is no committed message.
+     */
+    status_t peek(void** msg, size_t* len) {
+      uint64_t tail = _tail;
+
+      while (1) {
+        if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE)) {
+          return E_SPMC_CIRBUFF_EMPTY;
+        }
+
+        record_t* r = record_at(tail);
+        uint32_t flags = __atomic_load_n(&r->flags, __ATOMIC_ACQUIRE);
+
+        if (flags & REC_BUSY) {
+          return E_SPMC_CIRBUFF_EMPTY;
+        }
+
+        if (flags & REC_PAD) {
+          tail += r->len;
+          __atomic_store_n(&_tail, tail, __ATOMIC_RELEASE);
+          continue;
+        }
+
+        *msg = r + 1;
+        *len = r->len;
+        return E_SPMC_CIRBUFF_OK;
+      }
+    }
+
+    /** Removes the message returned by the last successful peek(). */
+    void release() {
+      record_t* r = record_at(_tail);
+      assert(r->flags == 0);
+      __atomic_store_n(&_tail, _tail + record_size(r->len), __ATOMIC_RELEASE);
+    }
+
+    /** Prints on screen information about the ring. */
+    void dump() {
+      std::cout << "===========================" << std::endl
+                << "Byte ring :" << std::endl
+                << "capacity = " << _capacity << std::endl
+                << "head     = " << _head << std::endl
+                << "tail     = " << _tail << std::endl
+                << "===========================" << std::endl;
+    }
+
+  };
+
+}
+
+#endif // __EXO_SHM_BYTE_RING_H__
@@ -36,7 +36,11 @@
 #ifndef __EXO_SPMC_CIRCULAR_BUFFER_H__
 #define __EXO_SPMC_CIRCULAR_BUFFER_H__
 
-#include "../exo/types.h"
+#include "common/types.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
 
 namespace Exokernel {  
 
@@ -61,16 +65,17 @@ namespace Exokernel {
 
     const static uint64_t __dummy_addr = ~(0x0);
 
-    /** Index of the next item to write. */
-    volatile uint64_t _head __attribute__((aligned)); 
+    /** Index of the next item to write (written by the producer only). */
+    volatile uint64_t _head __attribute__((aligned(CACHE_LINE_SIZE))); 
 
-    /** Index of the next item to read. */
-    volatile uint64_t _tail __attribute__((aligned));
+    /** Index of the next item to read. Kept on its own cache line so that
+        consumer CAS traffic does not false-share with the producer. */
+    volatile uint64_t _tail __attribute__((aligned(CACHE_LINE_SIZE)));
 
-    const uint64_t _begin __attribute__((aligned)); 
+    const uint64_t _begin __attribute__((aligned(CACHE_LINE_SIZE))); 
     const uint64_t _end __attribute__((aligned)); 
 
-    T* _buffer[SIZE] __attribute__((aligned)); 
+    T* _buffer[SIZE] __attribute__((aligned(CACHE_LINE_SIZE))); 
 
   public:
 
@@ -103,7 +108,7 @@ namespace Exokernel {
      * @return E_SPMC_CIRBUFF_EMPTY if the buffer is empty. 
      */
     status_t consume(T** item) {
-      unsigned temp = _tail;
+      uint64_t temp = _tail;
       if(_head - temp == 0) {
         return E_SPMC_CIRBUFF_EMPTY; 
       }
@@ -151,6 +156,80 @@ namespace Exokernel {
     }
 
 
+    /** 
+     * Removes up to 'max' items from the buffer. A contiguous run of slots
+     * is claimed with a single CAS on the tail.
+     *
+     * @param[out] items array receiving the pointers to the removed items.
+     * @param max maximum number of items to remove.
+     * @return number of items removed; 0 if the buffer is empty or the
+     *         claim lost against another consumer.
+     */
+    size_t consume_bulk(T** items, size_t max) {
+      if (items == NULL || max == 0) {
+        return 0;
+      }
+
+      uint64_t temp = _tail;
+      uint64_t avail = _head - temp;
+      if (avail == 0) {
+        return 0;
+      }
+
+      size_t n = (avail < max) ? avail : max;
+      if (!__sync_bool_compare_and_swap(&_tail, temp, (temp+n))) {
+        return 0;
+      }
+
+      for (size_t i = 0; i < n; i++) {
+        unsigned index = (temp + i) % SIZE;
+        items[i] = _buffer[index];
+        _buffer[index] = (T*) __dummy_addr;
+      }
+      return n;
+    }
+
+
+    /** 
+     * Inserts up to 'n' items into the buffer. The items are written into
+     * consecutive free slots and published with a single atomic add on the
+     * head. Insertion stops early at a slot that a consumer has claimed but
+     * not yet drained.
+     *
+     * @param items array of pointers to data items (none may be NULL).
+     * @param n number of items in 'items'.
+     * @return number of items inserted (a prefix of 'items'); 0 if the
+     *         buffer is full.
+     */
+    size_t produce_bulk(T** items, size_t n) {
+      if (items == NULL) {
+        return 0;
+      }
+
+      uint64_t head = _head;
+      uint64_t space = SIZE - (head - _tail);
+      if (n > space) {
+        n = space;
+      }
+
+      size_t count = 0;
+      while (count < n) {
+        unsigned index = (head + count) % SIZE;
+        if (_buffer[index] != (T*)__dummy_addr) {
+          break;
+        }
+        assert(items[count] != NULL);
+        _buffer[index] = items[count];
+        count++;
+      }
+
+      if (count > 0) {
+        __sync_fetch_and_add(&_head, count); 
+      }
+      return count;
+    }
+
+
     /** Prints on screen information about the channel. */
     void dump() {
       std::cout << "===========================" << std::endl
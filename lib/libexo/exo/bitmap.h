@@ -42,9 +42,10 @@
 namespace Exokernel
 {
   /** 
-   * Bitmap based tracking, usually used in a slab allocator (thread-safe version). Locks
-   * are managed on a per-dword section of the bitmap (i.e. one spin lock for each 32 or 64
-   * elements).
+   * Bitmap based tracking, usually used in a slab allocator (thread-safe version). Each
+   * word of the bitmap is updated with compare-and-swap; scanning always starts at word 0.
+   * See Bitmap_allocator_lockfree for a version with 64-bit words, start hints and
+   * contiguous runs.
    * 
    */
   class Bitmap_tracker_threadsafe
@@ -173,6 +174,242 @@ namespace Exokernel
       return (_bitmap[w] & (1<<idx));
     }
   };
+
+
+  /** 
+   * Lock-free bitmap allocator of slots (e.g., command slots, DMA pages). Bits are
+   * claimed with atomic test-and-set on 64-bit words; free bits are located with
+   * count-trailing-zeros, so a full word costs one load. Each thread starts scanning
+   * where its last allocation succeeded, which spreads concurrent allocators over
+   * the bitmap. Contiguous runs of slots can be allocated with next_free_n().
+   */
+  class Bitmap_allocator_lockfree
+  {
+  private:
+    enum { BITS = 64 };
+
+    size_t              _max_slot;
+    size_t              _words;
+    volatile uint64_t * _bitmap;
+
+    /** Calling thread's scan start (word index); shared by all instances. */
+    static unsigned& hint() {
+      static __thread unsigned __hint = 0;
+      return __hint;
+    }
+
+    /** Mask of 'count' bits starting at bit 'off' of a word. */
+    static inline uint64_t range_mask(unsigned off, unsigned count) {
+      return ((count == BITS) ? ~0ULL : ((1ULL << count) - 1)) << off;
+    }
+
+    /** Returns the first free slot at or after 'pos', or _max_slot. */
+    size_t find_free(size_t pos) const {
+      while (pos < _max_slot) {
+        size_t w = pos / BITS;
+        uint64_t x = ~_bitmap[w] & (~0ULL << (pos % BITS));
+        if (x) 
+          return w * BITS + __builtin_ctzll(x);
+        pos = (w + 1) * BITS;
+      }
+      return _max_slot;
+    }
+
+    /** Returns the number of free slots starting at 'pos', up to 'limit'. */
+    size_t free_run(size_t pos, size_t limit) const {
+      size_t run = 0;
+      while (run < limit && pos < _max_slot) {
+        unsigned off = pos % BITS;
+        uint64_t taken = _bitmap[pos / BITS] >> off;
+        unsigned n = taken ? __builtin_ctzll(taken) : (BITS - off);
+        if (n > BITS - off) n = BITS - off;
+        run += n;
+        if (off + n < BITS) 
+          break;
+        pos += n;
+      }
+      return (run < limit) ? run : limit;
+    }
+
+    /** Atomically takes slots [first, first+count) if they are all free. */
+    bool claim(size_t first, size_t count) {
+      size_t pos = first, end = first + count;
+      while (pos < end) {
+        unsigned off = pos % BITS;
+        unsigned n = (end - pos < BITS - off) ? (end - pos) : (BITS - off);
+        uint64_t mask = range_mask(off, n);
+        volatile uint64_t * word = &_bitmap[pos / BITS];
+
+        uint64_t old = *word;
+        bool ok;
+        while ((ok = !(old & mask)) && 
+               !__sync_bool_compare_and_swap(word, old, old | mask)) {
+          old = *word;
+        }
+
+        if (!ok) {
+          /* roll back the pieces already taken */
+          if (pos > first) 
+            release(first, pos - first);
+          return false;
+        }
+        pos += n;
+      }
+      return true;
+    }
+
+    /** Atomically clears slots [first, first+count). */
+    void release(size_t first, size_t count) {
+      size_t pos = first, end = first + count;
+      while (pos < end) {
+        unsigned off = pos % BITS;
+        unsigned n = (end - pos < BITS - off) ? (end - pos) : (BITS - off);
+        uint64_t mask = range_mask(off, n);
+        uint64_t old = __sync_fetch_and_and(&_bitmap[pos / BITS], ~mask);
+        if ((old & mask) != mask) 
+          panic("Bitmap_allocator_lockfree: freeing free slot(s) at %lu", pos);
+        pos += n;
+      }
+    }
+
+  public:
+
+    /** 
+     * Constructor.
+     * 
+     * @param slots Number of slots tracked.
+     */
+    Bitmap_allocator_lockfree(size_t slots) : _max_slot(slots) {
+      assert(slots > 0);
+      _words = (slots + BITS - 1) / BITS;
+      _bitmap = new uint64_t [_words];
+      memset((void*)_bitmap, 0, sizeof(uint64_t) * _words);
+
+      /* slots past the end are permanently taken */
+      if (slots % BITS) 
+        _bitmap[_words - 1] = ~0ULL << (slots % BITS);
+    }
+
+    ~Bitmap_allocator_lockfree() {
+      delete [] _bitmap;
+    }
+
+    /** 
+     * Return the index to the next free slot; mark slot taken
+     * 
+     * @return Index of a free slot, or E_INSUFFICIENT_RESOURCES if none
+     */
+    signed next_free() {
+      unsigned w = hint() % _words;
+
+      for (size_t checked = 0; checked < _words; ) {
+        uint64_t val = _bitmap[w];
+        if (val == ~0ULL) {
+          if (++w == _words) w = 0;
+          checked++;
+          continue;
+        }
+
+        uint64_t bit = 1ULL << __builtin_ctzll(~val);
+        uint64_t old = __sync_fetch_and_or(&_bitmap[w], bit);
+        if (old & bit) 
+          continue;  /* lost the race for this bit; rescan the word */
+
+        hint() = w;
+        return w * BITS + __builtin_ctzll(bit);
+      }
+
+      return E_INSUFFICIENT_RESOURCES;
+    }
+
+    /** 
+     * Allocate 'count' contiguous slots; mark them taken
+     * 
+     * @param count Number of slots
+     * 
+     * @return Index of the first slot, or E_INSUFFICIENT_RESOURCES if there is no
+     *         free run long enough
+     */
+    signed next_free_n(size_t count) {
+      if (count == 1) 
+        return next_free();
+      if (count == 0 || count > _max_slot) 
+        return E_INSUFFICIENT_RESOURCES;
+
+      /* scan from the hint to the end, then from the start */
+      size_t start = (size_t)(hint() % _words) * BITS;
+      for (unsigned pass = 0; pass < 2; pass++) {
+        size_t pos = (pass == 0) ? start : 0;
+        size_t end = (pass == 0) ? _max_slot : start + count;
+        if (end > _max_slot) end = _max_slot;
+
+        while ((pos = find_free(pos)) + count <= end) {
+          size_t run = free_run(pos, count);
+          if (run < count) {
+            pos += run;     /* skip past the taken slot ending the run */
+            continue;
+          }
+          if (claim(pos, count)) {
+            hint() = (pos + count) / BITS;
+            return pos;
+          }
+          /* raced with another allocator; re-examine from here */
+        }
+      }
+
+      return E_INSUFFICIENT_RESOURCES;
+    }
+
+    /** 
+     * Release a slot
+     * 
+     * @param slot Slot to release
+     */
+    status_t mark_free(unsigned slot) {
+      if (slot >= _max_slot) {
+        panic("mark_free: slot out of range");
+        return E_INVALID_REQUEST;
+      }
+      release(slot, 1);
+      return S_OK;
+    }
+
+    /** 
+     * Release a run of slots allocated with next_free_n
+     * 
+     * @param first First slot
+     * @param count Number of slots
+     */
+    status_t mark_free_n(unsigned first, size_t count) {
+      if (first + count > _max_slot) {
+        panic("mark_free_n: slots out of range");
+        return E_INVALID_REQUEST;
+      }
+      release(first, count);
+      return S_OK;
+    }
+
+    /** 
+     * Return whether or not a slot is taken
+     */
+    bool is_set(unsigned slot) const {
+      if (slot >= _max_slot) panic("invalid slot (0x%x) in bitmap is_set call\n",slot);
+      return (_bitmap[slot / BITS] >> (slot % BITS)) & 1;
+    }
+
+    /** 
+     * Return the number of free slots (a snapshot)
+     */
+    size_t count_free() const {
+      size_t taken = 0;
+      for (size_t w = 0; w < _words; w++) 
+        taken += __builtin_popcountll(_bitmap[w]);
+      return _words * BITS - taken;
+    }
+
+    /** Return the number of slots tracked. */
+    size_t size() const { return _max_slot; }
+  };
   
 }
 
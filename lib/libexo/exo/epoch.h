@@ -0,0 +1,430 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+#ifndef __EXO_EPOCH_H__
+#define __EXO_EPOCH_H__
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "spinlocks.h"
+
+namespace Exokernel {
+
+  namespace Lockfree
+  {
+    /** 
+     * Base class for objects reclaimed through an Epoch_domain. The link is
+     * separate from any link used by the data structure itself, because
+     * concurrent readers may still follow those after the object is retired.
+     */
+    class Epoch_entry {
+    public:
+      Epoch_entry * _limbo_next;
+
+      Epoch_entry() : _limbo_next(NULL) {}
+    };
+
+
+    /** 
+     * Epoch-based memory reclamation (Fraser). Threads bracket every access to
+     * shared nodes with enter()/leave(). Unlinked nodes are passed to retire()
+     * and handed back to the owner (via the reclaim callback) only once every
+     * thread that could still hold a reference has left its critical section,
+     * i.e. after the global epoch has advanced twice. This removes both
+     * use-after-free and ABA on recycled nodes.
+     *
+     * Threads are registered lazily on first use; each has a cache-line sized
+     * record holding its announced epoch and its per-epoch limbo lists.
+     * Records are allocated on demand, so any number of threads may use a
+     * domain. When a thread exits its records are released (through one
+     * pthread key shared by all domains) for reuse by later threads, and
+     * their limbo lists are handed to the domains as orphans.
+     */
+    class Epoch_domain {
+    public:
+      enum { 
+        EPOCHS           = 3,
+        RETIRE_THRESHOLD = 32,  /* retires between attempts to advance the epoch */
+      };
+
+      /** Callback receiving a chain of reclaimed entries linked by _limbo_next */
+      typedef void (*reclaim_t)(Epoch_entry * chain, void * arg);
+
+    private:
+      struct Record {
+        volatile uint64_t       epoch;  /* (global epoch << 1) | 1 when active, else 0 */
+        volatile unsigned long  owner;  /* pthread_t of the owner, 0 when unused */
+        Epoch_domain *          domain; /* NULL once the domain is destroyed */
+        Record *                next;   /* in the domain's record list */
+        Record *                thread_next; /* in the owner's record chain */
+        unsigned                nest;
+        size_t                  retired;
+        Epoch_entry *           limbo[EPOCHS];
+        uint64_t                limbo_epoch[EPOCHS];
+      } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+      enum { CACHE_WAYS = 4 };
+
+      struct Record_cache {
+        unsigned long id;
+        Record *      record;
+      };
+
+      volatile uint64_t _global __attribute__((aligned(CACHE_LINE_SIZE)));
+      unsigned long     _id;
+      reclaim_t         _reclaim;
+      void *            _reclaim_arg;
+
+      /* limbo lists of exited threads; protected by _orphan_lock */
+      Spin_lock         _orphan_lock;
+      Epoch_entry *     _orphans[EPOCHS];
+      uint64_t          _orphan_epoch[EPOCHS];
+
+      /* all records ever allocated; only ever prepended to until destruction */
+      Record * volatile _records;
+
+      static unsigned long next_id() {
+        static unsigned long id = 0;
+        return __sync_add_and_fetch(&id, 1);
+      }
+
+      /** 
+       * Protects the domain field of records owned by live threads, against
+       * thread exit racing with domain destruction
+       */
+      static Spin_lock& registry_lock() {
+        static Spin_lock lock;
+        return lock;
+      }
+
+      static pthread_key_t& exit_key_storage() {
+        static pthread_key_t key;
+        return key;
+      }
+
+      static void create_exit_key() {
+        if (pthread_key_create(&exit_key_storage(), thread_exit) != 0)
+          panic("Epoch_domain: pthread_key_create failed");
+      }
+
+      /** 
+       * The thread-specific key, shared by all domains, whose value is the
+       * chain of records the calling thread owns
+       */
+      static pthread_key_t exit_key() {
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+        pthread_once(&once, create_exit_key);
+        return exit_key_storage();
+      }
+
+      /** 
+       * Return the calling thread's record, registering the thread if needed
+       */
+      Record * record() {
+        static __thread Record_cache cache[CACHE_WAYS];
+
+        Record_cache& c = cache[_id % CACHE_WAYS];
+        if (c.id == _id) 
+          return c.record;
+
+        unsigned long self = (unsigned long) pthread_self();
+        Record * r = NULL;
+
+        for (Record * i = _records; i && !r; i = i->next) {
+          if (i->owner == self) 
+            r = i;
+        }
+        if (r) {
+          c.id = _id;
+          c.record = r;
+          return r;
+        }
+
+        /* reuse the record of an exited thread, or allocate a new one */
+        for (Record * i = _records; i && !r; i = i->next) {
+          if (i->owner == 0 && __sync_bool_compare_and_swap(&i->owner, 0UL, self)) 
+            r = i;
+        }
+        if (!r) {
+          void * p = NULL;
+          if (posix_memalign(&p, CACHE_LINE_SIZE, sizeof(Record)) != 0) 
+            panic("Epoch_domain: out of memory");
+          r = (Record *) p;
+          memset(r, 0, sizeof(Record));
+          r->owner = self;
+          Record * head;
+          do {
+            head = _records;
+            r->next = head;
+          } while (!__sync_bool_compare_and_swap(&_records, head, r));
+        }
+
+        r->domain = this;
+        pthread_key_t key = exit_key();
+        r->thread_next = (Record *) pthread_getspecific(key);
+        pthread_setspecific(key, r);
+
+        c.id = _id;
+        c.record = r;
+        return r;
+      }
+
+      void reclaim_bucket(Record * r, unsigned b) {
+        Epoch_entry * chain = r->limbo[b];
+        if (chain) {
+          r->limbo[b] = NULL;
+          _reclaim(chain, _reclaim_arg);
+        }
+      }
+
+      /** 
+       * Append a chain of entries retired in 'epoch' to a limbo bucket,
+       * reclaiming whatever the bucket holds from an older epoch.
+       */
+      void add_to_bucket(Epoch_entry *& bucket, uint64_t& bucket_epoch,
+                         Epoch_entry * chain, uint64_t epoch) {
+        if (bucket && bucket_epoch != epoch) {
+          /* same bucket index: the epochs differ by at least EPOCHS, and
+             both are <= _global, so the older chain is past its grace period */
+          if (bucket_epoch > epoch) {
+            _reclaim(chain, _reclaim_arg);
+            return;
+          }
+          Epoch_entry * old = bucket;
+          bucket = NULL;
+          _reclaim(old, _reclaim_arg);
+        }
+        Epoch_entry * tail = chain;
+        while (tail->_limbo_next) 
+          tail = tail->_limbo_next;
+        tail->_limbo_next = bucket;
+        bucket = chain;
+        bucket_epoch = epoch;
+      }
+
+      /** 
+       * Reclaim orphaned entries whose grace period has passed
+       */
+      void reclaim_orphans(uint64_t g) {
+        Spin_lock_guard guard(_orphan_lock);
+        for (unsigned b = 0; b < EPOCHS; b++) {
+          if (_orphans[b] && _orphan_epoch[b] + 2 <= g) {
+            Epoch_entry * chain = _orphans[b];
+            _orphans[b] = NULL;
+            _reclaim(chain, _reclaim_arg);
+          }
+        }
+      }
+
+      /** 
+       * pthread key destructor: for each record of the exiting thread, hand
+       * its limbo lists to the domain and release the record for reuse, or
+       * free it if its domain is already gone
+       */
+      static void thread_exit(void * p) {
+        Spin_lock_guard registry(registry_lock());
+
+        Record * r = (Record *) p;
+        while (r) {
+          Record * next = r->thread_next;
+          Epoch_domain * d = r->domain;
+          if (d == NULL) {
+            ::free(r);
+            r = next;
+            continue;
+          }
+          {
+            Spin_lock_guard guard(d->_orphan_lock);
+            for (unsigned b = 0; b < EPOCHS; b++) {
+              if (r->limbo[b]) {
+                unsigned ob = r->limbo_epoch[b] % EPOCHS;
+                d->add_to_bucket(d->_orphans[ob], d->_orphan_epoch[ob], 
+                                 r->limbo[b], r->limbo_epoch[b]);
+                r->limbo[b] = NULL;
+              }
+            }
+          }
+          r->nest = 0;
+          r->retired = 0;
+          r->epoch = 0;
+          r->thread_next = NULL;
+          __sync_synchronize();
+          r->owner = 0;
+          r = next;
+        }
+      }
+
+      /** 
+       * Advance the global epoch if every active thread has observed it
+       */
+      void try_advance() {
+        uint64_t g = _global;
+        for (Record * r = _records; r; r = r->next) {
+          uint64_t e = r->epoch;
+          if ((e & 1) && ((e >> 1) != g)) 
+            return;
+        }
+        if (__sync_bool_compare_and_swap(&_global, g, g + 1))
+          reclaim_orphans(g + 1);
+      }
+
+    public:
+
+      /** 
+       * Constructor
+       * 
+       * @param reclaim Callback invoked with entries that are safe to reuse
+       * @param arg Argument passed to the callback
+       */
+      Epoch_domain(reclaim_t reclaim, void * arg) 
+        : _global(EPOCHS), _id(next_id()), _reclaim(reclaim), _reclaim_arg(arg), 
+          _records(NULL) {
+        assert(reclaim);
+        memset(_orphans, 0, sizeof(_orphans));
+        memset(_orphan_epoch, 0, sizeof(_orphan_epoch));
+      }
+
+      /** 
+       * Destructor. Records still owned by live threads are detached and
+       * freed when those threads exit.
+       */
+      ~Epoch_domain() {
+        reclaim_all();
+
+        Spin_lock_guard registry(registry_lock());
+        Record * r = _records;
+        while (r) {
+          Record * next = r->next;
+          if (r->owner) 
+            r->domain = NULL;
+          else 
+            ::free(r);
+          r = next;
+        }
+        _records = NULL;
+      }
+
+      /** 
+       * Enter a critical section; nodes read from the data structure stay
+       * valid until the matching leave(). Calls may nest.
+       */
+      void enter() {
+        Record * r = record();
+        if (r->nest++) 
+          return;
+
+        uint64_t g;
+        do {
+          g = _global;
+          r->epoch = (g << 1) | 1;
+          __sync_synchronize();
+        } while (g != _global);
+
+        /* entries retired two or more epochs ago can no longer be referenced */
+        for (unsigned b = 0; b < EPOCHS; b++) {
+          if (r->limbo[b] && r->limbo_epoch[b] + 2 <= g) 
+            reclaim_bucket(r, b);
+        }
+      }
+
+      /** 
+       * Leave a critical section
+       */
+      void leave() {
+        Record * r = record();
+        assert(r->nest > 0);
+        if (--r->nest) 
+          return;
+        __sync_synchronize();
+        r->epoch = 0;
+      }
+
+      /** 
+       * Retire an entry that has been unlinked from the data structure. Must be
+       * called inside a critical section.
+       * 
+       * @param e Entry to retire
+       */
+      void retire(Epoch_entry * e) {
+        Record * r = record();
+        assert(r->nest > 0);
+
+        /* label with the global epoch as seen after the unlink, not the
+           (possibly older) epoch this thread is pinned at: readers may be
+           pinned one epoch ahead of us and still hold the entry */
+        __sync_synchronize();
+        uint64_t epoch = _global;
+        unsigned b = epoch % EPOCHS;
+
+        /* anything left in the bucket is at least EPOCHS old */
+        if (r->limbo_epoch[b] != epoch) {
+          reclaim_bucket(r, b);
+          r->limbo_epoch[b] = epoch;
+        }
+
+        e->_limbo_next = r->limbo[b];
+        r->limbo[b] = e;
+
+        if (++r->retired >= RETIRE_THRESHOLD) {
+          r->retired = 0;
+          try_advance();
+        }
+      }
+
+      /** 
+       * Reclaim all retired entries of all threads. Only call this when no
+       * thread is inside a critical section (e.g., on tear down).
+       */
+      void reclaim_all() {
+        for (Record * r = _records; r; r = r->next) {
+          assert(!(r->epoch & 1));
+          for (unsigned b = 0; b < EPOCHS; b++) 
+            reclaim_bucket(r, b);
+        }
+        Spin_lock_guard guard(_orphan_lock);
+        for (unsigned b = 0; b < EPOCHS; b++) {
+          if (_orphans[b]) {
+            Epoch_entry * chain = _orphans[b];
+            _orphans[b] = NULL;
+            _reclaim(chain, _reclaim_arg);
+          }
+        }
+      }
+
+      /** Return the current global epoch. */
+      uint64_t epoch() const { return _global; }
+    };
+  }
+}
+
+#endif // __EXO_EPOCH_H__
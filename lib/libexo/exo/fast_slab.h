@@ -47,9 +47,13 @@
 
 #include "assert.h"
 
+#include <pthread.h>
+#include <stdlib.h>
+
 #include "numa_memory.h"
 #include "../private/__sym_nbb.h"
 #include "pagemap.h"
+#include "lock_stats.h"
 
 namespace Exokernel {
 
@@ -63,8 +67,14 @@ namespace Exokernel {
      *    Exokernel::MCS_lock
      *    Exokernel::Spin_lock
      *    Exokernel::Ticket_lock
+     *    Exokernel::Instrumented_lock_tmpl<...> (contention statistics)
+     *
+     * Optionally (see enable_magazines()), each thread keeps a small stack
+     * ("magazine") of free blocks in front of the shared buffer, so that most
+     * alloc()/free() calls take no lock; blocks move between a magazine and
+     * the shared buffer in batches of the magazine size.
      */
-    template <class Lock = Exokernel::Spin_lock>
+    template <class Lock = Exokernel::Stat_spin_lock>
     class Fast_slab_allocator_T {
 
     private: 
@@ -145,6 +155,167 @@ namespace Exokernel {
       /** Lock for the producer access-point. */
       Lock __prod_axpoint_lock __attribute__((aligned(__SIZEOF_POINTER__)));
 
+      /** 
+       * Per-thread cache of free blocks; holds up to two magazines' worth.
+       * Also linked into the owning allocator's list so that the allocator
+       * can drain it on destruction.
+       */
+      struct Magazine {
+        Fast_slab_allocator_T<Lock>* owner; /* NULL once the owner is gone */
+        Magazine* prev;
+        Magazine* next;
+        size_t count;
+        Block_header* rounds[0];
+      };
+
+      /** 
+       * Per-thread table of magazines, indexed by allocator magazine index.
+       * All allocators of this type share one thread-specific key.
+       */
+      struct Magazine_table {
+        size_t size;
+        Magazine* mags[0];
+      };
+
+      /** Magazine size (0 = magazines disabled). */
+      size_t __mag_size;
+
+      /** This allocator's slot in the per-thread magazine tables. */
+      size_t __mag_index;
+
+      /** Magazines of live threads belonging to this allocator. */
+      Magazine* __mag_list;
+
+      /** Shared thread-specific key of the calling thread's Magazine_table. */
+      static pthread_key_t  __mag_table_key;
+      static pthread_once_t __mag_table_once;
+      static bool           __mag_table_key_valid;
+
+      /** Next free magazine table slot (slots are not reused). */
+      static size_t         __mag_next_index;
+
+      /** Protects magazine owner fields and the allocators' magazine lists. */
+      static Exokernel::Spin_lock __mag_registry_lock;
+
+      /** 
+       * Takes up to 'n' blocks from the shared buffer under a single lock.
+       * @return number of blocks taken.
+       */
+      size_t shared_get(Block_header** hdrs, size_t n) {
+        size_t count = 0;
+
+        __cons_axpoint_lock.lock();
+        while (count < n && __cons_axpoint->read_item(hdrs[count]) == NBB_OK) {
+          assert(hdrs[count]->block);
+          count++;
+        }
+        __cons_axpoint_lock.unlock();
+
+        return count;
+      }
+
+      /** Returns 'n' blocks to the shared buffer under a single lock. */
+      void shared_put(Block_header** hdrs, size_t n) {
+        __prod_axpoint_lock.lock();
+        for (size_t i = 0; i < n; i++) {
+          int err = __prod_axpoint->insert_item(hdrs[i]);
+          if (err != NBB_OK) {
+            panic("Fast_slab_allocator free() failed!!!!! err = %d\n", err);
+          }
+        }
+        __prod_axpoint_lock.unlock();
+      }
+
+      /** Returns the calling thread's magazine, or NULL if it has none. */
+      Magazine* find_magazine() {
+        Magazine_table* t = (Magazine_table*) pthread_getspecific(__mag_table_key);
+        if (t == NULL || __mag_index >= t->size) {
+          return NULL;
+        }
+        return t->mags[__mag_index];
+      }
+
+      /** Returns the calling thread's magazine, creating it on first use. */
+      Magazine* magazine() {
+        Magazine* m = find_magazine();
+        if (m != NULL) {
+          return m;
+        }
+
+        Magazine_table* t = (Magazine_table*) pthread_getspecific(__mag_table_key);
+        if (t == NULL || __mag_index >= t->size) {
+          size_t old_size = t ? t->size : 0;
+          size_t new_size = old_size ? old_size : 8;
+          while (new_size <= __mag_index) {
+            new_size *= 2;
+          }
+          t = (Magazine_table*) ::realloc(t, sizeof(Magazine_table) + new_size * sizeof(Magazine*));
+          assert(t);
+          __builtin_memset(&t->mags[old_size], 0, (new_size - old_size) * sizeof(Magazine*));
+          t->size = new_size;
+          pthread_setspecific(__mag_table_key, t);
+        }
+
+        m = (Magazine*) ::malloc(sizeof(Magazine) + 2 * __mag_size * sizeof(Block_header*));
+        assert(m);
+        m->owner = this;
+        m->count = 0;
+        m->prev = NULL;
+
+        __mag_registry_lock.lock();
+        m->next = __mag_list;
+        if (__mag_list) {
+          __mag_list->prev = m;
+        }
+        __mag_list = m;
+        __mag_registry_lock.unlock();
+
+        t->mags[__mag_index] = m;
+        return m;
+      }
+
+      /** Unlinks a magazine from this allocator's list; registry lock held. */
+      void unlink_magazine(Magazine* m) {
+        if (m->prev) {
+          m->prev->next = m->next;
+        }
+        else {
+          __mag_list = m->next;
+        }
+        if (m->next) {
+          m->next->prev = m->prev;
+        }
+      }
+
+      static void create_magazine_table_key() {
+        __mag_table_key_valid = 
+          (pthread_key_create(&__mag_table_key, magazine_table_destructor) == 0);
+      }
+
+      /** 
+       * Thread-exit destructor: gives the cached blocks back to allocators
+       * that still exist and frees the thread's magazines.
+       */
+      static void magazine_table_destructor(void* p) {
+        Magazine_table* t = (Magazine_table*) p;
+
+        __mag_registry_lock.lock();
+        for (size_t i = 0; i < t->size; i++) {
+          Magazine* m = t->mags[i];
+          if (m == NULL) {
+            continue;
+          }
+          if (m->owner) {
+            m->owner->shared_put(m->rounds, m->count);
+            m->owner->unlink_magazine(m);
+          }
+          ::free(m);
+        }
+        __mag_registry_lock.unlock();
+
+        ::free(t);
+      }
+
     public:
 
       /**
@@ -169,10 +340,13 @@ namespace Exokernel {
                             int alignment = 0, 
                             int32_t core_id = -1,
                             bool needs_phys_addr = false,
-                            unsigned debug_id = 0) : _debug_id(debug_id) {
+                            unsigned debug_id = 0) : _debug_id(debug_id), __mag_size(0), 
+                                                 __mag_index(0), __mag_list(NULL) {
 
         static Exokernel::Pagemap __page_map;
         assert(sizeof(Block_header) == CACHE_LINE_SIZE);  //cache-alignment requirement
+        lock_stats_name(__cons_axpoint_lock, "fast_slab.consumer");
+        lock_stats_name(__prod_axpoint_lock, "fast_slab.producer");
         __block_header_size = sizeof(Block_header);
 
         if (VERBOSE) {
@@ -364,8 +538,19 @@ namespace Exokernel {
 
       /** Destructor. */
       ~Fast_slab_allocator_T() {
+        /* drain the magazines of live threads; they are freed at thread exit */
+        __mag_registry_lock.lock();
+        for (Magazine* m = __mag_list; m != NULL; m = m->next) {
+          shared_put(m->rounds, m->count);
+          m->count = 0;
+          m->owner = NULL;
+        }
+        __mag_list = NULL;
+        __mag_registry_lock.unlock();
+
         /* clean up symmetric nbb storage */
         assert(__block_nbb);
+        __block_nbb->~Symmetric_nbb();
         numa_free(__block_nbb_raw, __block_nbb_raw_size);
       } 
 
@@ -377,6 +562,18 @@ namespace Exokernel {
         void* block = NULL; 
         Block_header* block_hdr = NULL;
 
+        if (__mag_size > 0) {
+          Magazine* m = magazine();
+          if (m->count == 0) {
+            m->count = shared_get(m->rounds, __mag_size);
+            if (m->count == 0) {
+              return NULL;
+            }
+          }
+          __sync_fetch_and_sub(&__num_avail, 1);
+          return m->rounds[--m->count]->block;
+        }
+
         __cons_axpoint_lock.lock();
 
         int err = __cons_axpoint->read_item(block_hdr); 
@@ -402,9 +599,7 @@ namespace Exokernel {
           }
           assert(block);
 
-          uint32_t temp = __num_avail;
-          temp --;
-          __num_avail = temp;  
+          __sync_fetch_and_sub(&__num_avail, 1);
         }
         else if (err == NBB_EMPTY) {
           if (VERBOSE) {
@@ -445,6 +640,20 @@ namespace Exokernel {
           return E_BAD_PARAM; 
         }
 
+        if (__mag_size > 0) {
+          Magazine* m = magazine();
+          if (m->count == 2 * __mag_size) {
+            /* give back the older (colder) magazine */
+            shared_put(m->rounds, __mag_size);
+            __builtin_memmove(m->rounds, &m->rounds[__mag_size], 
+                              __mag_size * sizeof(Block_header*));
+            m->count = __mag_size;
+          }
+          m->rounds[m->count++] = block_hdr;
+          __sync_fetch_and_add(&__num_avail, 1);
+          return S_OK;
+        }
+
         __prod_axpoint_lock.lock();
 
         // FIXME: No atomicity guarantees on ref_cout due to misalignment ; see note above.
@@ -469,9 +678,7 @@ namespace Exokernel {
 
 
         if (err == NBB_OK) {         
-          uint32_t temp = __num_avail;
-          temp ++;
-          __num_avail = temp; 
+          __sync_fetch_and_add(&__num_avail, 1);
           return S_OK;
         }
 
@@ -480,6 +687,127 @@ namespace Exokernel {
       }
 
 
+      /** 
+       * Gets up to 'n' blocks from the pool. Blocks come from the calling
+       * thread's magazine first, and the rest from the shared buffer under a
+       * single lock.
+       * @param blocks array receiving the blocks.
+       * @param n number of blocks wanted.
+       * @return number of blocks allocated.
+       */
+      size_t alloc_bulk(void** blocks, size_t n) {
+        Block_header** hdrs = (Block_header**) blocks;
+        size_t count = 0;
+
+        if (__mag_size > 0) {
+          Magazine* m = magazine();
+          while (count < n && m->count > 0) {
+            hdrs[count++] = m->rounds[--m->count];
+          }
+        }
+
+        if (count < n) {
+          count += shared_get(&hdrs[count], n - count);
+        }
+
+        /* convert headers to block pointers in place */
+        for (size_t i = 0; i < count; i++) {
+          blocks[i] = hdrs[i]->block;
+        }
+
+        __sync_fetch_and_sub(&__num_avail, count);
+        return count;
+      }
+
+
+      /** 
+       * Puts 'n' blocks back into the pool. Blocks fill the calling thread's
+       * magazine first; the rest go to the shared buffer under a single lock.
+       * @param blocks the blocks.
+       * @param n number of blocks.
+       * @return S_OK if succeeds. 
+       * @return E_BAD_PARAM if any block is NULL or not owned by this
+       *         allocator (no block is freed in that case).
+       */
+      status_t free_bulk(void** blocks, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+          if (blocks[i] == NULL ||
+              ((Block_header*)((byte*)blocks[i] - __block_header_size))->owner_allocator != this) {
+            PERR("Fast_slab_allocator: bad block %p in free_bulk\n", blocks[i]);
+            return E_BAD_PARAM;
+          }
+        }
+
+        /* convert block pointers to headers in place */
+        Block_header** hdrs = (Block_header**) blocks;
+        for (size_t i = 0; i < n; i++) {
+          hdrs[i] = (Block_header*)((byte*)blocks[i] - __block_header_size);
+        }
+
+        size_t i = 0;
+        if (__mag_size > 0) {
+          Magazine* m = magazine();
+          while (i < n && m->count < 2 * __mag_size) {
+            m->rounds[m->count++] = hdrs[i++];
+          }
+        }
+
+        if (i < n) {
+          shared_put(&hdrs[i], n - i);
+        }
+
+        __sync_fetch_and_add(&__num_avail, n);
+        return S_OK;
+      }
+
+
+      /** 
+       * Enables per-thread magazines. Must be called before the allocator is
+       * shared between threads.
+       * @param mag_size number of blocks moved per exchange with the shared
+       *                 buffer; each thread caches up to twice as many.
+       * @return S_OK if succeeds.
+       * @return E_FAIL if magazines are already enabled or cannot be set up.
+       */
+      status_t enable_magazines(size_t mag_size) {
+        if (__mag_size > 0 || mag_size == 0) {
+          return E_FAIL;
+        }
+
+        pthread_once(&__mag_table_once, create_magazine_table_key);
+        if (!__mag_table_key_valid) {
+          PERR("Fast_slab_allocator: pthread_key_create failed");
+          return E_FAIL;
+        }
+
+        __mag_index = __sync_fetch_and_add(&__mag_next_index, 1);
+        __mag_size = mag_size;
+        return S_OK;
+      }
+
+
+      /** 
+       * Returns the blocks cached in the calling thread's magazine to the
+       * shared buffer (they are returned automatically at thread exit).
+       */
+      void flush_magazine() {
+        if (__mag_size == 0) {
+          return;
+        }
+
+        Magazine* m = find_magazine();
+        if (m != NULL) {
+          shared_put(m->rounds, m->count);
+          m->count = 0;
+        }
+      }
+
+      /** Returns the magazine size (0 if magazines are disabled). */
+      size_t magazine_size() const {
+        return __mag_size;
+      }
+
+
       /** Returns the size of each block. */
       size_t get_block_size() {
         return __block_len;
@@ -535,7 +863,10 @@ namespace Exokernel {
         return block_hdr->block_phys_addr;
       }
 
-      /** Returns the number of blocks available */
+      /** 
+       * Returns the number of blocks available (not held by users), including
+       * those cached in per-thread magazines.
+       */
       inline uint32_t num_avail() { 
         return __num_avail; 
       }
@@ -546,6 +877,22 @@ namespace Exokernel {
     };
 
 
+    template <class Lock>
+    pthread_key_t Fast_slab_allocator_T<Lock>::__mag_table_key;
+
+    template <class Lock>
+    pthread_once_t Fast_slab_allocator_T<Lock>::__mag_table_once = PTHREAD_ONCE_INIT;
+
+    template <class Lock>
+    bool Fast_slab_allocator_T<Lock>::__mag_table_key_valid = false;
+
+    template <class Lock>
+    size_t Fast_slab_allocator_T<Lock>::__mag_next_index = 0;
+
+    template <class Lock>
+    Exokernel::Spin_lock Fast_slab_allocator_T<Lock>::__mag_registry_lock;
+
+
     typedef Fast_slab_allocator_T<> Fast_slab_allocator;
 
 
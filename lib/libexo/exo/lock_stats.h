@@ -0,0 +1,256 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+#ifndef __EXO_LOCK_STATS_H__
+#define __EXO_LOCK_STATS_H__
+
+#include <string.h>
+#include <common/cycles.h>
+#include <common/logging.h>
+
+#include "spinlocks.h"
+
+/*
+ * Build with -DCONFIG_LOCK_STATS to make Stat_spin_lock (used by the slab
+ * allocators) an instrumented lock; otherwise it is a plain Spin_lock and
+ * the naming helpers compile to nothing.
+ */
+
+namespace Exokernel
+{
+  /** 
+   * Contention counters of one lock instance.  Counters are only updated by
+   * the lock holder, so they need no atomics.
+   */
+  struct Lock_stats {
+    const char * name;
+    uint64_t     acquisitions;  /**< total acquisitions */
+    uint64_t     contended;     /**< acquisitions that had to wait */
+    uint64_t     spin_cycles;   /**< TSC cycles spent waiting */
+  } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+
+  /** 
+   * Process-wide table of lock statistics.  Records are handed out on a lock's
+   * first acquisition and never released; reports aggregate records by name.
+   */
+  class Lock_stats_registry
+  {
+  private:
+    enum { MAX_RECORDS = 4096 };
+
+    static Lock_stats * records() {
+      static Lock_stats r[MAX_RECORDS + 1]; /* last entry absorbs overflow */
+      return r;
+    }
+
+    static volatile unsigned& num_records() {
+      static volatile unsigned n = 0;
+      return n;
+    }
+
+  public:
+
+    /** 
+     * Allocate a statistics record
+     * 
+     * @param name Lock name (not copied)
+     * 
+     * @return Record for the lock
+     */
+    static Lock_stats * register_lock(const char * name) {
+      unsigned i = __sync_fetch_and_add(&num_records(), 1);
+      if (i >= MAX_RECORDS) {
+        /* shared by all late locks; counts become approximate */
+        i = MAX_RECORDS;
+        records()[i].name = "(overflow)";
+        return &records()[i];
+      }
+      records()[i].name = name ? name : "(unnamed)";
+      return &records()[i];
+    }
+
+    /** 
+     * Sum the statistics of all locks with the given name
+     * 
+     * @param name Lock name
+     * @param out [out] Aggregated statistics
+     * 
+     * @return Number of lock instances found
+     */
+    static unsigned get(const char * name, Lock_stats * out) {
+      unsigned n = num_records() > MAX_RECORDS ? MAX_RECORDS + 1 : num_records();
+      unsigned found = 0;
+      memset(out, 0, sizeof(Lock_stats));
+      out->name = name;
+      for (unsigned i = 0; i < n; i++) {
+        Lock_stats * r = &records()[i];
+        if (r->name && strcmp(r->name, name) == 0) {
+          out->acquisitions += r->acquisitions;
+          out->contended += r->contended;
+          out->spin_cycles += r->spin_cycles;
+          found++;
+        }
+      }
+      return found;
+    }
+
+    /** 
+     * Print statistics aggregated per lock name
+     * 
+     */
+    static void dump() {
+      unsigned n = num_records() > MAX_RECORDS ? MAX_RECORDS + 1 : num_records();
+      for (unsigned i = 0; i < n; i++) {
+        const char * name = records()[i].name;
+        if (!name) continue;
+
+        /* report each name once, at its first record */
+        bool seen = false;
+        for (unsigned j = 0; j < i && !seen; j++) 
+          seen = records()[j].name && strcmp(records()[j].name, name) == 0;
+        if (seen) continue;
+
+        Lock_stats s;
+        unsigned instances = get(name, &s);
+        PINF("lock [%s] x%u: acquisitions=%lu contended=%lu (%.1f%%) spin_cycles=%lu (%.0f per contended)",
+             name, instances,
+             (unsigned long) s.acquisitions, (unsigned long) s.contended,
+             s.acquisitions ? (100.0 * s.contended) / s.acquisitions : 0.0,
+             (unsigned long) s.spin_cycles,
+             s.contended ? ((double) s.spin_cycles) / s.contended : 0.0);
+      }
+    }
+
+    /** 
+     * Zero all counters (names are kept)
+     * 
+     */
+    static void reset() {
+      unsigned n = num_records() > MAX_RECORDS ? MAX_RECORDS + 1 : num_records();
+      for (unsigned i = 0; i < n; i++) {
+        records()[i].acquisitions = 0;
+        records()[i].contended = 0;
+        records()[i].spin_cycles = 0;
+      }
+    }
+  };
+
+
+  /** 
+   * Lock wrapper that records acquisitions, contended acquisitions and the
+   * cycles spent waiting.  An acquisition is uncontended if try_lock()
+   * succeeds first time.  The statistics record is registered lazily on the
+   * first acquisition, so instances that are zeroed with memset remain usable.
+   * 
+   * @param LOCK Underlying lock (Spin_lock, Ticket_lock, MCS_lock)
+   */
+  template <class LOCK>
+  class Instrumented_lock_tmpl : public LOCK
+  {
+  private:
+    const char * _name;
+    Lock_stats * _stats;
+
+    /* called with the lock held */
+    INLINE Lock_stats * stats() {
+      if (!_stats)
+        _stats = Lock_stats_registry::register_lock(_name);
+      return _stats;
+    }
+
+  public:
+    Instrumented_lock_tmpl(const char * name = NULL) : _name(name), _stats(NULL) {
+    }
+
+    Instrumented_lock_tmpl(const Instrumented_lock_tmpl& other) : LOCK(), _name(other._name), _stats(NULL) {
+    }
+
+    /** 
+     * Set the name under which the lock is reported
+     * 
+     * @param name Lock name (not copied)
+     */
+    void set_name(const char * name) {
+      _name = name;
+      if (_stats) _stats->name = name;
+    }
+
+    INLINE void lock() {
+      if (this->LOCK::try_lock()) {
+        stats()->acquisitions++;
+        return;
+      }
+      cpu_time_t start = rdtsc();
+      this->LOCK::lock();
+      Lock_stats * s = stats();
+      s->spin_cycles += rdtsc() - start;
+      s->contended++;
+      s->acquisitions++;
+    }
+
+    INLINE void unlock() {
+      this->LOCK::unlock();
+    }
+
+    INLINE bool try_lock() {
+      if (!this->LOCK::try_lock())
+        return false;
+      stats()->acquisitions++;
+      return true;
+    }
+  };
+
+
+  /** 
+   * Name a lock for statistics reporting; a no-op for uninstrumented locks.
+   */
+  template <class LOCK>
+  inline void lock_stats_name(LOCK& lock, const char * name) {
+  }
+
+  template <class LOCK>
+  inline void lock_stats_name(Instrumented_lock_tmpl<LOCK>& lock, const char * name) {
+    lock.set_name(name);
+  }
+
+
+  typedef Instrumented_lock_tmpl<Spin_lock> Instrumented_spin_lock;
+  typedef Instrumented_lock_tmpl<Ticket_lock> Instrumented_ticket_lock;
+  typedef Instrumented_lock_tmpl<MCS_lock> Instrumented_mcs_lock;
+
+#ifdef CONFIG_LOCK_STATS
+  typedef Instrumented_spin_lock Stat_spin_lock;
+#else
+  typedef Spin_lock Stat_spin_lock;
+#endif
+
+}
+
+#endif // __EXO_LOCK_STATS_H__
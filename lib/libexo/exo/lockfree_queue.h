@@ -39,8 +39,10 @@
 #include <assert.h>
 #include <new>
 #include "atomic.h"
+#include "memory.h"
+#include "epoch.h"
 
-#define DBG_LOCKFREE_Q
+//#define DBG_LOCKFREE_Q
 //#define USE_GENODE_HEAP_FOR_OBJECTS /* use for testing only. */
 
 #ifdef DBG_LOCKFREE_Q
@@ -48,8 +50,7 @@
 #define CHECK(X)  assert((((unsigned long) X ) & 7UL) == 0)
 #else
 #define DBG(...)
-//#define CHECK(X)
-#define CHECK(X)  assert((((unsigned long) X ) & 7UL) == 0)
+#define CHECK(X)
 #endif
 
 /** 
@@ -66,10 +67,12 @@ namespace Exokernel {
   namespace Lockfree
   {
     /** 
-     * Class for elements of the lock-free queue
+     * Class for elements of the lock-free queue. Nodes are recycled through
+     * the queue's node pool; _limbo_next (from Epoch_entry) links them while
+     * they are retired or pooled.
      * 
      */
-    template <class T> class Node {
+    template <class T> class Node : public Epoch_entry {
     private:
       T data;
 
@@ -81,8 +84,6 @@ namespace Exokernel {
       Node() : _next(NULL) {}
       Node(T val) : data(val), _next(NULL) {}
 
-      virtual ~Node() {}
-
       T get_data() const {
         return data;
       }
@@ -98,25 +99,78 @@ namespace Exokernel {
 
     /** 
      * Lock-free queue implementation using the algorithm by Michael & Scott @ Rochester
+     *
+     * Popped nodes are retired to an epoch domain and only return to the node
+     * pool once no concurrent push/pop can still reference them, so nodes are
+     * never freed or reused under a reader (no use-after-free, no ABA on the
+     * head/tail CAS). Push takes nodes from the pool and only calls the
+     * allocator when the pool is empty; memory is released on destruction.
      * 
      * @param T Node type
-     * @param _Allocator Allocator class
+     * @param _Allocator Allocator class (allocates Node<T>)
      * 
      */
     template <class T, 
-              typename _Allocator = class Exokernel::Memory::Typed_stdc_allocator<T> >
+              typename _Allocator = class Exokernel::Memory::Typed_stdc_allocator<Node<T> > >
     class Queue {
       
     private:
       
-      Node<T> *_Q_Head __attribute__((aligned(__SIZEOF_POINTER__)));
-      Node<T> *_Q_Tail __attribute__((aligned(__SIZEOF_POINTER__)));
+      Node<T> *_Q_Head __attribute__((aligned(CACHE_LINE_SIZE)));
+      Node<T> *_Q_Tail __attribute__((aligned(CACHE_LINE_SIZE)));
+      Node<T> *_pool   __attribute__((aligned(CACHE_LINE_SIZE)));
+
+      _Allocator   _allocator;
+      Epoch_domain _epoch;
+
+      /** 
+       * Epoch callback: return a chain of reclaimed nodes to the pool
+       */
+      static void reclaim_nodes(Epoch_entry * chain, void * arg) {
+        Queue * q = static_cast<Queue *>(arg);
+        Epoch_entry * last = chain;
+        while (last->_limbo_next) 
+          last = last->_limbo_next;
+
+        Node<T> * top;
+        do {
+          top = q->_pool;
+          last->_limbo_next = top;
+        } while (!__sync_bool_compare_and_swap(&q->_pool, top, static_cast<Node<T> *>(chain)));
+      }
 
-      _Allocator _allocator;
+      /** 
+       * Take a node from the pool, or allocate one. Must be called inside an
+       * epoch critical section: pooled nodes are only pushed back after a
+       * grace period, which rules out ABA on the pool head.
+       */
+      Node<T> * get_node() {
+        Node<T> * node;
+        Node<T> * next;
+        do {
+          node = _pool;
+          if (node == NULL) {
+            node = new (_allocator.alloc()) Node<T>;
+            if (node == NULL) {
+              PERR("Lockfree queue failed to allocate memory");
+              assert(0);
+            }
+            return node;
+          }
+          next = static_cast<Node<T> *>(node->_limbo_next);
+        } while (!__sync_bool_compare_and_swap(&_pool, node, next));
+
+        return node;
+      }
 
     public:
 
-      Queue() {
+      /** 
+       * Constructor
+       * 
+       * @param prealloc Number of nodes to place in the pool up front
+       */
+      Queue(size_t prealloc = 0) : _pool(NULL), _epoch(reclaim_nodes, this) {
 
         _Q_Head = _Q_Tail = new (_allocator.alloc()) Node<T>;
 
@@ -124,12 +178,31 @@ namespace Exokernel {
 
         assert(_Q_Head);
         _Q_Head->_next = NULL;
+
+        for (size_t i = 0; i < prealloc; i++) {
+          Node<T> * n = new (_allocator.alloc()) Node<T>;
+          assert(n);
+          n->_limbo_next = _pool;
+          _pool = n;
+        }
       }
 
       // dtor
       virtual ~Queue() {
-        while(!empty())
+        while(_Q_Head->_next)
           pop();
+
+        /* no concurrent users remain; return everything to the pool and free it */
+        _epoch.reclaim_all();
+
+        while (_pool) {
+          Node<T> * n = _pool;
+          _pool = static_cast<Node<T> *>(n->_limbo_next);
+          n->~Node<T>();
+          _allocator.free(n);
+        }
+        _Q_Head->~Node<T>();
+        _allocator.free(_Q_Head);
       }
 
       /** 
@@ -159,23 +232,14 @@ namespace Exokernel {
        */
       void push(T val) {
 
-        CHECK(_Q_Tail);
-        CHECK(_Q_Head);
+        _epoch.enter();
 
         Node<T> *node __attribute__((aligned(__SIZEOF_POINTER__)));
 
-        node = (Node<T> *) new (_allocator.alloc()) Node<T>;
+        node = get_node();
 
         CHECK(node);
-        assert((umword_t) node != 0x7fff00000000);
-
-        DBG("[%p]: push() qtail=%p qtail->_next=%p node=%p", 
-            (void *) this, _Q_Tail, _Q_Tail->_next, node);
 
-        if (node == NULL) {
-          PERR("Lockfree queue failed to allocate memory");
-          assert(0);
-        }
         node->set_data(val);
         node->_next = NULL;
 
@@ -185,12 +249,9 @@ namespace Exokernel {
         /* we are trying to push 'node' onto the queue */
         while (true) {
 
-          assert(_Q_Tail);
           tail = _Q_Tail;
-
-          assert((umword_t) tail->_next != 0x7fff00000000);
+          CHECK(tail);
           next = tail->_next;
-          assert((umword_t) next != 0x7fff00000000);
 
           if (tail == _Q_Tail) {
             if (next == NULL) {
@@ -200,7 +261,7 @@ namespace Exokernel {
                                                (atomic_t) next,
                                                (atomic_t) node) == (atomic_t) next) {
 
-                DBG("[%p]: Pushing LFQ item %p\n", (void *) this, (void*) node->get_data());
+                DBG("[%p]: Pushing LFQ item %p\n", (void *) this, (void*) node);
                 break;
               }
 
@@ -219,14 +280,14 @@ namespace Exokernel {
         if (Atomic::compare_and_swap((atomic_t *) & _Q_Tail, (atomic_t) tail, (atomic_t) node) == (atomic_t) tail)
           DBG("++Q_Tail after = %p\n", _Q_Tail);
 
-        DBG("[%p]: [afterwhile] push() qtail=%p qtail->_next=%p", (void *) this, _Q_Tail, _Q_Tail->_next);
+        _epoch.leave();
       }
 
       /** 
        * Remove an element from the queue
        * 
        * 
-       * @return removed element
+       * @return removed element (T() if the queue is empty)
        */
       T pop() {
         T res;
@@ -234,10 +295,7 @@ namespace Exokernel {
         Node<T> *tail __attribute__((aligned(__SIZEOF_POINTER__)));
         Node<T> *next __attribute__((aligned(__SIZEOF_POINTER__)));
 
-        CHECK(_Q_Tail);
-        CHECK(_Q_Head);
-        DBG("[%p]: pop() qtail=%p qtail->_next=%p head=%p head->_next=%p", 
-            (void *) this, _Q_Tail, _Q_Tail->_next, _Q_Head, _Q_Head->_next);
+        _epoch.enter();
 
         while (true) {
 
@@ -250,7 +308,7 @@ namespace Exokernel {
           if (head == _Q_Head) {
             if (head == tail) {
               if (next == NULL) {
-                //                PERR("LFQ underflow");
+                _epoch.leave();
                 return T();
               }
 
@@ -283,10 +341,9 @@ namespace Exokernel {
           }
         }
 
-        DBG("[%p]: [afterwhile] pop() qtail=%p qtail->_next=%p head=%p head->_next=%p", (void *) 0, _Q_Tail, _Q_Tail->_next, head, head->_next);
-
-        /* free memory for element that has been popped */
-        delete head;
+        /* the old dummy node goes back to the pool after a grace period */
+        _epoch.retire(head);
+        _epoch.leave();
 
         return res;
       }
@@ -313,5 +370,6 @@ namespace Exokernel {
 
 
 #undef DBG
+#undef CHECK
 #undef DBG_LOCKFREE_Q
 #endif
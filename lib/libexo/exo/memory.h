@@ -150,6 +150,16 @@ namespace Exokernel
      */
     void * huge_malloc(size_t size);
 
+    /** 
+     * Alloc an area of memory using huge pages (2MB) on a given NUMA node
+     * 
+     * @param size Size in bytes to allocate
+     * @param numa_node NUMA node to allocate from
+     * 
+     * @return Pointer to allocated memory (release with huge_free), NULL on failure
+     */
+    void * huge_malloc_onnode(size_t size, int numa_node);
+
     /** 
      * Free a huge page allocation
      * 
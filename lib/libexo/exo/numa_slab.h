@@ -47,6 +47,7 @@
         #include <common/xdk_numa_wrapper.h>
 #endif
 
+#include <new>
 #include <string>
 
 
@@ -60,21 +61,118 @@ namespace Exokernel {
   namespace Memory {
 
 #if defined(__x86_64__)
+    /** Rebalancing counters of one core's partition. */
+    struct Numa_slab_stats {
+      uint64_t steals;          /**< Times the core stole from a sibling. */
+      uint64_t stolen_blocks;   /**< Blocks obtained by stealing. */
+      uint64_t remote_frees;    /**< Blocks freed on this core but owned by another. */
+      uint64_t remote_flushes;  /**< Batches of remote frees returned to their owners. */
+    };
+
     /** 
      * Per-NUMA-node slab allocator. 
      * It is a "partitioned" fixed block allocator which uses per-core local
      * partitions to reduce contention, but allows cross-core frees. 
      * You only need one instance of this class per NUMA node. 
+     *
+     * When a core's partition runs dry, alloc() steals a batch (half a
+     * magazine) from the fullest sibling partition and serves it from a
+     * per-core stash; stolen blocks still return to their owner on free.
+     * free(p, core_id) collects blocks owned by other cores and returns them
+     * to their owners in batches.
      */
     class Numa_slab_allocator
     {
     private:
 
+      enum { 
+        STEAL_BATCH_DEFAULT = 16,  /**< steal batch without magazines */
+        STEAL_MAX = 64,            /**< largest steal batch */
+        REMOTE_BATCH = 32,         /**< remote frees held before returning them */
+      };
+
+      /** Per-core rebalancing state. */
+      struct Core_state {
+        Stat_spin_lock lock;
+        unsigned last_victim;
+        unsigned num_stolen;
+        void* stolen[STEAL_MAX];
+        unsigned num_remote;
+        void* remote[REMOTE_BATCH];
+        Numa_slab_stats stats;
+      } __attribute__((aligned(CACHE_LINE_SIZE)));
+
       Fast_slab_allocator* _per_cpu_allocs[EXOLIB_MAX_CPUS];
+      Core_state* _core_state[EXOLIB_MAX_CPUS];
       size_t _block_size;
       unsigned _numa_id;
       unsigned _debug_id;
 
+      /** 
+       * Refills a core's stash from the fullest sibling; core's lock held.
+       * @return number of blocks stolen.
+       */
+      unsigned steal(core_id_t core_id, Core_state* cs) {
+        /* stick with the last victim while it still has plenty */
+        unsigned batch = steal_batch(cs->last_victim);
+        int victim = -1;
+        if (cs->last_victim != core_id && _per_cpu_allocs[cs->last_victim] != NULL &&
+            _per_cpu_allocs[cs->last_victim]->num_avail() >= 2 * batch) {
+          victim = cs->last_victim;
+        }
+        else {
+          victim = find_fullest(core_id);
+          if (victim < 0) {
+            return 0;
+          }
+          batch = steal_batch(victim);
+        }
+
+        unsigned n = _per_cpu_allocs[victim]->alloc_bulk(cs->stolen, batch);
+        if (n > 0) {
+          cs->last_victim = victim;
+          cs->num_stolen = n;
+          cs->stats.steals++;
+          cs->stats.stolen_blocks += n;
+        }
+        return n;
+      }
+
+      /** Steal batch for a victim: half its magazine. */
+      unsigned steal_batch(core_id_t victim) const {
+        size_t mag = (_per_cpu_allocs[victim] != NULL) ? 
+          _per_cpu_allocs[victim]->magazine_size() : 0;
+        if (mag == 0) {
+          return STEAL_BATCH_DEFAULT;
+        }
+        return (mag / 2 == 0) ? 1 : ((mag / 2 > STEAL_MAX) ? STEAL_MAX : mag / 2);
+      }
+
+      /** Returns a core's batch of remote frees to their owners; lock held. */
+      void flush_remote(Core_state* cs) {
+        unsigned n = cs->num_remote;
+        unsigned i = 0;
+
+        /* group the batch by owner and free each group in one call */
+        while (i < n) {
+          int owner = Fast_slab_allocator::get_id_from_block(cs->remote[i]);
+          unsigned j = i + 1;
+          for (unsigned k = i + 1; k < n; k++) {
+            if (Fast_slab_allocator::get_id_from_block(cs->remote[k]) == owner) {
+              void* tmp = cs->remote[j];
+              cs->remote[j++] = cs->remote[k];
+              cs->remote[k] = tmp;
+            }
+          }
+          assert(_per_cpu_allocs[owner] != NULL);
+          _per_cpu_allocs[owner]->free_bulk(&cs->remote[i], j - i);
+          i = j;
+        }
+
+        cs->num_remote = 0;
+        cs->stats.remote_flushes++;
+      }
+
     protected:
       Cpu_bitset _cpu_mask;
       //      unsigned                _first_core_id;
@@ -121,6 +219,7 @@ namespace Exokernel {
 
         // Make sure pointers are NULL by default.
         __builtin_memset(_per_cpu_allocs, 0, sizeof(_per_cpu_allocs));
+        __builtin_memset(_core_state, 0, sizeof(_core_state));
 
         //size_t total_partitions = cpu_mask.count();
         //size_t s = total_partitions * block_size * per_core_block_quota;
@@ -176,6 +275,18 @@ namespace Exokernel {
                                                            debug_id);
             assert(_per_cpu_allocs[cpu] != NULL);
 
+            /* plain new does not honour the cache-line alignment before C++17 */
+            void* cs_mem = NULL;
+            if (posix_memalign(&cs_mem, CACHE_LINE_SIZE, sizeof(Core_state)) != 0) {
+              panic("NUMA_ALLOCATOR: cannot allocate per-core state.");
+            }
+            _core_state[cpu] = new (cs_mem) Core_state();
+            lock_stats_name(_core_state[cpu]->lock, "numa_slab.core");
+            _core_state[cpu]->last_victim = cpu;
+            _core_state[cpu]->num_stolen = 0;
+            _core_state[cpu]->num_remote = 0;
+            __builtin_memset(&_core_state[cpu]->stats, 0, sizeof(Numa_slab_stats));
+
             space_v = (void*)((addr_t)space_v + per_cpu_total_size);
           }
         }
@@ -188,6 +299,10 @@ namespace Exokernel {
           if (_per_cpu_allocs[i] != NULL) {
             delete _per_cpu_allocs[i];
           }
+          if (_core_state[i] != NULL) {
+            _core_state[i]->~Core_state();
+            ::free(_core_state[i]);
+          }
         }
       }
 
@@ -208,7 +323,33 @@ namespace Exokernel {
 
         assert(_per_cpu_allocs[core_id] != NULL);
 
-        return _per_cpu_allocs[core_id]->alloc();
+        Core_state* cs = _core_state[core_id];
+
+        /* hand out stolen blocks first so they go back into circulation */
+        if (cs->num_stolen > 0) {
+          void* p = NULL;
+          cs->lock.lock();
+          if (cs->num_stolen > 0) {
+            p = cs->stolen[--cs->num_stolen];
+          }
+          cs->lock.unlock();
+          if (p != NULL) {
+            return p;
+          }
+        }
+
+        void* p = _per_cpu_allocs[core_id]->alloc();
+        if (p != NULL) {
+          return p;
+        }
+
+        cs->lock.lock();
+        if (cs->num_stolen > 0 || steal(core_id, cs) > 0) {
+          p = cs->stolen[--cs->num_stolen];
+        }
+        cs->lock.unlock();
+
+        return p;
       }
   
       /** 
@@ -231,6 +372,130 @@ namespace Exokernel {
         return _per_cpu_allocs[core_id]->free(p);
       }
 
+      /** 
+       * Frees a block of data on behalf of a given core. Blocks owned by
+       * another core are batched and returned to their owners together.
+       * @param p Pointer to the block to be freed.
+       * @param core_id Identifier of the core from which the thread is calling.  
+       * @return S_OK on success.
+       */
+      INLINE status_t free(void* p, core_id_t core_id) {
+        assert(p != NULL);
+        core_id_t owner = Fast_slab_allocator::get_id_from_block(p);
+
+        Core_state* cs = _core_state[core_id];
+        if (owner == core_id || cs == NULL) {
+          return free(p);
+        }
+
+        assert(_per_cpu_allocs[owner] != NULL);
+
+        cs->lock.lock();
+        cs->remote[cs->num_remote++] = p;
+        cs->stats.remote_frees++;
+        if (cs->num_remote == REMOTE_BATCH) {
+          flush_remote(cs);
+        }
+        cs->lock.unlock();
+
+        return S_OK;
+      }
+
+      /** 
+       * Returns a core's pending remote frees and unused stolen blocks to
+       * their owners.
+       * @param core_id Core identifier.
+       */
+      void flush(core_id_t core_id) {
+        Core_state* cs = _core_state[core_id];
+        if (cs == NULL) {
+          return;
+        }
+
+        cs->lock.lock();
+        if (cs->num_remote > 0) {
+          flush_remote(cs);
+        }
+        if (cs->num_stolen > 0) {
+          __builtin_memcpy(cs->remote, cs->stolen, cs->num_stolen * sizeof(void*));
+          cs->num_remote = cs->num_stolen;
+          cs->num_stolen = 0;
+          flush_remote(cs);
+        }
+        cs->lock.unlock();
+      }
+
+      /** 
+       * Retrieves the rebalancing counters of a core.
+       * @param core_id Core identifier.
+       * @param stats [out] Counters.
+       * @return S_OK on success, E_INVAL if the core has no partition.
+       */
+      status_t get_stats(core_id_t core_id, Numa_slab_stats* stats) const {
+        if (core_id >= EXOLIB_MAX_CPUS || _core_state[core_id] == NULL) {
+          return E_INVAL;
+        }
+        *stats = _core_state[core_id]->stats;
+        return S_OK;
+      }
+
+      /** 
+       * Allocates up to 'n' blocks.
+       * @param core_id Identifier of the core from which the thread is calling.  
+       * @param blocks Array receiving the blocks.
+       * @param n Number of blocks wanted.
+       * @return Number of blocks allocated.
+       */
+      INLINE size_t alloc_bulk(core_id_t core_id, void** blocks, size_t n) {
+        assert(_per_cpu_allocs[core_id] != NULL);
+        return _per_cpu_allocs[core_id]->alloc_bulk(blocks, n);
+      }
+
+      /** 
+       * Frees 'n' blocks.  This method is cross-thread safe; consecutive
+       * blocks from the same per-core allocator are freed together.
+       * @param blocks Blocks to be freed.
+       * @param n Number of blocks.
+       * @return S_OK on success.
+       */
+      status_t free_bulk(void** blocks, size_t n) {
+        size_t i = 0;
+        while (i < n) {
+          core_id_t core_id = Fast_slab_allocator::get_id_from_block(blocks[i]);
+          size_t run = 1;
+          while (i + run < n && 
+                 Fast_slab_allocator::get_id_from_block(blocks[i + run]) == (int) core_id) {
+            run++;
+          }
+
+          assert(_per_cpu_allocs[core_id] != NULL);
+          status_t rc = _per_cpu_allocs[core_id]->free_bulk(&blocks[i], run);
+          if (rc != S_OK) {
+            return rc;
+          }
+          i += run;
+        }
+        return S_OK;
+      }
+
+      /** 
+       * Enables per-thread magazines on all the per-core allocators (see
+       * Fast_slab_allocator_T::enable_magazines).
+       * @param mag_size Magazine size in blocks.
+       * @return S_OK on success.
+       */
+      status_t enable_magazines(size_t mag_size) {
+        for (size_t i = 0; i < EXOLIB_MAX_CPUS; i++) {
+          if (_per_cpu_allocs[i] != NULL) {
+            status_t rc = _per_cpu_allocs[i]->enable_magazines(mag_size);
+            if (rc != S_OK) {
+              return rc;
+            }
+          }
+        }
+        return S_OK;
+      }
+
       /** 
        * Gets the physical address for a block.
        * @param p Pointer to the block.
@@ -269,38 +534,42 @@ namespace Exokernel {
 
       /** 
        * Searches for the first core id with an allocator with at least the specified number of
-       * objects. 
+       * objects, starting after init_core_id. 
        */
       int find_first_with_avail(core_id_t init_core_id, int min_num_avail) {
-
-        // TODO: Reimplement.
-        panic("%s(...) not implemented yet!", __PRETTY_FUNCTION__);
-
         assert(min_num_avail > 0);
- 
-        //// Randomize the section of the initial core id.   
-        //uint32_t v = rdtsc_low();
-        //init_core_id = v % (_last_core_id - _first_core_id) + _first_core_id;
-
-        //assert(init_core_id >= _first_core_id && init_core_id <= _last_core_id);
-
-        //for (core_id_t i = init_core_id; i <= _last_core_id; i++) {
-        //  if (_per_cpu_allocs[i] == NULL) 
-        //    continue;
-        //  else if (this->num_avail(i) >= (int64_t) min_num_avail)
-        //    return i;
-        //}
-
-        //for (core_id_t i = _first_core_id; i < init_core_id; i++) {
-        //  if (_per_cpu_allocs[i] == NULL)
-        //    continue;
-        //  else if (this->num_avail(i) >= (int64_t) min_num_avail)
-        //    return i;
-        //}
-      
+
+        for (size_t i = 1; i <= EXOLIB_MAX_CPUS; i++) {
+          core_id_t cpu = (init_core_id + i) % EXOLIB_MAX_CPUS;
+          if (_per_cpu_allocs[cpu] != NULL && this->num_avail(cpu) >= (int64_t) min_num_avail)
+            return cpu;
+        }
         return -1; 
       }
 
+      /** 
+       * Searches for the sibling partition (all partitions share the NUMA
+       * node) with the most available blocks.
+       * @param exclude Core to leave out (the caller).
+       * @return Core id, or -1 if every sibling is empty.
+       */
+      int find_fullest(core_id_t exclude) {
+        int best = -1;
+        int64_t best_avail = 0;
+
+        for (size_t cpu = 0; cpu < EXOLIB_MAX_CPUS; cpu++) {
+          if (cpu == exclude || _per_cpu_allocs[cpu] == NULL) 
+            continue;
+
+          int64_t avail = this->num_avail(cpu);
+          if (avail > best_avail) {
+            best = cpu;
+            best_avail = avail;
+          }
+        }
+        return best;
+      }
+
     };
 
 #endif
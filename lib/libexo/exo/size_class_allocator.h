@@ -0,0 +1,419 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+#ifndef __EXO_SIZE_CLASS_ALLOCATOR_H__
+#define __EXO_SIZE_CLASS_ALLOCATOR_H__
+
+#include <sched.h>
+#include <new>
+#include <limits>
+
+#include "memory.h"
+#include "numa_slab.h"
+
+namespace Exokernel {
+
+  namespace Memory {
+
+#if defined(__x86_64__)
+    /** 
+     * General-purpose allocator for variable-sized requests on one NUMA node.
+     *
+     * Requests up to MAX_SMALL_SIZE bytes are rounded up to one of NUM_CLASSES
+     * geometric size classes (16-byte steps up to 64 bytes, then four classes
+     * per power of two), each served by a Numa_slab_allocator with per-core
+     * partitions and per-thread magazines in front. All the classes are
+     * carved out of a single huge-page region on the node. Larger requests
+     * get their own huge-page mapping. When a class runs out of blocks,
+     * requests overflow to node-local memory from numa_alloc_onnode.
+     *
+     * Blocks are 16-byte aligned. Any thread may free any block.
+     */
+    class Size_class_allocator : public Allocator_base
+    {
+    public:
+
+      enum { 
+        NUM_CLASSES = 40,                 /**< Number of size classes. */
+        MAX_SMALL_SIZE = 32 * 1024,       /**< Largest size-classed request. */
+        MIN_BLOCKS_PER_CPU = 4,           /**< Minimum partition size of a class. */
+        DEFAULT_CLASS_BYTES = 2 * 1024 * 1024,
+        DEFAULT_MAGAZINE_SIZE = 16,
+      };
+
+    private:
+
+      enum { 
+        LARGE_HEADER_SIZE = 64, 
+      };
+
+      static const uint64_t LARGE_MAGIC = 0x1a46e5c1a55ULL;
+      static const uint64_t OVERFLOW_MAGIC = 0x0fe4f10c1a55ULL;
+
+      /** Header in front of each large or overflow allocation. */
+      struct Large_header {
+        uint64_t magic;
+        size_t map_size;
+      };
+
+      int _numa_node;
+      byte* _base;                          /**< Huge-page region holding all the classes. */
+      size_t _region_size;
+      byte* _class_start[NUM_CLASSES + 1];  /**< Start of each class' sub-region (+ end). */
+      Numa_slab_allocator* _classes[NUM_CLASSES];
+      core_id_t _home_cpu[EXOLIB_MAX_CPUS]; /**< Any CPU -> a CPU of this node. */
+
+    public:
+
+      /** Returns the size of a size class. */
+      static size_t class_size(unsigned idx) {
+        assert(idx < NUM_CLASSES);
+        if (idx < 4) {
+          return (idx + 1) * 16;
+        }
+        unsigned p = 6 + (idx - 4) / 4;
+        unsigned j = (idx - 4) % 4 + 1;
+        return (1UL << p) + j * (1UL << (p - 2));
+      }
+
+      /** Returns the smallest size class holding 'size' bytes (size <= MAX_SMALL_SIZE). */
+      static unsigned size_to_class(size_t size) {
+        assert(size <= MAX_SMALL_SIZE);
+        if (size <= 64) {
+          return (size == 0) ? 0 : (size - 1) >> 4;
+        }
+        unsigned p = 63 - __builtin_clzl(size - 1);   /* 2^p < size <= 2^(p+1) */
+        unsigned j = ((size - 1 - (1UL << p)) >> (p - 2)) + 1;
+        return 4 + (p - 6) * 4 + (j - 1);
+      }
+
+      /** 
+       * Constructor.
+       * 
+       * @param numa_node NUMA node to allocate memory from and serve.
+       * @param class_bytes Memory budget of each size class in bytes.
+       * @param magazine_size Per-thread magazine size of each class (0 = none).
+       */
+      Size_class_allocator(int numa_node,
+                           size_t class_bytes = DEFAULT_CLASS_BYTES,
+                           size_t magazine_size = DEFAULT_MAGAZINE_SIZE)
+        : _numa_node(numa_node) {
+
+        /* CPUs of the node; every other CPU is folded onto them */
+        Cpu_bitset cpu_mask;
+        struct bitmask * bm = numa_allocate_cpumask();
+        if (numa_node_to_cpus(numa_node, bm) != 0) {
+          numa_free_cpumask(bm);
+          throw Exokernel::Constructor_error();
+        }
+        unsigned ncpus = 0;
+        core_id_t local[EXOLIB_MAX_CPUS];
+        for (unsigned cpu = 0; cpu < EXOLIB_MAX_CPUS; cpu++) {
+          if (numa_bitmask_isbitset(bm, cpu)) {
+            cpu_mask.set(cpu);
+            local[ncpus++] = cpu;
+          }
+        }
+        numa_free_cpumask(bm);
+
+        if (ncpus == 0) {
+          throw Exokernel::Constructor_error();
+        }
+
+        for (unsigned cpu = 0; cpu < EXOLIB_MAX_CPUS; cpu++) {
+          _home_cpu[cpu] = cpu_mask.test(cpu) ? cpu : local[cpu % ncpus];
+        }
+
+        /* size each class' sub-region */
+        size_t quota[NUM_CLASSES];
+        _region_size = 0;
+        for (unsigned c = 0; c < NUM_CLASSES; c++) {
+          size_t actual = Fast_slab_allocator::actual_block_size(class_size(c));
+          quota[c] = class_bytes / (actual * ncpus);
+          if (quota[c] < MIN_BLOCKS_PER_CPU) {
+            quota[c] = MIN_BLOCKS_PER_CPU;
+          }
+          _region_size += quota[c] * ncpus * actual;
+        }
+        _region_size = align_to_huge_page(_region_size);
+
+        _base = (byte*) huge_malloc_onnode(_region_size, numa_node);
+        if (_base == NULL) {
+          PERR("Size_class_allocator: huge page allocation of %lu bytes on node %d failed",
+               _region_size, numa_node);
+          throw Exokernel::Constructor_error();
+        }
+
+        byte* p = _base;
+        for (unsigned c = 0; c < NUM_CLASSES; c++) {
+          size_t bytes = quota[c] * ncpus * Fast_slab_allocator::actual_block_size(class_size(c));
+
+          _class_start[c] = p;
+          _classes[c] = new Numa_slab_allocator(p, bytes, quota[c], class_size(c), cpu_mask,
+                                                0, false, c, "size class");
+          if (magazine_size > 0) {
+            _classes[c]->enable_magazines(magazine_size);
+          }
+          p += bytes;
+        }
+        _class_start[NUM_CLASSES] = p;
+      }
+
+      /** Destructor. */
+      virtual ~Size_class_allocator() {
+        for (unsigned c = 0; c < NUM_CLASSES; c++) {
+          delete _classes[c];
+        }
+        huge_free(_base);
+      }
+
+      /** 
+       * Allocates memory.
+       * 
+       * @param count Size in bytes.
+       * @param arg Calling core, or -1 to use the core the thread runs on.
+       * 
+       * @return Pointer to the memory (16-byte aligned), NULL if out of memory.
+       */
+      void* alloc(size_t count, signed arg = -1) {
+        if (count > MAX_SMALL_SIZE) {
+          return alloc_large(count);
+        }
+
+        core_id_t core = (arg < 0) ? sched_getcpu() : arg;
+        void* p = _classes[size_to_class(count)]->alloc(_home_cpu[core % EXOLIB_MAX_CPUS]);
+        if (p == NULL) {
+          /* class budget used up */
+          return alloc_overflow(count);
+        }
+        return p;
+      }
+
+      /** 
+       * Frees memory allocated by this allocator.
+       * 
+       * @param p Pointer returned by alloc (NULL is ignored).
+       */
+      void free(void* p) {
+        free(p, -1);
+      }
+
+      /** 
+       * Frees memory on behalf of a core. Blocks that belong to another
+       * core's partition are batched and returned to it together.
+       * 
+       * @param p Pointer returned by alloc (NULL is ignored).
+       * @param arg Calling core, or -1 to use the core the thread runs on.
+       */
+      void free(void* p, signed arg) {
+        if (p == NULL) {
+          return;
+        }
+
+        byte* b = (byte*) p;
+        if (b < _base || b >= _class_start[NUM_CLASSES]) {
+          free_large(p);
+          return;
+        }
+
+        /* binary search for the owning class */
+        unsigned lo = 0, hi = NUM_CLASSES;
+        while (hi - lo > 1) {
+          unsigned mid = (lo + hi) / 2;
+          if (b >= _class_start[mid]) 
+            lo = mid;
+          else 
+            hi = mid;
+        }
+        core_id_t core = (arg < 0) ? sched_getcpu() : arg;
+        _classes[lo]->free(p, _home_cpu[core % EXOLIB_MAX_CPUS]);
+      }
+
+      /** Returns the usable size of an allocation of 'count' bytes. */
+      static size_t usable_size(size_t count) {
+        if (count > MAX_SMALL_SIZE) {
+          return count;
+        }
+        return class_size(size_to_class(count));
+      }
+
+      /** Returns the NUMA node served. */
+      int numa_node() const { return _numa_node; }
+
+      /** Returns the allocator of a size class (e.g., for statistics). */
+      Numa_slab_allocator* size_class(unsigned idx) {
+        assert(idx < NUM_CLASSES);
+        return _classes[idx];
+      }
+
+      /** 
+       * Returns a shared per-node instance with default parameters, created
+       * on first use.
+       *
+       * @param numa_node NUMA node, or -1 for the node of the calling core.
+       */
+      static Size_class_allocator* node_instance(int numa_node = -1) {
+        static Size_class_allocator* volatile __instances[EXOLIB_MAX_CPUS];
+        static volatile int __init_lock = 0;
+
+        if (numa_node < 0) {
+          numa_node = numa_node_of_cpu(sched_getcpu());
+          if (numa_node < 0) 
+            numa_node = 0;
+        }
+        assert(numa_node < EXOLIB_MAX_CPUS);
+
+        if (__instances[numa_node] == NULL) {
+          while (!__sync_bool_compare_and_swap(&__init_lock, 0, 1)) 
+            cpu_relax();
+          if (__instances[numa_node] == NULL) {
+            __instances[numa_node] = new Size_class_allocator(numa_node);
+          }
+          __sync_lock_release(&__init_lock);
+        }
+        return __instances[numa_node];
+      }
+
+    private:
+
+      void* alloc_large(size_t count) {
+        size_t map_size = align_to_huge_page(count + LARGE_HEADER_SIZE);
+        Large_header* h = (Large_header*) huge_malloc_onnode(map_size, _numa_node);
+        if (h == NULL) {
+          return NULL;
+        }
+        h->magic = LARGE_MAGIC;
+        h->map_size = map_size;
+        return ((byte*) h) + LARGE_HEADER_SIZE;
+      }
+
+      void* alloc_overflow(size_t count) {
+        /* keep the whole class size usable, as reported by usable_size */
+        size_t size = class_size(size_to_class(count)) + LARGE_HEADER_SIZE;
+        Large_header* h = (Large_header*) numa_alloc_onnode(size, _numa_node);
+        if (h == NULL) {
+          return NULL;
+        }
+        h->magic = OVERFLOW_MAGIC;
+        h->map_size = size;
+        return ((byte*) h) + LARGE_HEADER_SIZE;
+      }
+
+      void free_large(void* p) {
+        Large_header* h = (Large_header*)(((byte*) p) - LARGE_HEADER_SIZE);
+        if (h->magic == OVERFLOW_MAGIC) {
+          h->magic = 0;
+          numa_free(h, h->map_size);
+          return;
+        }
+        if (h->magic != LARGE_MAGIC) {
+          PERR("Size_class_allocator: free of foreign pointer %p", p);
+          assert(0);
+          return;
+        }
+        h->magic = 0;
+        huge_free(h);
+      }
+    };
+
+
+    /** 
+     * STL-compatible allocator template backed by a Size_class_allocator
+     * (by default the instance of the calling core's NUMA node).
+     *
+     * e.g., std::vector<int, Size_class_stl_allocator<int> > v;
+     */
+    template <typename T>
+    class Size_class_stl_allocator
+    {
+    public:
+      typedef T              value_type;
+      typedef T*             pointer;
+      typedef const T*       const_pointer;
+      typedef T&             reference;
+      typedef const T&       const_reference;
+      typedef size_t         size_type;
+      typedef ptrdiff_t      difference_type;
+
+      template <typename U>
+      struct rebind {
+        typedef Size_class_stl_allocator<U> other;
+      };
+
+      Size_class_allocator* _allocator;
+
+      Size_class_stl_allocator() throw() 
+        : _allocator(Size_class_allocator::node_instance()) { }
+
+      explicit Size_class_stl_allocator(Size_class_allocator* a) throw() 
+        : _allocator(a) { }
+
+      template <typename U>
+      Size_class_stl_allocator(const Size_class_stl_allocator<U>& other) throw() 
+        : _allocator(other._allocator) { }
+
+      pointer address(reference x) const { return &x; }
+      const_pointer address(const_reference x) const { return &x; }
+
+      pointer allocate(size_type n, const void* hint = 0) {
+        void* p = _allocator->alloc(n * sizeof(T));
+        if (p == NULL) {
+          throw std::bad_alloc();
+        }
+        return static_cast<pointer>(p);
+      }
+
+      void deallocate(pointer p, size_type n) {
+        _allocator->free(p);
+      }
+
+      size_type max_size() const throw() {
+        return std::numeric_limits<size_type>::max() / sizeof(T);
+      }
+
+      void construct(pointer p, const T& val) { new((void*) p) T(val); }
+      void destroy(pointer p) { p->~T(); }
+
+      template <typename U>
+      bool operator==(const Size_class_stl_allocator<U>& other) const { 
+        return _allocator == other._allocator; 
+      }
+
+      template <typename U>
+      bool operator!=(const Size_class_stl_allocator<U>& other) const { 
+        return _allocator != other._allocator; 
+      }
+    };
+
+#endif
+
+  }
+}
+
+#endif // __EXO_SIZE_CLASS_ALLOCATOR_H__
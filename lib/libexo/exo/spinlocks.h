@@ -129,6 +129,15 @@ namespace Exokernel
       return Exokernel::E_BUSY;
     }
 
+    /** 
+     * Try to take lock.  Do not block.
+     * 
+     * @return true if the lock was taken
+     */
+    INLINE bool try_lock() {
+      return trylock() == 0;
+    }
+
     int lockable()
     {
       xdk_barrier();
@@ -193,6 +202,138 @@ namespace Exokernel
 
   } __attribute__((packed));
 
+
+  /** 
+   * MCS queue lock (Mellor-Crummey and Scott).  Waiters form a FIFO queue and
+   * each spins on its own cache-line sized queue node, so a hand-off touches
+   * only the lock word and the successor's node.  Unlike the ticket lock,
+   * performance does not collapse as the number of waiting cores grows.
+   *
+   * lock()/unlock() take a queue node from a small per-thread pool, so the
+   * lock is a drop-in replacement for Spin_lock; the lock must be released by
+   * the thread that took it.  Callers may also supply their own node.
+   */
+  class MCS_lock {
+  public:
+    struct Qnode {
+      Qnode * volatile next;
+      volatile int     locked;
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+  private:
+    enum { MAX_NODES_PER_THREAD = 16 };  /* MCS locks one thread can hold at once */
+
+    Qnode * volatile _tail __attribute__((aligned(CACHE_LINE_SIZE)));
+    Qnode *          _holder;  /* node of the current holder; written by it only */
+    byte _padding[CACHE_LINE_SIZE - 2*sizeof(Qnode *)];
+
+    struct Node_pool {
+      Qnode    nodes[MAX_NODES_PER_THREAD];
+      unsigned used;
+    };
+
+    static INLINE Node_pool& node_pool() {
+      static __thread Node_pool pool;
+      return pool;
+    }
+
+    static INLINE Qnode * get_node() {
+      Node_pool& p = node_pool();
+      if (p.used == (1U << MAX_NODES_PER_THREAD) - 1) 
+        panic("MCS_lock: too many locks held by one thread");
+      unsigned i = __builtin_ctz(~p.used);
+      p.used |= 1U << i;
+      return &p.nodes[i];
+    }
+
+    static INLINE void put_node(Qnode * n) {
+      Node_pool& p = node_pool();
+      unsigned i = n - p.nodes;
+      assert(i < MAX_NODES_PER_THREAD);
+      p.used &= ~(1U << i);
+    }
+
+  public:
+    MCS_lock() : _tail(NULL), _holder(NULL) {
+    }
+
+    /** 
+     * Take lock, queueing on the caller's node
+     * 
+     * @param me Queue node, owned by the caller until unlock(me) returns
+     */
+    INLINE void lock(Qnode * me) {
+      me->next = NULL;
+      me->locked = 1;
+      Qnode * pred = (Qnode *) __sync_lock_test_and_set(&_tail, me);
+      if (pred) {
+        pred->next = me;
+        while (me->locked) cpu_relax();
+      }
+      xdk_barrier();
+    }
+
+    /** 
+     * Release lock taken with lock(me)
+     * 
+     * @param me Queue node passed to lock()
+     */
+    INLINE void unlock(Qnode * me) {
+      if (me->next == NULL) {
+        if (__sync_bool_compare_and_swap(&_tail, me, (Qnode *) NULL)) 
+          return;
+        while (me->next == NULL) cpu_relax(); /* successor is linking in */
+      }
+      xdk_barrier();
+      me->next->locked = 0;
+    }
+
+    /** 
+     * Try to take lock on the caller's node.  Do not block.
+     * 
+     * @return true if the lock was taken
+     */
+    INLINE bool try_lock(Qnode * me) {
+      me->next = NULL;
+      me->locked = 0;
+      return __sync_bool_compare_and_swap(&_tail, (Qnode *) NULL, me);
+    }
+
+    /** 
+     * Take lock
+     * 
+     */
+    INLINE void lock() {
+      Qnode * me = get_node();
+      lock(me);
+      _holder = me;
+    }
+
+    INLINE void unlock() {
+      Qnode * me = _holder;
+      assert(me);
+      unlock(me);
+      put_node(me);
+    }
+
+    /** 
+     * Try to take lock.  Do not block.
+     * 
+     * 
+     * @return true if the lock was taken
+     */
+    INLINE bool try_lock() {
+      Qnode * me = get_node();
+      if (try_lock(me)) {
+        _holder = me;
+        return true;
+      }
+      put_node(me);
+      return false;
+    }
+
+  } __attribute__((aligned(CACHE_LINE_SIZE)));
+
     
   /** 
    * Reentrant locks can be locked multiple times by the same thread.  This
@@ -267,6 +408,7 @@ namespace Exokernel
   typedef Lock_guard_tmpl<Reentrant_spin_lock> Reentrant_lock_guard;
   typedef Lock_guard_tmpl<Spin_lock> Spin_lock_guard;
   typedef Lock_guard_tmpl<Ticket_lock> Ticket_lock_guard;
+  typedef Lock_guard_tmpl<MCS_lock> MCS_lock_guard;
 
 }
 
@@ -47,6 +47,7 @@
 #include "exo/memory.h"
 #include "exo/pagemap.h"
 #include "exo/device.h"
+#include "exo/spinlocks.h"
 
 /** 
  * Mapping table for IO memory mappings
@@ -56,10 +57,12 @@ static std::map<void *, size_t> __vm_mapping_size_table;
 static std::map<void *, size_t> __alloc_pages_mappings;
 
 /**
- * Mapping table for huge memory allocations
+ * Mapping table for huge memory allocations; callers may be on any
+ * thread (e.g. Size_class_allocator large allocations)
  *
  */
 static std::map<void *, size_t> __huge_page_allocations;
+static Exokernel::Spin_lock      __huge_page_allocations_lock;
 
 /** 
  * Alloc an area of memory using huge pages (2MB)
@@ -77,7 +80,42 @@ void * Exokernel::Memory::huge_malloc(size_t alloc_size) {
                   -1, 0);
 
   assert(p);
-  __huge_page_allocations[p] = alloc_size;
+  {
+    Exokernel::Spin_lock_guard guard(__huge_page_allocations_lock);
+    __huge_page_allocations[p] = alloc_size;
+  }
+
+  return p;
+}
+
+
+/** 
+ * Alloc an area of memory using huge pages (2MB) bound to a NUMA node
+ * 
+ * @param alloc_size Size of allocation in bytes
+ * @param numa_node NUMA node to take the pages from
+ * 
+ * @return Pointer to newly allocated memory, NULL on failure
+ */
+void * Exokernel::Memory::huge_malloc_onnode(size_t alloc_size, int numa_node) {
+
+  /* bind before the pages are faulted in, then populate them */
+  void * p = mmap(NULL, 
+                  alloc_size, 
+                  PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB, 
+                  -1, 0);
+
+  if(p == MAP_FAILED)
+    return NULL;
+
+  numa_tonode_memory(p, alloc_size, numa_node);
+  memset(p, 0, alloc_size);
+
+  {
+    Exokernel::Spin_lock_guard guard(__huge_page_allocations_lock);
+    __huge_page_allocations[p] = alloc_size;
+  }
 
   return p;
 }
@@ -131,13 +169,17 @@ void * Exokernel::Memory::huge_mmap(size_t size, addr_t paddr) {
  */
 int Exokernel::Memory::huge_free(void * ptr) {
 
-  std::map<void*,size_t>::iterator i = __huge_page_allocations.find(ptr);
+  size_t allocation_size;
+  {
+    Exokernel::Spin_lock_guard guard(__huge_page_allocations_lock);
+    std::map<void*,size_t>::iterator i = __huge_page_allocations.find(ptr);
 
-  if(i == __huge_page_allocations.end())
-    return E_NOT_FOUND;
+    if(i == __huge_page_allocations.end())
+      return E_NOT_FOUND;
 
-  size_t allocation_size = __huge_page_allocations[ptr];
-  __huge_page_allocations.erase(i);
+    allocation_size = i->second;
+    __huge_page_allocations.erase(i);
+  }
 
   return munmap(ptr,allocation_size);
 }
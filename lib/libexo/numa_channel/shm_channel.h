@@ -37,7 +37,9 @@
 #define __EXO_NUMA_CHANNEL_H__
 
 #include "shm_area.h"
+#include "../channel/channel_wait.h"
 #include "spmc_circbuffer.h"
+#include "../channel/mpmc_circbuffer.h"
 
 #define SHMSZ_BASE (4096)
 
@@ -59,16 +61,26 @@ namespace Exokernel {
    * 1) T: T* is the data type transferred through the channel. 
    * 2) SIZE: the number of slots of buffer created in the shared memory.
    * 3) BUFFER: the buffer implementation used in the shared memory (the default
-   *            buffer implementation is SPMC_circular_buffer<T,SIZE>). 
+   *            buffer implementation is SPMC_circular_buffer<T,SIZE>; use
+   *            MPMC_circular_buffer when several processes share one end). 
+   *
+   * Consumers may either poll with consume() or block with consume_wait();
+   * producers only issue a futex wake when a consumer is actually asleep.
    */
   template <class T, unsigned SIZE, 
-            template <class T, unsigned SIZE> class BUFFER = SPMC_circular_buffer >
+            template <class, unsigned> class BUFFER = SPMC_circular_buffer >
   class Shm_channel {
 
   private:
 
     Shm_area* _shm_areas[2];    /**< Two shared memory areas. */
     BUFFER<T, SIZE>* _buffers[2]; /**< Two buffers, each in one shared memory area. */
+    Channel_waitq* _waitqs[2];    /**< Wait queues, placed after each buffer. */
+
+    /** Offset of the wait queue within a shared memory area. */
+    static size_t waitq_offset() {
+      return (sizeof(BUFFER<T, SIZE>) + CACHE_LINE_SIZE - 1) & ~((size_t) CACHE_LINE_SIZE - 1);
+    }
 
   public:
 
@@ -101,6 +113,7 @@ namespace Exokernel {
         if (need_alloc) {
           // create two new buffers on the shared memory.
           _buffers[i] = new(ptr) BUFFER<T, SIZE>();
+          _waitqs[i] = new((char*) ptr + waitq_offset()) Channel_waitq();
 
 #if (DEBUG_CHANNEL != 0)
           std::cout << "When creat: buf[" << i << "] : attached @ " 
@@ -110,6 +123,7 @@ namespace Exokernel {
         else {
           // Switch the two existing buffers created by its counterpart.
           _buffers[(i+1)%2] = (BUFFER<T, SIZE> *)ptr;
+          _waitqs[(i+1)%2] = (Channel_waitq *)((char*) ptr + waitq_offset());
 
 #if (DEBUG_CHANNEL != 0)
           std::cout << "When match: buf[" << (i+1)%2 << "] : attached @ " 
@@ -132,7 +146,11 @@ namespace Exokernel {
      * @return status of this operation.
      */
     inline status_t produce(T* item) { 
-      return _buffers[0]->produce(item); 
+      status_t s = _buffers[0]->produce(item); 
+      if (s == E_SPMC_CIRBUFF_OK) {
+        _waitqs[0]->wake(1);
+      }
+      return s;
     }
 
     /**
@@ -144,6 +162,72 @@ namespace Exokernel {
       return _buffers[1]->consume(item); 
     }
 
+    /**
+     * Extracts an item from the channel, blocking while it is empty. The
+     * consumer polls up to 'spin_budget' times and then sleeps on a
+     * process-shared futex until the producer wakes it.
+     *
+     * @param[out] item the ptr to the extracted item.
+     * @param spin_budget number of empty polls before sleeping.
+     * @param timeout_ms give up after sleeping this long without an item
+     *                   (0 = wait forever).
+     * @return E_SPMC_CIRBUFF_OK on success, E_SPMC_CIRBUFF_EMPTY on timeout.
+     */
+    status_t consume_wait(T** item, 
+                          unsigned spin_budget = CHANNEL_SPIN_BUDGET,
+                          unsigned timeout_ms = 0) {
+      Channel_waitq* wq = _waitqs[1];
+
+      while (1) {
+        for (unsigned spin = 0; spin <= spin_budget; spin++) {
+          status_t s = _buffers[1]->consume(item);
+          if (s == E_SPMC_CIRBUFF_OK) {
+            return s;
+          }
+          if (s == E_SPMC_CIRBUFF_EMPTY) {
+            cpu_relax();
+          }
+        }
+
+        uint32_t seq = wq->prepare();
+        status_t s;
+        while ((s = _buffers[1]->consume(item)) == E_SPMC_CIRBUFF_CONTENTION);
+        if (s == E_SPMC_CIRBUFF_OK) {
+          wq->cancel();
+          return s;
+        }
+
+        if (!wq->wait(seq, timeout_ms)) {
+          return _buffers[1]->consume(item) == E_SPMC_CIRBUFF_OK ? 
+            E_SPMC_CIRBUFF_OK : E_SPMC_CIRBUFF_EMPTY;
+        }
+      }
+    }
+
+    /**
+     * Inserts up to 'n' items into the channel with a single publish.
+     * @param items the ptrs to the items.
+     * @param n number of items.
+     * @return number of items inserted.
+     */
+    inline size_t produce_bulk(T** items, size_t n) { 
+      size_t count = _buffers[0]->produce_bulk(items, n); 
+      if (count > 0) {
+        _waitqs[0]->wake(count);
+      }
+      return count;
+    }
+
+    /**
+     * Extracts up to 'max' items from the channel with a single claim.
+     * @param[out] items the ptrs to the extracted items.
+     * @param max maximum number of items to extract.
+     * @return number of items extracted.
+     */
+    inline size_t consume_bulk(T** items, size_t max) {
+      return _buffers[1]->consume_bulk(items, max); 
+    }
+
     /** Prints on screen information about the channel. */
     void dump() {
       std::cout << std::endl << "**** Shm_channel information :" << std::endl;
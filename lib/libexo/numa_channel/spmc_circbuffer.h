@@ -45,6 +45,10 @@ namespace Exokernel {
 
 #define HEAD_TAIL_DISTANCE    (8)
 
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
   enum {
     E_SPMC_CIRBUFF_OK = 0,
     E_SPMC_CIRBUFF_EMPTY = 1,
@@ -66,13 +70,15 @@ namespace Exokernel {
 
     const uint32_t _mask;
 
-    volatile uint32_t _prod_head __attribute__((aligned(32))); 
-    volatile uint32_t _cons_head __attribute__((aligned(32))); 
+    /* producer indices and consumer indices live on separate cache lines
+       so that consumer CAS traffic does not false-share with the producer */
+    volatile uint32_t _prod_head __attribute__((aligned(CACHE_LINE_SIZE))); 
+    volatile uint32_t _prod_tail;
 
-    volatile uint32_t _prod_tail __attribute__((aligned(32)));
-    volatile uint32_t _cons_tail __attribute__((aligned(32)));
+    volatile uint32_t _cons_head __attribute__((aligned(CACHE_LINE_SIZE))); 
+    volatile uint32_t _cons_tail;
 
-    const uint32_t _begin __attribute__((aligned)); 
+    const uint32_t _begin __attribute__((aligned(CACHE_LINE_SIZE))); 
     const uint32_t _end __attribute__((aligned)); 
 
     T* _buffer[SIZE] __attribute__((aligned(64))); 
@@ -184,6 +190,93 @@ namespace Exokernel {
     }
 
 
+    /** 
+     * Removes up to 'max' items from the buffer. A contiguous run of
+     * entries is claimed with a single CAS on the consumer head.
+     *
+     * @param[out] items array receiving the pointers to the removed items.
+     * @param max maximum number of items to remove.
+     * @return number of items removed; 0 if the buffer is empty or the
+     *         claim lost against another consumer.
+     */
+    size_t consume_bulk(T** items, size_t max) {
+      if (items == NULL || max == 0) {
+        return 0;
+      }
+
+      uint32_t cons_head, prod_tail;
+      uint32_t cons_next, entries;
+
+      cons_head = _cons_head;
+      prod_tail = _prod_tail;
+
+      entries = (prod_tail - cons_head) / HEAD_TAIL_DISTANCE;
+      if (entries == 0) {
+        return 0;
+      }
+
+      size_t n = (entries < max) ? entries : max;
+      cons_next = cons_head + n * HEAD_TAIL_DISTANCE;
+      if (!__sync_bool_compare_and_swap(&_cons_head, cons_head, cons_next)) {
+        return 0;
+      }
+
+      for (size_t i = 0; i < n; i++) {
+        items[i] = _buffer[(cons_head + i * HEAD_TAIL_DISTANCE) % SIZE];
+      }
+      COMPILER_BARRIER();
+
+      /* wait for preceding dequeues to complete */
+      while (_cons_tail != cons_head)
+        cpu_relax();
+
+      _cons_tail = cons_next;
+      return n;
+    }
+
+
+    /** 
+     * Inserts up to 'n' items into the buffer and publishes them with a
+     * single update of the producer tail.
+     *
+     * @param items array of pointers to data items (none may be NULL).
+     * @param n number of items in 'items'.
+     * @return number of items inserted (a prefix of 'items'); 0 if the
+     *         buffer is full.
+     */
+    size_t produce_bulk(T** items, size_t n) {
+      if (items == NULL) {
+        return 0;
+      }
+
+      uint32_t prod_head, cons_tail;
+      uint32_t prod_next, free_entries;
+
+      prod_head = _prod_head;
+      cons_tail = _cons_tail;
+
+      free_entries = (_mask + cons_tail - prod_head) / HEAD_TAIL_DISTANCE;
+      if (n > free_entries) {
+        n = free_entries;
+      }
+      if (n == 0) {
+        return 0;
+      }
+
+      prod_next = prod_head + n * HEAD_TAIL_DISTANCE;
+      _prod_head = prod_next;
+
+      for (size_t i = 0; i < n; i++) {
+        assert(items[i] != NULL);
+        _buffer[(prod_head + i * HEAD_TAIL_DISTANCE) % SIZE] = items[i];
+      }
+      COMPILER_BARRIER();
+
+      _prod_tail = prod_next;
+      return n;
+    }
+
+
     /** Prints on screen information about the channel. */
     void dump() {
       std::cout << "===========================" << std::endl
@@ -0,0 +1,226 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+/*
+  Tests for Shm_byte_ring: records padded at the wrap point, the largest
+  accepted message on a ring whose head sits just before the wrap, and
+  two producer threads streaming variable-length messages to a consumer
+  through many wrap-arounds.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <common/types.h>
+#include <channel/shm_byte_ring.h>
+
+#define RING_SIZE      (256)
+#define NUM_PRODUCERS  (2)
+#define MSGS_PER_PROD  (200000)
+
+using namespace Exokernel;
+
+typedef Shm_byte_ring<true> Ring_t;
+
+static bool ok = true;
+
+#define CHECK(cond) do {                                        \
+    if (!(cond)) {                                              \
+      printf("check failed (line %d): %s\n", __LINE__, #cond);  \
+      ok = false;                                               \
+    }                                                           \
+  } while (0)
+
+static Ring_t * new_ring(size_t capacity)
+{
+  void * p = NULL;
+  if (posix_memalign(&p, CACHE_LINE_SIZE, Ring_t::footprint(capacity)) != 0)
+    return NULL;
+  return new (p) Ring_t(capacity);
+}
+
+/* sends one message of 'len' bytes filled with 'fill'; false if no room */
+static bool send(Ring_t * ring, size_t len, uint8_t fill)
+{
+  void * msg = ring->reserve(len);
+  if (!msg) return false;
+  memset(msg, fill, len);
+  ring->commit(msg);
+  return true;
+}
+
+/* receives one message and checks its length and content */
+static bool recv_check(Ring_t * ring, size_t len, uint8_t fill)
+{
+  void * msg;
+  size_t n;
+  if (ring->peek(&msg, &n) != E_SPMC_CIRBUFF_OK) return false;
+  bool good = (n == len);
+  for (size_t i = 0; good && i < n; i++) 
+    good = (((uint8_t *) msg)[i] == fill);
+  ring->release();
+  return good;
+}
+
+static void test_limits()
+{
+  Ring_t * ring = new_ring(RING_SIZE);
+  size_t max = ring->max_message();
+
+  CHECK(max == RING_SIZE / 2 - 8);
+  CHECK(ring->reserve(RING_SIZE) == NULL);
+  CHECK(ring->reserve(max + 1) == NULL);
+
+  /* move the empty ring's head to 8 bytes before the wrap point */
+  for (size_t off = 0; off < RING_SIZE - 8; off += 64) {
+    size_t len = (RING_SIZE - 8 - off >= 64) ? 56 : RING_SIZE - 8 - off - 8;
+    CHECK(send(ring, len, 0x11));
+    CHECK(recv_check(ring, len, 0x11));
+  }
+
+  /* the largest message still fits behind a padding record */
+  for (unsigned i = 0; i < 8; i++) {
+    CHECK(send(ring, max, 0x20 + i));
+    CHECK(recv_check(ring, max, 0x20 + i));
+  }
+
+  /* two maximal messages fill the ring exactly */
+  CHECK(send(ring, max, 0x30));
+  CHECK(send(ring, max, 0x31));
+  CHECK(ring->reserve(1) == NULL);
+  CHECK(recv_check(ring, max, 0x30));
+  CHECK(recv_check(ring, max, 0x31));
+
+  void * msg;
+  size_t n;
+  CHECK(ring->peek(&msg, &n) == E_SPMC_CIRBUFF_EMPTY);
+  free(ring);
+}
+
+static void test_wrap_padding()
+{
+  Ring_t * ring = new_ring(RING_SIZE);
+  size_t max = ring->max_message();
+
+  /* varying lengths move the wrap point through every offset, so many
+     messages are placed behind a padding record */
+  for (unsigned i = 0; i < 10000; i++) {
+    size_t len = 1 + (i * 7) % max;
+    CHECK(send(ring, len, i & 0xff));
+    CHECK(recv_check(ring, len, i & 0xff));
+  }
+
+  /* a second, short message queued behind a large one */
+  for (unsigned i = 0; i < 10000; i++) {
+    size_t len1 = 1 + (i * 13) % (max - 16);
+    size_t len2 = 1 + i % 8;
+    CHECK(send(ring, len1, i & 0xff));
+    CHECK(send(ring, len2, ~i & 0xff));
+    CHECK(recv_check(ring, len1, i & 0xff));
+    CHECK(recv_check(ring, len2, ~i & 0xff));
+  }
+  free(ring);
+}
+
+/* messages carry the producer id and a sequence number */
+struct Message {
+  uint32_t producer;
+  uint32_t seq;
+};
+
+static Ring_t * stream_ring;
+
+/* the threads yield when blocked, so the test also completes on one CPU */
+static void * producer(void * arg)
+{
+  uint32_t id = (uint32_t) (uintptr_t) arg;
+
+  for (uint32_t seq = 0; seq < MSGS_PER_PROD; seq++) {
+    size_t len = sizeof(Message) + (seq % (stream_ring->max_message() - sizeof(Message) + 1));
+    Message * m;
+    while ((m = (Message *) stream_ring->reserve(len)) == NULL)
+      sched_yield();
+    m->producer = id;
+    m->seq = seq;
+    memset(m + 1, (uint8_t) seq, len - sizeof(Message));
+    stream_ring->commit(m);
+  }
+  return NULL;
+}
+
+static void test_stream()
+{
+  stream_ring = new_ring(RING_SIZE * 16);
+
+  pthread_t threads[NUM_PRODUCERS];
+  for (uintptr_t i = 0; i < NUM_PRODUCERS; i++)
+    pthread_create(&threads[i], NULL, producer, (void *) i);
+
+  uint32_t next[NUM_PRODUCERS] = {0};
+  unsigned received = 0;
+  while (received < NUM_PRODUCERS * MSGS_PER_PROD) {
+    void * msg;
+    size_t len;
+    if (stream_ring->peek(&msg, &len) != E_SPMC_CIRBUFF_OK) {
+      sched_yield();
+      continue;
+    }
+
+    Message * m = (Message *) msg;
+    bool good = (len >= sizeof(Message)) && (m->producer < NUM_PRODUCERS) &&
+      (m->seq == next[m->producer]);
+    for (size_t i = sizeof(Message); good && i < len; i++)
+      good = (((uint8_t *) msg)[i] == (uint8_t) m->seq);
+    if (!good) {
+      CHECK(good);
+      break;
+    }
+    next[m->producer]++;
+    stream_ring->release();
+    received++;
+  }
+
+  for (unsigned i = 0; i < NUM_PRODUCERS; i++)
+    pthread_join(threads[i], NULL);
+  free(stream_ring);
+}
+
+int main(int argc, char * argv[])
+{
+  test_limits();
+  test_wrap_padding();
+  test_stream();
+
+  printf("Shm_byte_ring test: %s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -78,9 +78,8 @@ void * app_thread(void * arg) {
   unsigned count = 0;
 
   while (1) {
-    while (app_side_channel->consume(&item) != E_SPMC_CIRBUFF_OK) {
-      cpu_relax();   
-    }
+    /* spin briefly, then sleep until the other end produces */
+    app_side_channel->consume_wait(&item);
     count++;
     //printf("[Dummy App %d] Consumed an item at %p count = %u\n",tinfo->global_id, item, count);
 
@@ -0,0 +1,163 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+/*
+  Stress test for MPMC_circular_buffer used as the buffer of Shm_channel.
+  Several producer processes attach to one end of a channel and several
+  consumer processes share the other end; every item must be received
+  exactly once.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <common/types.h>
+#include <channel/shm_channel.h>
+
+#define CHANNEL_ID     (100)
+#define CHANNEL_SIZE   (256)
+#define NUM_PRODUCERS  (4)
+#define NUM_CONSUMERS  (3)
+#define ITEMS_PER_PROD (200000)
+#define TOTAL_ITEMS    (NUM_PRODUCERS * ITEMS_PER_PROD)
+#define BULK           (16)
+
+using namespace Exokernel;
+
+typedef Shm_channel<void, CHANNEL_SIZE, MPMC_circular_buffer> Channel_t;
+
+/* results, shared by all processes through an anonymous mapping */
+struct Results {
+  volatile uint64_t consumed;
+  volatile uint64_t sum;
+  volatile uint64_t duplicates;
+  volatile uint8_t  seen[TOTAL_ITEMS + 1];
+};
+
+static void producer(unsigned id)
+{
+  Channel_t * ch = new Channel_t(CHANNEL_ID, false);
+  uint64_t next = (uint64_t) id * ITEMS_PER_PROD + 1;
+  uint64_t end = next + ITEMS_PER_PROD;
+
+  while (next < end) {
+    if (next & 1) {
+      while (ch->produce((void*) next) != E_SPMC_CIRBUFF_OK) 
+        cpu_relax();
+      next++;
+    }
+    else {
+      void * items[BULK];
+      size_t n = 0;
+      while (n < BULK && next + n < end) {
+        items[n] = (void*) (next + n);
+        n++;
+      }
+      next += ch->produce_bulk(items, n);
+    }
+  }
+  _exit(0); /* do not unlink the channel */
+}
+
+static void consumer(Channel_t * ch, Results * r)
+{
+  uint64_t sum = 0;
+  unsigned iter = 0;
+
+  while (r->consumed < TOTAL_ITEMS) {
+    void * items[BULK];
+    size_t n;
+
+    if (iter++ & 1) {
+      n = ch->consume_bulk(items, BULK);
+    }
+    else {
+      n = (ch->consume(&items[0]) == E_SPMC_CIRBUFF_OK) ? 1 : 0;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      uint64_t v = (uint64_t) items[i];
+      assert(v > 0 && v <= TOTAL_ITEMS);
+      if (__sync_lock_test_and_set(&r->seen[v], 1))
+        __sync_fetch_and_add(&r->duplicates, 1);
+      sum += v;
+    }
+
+    if (n > 0) 
+      __sync_fetch_and_add(&r->consumed, n);
+    else 
+      cpu_relax();
+  }
+
+  __sync_fetch_and_add(&r->sum, sum);
+  _exit(0);
+}
+
+int main(int argc, char * argv[])
+{
+  Results * r = (Results *) mmap(NULL, sizeof(Results), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(r != MAP_FAILED);
+  memset((void*) r, 0, sizeof(Results));
+
+  /* the consumer end; consumers inherit it across fork */
+  Channel_t * ch = new Channel_t(CHANNEL_ID, true);
+
+  for (unsigned i = 0; i < NUM_CONSUMERS; i++) {
+    if (fork() == 0) consumer(ch, r);
+  }
+  for (unsigned i = 0; i < NUM_PRODUCERS; i++) {
+    if (fork() == 0) producer(i);
+  }
+
+  int status;
+  bool ok = true;
+  for (unsigned i = 0; i < NUM_CONSUMERS + NUM_PRODUCERS; i++) {
+    wait(&status);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+  }
+
+  uint64_t expected = (uint64_t) TOTAL_ITEMS * (TOTAL_ITEMS + 1) / 2;
+  for (uint64_t v = 1; v <= TOTAL_ITEMS; v++) {
+    if (!r->seen[v]) ok = false;
+  }
+  ok = ok && (r->consumed == TOTAL_ITEMS) && (r->sum == expected) && (r->duplicates == 0);
+
+  printf("MPMC channel: %u producers, %u consumers, %lu items, %lu duplicates: %s\n",
+         NUM_PRODUCERS, NUM_CONSUMERS, (unsigned long) r->consumed, 
+         (unsigned long) r->duplicates, ok ? "PASS" : "FAIL");
+
+  delete ch;
+  return ok ? 0 : 1;
+}
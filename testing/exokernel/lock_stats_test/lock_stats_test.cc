@@ -0,0 +1,111 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+/*
+  Contention test for MCS_lock and the lock statistics.  Worker threads
+  increment a shared counter under an instrumented MCS lock; the counter
+  must be exact and the per-name statistics must account for every
+  acquisition, including the contended ones forced at start-up.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <common/types.h>
+#include <exo/lock_stats.h>
+
+#define MAX_THREADS    (4)
+#define ITERS          (1000)
+#define LOCK_NAME      "test.mcs"
+
+using namespace Exokernel;
+
+typedef Instrumented_lock_tmpl<MCS_lock> Stat_mcs_lock;
+
+static Stat_mcs_lock     lock(LOCK_NAME);
+static volatile uint64_t counter = 0;
+static volatile unsigned arrived = 0;
+static unsigned          num_threads;
+
+static void * worker(void * arg)
+{
+  __sync_fetch_and_add(&arrived, 1);
+
+  for (unsigned i = 0; i < ITERS; i++) {
+    lock.lock();
+    counter = counter + 1; /* not atomic: relies on the lock */
+    lock.unlock();
+  }
+  return NULL;
+}
+
+int main(int argc, char * argv[])
+{
+  pthread_t threads[MAX_THREADS];
+
+  /* queue locks convoy when waiters outnumber CPUs */
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  num_threads = (cpus < 2) ? 2 : ((cpus > MAX_THREADS) ? MAX_THREADS : (unsigned) cpus);
+
+  Lock_stats_registry::reset();
+
+  /* hold the lock while the workers start, so that each of them has to
+     queue for its first acquisition */
+  lock.lock();
+  for (unsigned i = 0; i < num_threads; i++) 
+    pthread_create(&threads[i], NULL, worker, NULL);
+
+  while (arrived < num_threads) 
+    usleep(1000);
+  usleep(100 * 1000);
+  lock.unlock();
+
+  for (unsigned i = 0; i < num_threads; i++) 
+    pthread_join(threads[i], NULL);
+
+  Lock_stats s;
+  unsigned instances = Lock_stats_registry::get(LOCK_NAME, &s);
+  Lock_stats_registry::dump();
+
+  const uint64_t expected = (uint64_t) num_threads * ITERS;
+  bool ok = (counter == expected) &&
+    (instances == 1) &&
+    (s.acquisitions == expected + 1) && /* plus main's acquisition */
+    (s.contended >= num_threads) &&
+    (s.contended <= s.acquisitions) &&
+    (s.spin_cycles > 0);
+
+  printf("MCS lock: %u threads, counter=%lu, acquisitions=%lu, contended=%lu: %s\n",
+         num_threads, (unsigned long) counter, (unsigned long) s.acquisitions,
+         (unsigned long) s.contended, ok ? "PASS" : "FAIL");
+
+  return ok ? 0 : 1;
+}
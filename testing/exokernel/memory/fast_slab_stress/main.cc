@@ -0,0 +1,219 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+/*
+  Multi-threaded stress test for Fast_slab_allocator with per-thread
+  magazines.  Threads allocate (singly and in bulk), hand half of their
+  blocks to a neighbour that frees them into its own magazine, and exit
+  at different times so that their magazines are returned by the thread
+  exit handler.  Every block carries a stamp that is claimed with a CAS
+  on allocation, so a block handed out twice is detected; at the end all
+  blocks must be back in the allocator.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "libexo.h"
+#include <exo/fast_slab.h>
+
+#define NUM_THREADS    (4)
+#define NUM_BLOCKS     (4096)
+#define BLOCK_SIZE     (64)
+#define MAGAZINE_SIZE  (8)
+#define ROUNDS         (20000)
+#define MAX_BATCH      (16)
+#define MAILBOX_SIZE   (256)
+#define FREE_STAMP     (0)
+
+using namespace Exokernel::Memory;
+
+/* blocks handed from one thread to the next */
+struct Mailbox {
+  pthread_mutex_t lock;
+  unsigned        count;
+  void *          blocks[MAILBOX_SIZE];
+};
+
+static Fast_slab_allocator * allocator;
+static Mailbox               mailboxes[NUM_THREADS];
+static volatile unsigned     errors = 0;
+
+static void error(const char * what)
+{
+  if (__sync_fetch_and_add(&errors, 1) == 0)
+    printf("error: %s\n", what);
+}
+
+/* claims a freshly allocated block for 'owner' */
+static void claim(void * p, uint64_t owner)
+{
+  if (!__sync_bool_compare_and_swap((volatile uint64_t *) p, FREE_STAMP, owner))
+    error("block allocated twice");
+}
+
+/* releases a block held by 'owner' before it is freed */
+static void release(void * p, uint64_t owner)
+{
+  if (!__sync_bool_compare_and_swap((volatile uint64_t *) p, owner, FREE_STAMP))
+    error("block stamp overwritten");
+}
+
+static void * worker(void * arg)
+{
+  unsigned id = (unsigned) (uintptr_t) arg;
+  uint64_t stamp = id + 1;
+  unsigned seed = id;
+  Mailbox * next = &mailboxes[(id + 1) % NUM_THREADS];
+  Mailbox * mine = &mailboxes[id];
+
+  /* threads exit one after another; the exit handler drains their magazines */
+  unsigned rounds = ROUNDS / NUM_THREADS * (id + 1);
+
+  for (unsigned r = 0; r < rounds; r++) {
+    void * blocks[MAX_BATCH];
+    size_t n = 1 + rand_r(&seed) % MAX_BATCH;
+    size_t got = 0;
+
+    if (r & 1) {
+      got = allocator->alloc_bulk(blocks, n);
+    }
+    else {
+      while (got < n && (blocks[got] = allocator->alloc()) != NULL)
+        got++;
+    }
+
+    for (size_t i = 0; i < got; i++) 
+      claim(blocks[i], stamp);
+
+    /* the second half goes to the next thread, which frees it */
+    size_t keep = got / 2;
+    pthread_mutex_lock(&next->lock);
+    for (size_t i = keep; i < got; i++) {
+      if (next->count < MAILBOX_SIZE) 
+        next->blocks[next->count++] = blocks[i];
+      else 
+        blocks[keep++] = blocks[i];
+    }
+    pthread_mutex_unlock(&next->lock);
+
+    for (size_t i = 0; i < keep; i++) 
+      release(blocks[i], stamp);
+    if (r & 2) {
+      if (allocator->free_bulk(blocks, keep) != Exokernel::S_OK) 
+        error("free_bulk failed");
+    }
+    else {
+      for (size_t i = 0; i < keep; i++) 
+        if (allocator->free(blocks[i]) != Exokernel::S_OK) 
+          error("free failed");
+    }
+
+    /* free what the previous thread handed over */
+    void * received[MAILBOX_SIZE];
+    unsigned count;
+    pthread_mutex_lock(&mine->lock);
+    count = mine->count;
+    memcpy(received, mine->blocks, count * sizeof(void *));
+    mine->count = 0;
+    pthread_mutex_unlock(&mine->lock);
+
+    uint64_t sender = (id + NUM_THREADS - 1) % NUM_THREADS + 1;
+    for (unsigned i = 0; i < count; i++) {
+      release(received[i], sender);
+      if (allocator->free(received[i]) != Exokernel::S_OK) 
+        error("free of received block failed");
+    }
+
+    if (r % 1000 == 999) 
+      allocator->flush_magazine();
+  }
+  return NULL;
+}
+
+int main(int argc, char * argv[])
+{
+  size_t len = Fast_slab_allocator::actual_block_size(BLOCK_SIZE) * NUM_BLOCKS;
+  void * mem = NULL;
+  if (posix_memalign(&mem, 4096, len) != 0) 
+    return 1;
+
+  allocator = new Fast_slab_allocator(mem, len, BLOCK_SIZE);
+  if (allocator->enable_magazines(MAGAZINE_SIZE) != Exokernel::S_OK) {
+    printf("Fast_slab_allocator stress: cannot enable magazines: FAIL\n");
+    return 1;
+  }
+
+  /* stamp every block free */
+  static void * all[NUM_BLOCKS + 1];
+  size_t n = allocator->alloc_bulk(all, NUM_BLOCKS);
+  assert(n == NUM_BLOCKS);
+  for (size_t i = 0; i < n; i++) 
+    *(uint64_t *) all[i] = FREE_STAMP;
+  allocator->free_bulk(all, n);
+  allocator->flush_magazine();
+
+  for (unsigned i = 0; i < NUM_THREADS; i++) {
+    pthread_mutex_init(&mailboxes[i].lock, NULL);
+    mailboxes[i].count = 0;
+  }
+
+  pthread_t threads[NUM_THREADS];
+  for (uintptr_t i = 0; i < NUM_THREADS; i++) 
+    pthread_create(&threads[i], NULL, worker, (void *) i);
+  for (unsigned i = 0; i < NUM_THREADS; i++) 
+    pthread_join(threads[i], NULL);
+
+  /* blocks left in the mailboxes of threads that exited first */
+  for (unsigned t = 0; t < NUM_THREADS; t++) {
+    for (unsigned i = 0; i < mailboxes[t].count; i++) {
+      release(mailboxes[t].blocks[i], (t + NUM_THREADS - 1) % NUM_THREADS + 1);
+      allocator->free(mailboxes[t].blocks[i]);
+    }
+  }
+  allocator->flush_magazine();
+
+  /* every block is back, exactly once */
+  bool ok = (allocator->num_avail() == NUM_BLOCKS);
+  n = allocator->alloc_bulk(all, NUM_BLOCKS + 1);
+  ok = ok && (n == NUM_BLOCKS);
+  for (size_t i = 0; i < n; i++) 
+    claim(all[i], 1);
+  ok = ok && (errors == 0);
+
+  printf("Fast_slab_allocator stress: %u threads, %u blocks, %u errors: %s\n",
+         NUM_THREADS, NUM_BLOCKS, errors, ok ? "PASS" : "FAIL");
+
+  delete allocator;
+  ::free(mem);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+/*
+  Multi-threaded stress test for Numa_slab_allocator.  One thread runs
+  per partition (up to four CPUs of node 0).  Threads pass half of their
+  blocks to a neighbour, which frees them with free(p, core) so that the
+  blocks are batched and returned to their owning partition; the first
+  thread periodically drains its own partition to force steals from its
+  siblings.  Every block carries a stamp that is claimed with a CAS on
+  allocation, so a block handed out twice is detected.  At the end every
+  core is flushed and all blocks must be back in their partitions.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <numa.h>
+
+#include "libexo.h"
+#include <exo/numa_slab.h>
+
+#define MAX_THREADS    (4)
+#define QUOTA          (512)
+#define BLOCK_SIZE     (128)
+#define MAGAZINE_SIZE  (8)
+#define ROUNDS         (20000)
+#define MAX_BATCH      (32)
+#define MAILBOX_SIZE   (128)
+#define FREE_STAMP     (0)
+
+using namespace Exokernel::Memory;
+
+/* blocks handed from one thread to the next */
+struct Mailbox {
+  pthread_mutex_t lock;
+  unsigned        count;
+  void *          blocks[MAILBOX_SIZE];
+};
+
+static Numa_slab_allocator * allocator;
+static core_id_t             cores[MAX_THREADS];
+static unsigned              num_threads = 0;
+static Mailbox               mailboxes[MAX_THREADS];
+static volatile unsigned     errors = 0;
+
+static void error(const char * what)
+{
+  if (__sync_fetch_and_add(&errors, 1) == 0)
+    printf("error: %s\n", what);
+}
+
+/* claims a freshly allocated block for 'owner' */
+static void claim(void * p, uint64_t owner)
+{
+  if (!__sync_bool_compare_and_swap((volatile uint64_t *) p, FREE_STAMP, owner))
+    error("block allocated twice");
+}
+
+/* releases a block held by 'owner' before it is freed */
+static void release(void * p, uint64_t owner)
+{
+  if (!__sync_bool_compare_and_swap((volatile uint64_t *) p, owner, FREE_STAMP))
+    error("block stamp overwritten");
+}
+
+/* allocates more than the core's quota, which needs steals, and frees it all */
+static void drain(core_id_t core, uint64_t stamp)
+{
+  static void * held[QUOTA + QUOTA / 4];
+  size_t n = 0;
+
+  while (n < QUOTA + QUOTA / 4 && (held[n] = allocator->alloc(core)) != NULL) {
+    claim(held[n], stamp);
+    n++;
+  }
+  for (size_t i = 0; i < n; i++) {
+    release(held[i], stamp);
+    allocator->free(held[i], core);
+  }
+}
+
+static void * worker(void * arg)
+{
+  unsigned id = (unsigned) (uintptr_t) arg;
+  core_id_t core = cores[id];
+  uint64_t stamp = id + 1;
+  unsigned seed = id;
+  Mailbox * next = &mailboxes[(id + 1) % num_threads];
+  Mailbox * mine = &mailboxes[id];
+
+  for (unsigned r = 0; r < ROUNDS; r++) {
+    void * blocks[MAX_BATCH];
+    size_t n = 1 + rand_r(&seed) % MAX_BATCH;
+    size_t got = 0;
+
+    if (r & 1) {
+      got = allocator->alloc_bulk(core, blocks, n);
+    }
+    else {
+      while (got < n && (blocks[got] = allocator->alloc(core)) != NULL)
+        got++;
+    }
+
+    for (size_t i = 0; i < got; i++) 
+      claim(blocks[i], stamp);
+
+    /* the second half goes to the next thread, which frees it remotely */
+    size_t keep = got / 2;
+    if (num_threads > 1) {
+      pthread_mutex_lock(&next->lock);
+      for (size_t i = keep; i < got; i++) {
+        if (next->count < MAILBOX_SIZE) 
+          next->blocks[next->count++] = blocks[i];
+        else 
+          blocks[keep++] = blocks[i];
+      }
+      pthread_mutex_unlock(&next->lock);
+    }
+    else {
+      keep = got;
+    }
+
+    for (size_t i = 0; i < keep; i++) {
+      release(blocks[i], stamp);
+      if (allocator->free(blocks[i], core) != Exokernel::S_OK) 
+        error("free failed");
+    }
+
+    /* free what the previous thread handed over: remote frees, batched */
+    void * received[MAILBOX_SIZE];
+    unsigned count;
+    pthread_mutex_lock(&mine->lock);
+    count = mine->count;
+    memcpy(received, mine->blocks, count * sizeof(void *));
+    mine->count = 0;
+    pthread_mutex_unlock(&mine->lock);
+
+    uint64_t sender = (id + num_threads - 1) % num_threads + 1;
+    for (unsigned i = 0; i < count; i++) {
+      release(received[i], sender);
+      status_t rc = (i & 1) ? allocator->free(received[i], core) : allocator->free(received[i]);
+      if (rc != Exokernel::S_OK) 
+        error("free of received block failed");
+    }
+
+    if (id == 0 && r % 1000 == 500) 
+      drain(core, stamp);
+  }
+  return NULL;
+}
+
+int main(int argc, char * argv[])
+{
+  /* partitions on the CPUs of node 0 */
+  Cpu_bitset mask;
+  struct bitmask * bm = numa_allocate_cpumask();
+  if (numa_node_to_cpus(0, bm) != 0) {
+    printf("Numa_slab_allocator stress: cannot read CPUs of node 0: FAIL\n");
+    return 1;
+  }
+  for (unsigned cpu = 0; cpu < EXOLIB_MAX_CPUS && num_threads < MAX_THREADS; cpu++) {
+    if (numa_bitmask_isbitset(bm, cpu)) {
+      mask.set(cpu);
+      cores[num_threads++] = cpu;
+    }
+  }
+  numa_free_cpumask(bm);
+  assert(num_threads > 0);
+
+  size_t total = num_threads * QUOTA;
+  size_t len = Fast_slab_allocator::actual_block_size(BLOCK_SIZE) * total;
+  void * mem = NULL;
+  if (posix_memalign(&mem, 4096, len) != 0) 
+    return 1;
+
+  allocator = new Numa_slab_allocator(mem, len, QUOTA, BLOCK_SIZE, mask);
+
+  /* stamp every block free before the magazines hold any */
+  static void * all[QUOTA];
+  for (unsigned t = 0; t < num_threads; t++) {
+    size_t n = allocator->alloc_bulk(cores[t], all, QUOTA);
+    assert(n == QUOTA);
+    for (size_t i = 0; i < n; i++) 
+      *(uint64_t *) all[i] = FREE_STAMP;
+    allocator->free_bulk(all, n);
+  }
+  if (allocator->enable_magazines(MAGAZINE_SIZE) != Exokernel::S_OK) {
+    printf("Numa_slab_allocator stress: cannot enable magazines: FAIL\n");
+    return 1;
+  }
+
+  for (unsigned i = 0; i < num_threads; i++) {
+    pthread_mutex_init(&mailboxes[i].lock, NULL);
+    mailboxes[i].count = 0;
+  }
+
+  pthread_t threads[MAX_THREADS];
+  for (uintptr_t i = 0; i < num_threads; i++) 
+    pthread_create(&threads[i], NULL, worker, (void *) i);
+  for (unsigned i = 0; i < num_threads; i++) 
+    pthread_join(threads[i], NULL);
+
+  for (unsigned t = 0; t < num_threads; t++) {
+    for (unsigned i = 0; i < mailboxes[t].count; i++) {
+      release(mailboxes[t].blocks[i], (t + num_threads - 1) % num_threads + 1);
+      allocator->free(mailboxes[t].blocks[i]);
+    }
+  }
+
+  /* return pending remote frees and stolen blocks to their owners */
+  Numa_slab_stats sum;
+  memset(&sum, 0, sizeof(sum));
+  for (unsigned t = 0; t < num_threads; t++) {
+    allocator->flush(cores[t]);
+
+    Numa_slab_stats s;
+    if (allocator->get_stats(cores[t], &s) != Exokernel::S_OK) {
+      error("get_stats failed");
+      continue;
+    }
+    sum.steals += s.steals;
+    sum.stolen_blocks += s.stolen_blocks;
+    sum.remote_frees += s.remote_frees;
+    sum.remote_flushes += s.remote_flushes;
+  }
+
+  bool ok = (errors == 0) && (allocator->num_total_avail() == (int64_t) total);
+  for (unsigned t = 0; t < num_threads; t++) 
+    ok = ok && (allocator->num_avail(cores[t]) == QUOTA);
+
+  /* with siblings, the remote and steal paths must have been taken */
+  if (num_threads > 1) 
+    ok = ok && sum.remote_frees > 0 && sum.remote_flushes > 0 && sum.steals > 0;
+  else 
+    printf("single partition: remote frees and steals not exercised\n");
+
+  printf("Numa_slab_allocator stress: %u partitions, %lu steals (%lu blocks), "
+         "%lu remote frees in %lu flushes, %u errors: %s\n",
+         num_threads, sum.steals, sum.stolen_blocks, sum.remote_frees, sum.remote_flushes,
+         errors, ok ? "PASS" : "FAIL");
+
+  delete allocator;
+  ::free(mem);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,250 @@
+/*
+   eXokernel Development Kit (XDK)
+
+   Based on code by Samsung Research America Copyright (C) 2013
+ 
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.  
+*/
+
+/*
+  Multi-threaded stress test for Size_class_allocator.  Threads allocate
+  sizes drawn from every size class, fill each allocation with a pattern
+  and hand half of them to a neighbour, which checks the pattern and frees
+  them with free(p) or free(p, core).  The class budget is kept small so
+  the larger classes overflow to plain NUMA memory, and every few rounds a
+  thread allocates above 32K, which takes whole 2MB huge pages (reserve
+  at least 16 huge pages before running, e.g. through
+  /proc/sys/vm/nr_hugepages).  At the end every class is flushed on every
+  core and must hold all of its blocks again.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "libexo.h"
+#include <exo/size_class_allocator.h>
+
+#define NUM_THREADS    (4)
+#define CLASS_BYTES    (256 * 1024)
+#define MAGAZINE_SIZE  (8)
+#define ROUNDS         (20000)
+#define MAX_BATCH      (8)
+#define MAILBOX_SIZE   (64)
+#define LARGE_EVERY    (500)
+
+using namespace Exokernel::Memory;
+
+struct Allocation {
+  void *   p;
+  size_t   size;
+};
+
+/* allocations handed from one thread to the next */
+struct Mailbox {
+  pthread_mutex_t lock;
+  unsigned        count;
+  Allocation      items[MAILBOX_SIZE];
+};
+
+static Size_class_allocator * allocator;
+static Mailbox                mailboxes[NUM_THREADS];
+static volatile uint64_t      next_token = 1;
+static volatile unsigned      errors = 0;
+static volatile unsigned      large_allocs = 0;
+
+static void error(const char * what)
+{
+  if (__sync_fetch_and_add(&errors, 1) == 0)
+    printf("error: %s\n", what);
+}
+
+/* returns a size in size class 'c' */
+static size_t size_in_class(unsigned c, unsigned * seed)
+{
+  size_t lo = (c == 0) ? 1 : Size_class_allocator::class_size(c - 1) + 1;
+  size_t hi = Size_class_allocator::class_size(c);
+  return lo + rand_r(seed) % (hi - lo + 1);
+}
+
+/* fills an allocation with a token and a byte pattern derived from it */
+static void fill(Allocation & a)
+{
+  size_t len = Size_class_allocator::usable_size(a.size);
+  uint64_t token = __sync_fetch_and_add(&next_token, 1);
+  memset(a.p, (int) (token & 0xff), len);
+  *(uint64_t *) a.p = token;
+}
+
+/* checks that nobody else wrote to the allocation */
+static void check(const Allocation & a)
+{
+  size_t len = Size_class_allocator::usable_size(a.size);
+  byte * b = (byte *) a.p;
+  byte pattern = (byte) (*(uint64_t *) a.p & 0xff);
+  for (size_t i = sizeof(uint64_t); i < len; i++) {
+    if (b[i] != pattern) {
+      error("allocation overwritten");
+      return;
+    }
+  }
+}
+
+/* allocates above MAX_SMALL_SIZE and frees it again on another core */
+static void large(core_id_t core, unsigned * seed)
+{
+  Allocation a;
+  a.size = Size_class_allocator::MAX_SMALL_SIZE + 1 + rand_r(seed) % (2 * 1024 * 1024);
+  a.p = allocator->alloc(a.size, core);
+  if (a.p == NULL) {
+    error("large allocation failed (huge pages reserved?)");
+    return;
+  }
+  __sync_fetch_and_add(&large_allocs, 1);
+  fill(a);
+  check(a);
+  allocator->free(a.p, (core + 1) % NUM_THREADS);
+}
+
+static void * worker(void * arg)
+{
+  unsigned id = (unsigned) (uintptr_t) arg;
+  core_id_t core = id;
+  unsigned seed = id;
+  Mailbox * next = &mailboxes[(id + 1) % NUM_THREADS];
+  Mailbox * mine = &mailboxes[id];
+
+  for (unsigned r = 0; r < ROUNDS; r++) {
+    Allocation items[MAX_BATCH];
+    size_t n = 1 + rand_r(&seed) % MAX_BATCH;
+    size_t got = 0;
+
+    /* walk through the classes so each one is hit from every thread */
+    for (size_t i = 0; i < n; i++) {
+      unsigned c = (r * MAX_BATCH + i + id) % Size_class_allocator::NUM_CLASSES;
+      items[got].size = size_in_class(c, &seed);
+      items[got].p = allocator->alloc(items[got].size, core);
+      if (items[got].p == NULL) {
+        error("allocation failed");
+        continue;
+      }
+      if (((addr_t) items[got].p) % 16) 
+        error("allocation not 16-byte aligned");
+      fill(items[got]);
+      got++;
+    }
+
+    /* the second half goes to the next thread */
+    size_t keep = got / 2;
+    pthread_mutex_lock(&next->lock);
+    for (size_t i = keep; i < got; i++) {
+      if (next->count < MAILBOX_SIZE) 
+        next->items[next->count++] = items[i];
+      else 
+        items[keep++] = items[i];
+    }
+    pthread_mutex_unlock(&next->lock);
+
+    for (size_t i = 0; i < keep; i++) {
+      check(items[i]);
+      allocator->free(items[i].p, core);
+    }
+
+    /* free what the previous thread handed over */
+    Allocation received[MAILBOX_SIZE];
+    unsigned count;
+    pthread_mutex_lock(&mine->lock);
+    count = mine->count;
+    memcpy(received, mine->items, count * sizeof(Allocation));
+    mine->count = 0;
+    pthread_mutex_unlock(&mine->lock);
+
+    for (unsigned i = 0; i < count; i++) {
+      check(received[i]);
+      if (i & 1) 
+        allocator->free(received[i].p, core);
+      else 
+        allocator->free(received[i].p);
+    }
+
+    if (r % LARGE_EVERY == id) 
+      large(core, &seed);
+  }
+  return NULL;
+}
+
+int main(int argc, char * argv[])
+{
+  try {
+    allocator = new Size_class_allocator(0, CLASS_BYTES, MAGAZINE_SIZE);
+  }
+  catch (Exokernel::Constructor_error) {
+    printf("Size_class_allocator stress: cannot create allocator (huge pages reserved?): FAIL\n");
+    return 1;
+  }
+
+  int64_t initial[Size_class_allocator::NUM_CLASSES];
+  for (unsigned c = 0; c < Size_class_allocator::NUM_CLASSES; c++) 
+    initial[c] = allocator->size_class(c)->num_total_avail();
+
+  for (unsigned i = 0; i < NUM_THREADS; i++) {
+    pthread_mutex_init(&mailboxes[i].lock, NULL);
+    mailboxes[i].count = 0;
+  }
+
+  pthread_t threads[NUM_THREADS];
+  for (uintptr_t i = 0; i < NUM_THREADS; i++) 
+    pthread_create(&threads[i], NULL, worker, (void *) i);
+  for (unsigned i = 0; i < NUM_THREADS; i++) 
+    pthread_join(threads[i], NULL);
+
+  for (unsigned t = 0; t < NUM_THREADS; t++) {
+    for (unsigned i = 0; i < mailboxes[t].count; i++) {
+      check(mailboxes[t].items[i]);
+      allocator->free(mailboxes[t].items[i].p);
+    }
+  }
+
+  /* return pending remote frees and stolen blocks, then count every class */
+  bool ok = true;
+  for (unsigned c = 0; c < Size_class_allocator::NUM_CLASSES; c++) {
+    Numa_slab_allocator * sc = allocator->size_class(c);
+    for (unsigned core = 0; core < EXOLIB_MAX_CPUS; core++) 
+      sc->flush(core);
+    if (sc->num_total_avail() != initial[c]) {
+      printf("class %u (%lu bytes): %ld of %ld blocks available\n",
+             c, Size_class_allocator::class_size(c), sc->num_total_avail(), initial[c]);
+      ok = false;
+    }
+  }
+  ok = ok && (errors == 0);
+
+  printf("Size_class_allocator stress: %u threads, %u large allocations, %u errors: %s\n",
+         NUM_THREADS, large_allocs, errors, ok ? "PASS" : "FAIL");
+
+  delete allocator;
+  return ok ? 0 : 1;
+}